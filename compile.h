@@ -21,6 +21,8 @@
 	// really Android? I need to do this?
 	#define __STDC_LIMIT_MACROS
 	#include <stdint.h>
+#elif LINUX_DMZ
+    #define COMPILE_DMZ 1
 #else
     #error "Encountered unknown dmz client. Make sure the right *_DMZ preprocessor macro is set."
 #endif
@@ -47,6 +47,7 @@
 #include "dmz_macros.h"
 #include "processor_support.h"
 #include "canny.h"
+#include "image_util.h"
 #include "sobel.h"
 #include "opencv2/core/core.hpp" // needed for IplImage
 #include "opencv2/core/internal.hpp"
@@ -54,22 +55,376 @@
 #if DMZ_HAS_NEON_COMPILETIME
   #include <arm_neon.h>
 #endif // DMZ_HAS_NEON_COMPILETIME
+#if DMZ_HAS_SSE2_COMPILETIME
+  #include <emmintrin.h>
+#endif
+
+#pragma mark magnitude and non-maxima suppression rows
+
+#define CANNY_SHIFT 15L
+// 0.4142135623730950488016887242097 == tan(22.5 degrees)
+#define TG22  ((int)(0.4142135623730950488016887242097*(1<<CANNY_SHIFT) + 0.5))
+
+// Map value for a local maximum above the high threshold (see llcv_canny_nms_c).
+#define CANNY_STRONG 3
+
+// mag[j] = abs(dx[j]) + abs(dy[j])
+DMZ_INTERNAL void llcv_canny_magnitude_row_c(const int16_t *dx, const int16_t *dy, int *mag, int width) {
+  for(int j = 0; j < width; j++) {
+    mag[j] = abs(dx[j]) + abs(dy[j]);
+  }
+}
+
+// For each pixel of the central row, map[j] is 1 if it can't belong to an edge, CANNY_STRONG if it is
+// a local maximum above the high threshold, and 0 if it is a local maximum above the low one.
+// Local maximum is along the gradient direction, quantized to one of four sectors (see below).
+// The magnitude rows must be padded with one column on either side.
+static inline void llcv_canny_nms_c(const int *mag_prev, const int *mag, const int *mag_next, const int16_t *dx, const int16_t *dy, uint8_t *map, int start, int width, int low, int high) {
+  for(int j = start; j < width; j++) {
+    int64_t x = dx[j];
+    int64_t y = dy[j];
+    int s = (x ^ y) < 0 ? -1 : 1;
+    int m = mag[j];
+    uint8_t flag = 1;
+
+    x = llabs(x);
+    y = llabs(y);
+    if(m > low) {
+      int64_t tg22x = x * TG22;
+      int64_t tg67x = tg22x + ((x + x) << CANNY_SHIFT);
+
+      y <<= CANNY_SHIFT;
+
+      bool is_max;
+      if(y < tg22x) {
+        is_max = m > mag[j - 1] && m >= mag[j + 1];
+      } else if(y > tg67x) {
+        is_max = m > mag_prev[j] && m >= mag_next[j];
+      } else {
+        is_max = m > mag_prev[j - s] && m > mag_next[j + s];
+      }
+      if(is_max) {
+        flag = m > high ? CANNY_STRONG : 0;
+      }
+    }
+    map[j] = flag;
+  }
+}
+
+// The rows hand the map values on packed into two bitmaps, a bit per pixel and a byte per 8 pixels
+// (bit k of a byte for the kth pixel): candidates (anything but 1) and strong maxima (CANNY_STRONG).
+// Pixels past the end of the row get 0 bits. start must be a multiple of 8.
+static inline void llcv_canny_nms_bits_c(const int *mag_prev, const int *mag, const int *mag_next, const int16_t *dx, const int16_t *dy, uint8_t *candidate, uint8_t *strong, int start, int width, int low, int high) {
+  uint8_t map[8];
+  for(int j = start; j < width; j += 8) {
+    int n = MIN(8, width - j);
+    llcv_canny_nms_c(mag_prev + j, mag + j, mag_next + j, dx + j, dy + j, map, 0, n, low, high);
+    uint8_t candidate_bits = 0;
+    uint8_t strong_bits = 0;
+    for(int k = 0; k < n; k++) {
+      candidate_bits |= (map[k] != 1) << k;
+      strong_bits |= (map[k] == CANNY_STRONG) << k;
+    }
+    candidate[j / 8] = candidate_bits;
+    strong[j / 8] = strong_bits;
+  }
+}
+
+DMZ_INTERNAL void llcv_canny_nms_row_c(const int *mag_prev, const int *mag, const int *mag_next, const int16_t *dx, const int16_t *dy, uint8_t *candidate, uint8_t *strong, int width, int low, int high) {
+  llcv_canny_nms_bits_c(mag_prev, mag, mag_next, dx, dy, candidate, strong, 0, width, low, high);
+}
+
+// The vectorized versions work on 8 pixels at a time, in 32-bit lanes. With x = abs(dx) <= 32768,
+// x * TG22 fits easily, and x * TG22 + (x << 16) still fits when unsigned.
+
+DMZ_INTERNAL void llcv_canny_magnitude_row_sse2(const int16_t *dx, const int16_t *dy, int *mag, int width) {
+#if DMZ_HAS_SSE2_COMPILETIME
+#define kVectorSize 8
+  const __m128i zero = _mm_setzero_si128();
+  int j = 0;
+  for(; j + kVectorSize <= width; j += kVectorSize) {
+    __m128i dx8 = _mm_loadu_si128((const __m128i *)(dx + j));
+    __m128i dy8 = _mm_loadu_si128((const __m128i *)(dy + j));
+    // max(v, -v) is abs(v) when read as unsigned, even for -32768
+    __m128i x = _mm_max_epi16(dx8, _mm_sub_epi16(zero, dx8));
+    __m128i y = _mm_max_epi16(dy8, _mm_sub_epi16(zero, dy8));
+    _mm_storeu_si128((__m128i *)(mag + j), _mm_add_epi32(_mm_unpacklo_epi16(x, zero), _mm_unpacklo_epi16(y, zero)));
+    _mm_storeu_si128((__m128i *)(mag + j + 4), _mm_add_epi32(_mm_unpackhi_epi16(x, zero), _mm_unpackhi_epi16(y, zero)));
+  }
+  llcv_canny_magnitude_row_c(dx + j, dy + j, mag + j, width - j);
+#undef kVectorSize
+#endif
+}
+
+#if DMZ_HAS_SSE2_COMPILETIME
+
+static inline __m128i llcv_canny_select_sse2(__m128i mask, __m128i a, __m128i b) {
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// Four pixels' worth of llcv_canny_nms_c, given x, y and x * TG22 in 32-bit lanes, and the sign s as a mask
+// (all ones for s == -1). Returns the map values, in 32-bit lanes.
+static inline __m128i llcv_canny_nms4_sse2(const int *mag_prev, const int *mag, const int *mag_next, __m128i x, __m128i y, __m128i tg22x, __m128i negative, __m128i low, __m128i high) {
+  const __m128i sign_bit = _mm_set1_epi32(INT32_MIN);
+  __m128i m = _mm_loadu_si128((const __m128i *)mag);
+
+  y = _mm_slli_epi32(y, CANNY_SHIFT);
+  __m128i tg67x = _mm_add_epi32(tg22x, _mm_slli_epi32(x, 16));
+  __m128i horizontal = _mm_cmplt_epi32(y, tg22x);
+  __m128i vertical = _mm_cmpgt_epi32(_mm_xor_si128(y, sign_bit), _mm_xor_si128(tg67x, sign_bit)); // unsigned y > tg67x
+
+  __m128i max_horizontal = _mm_andnot_si128(_mm_cmpgt_epi32(_mm_loadu_si128((const __m128i *)(mag + 1)), m),
+                                            _mm_cmpgt_epi32(m, _mm_loadu_si128((const __m128i *)(mag - 1))));
+  __m128i max_vertical = _mm_andnot_si128(_mm_cmpgt_epi32(_mm_loadu_si128((const __m128i *)mag_next), m),
+                                          _mm_cmpgt_epi32(m, _mm_loadu_si128((const __m128i *)mag_prev)));
+  __m128i diagonal_prev = llcv_canny_select_sse2(negative, _mm_loadu_si128((const __m128i *)(mag_prev + 1)), _mm_loadu_si128((const __m128i *)(mag_prev - 1)));
+  __m128i diagonal_next = llcv_canny_select_sse2(negative, _mm_loadu_si128((const __m128i *)(mag_next - 1)), _mm_loadu_si128((const __m128i *)(mag_next + 1)));
+  __m128i max_diagonal = _mm_and_si128(_mm_cmpgt_epi32(m, diagonal_prev), _mm_cmpgt_epi32(m, diagonal_next));
+
+  __m128i is_max = llcv_canny_select_sse2(horizontal, max_horizontal, llcv_canny_select_sse2(vertical, max_vertical, max_diagonal));
+  is_max = _mm_and_si128(is_max, _mm_cmpgt_epi32(m, low));
+  __m128i strong = _mm_and_si128(is_max, _mm_cmpgt_epi32(m, high));
+  return _mm_or_si128(_mm_andnot_si128(is_max, _mm_set1_epi32(1)), _mm_and_si128(strong, _mm_set1_epi32(CANNY_STRONG)));
+}
+
+#endif // DMZ_HAS_SSE2_COMPILETIME
+
+DMZ_INTERNAL void llcv_canny_nms_row_sse2(const int *mag_prev, const int *mag, const int *mag_next, const int16_t *dx, const int16_t *dy, uint8_t *candidate, uint8_t *strong, int width, int low, int high) {
+#if DMZ_HAS_SSE2_COMPILETIME
+#define kVectorSize 8
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i tg22 = _mm_set1_epi16(TG22);
+  const __m128i low_v = _mm_set1_epi32(low);
+  const __m128i high_v = _mm_set1_epi32(high);
+  const __m128i one = _mm_set1_epi8(1);
+  const __m128i strong_flag = _mm_set1_epi8(CANNY_STRONG);
+  int j = 0;
+  for(; j + kVectorSize <= width; j += kVectorSize) {
+    __m128i dx8 = _mm_loadu_si128((const __m128i *)(dx + j));
+    __m128i dy8 = _mm_loadu_si128((const __m128i *)(dy + j));
+    __m128i x = _mm_max_epi16(dx8, _mm_sub_epi16(zero, dx8));
+    __m128i y = _mm_max_epi16(dy8, _mm_sub_epi16(zero, dy8));
+    __m128i negative = _mm_srai_epi16(_mm_xor_si128(dx8, dy8), 15);
+    __m128i tg22x_lo = _mm_mullo_epi16(x, tg22);
+    __m128i tg22x_hi = _mm_mulhi_epu16(x, tg22);
+
+    __m128i flags_lo = llcv_canny_nms4_sse2(mag_prev + j, mag + j, mag_next + j,
+                                            _mm_unpacklo_epi16(x, zero), _mm_unpacklo_epi16(y, zero),
+                                            _mm_unpacklo_epi16(tg22x_lo, tg22x_hi), _mm_unpacklo_epi16(negative, negative),
+                                            low_v, high_v);
+    __m128i flags_hi = llcv_canny_nms4_sse2(mag_prev + j + 4, mag + j + 4, mag_next + j + 4,
+                                            _mm_unpackhi_epi16(x, zero), _mm_unpackhi_epi16(y, zero),
+                                            _mm_unpackhi_epi16(tg22x_lo, tg22x_hi), _mm_unpackhi_epi16(negative, negative),
+                                            low_v, high_v);
+    __m128i flags = _mm_packus_epi16(_mm_packs_epi32(flags_lo, flags_hi), zero);
+    candidate[j / 8] = (uint8_t)~_mm_movemask_epi8(_mm_cmpeq_epi8(flags, one));
+    strong[j / 8] = (uint8_t)_mm_movemask_epi8(_mm_cmpeq_epi8(flags, strong_flag));
+  }
+  llcv_canny_nms_bits_c(mag_prev, mag, mag_next, dx, dy, candidate, strong, j, width, low, high);
+#undef kVectorSize
+#endif
+}
+
+DMZ_INTERNAL void llcv_canny_magnitude_row_neon(const int16_t *dx, const int16_t *dy, int *mag, int width) {
+#if DMZ_HAS_NEON_COMPILETIME
+#define kVectorSize 8
+  int j = 0;
+  for(; j + kVectorSize <= width; j += kVectorSize) {
+    // vabsq_s16 wraps -32768 to itself, which is 32768 when read as unsigned
+    uint16x8_t x = vreinterpretq_u16_s16(vabsq_s16(vld1q_s16(dx + j)));
+    uint16x8_t y = vreinterpretq_u16_s16(vabsq_s16(vld1q_s16(dy + j)));
+    vst1q_s32(mag + j, vreinterpretq_s32_u32(vaddl_u16(vget_low_u16(x), vget_low_u16(y))));
+    vst1q_s32(mag + j + 4, vreinterpretq_s32_u32(vaddl_u16(vget_high_u16(x), vget_high_u16(y))));
+  }
+  llcv_canny_magnitude_row_c(dx + j, dy + j, mag + j, width - j);
+#undef kVectorSize
+#endif
+}
+
+#if DMZ_HAS_NEON_COMPILETIME
+
+// See llcv_canny_nms4_sse2.
+static inline uint16x4_t llcv_canny_nms4_neon(const int *mag_prev, const int *mag, const int *mag_next, uint16x4_t x, uint16x4_t y, int16x4_t negative, int32x4_t low, int32x4_t high) {
+  int32x4_t m = vld1q_s32(mag);
+
+  uint32x4_t tg22x = vmull_n_u16(x, TG22);
+  uint32x4_t tg67x = vaddq_u32(tg22x, vshll_n_u16(x, 16));
+  uint32x4_t y_shifted = vshll_n_u16(y, CANNY_SHIFT);
+  uint32x4_t horizontal = vcltq_u32(y_shifted, tg22x);
+  uint32x4_t vertical = vcgtq_u32(y_shifted, tg67x);
+
+  uint32x4_t max_horizontal = vandq_u32(vcgtq_s32(m, vld1q_s32(mag - 1)), vcgeq_s32(m, vld1q_s32(mag + 1)));
+  uint32x4_t max_vertical = vandq_u32(vcgtq_s32(m, vld1q_s32(mag_prev)), vcgeq_s32(m, vld1q_s32(mag_next)));
+  uint32x4_t is_negative = vreinterpretq_u32_s32(vmovl_s16(negative));
+  int32x4_t diagonal_prev = vbslq_s32(is_negative, vld1q_s32(mag_prev + 1), vld1q_s32(mag_prev - 1));
+  int32x4_t diagonal_next = vbslq_s32(is_negative, vld1q_s32(mag_next - 1), vld1q_s32(mag_next + 1));
+  uint32x4_t max_diagonal = vandq_u32(vcgtq_s32(m, diagonal_prev), vcgtq_s32(m, diagonal_next));
+
+  uint32x4_t is_max = vbslq_u32(horizontal, max_horizontal, vbslq_u32(vertical, max_vertical, max_diagonal));
+  is_max = vandq_u32(is_max, vcgtq_s32(m, low));
+  uint32x4_t strong = vandq_u32(is_max, vcgtq_s32(m, high));
+  uint32x4_t flags = vorrq_u32(vbicq_u32(vdupq_n_u32(1), is_max), vandq_u32(strong, vdupq_n_u32(CANNY_STRONG)));
+  return vmovn_u32(flags);
+}
+
+#endif // DMZ_HAS_NEON_COMPILETIME
+
+DMZ_INTERNAL void llcv_canny_nms_row_neon(const int *mag_prev, const int *mag, const int *mag_next, const int16_t *dx, const int16_t *dy, uint8_t *candidate, uint8_t *strong, int width, int low, int high) {
+#if DMZ_HAS_NEON_COMPILETIME
+#define kVectorSize 8
+  static const uint8_t bit_values[kVectorSize] = {1, 2, 4, 8, 16, 32, 64, 128};
+  uint8x8_t bits = vld1_u8(bit_values);
+  int32x4_t low_v = vdupq_n_s32(low);
+  int32x4_t high_v = vdupq_n_s32(high);
+  int j = 0;
+  for(; j + kVectorSize <= width; j += kVectorSize) {
+    int16x8_t dx8 = vld1q_s16(dx + j);
+    int16x8_t dy8 = vld1q_s16(dy + j);
+    uint16x8_t x = vreinterpretq_u16_s16(vabsq_s16(dx8));
+    uint16x8_t y = vreinterpretq_u16_s16(vabsq_s16(dy8));
+    int16x8_t negative = vshrq_n_s16(veorq_s16(dx8, dy8), 15);
+
+    uint16x4_t flags_lo = llcv_canny_nms4_neon(mag_prev + j, mag + j, mag_next + j, vget_low_u16(x), vget_low_u16(y), vget_low_s16(negative), low_v, high_v);
+    uint16x4_t flags_hi = llcv_canny_nms4_neon(mag_prev + j + 4, mag + j + 4, mag_next + j + 4, vget_high_u16(x), vget_high_u16(y), vget_high_s16(negative), low_v, high_v);
+    uint8x8_t flags = vmovn_u16(vcombine_u16(flags_lo, flags_hi));
+    uint8x8_t candidate_bits = vbic_u8(bits, vceq_u8(flags, vdup_n_u8(1)));
+    uint8x8_t strong_bits = vand_u8(bits, vceq_u8(flags, vdup_n_u8(CANNY_STRONG)));
+    // pairwise adds gather the candidate bits into lane 0 and the strong ones into lane 1
+    uint8x8_t packed = vpadd_u8(candidate_bits, strong_bits);
+    packed = vpadd_u8(packed, packed);
+    packed = vpadd_u8(packed, packed);
+    candidate[j / 8] = vget_lane_u8(packed, 0);
+    strong[j / 8] = vget_lane_u8(packed, 1);
+  }
+  llcv_canny_nms_bits_c(mag_prev, mag, mag_next, dx, dy, candidate, strong, j, width, low, high);
+#undef kVectorSize
+#endif
+}
+
+#define TEST_CANNY_ROWS 0
+
+#pragma mark hysteresis
+
+// Hysteresis works on the bitmaps from the non-maxima suppression rows instead of with a stack of pixels,
+// 64 pixels to a word (the bytes of a word being little-endian). Edges are grown from the strong maxima
+// through the candidates, sweeping down and then up the rows, a word at a time, until a sweep up adds nothing.
+// That reaches exactly the pixels the stack-based flood fill reached, so the edge map is identical, but
+// the work is a few word-wide bit operations per 64 pixels per sweep, without branching per pixel.
+
+#define kCannyBitsPerWord 64
+
+DMZ_INTERNAL void llcv_canny_workspace_release(llcv_canny_workspace *workspace) {
+  llcv_buffer_release(&workspace->magnitude);
+  llcv_buffer_release(&workspace->bits);
+}
+
+// Grows the set bits of seeds through each run of set bits in mask that contains one, in both directions.
+// Within a word, this is a masked parallel prefix; runs that cross words are carried over.
+static inline void llcv_canny_fill_row(const uint64_t *mask, uint64_t *seeds, int n_words) {
+  uint64_t carry = 0;
+  for(int word_index = 0; word_index < n_words; word_index++) {
+    uint64_t run = mask[word_index];
+    uint64_t fill = (seeds[word_index] | carry) & run;
+    if(fill != 0) {
+      fill |= run & (fill << 1); run &= run << 1;
+      fill |= run & (fill << 2); run &= run << 2;
+      fill |= run & (fill << 4); run &= run << 4;
+      fill |= run & (fill << 8); run &= run << 8;
+      fill |= run & (fill << 16); run &= run << 16;
+      fill |= run & (fill << 32);
+    }
+    seeds[word_index] = fill;
+    carry = fill >> 63;
+  }
+  carry = 0;
+  for(int word_index = n_words - 1; word_index >= 0; word_index--) {
+    uint64_t run = mask[word_index];
+    uint64_t fill = seeds[word_index] | (carry & run);
+    if(fill != 0) {
+      fill |= run & (fill >> 1); run &= run >> 1;
+      fill |= run & (fill >> 2); run &= run >> 2;
+      fill |= run & (fill >> 4); run &= run >> 4;
+      fill |= run & (fill >> 8); run &= run >> 8;
+      fill |= run & (fill >> 16); run &= run >> 16;
+      fill |= run & (fill >> 32);
+    }
+    seeds[word_index] = fill;
+    carry = fill << 63;
+  }
+}
+
+// One sweep over the rows, down or up: each row's edges grow through its candidates from whatever touches the
+// (already swept) previous row's edges, diagonals included. The first sweep also grows each row's own strong maxima.
+// Returns whether any row changed.
+static bool llcv_canny_sweep(const uint64_t *candidate, uint64_t *edge, uint64_t *seeds, int n_words, int height, bool down, bool first) {
+  bool changed = false;
+  for(int sweep_index = 0; sweep_index < height; sweep_index++) {
+    int row_index = down ? sweep_index : height - 1 - sweep_index;
+    int neighbour_row_index = down ? row_index - 1 : row_index + 1;
+    const uint64_t *row_candidate = candidate + row_index * n_words;
+    uint64_t *row_edge = edge + row_index * n_words;
+
+    // only candidates that aren't edges yet are news
+    uint64_t news = 0;
+    if(first) {
+      for(int word_index = 0; word_index < n_words; word_index++) {
+        news |= row_edge[word_index];
+      }
+    }
+    if(neighbour_row_index >= 0 && neighbour_row_index < height) {
+      const uint64_t *neighbour = edge + neighbour_row_index * n_words;
+      for(int word_index = 0; word_index < n_words; word_index++) {
+        uint64_t from_below = word_index > 0 ? neighbour[word_index - 1] >> 63 : 0;
+        uint64_t from_above = word_index + 1 < n_words ? neighbour[word_index + 1] << 63 : 0;
+        uint64_t word = neighbour[word_index];
+        uint64_t touching = (word | (word << 1) | from_below | (word >> 1) | from_above) & row_candidate[word_index] & ~row_edge[word_index];
+        seeds[word_index] = row_edge[word_index] | touching;
+        news |= touching;
+      }
+    } else {
+      memcpy(seeds, row_edge, n_words * sizeof(uint64_t));
+    }
+    if(news == 0) {
+      continue;
+    }
+
+    llcv_canny_fill_row(row_candidate, seeds, n_words);
+    memcpy(row_edge, seeds, n_words * sizeof(uint64_t));
+    changed = true;
+  }
+  return changed;
+}
 
-DMZ_INTERNAL void llcv_canny7_precomputed_sobel(IplImage *srcarr, IplImage *dstarr, IplImage *sobel_dx, IplImage *sobel_dy, double low_thresh, double high_thresh) {
-    cv::AutoBuffer<char> buffer;
-    std::vector<uchar*> stack;
-    uchar **stack_top = 0, **stack_bottom = 0;
+// Writes a row of edge bits out as 0 / 255 bytes.
+static inline void llcv_canny_unpack_edge_row(const uint64_t *edge, int width, uint8_t *dst) {
+  const uint8_t *edge_bytes = (const uint8_t *)edge;
+  for(int col_index = 0; col_index < width; col_index += 8) {
+    // spread the 8 bits out, one to the low bit of each byte, then fill the bytes
+    uint64_t eight = edge_bytes[col_index / 8];
+    eight = (eight | (eight << 28)) & 0x0000000F0000000FULL;
+    eight = (eight | (eight << 14)) & 0x0003000300030003ULL;
+    eight = (eight | (eight << 7)) & 0x0101010101010101ULL;
+    eight *= 0xFF;
+    if(col_index + 8 <= width) {
+      memcpy(dst + col_index, &eight, sizeof(eight));
+    } else {
+      memcpy(dst + col_index, &eight, width - col_index);
+    }
+  }
+}
+
+DMZ_INTERNAL void llcv_canny7_precomputed_sobel(IplImage *srcarr, IplImage *dstarr, IplImage *sobel_dx, IplImage *sobel_dy, double low_thresh, double high_thresh, llcv_canny_workspace *workspace) {
+    llcv_canny_workspace local_workspace = {};
+    if( workspace == NULL )
+        workspace = &local_workspace;
+    const dmz_kernel_table *kernels = dmz_kernels();
 
     CvMat srcstub, *src = cvGetMat( srcarr, &srcstub );
     CvMat dststub, *dst = cvGetMat( dstarr, &dststub );
     CvSize size;
     int low, high;
     int* mag_buf[3];
-    uchar* map;
-    ptrdiff_t mapstep;
-    int maxsize;
-    int i, j;
-    CvMat mag_row;
+    int i;
 
     if( CV_MAT_TYPE( src->type ) != CV_8UC1 ||
         CV_MAT_TYPE( dst->type ) != CV_8UC1 )
@@ -96,21 +451,16 @@ DMZ_INTERNAL void llcv_canny7_precomputed_sobel(IplImage *srcarr, IplImage *dsta
     low = cvFloor(low_thresh);
     high = cvFloor(high_thresh);
 
-    buffer.allocate( (size.width+2)*(size.height+2) + (size.width+2)*3*sizeof(int) );
-
-    mag_buf[0] = (int*)(char*)buffer;
+    mag_buf[0] = (int*)llcv_buffer_reserve( &workspace->magnitude, (size.width+2)*3*sizeof(int) );
     mag_buf[1] = mag_buf[0] + size.width + 2;
     mag_buf[2] = mag_buf[1] + size.width + 2;
-    map = (uchar*)(mag_buf[2] + size.width + 2);
-    mapstep = size.width + 2;
 
-    maxsize = MAX( 1 << 10, size.width*size.height/10 );
-    stack.resize( maxsize );
-    stack_top = stack_bottom = &stack[0];
+    int n_words = (size.width + kCannyBitsPerWord - 1) / kCannyBitsPerWord;
+    uint64_t *candidate = (uint64_t *)llcv_buffer_reserve( &workspace->bits, (2*size.height + 1)*n_words*sizeof(uint64_t) );
+    uint64_t *edge = candidate + size.height*n_words;
+    uint64_t *seeds = edge + size.height*n_words;
 
     memset( mag_buf[0], 0, (size.width+2)*sizeof(int) );
-    memset( map, 1, mapstep );
-    memset( map + mapstep*(size.height + 1), 1, mapstep );
 
     /* sector numbers
        (Top-Left Origin)
@@ -124,71 +474,20 @@ DMZ_INTERNAL void llcv_canny7_precomputed_sobel(IplImage *srcarr, IplImage *dsta
         3   2   1
     */
 
-    #define CANNY_PUSH(d)    *(d) = (uchar)2, *stack_top++ = (d)
-    #define CANNY_POP(d)     (d) = *--stack_top
-
-    mag_row = cvMat( 1, size.width, CV_32F );
-
     // calculate magnitude and angle of gradient, perform non-maxima supression.
-    // fill the map with one of the following values:
-    //   0 - the pixel might belong to an edge
-    //   1 - the pixel can not belong to an edge
-    //   2 - the pixel does belong to an edge
+    // fill the candidate bitmap with the pixels that might belong to an edge,
+    // and the edge bitmap with the ones that do (the strong maxima).
     for( i = 0; i <= size.height; i++ )
     {
         int* _mag = mag_buf[(i > 0) + 1] + 1;
         const short* _dx = (short*)(dx->data.ptr + dx->step*i);
         const short* _dy = (short*)(dy->data.ptr + dy->step*i);
-        uchar* _map;
-        int64_t x, y;
         ptrdiff_t magstep1, magstep2;
-        int prev_flag = 0;
 
         if( i < size.height )
         {
             _mag[-1] = _mag[size.width] = 0;
-
-        /*
-          // TODO: Needs dmz neon protection
-          // TODO: Test and enable this code, if we can get enough other performance benefits from NEON elsewhere
-          // in this function to make it worth having a dedicated NEON or assembly version.
-#define kVectorSize 8
-            uint16_t scalar_cols = size.width % kVectorSize;
-            uint16_t vector_chunks = size.width / kVectorSize;
-            uint16_t vector_cols = vector_chunks * kVectorSize;
-
-            for(uint16_t vector_index = 0; vector_index < vector_chunks; vector_index++) {
-              uint16_t col_index = vector_index * kVectorSize;
-
-              int16x8_t dx_q = vld1q_s16(_dx + col_index);
-              int16x8_t dy_q = vld1q_s16(_dy + col_index);
-
-              int16x4_t dx_d0 = vget_low_s16(dx_q);
-              int16x4_t dx_d1 = vget_high_s16(dx_q);
-              int16x4_t dy_d0 = vget_low_s16(dy_q);
-              int16x4_t dy_d1 = vget_high_s16(dy_q);
-
-              int32x4_t dx_wq0 = vmovl_s16(dx_d0);
-              int32x4_t dx_wq1 = vmovl_s16(dx_d1);
-              int32x4_t dy_wq0 = vmovl_s16(dy_d0);
-              int32x4_t dy_wq1 = vmovl_s16(dy_d1);
-
-              int32x4_t abs_q0 = vaddq_s32(vabsq_s32(dx_wq0), vabsq_s32(dy_wq0));
-              int32x4_t abs_q1 = vaddq_s32(vabsq_s32(dx_wq1), vabsq_s32(dy_wq1));
-
-              vst1q_s32(_mag + col_index, abs_q0);
-              vst1q_s32(_mag + col_index + (kVectorSize / 2), abs_q1);
-            }
-
-            for(uint16_t scalar_index = 0; scalar_index < scalar_cols; scalar_index++) {
-              uint16_t col_index = scalar_index + vector_cols;
-              _mag[col_index] = abs(_dx[col_index]) + abs(_dy[col_index]);
-            }
-#undef kVectorSize 8
-          */
-          
-            for( j = 0; j < size.width; j++ )
-                _mag[j] = abs(_dx[j]) + abs(_dy[j]);
+            kernels->canny_magnitude_row( _dx, _dy, _mag, size.width );
         }
         else
             memset( _mag-1, 0, (size.width + 2)*sizeof(int) );
@@ -198,9 +497,6 @@ DMZ_INTERNAL void llcv_canny7_precomputed_sobel(IplImage *srcarr, IplImage *dsta
         if( i == 0 )
             continue;
 
-        _map = map + mapstep*i + 1;
-        _map[-1] = _map[size.width] = 1;
-
         _mag = mag_buf[1] + 1; // take the central row
         _dx = (short*)(dx->data.ptr + dx->step*(i-1));
         _dy = (short*)(dy->data.ptr + dy->step*(i-1));
@@ -208,81 +504,21 @@ DMZ_INTERNAL void llcv_canny7_precomputed_sobel(IplImage *srcarr, IplImage *dsta
         magstep1 = mag_buf[2] - mag_buf[1];
         magstep2 = mag_buf[0] - mag_buf[1];
 
-        if( (stack_top - stack_bottom) + size.width > maxsize )
-        {
-            int sz = (int)(stack_top - stack_bottom);
-            maxsize = MAX( maxsize * 3/2, maxsize + 8 );
-            stack.resize(maxsize);
-            stack_bottom = &stack[0];
-            stack_top = stack_bottom + sz;
-        }
+        uint64_t *row_candidate = candidate + (i-1)*n_words;
+        uint64_t *row_edge = edge + (i-1)*n_words;
+        row_candidate[n_words-1] = row_edge[n_words-1] = 0; // the rows only write the bytes they cover
+        kernels->canny_nms_row( _mag + magstep2, _mag, _mag + magstep1, _dx, _dy, (uint8_t *)row_candidate, (uint8_t *)row_edge, size.width, low, high );
 
-        for( j = 0; j < size.width; j++ )
+#if TEST_CANNY_ROWS
         {
-            #define CANNY_SHIFT 15L
-            // 0.4142135623730950488016887242097 == tan(22.5 degrees)
-            #define TG22  ((int)(0.4142135623730950488016887242097*(1<<CANNY_SHIFT) + 0.5))
-
-            x = _dx[j];
-            y = _dy[j];
-            int s = (x ^ y) < 0 ? -1 : 1;
-            int m = _mag[j];
-
-            x = llabs(x);
-            y = llabs(y);
-            if( m > low )
-            {
-                int64_t tg22x = x * TG22;
-                int64_t tg67x = tg22x + ((x + x) << CANNY_SHIFT);
-
-                y <<= CANNY_SHIFT;
-
-                if( y < tg22x )
-                {
-                    if( m > _mag[j-1] && m >= _mag[j+1] )
-                    {
-                        if( m > high && !prev_flag && _map[j-mapstep] != 2 )
-                        {
-                            CANNY_PUSH( _map + j );
-                            prev_flag = 1;
-                        }
-                        else
-                            _map[j] = (uchar)0;
-                        continue;
-                    }
-                }
-                else if( y > tg67x )
-                {
-                    if( m > _mag[j+magstep2] && m >= _mag[j+magstep1] )
-                    {
-                        if( m > high && !prev_flag && _map[j-mapstep] != 2 )
-                        {
-                            CANNY_PUSH( _map + j );
-                            prev_flag = 1;
-                        }
-                        else
-                            _map[j] = (uchar)0;
-                        continue;
-                    }
-                }
-                else
-                {
-                    if( m > _mag[j+magstep2-s] && m > _mag[j+magstep1+s] )
-                    {
-                        if( m > high && !prev_flag && _map[j-mapstep] != 2 )
-                        {
-                            CANNY_PUSH( _map + j );
-                            prev_flag = 1;
-                        }
-                        else
-                            _map[j] = (uchar)0;
-                        continue;
-                    }
-                }
-            }
-            prev_flag = 0;
-            _map[j] = (uchar)1;
+            uint64_t reference_candidate[n_words], reference_edge[n_words];
+            reference_candidate[n_words-1] = reference_edge[n_words-1] = 0;
+            llcv_canny_nms_row_c( _mag + magstep2, _mag, _mag + magstep1, _dx, _dy, (uint8_t *)reference_candidate, (uint8_t *)reference_edge, size.width, low, high );
+            if( memcmp( reference_candidate, row_candidate, n_words*sizeof(uint64_t) ) != 0 ||
+                memcmp( reference_edge, row_edge, n_words*sizeof(uint64_t) ) != 0 )
+                dmz_debug_log( "canny_nms_row mismatch in row %i", i - 1 );
         }
+#endif
 
         // scroll the ring buffer
         _mag = mag_buf[0];
@@ -292,74 +528,53 @@ DMZ_INTERNAL void llcv_canny7_precomputed_sobel(IplImage *srcarr, IplImage *dsta
     }
 
     // now track the edges (hysteresis thresholding)
-    while( stack_top > stack_bottom )
+    bool first = true;
+    bool changed;
+    do
     {
-        uchar* m;
-        if( (stack_top - stack_bottom) + 8 > maxsize )
-        {
-            int sz = (int)(stack_top - stack_bottom);
-            maxsize = MAX( maxsize * 3/2, maxsize + 8 );
-            stack.resize(maxsize);
-            stack_bottom = &stack[0];
-            stack_top = stack_bottom + sz;
-        }
-
-        CANNY_POP(m);
-
-        if( !m[-1] )
-            CANNY_PUSH( m - 1 );
-        if( !m[1] )
-            CANNY_PUSH( m + 1 );
-        if( !m[-mapstep-1] )
-            CANNY_PUSH( m - mapstep - 1 );
-        if( !m[-mapstep] )
-            CANNY_PUSH( m - mapstep );
-        if( !m[-mapstep+1] )
-            CANNY_PUSH( m - mapstep + 1 );
-        if( !m[mapstep-1] )
-            CANNY_PUSH( m + mapstep - 1 );
-        if( !m[mapstep] )
-            CANNY_PUSH( m + mapstep );
-        if( !m[mapstep+1] )
-            CANNY_PUSH( m + mapstep + 1 );
+        llcv_canny_sweep( candidate, edge, seeds, n_words, size.height, true, first );
+        changed = llcv_canny_sweep( candidate, edge, seeds, n_words, size.height, false, false );
+        first = false;
     }
+    while( changed );
 
     // the final pass, form the final image
     for( i = 0; i < size.height; i++ )
-    {
-        const uchar* _map = map + mapstep*(i+1) + 1;
-        uchar* _dst = dst->data.ptr + dst->step*i;
+        llcv_canny_unpack_edge_row( edge + i*n_words, size.width, dst->data.ptr + dst->step*i );
 
-        for( j = 0; j < size.width; j++ )
-            _dst[j] = (uchar)-(_map[j] >> 1);
-    }
+    llcv_canny_workspace_release( &local_workspace );
 }
 
-DMZ_INTERNAL void llcv_canny7(IplImage *src, IplImage *dst, double low_thresh, double high_thresh) {
-  CvSize src_size = cvGetSize(src);
-
-  IplImage *sobel_scratch = cvCreateImage(cvSize(src_size.height, src_size.width), IPL_DEPTH_16S, 1);
-  IplImage *dx = cvCreateImage(src_size, IPL_DEPTH_16S, 1);
-  IplImage *dy = cvCreateImage(src_size, IPL_DEPTH_16S, 1);
-  llcv_sobel7(src, dx, sobel_scratch, 1, 0);
-  llcv_sobel7(src, dy, sobel_scratch, 0, 1);
-  cvReleaseImage(&sobel_scratch);
+#undef CANNY_SHIFT
+#undef TG22
+#undef CANNY_STRONG
+#undef kCannyBitsPerWord
 
-  llcv_canny7_precomputed_sobel(src, dst, dx, dy, low_thresh, high_thresh);
+// Calculate sum of abs(image). Same result as cvSum(cvAbs(image)), including the saturation
+// of abs(-32768), without the temporary image.
+DMZ_INTERNAL double sum_abs_magnitude_c(IplImage *image) {
+  assert(image->depth == IPL_DEPTH_16S);
+  assert(image->nChannels == 1);
 
-  cvReleaseImage(&dx);
-  cvReleaseImage(&dy);
+  CvSize image_size = cvGetSize(image);
+  const uint8_t *origin = (uint8_t *)llcv_get_data_origin(image);
+
+  int64_t sum = 0;
+  for(int row_index = 0; row_index < image_size.height; row_index++) {
+    const int16_t *row_origin = (int16_t *)(origin + row_index * image->widthStep);
+    for(int col_index = 0; col_index < image_size.width; col_index++) {
+      int32_t value = row_origin[col_index];
+      sum += MIN(abs(value), INT16_MAX);
+    }
+  }
+  return (double)sum;
 }
 
-// Calculate sum of abs(image)
-DMZ_INTERNAL double sum_abs_magnitude_c(IplImage *image) {
-  IplImage *image_abs = cvCreateImage(cvGetSize(image), image->depth, image->nChannels);
-  cvAbs(image, image_abs);
-  CvScalar sum = cvSum(image_abs);
-  cvReleaseImage(&image_abs);
-  return sum.val[0];
-}
+// sum_magnitude is the sqrt(dx^2 + dy^2) alternative to the |dx| + |dy| Canny threshold; see
+// llcv_adaptive_canny7_precomputed_sobel. Nothing calls it unless that alternative is switched on.
+#define USE_SUM_MAGNITUDE 0
 
+#if USE_SUM_MAGNITUDE
 DMZ_INTERNAL double sum_magnitude_c(IplImage *dx, IplImage *dy) {
   CvSize src_size = cvGetSize(dx);
 
@@ -381,6 +596,7 @@ DMZ_INTERNAL double sum_magnitude_c(IplImage *dx, IplImage *dy) {
   cvReleaseImage(&magnitude);
   return sum.val[0];
 }
+#endif // USE_SUM_MAGNITUDE
 
 DMZ_INTERNAL double sum_abs_magnitude_neon(IplImage *image) {
 #if DMZ_HAS_NEON_COMPILETIME
@@ -437,6 +653,7 @@ DMZ_INTERNAL double sum_abs_magnitude_neon(IplImage *image) {
 #endif // DMZ_HAS_NEON_COMPILETIME
 }
 
+#if USE_SUM_MAGNITUDE
 DMZ_INTERNAL double sum_magnitude_neon(IplImage *dx, IplImage *dy) {
 #if DMZ_HAS_NEON_COMPILETIME
 #define kVectorSize 8
@@ -536,7 +753,7 @@ DMZ_INTERNAL double sum_magnitude_neon(IplImage *dx, IplImage *dy) {
 #define TEST_SUM_MAGNITUDE_NEON 0
 
 DMZ_INTERNAL double sum_magnitude(IplImage *dx, IplImage *dy) {
-  if(dmz_has_neon_runtime()) {
+  if(dmz_kernels()->isa == DMZ_ISA_NEON) {
     double neon_ret = sum_magnitude_neon(dx, dy);
 #if TEST_SUM_MAGNITUDE_NEON
     double c_ret = sum_magnitude_c(dx, dy);
@@ -547,36 +764,36 @@ DMZ_INTERNAL double sum_magnitude(IplImage *dx, IplImage *dy) {
     return sum_magnitude_c(dx, dy);
   }
 }
+#endif // USE_SUM_MAGNITUDE
 
 #define TEST_SUM_ABS_MAGNITUDE_NEON 0
 
 // TODO: The NEON implementation will be faster if we pass it both images at
 // once and let it interleave memory accesses and calculations.
 DMZ_INTERNAL double sum_abs_magnitude(IplImage *image) {
-    if(dmz_has_neon_runtime()) {
-      double neon_ret = sum_abs_magnitude_neon(image);
+  const dmz_kernel_table *kernels = dmz_kernels();
 #if TEST_SUM_ABS_MAGNITUDE_NEON
-      double c_ret = sum_abs_magnitude_c(image);
-      fprintf(stderr, "sum_abs_magnitude C: %f, NEON: %f, DELTA: %f (%f %%)\n", c_ret, neon_ret, c_ret - neon_ret, 100.0f * (c_ret - neon_ret) / c_ret);
+  if(kernels->isa == DMZ_ISA_NEON) {
+    double neon_ret = kernels->sum_abs_magnitude(image);
+    double c_ret = sum_abs_magnitude_c(image);
+    fprintf(stderr, "sum_abs_magnitude C: %f, NEON: %f, DELTA: %f (%f %%)\n", c_ret, neon_ret, c_ret - neon_ret, 100.0f * (c_ret - neon_ret) / c_ret);
+    return neon_ret;
+  }
 #endif
-      return neon_ret;
-    } else {
-      return sum_abs_magnitude_c(image);
-    }
+  return kernels->sum_abs_magnitude(image);
 }
 
-DMZ_INTERNAL void llcv_adaptive_canny7_precomputed_sobel(IplImage *src, IplImage *dst, IplImage *dx, IplImage *dy) {
+DMZ_INTERNAL void llcv_adaptive_canny7_precomputed_sobel(IplImage *src, IplImage *dst, IplImage *dx, IplImage *dy, double abs_gradient_sum, llcv_canny_workspace *workspace) {
   CvSize src_size = cvGetSize(src);
-  // We can use either sum_abs_magnitude (|dx| + |dy|) or sum_magnitude (sqrt(dx^2 + dy^2)) here. They yield
-  // comparable results, and sum_abs_magnitude is marginally faster to compute, and can be made faster
-  // still than our current implementation.
-  double mean = (sum_abs_magnitude(dx) + sum_abs_magnitude(dy)) / (src_size.width * src_size.height);
+  // We can use either the sum of |dx| + |dy| or sum_magnitude (sqrt(dx^2 + dy^2)) here. They yield
+  // comparable results, and the former comes almost for free out of llcv_sobel7_dx_dy.
+  double mean = abs_gradient_sum / (src_size.width * src_size.height);
   // double mean = sum_magnitude(dx, dy) / (src_size.width * src_size.height);
 
   double low_threshold = mean;
   double high_threshold = 3.0f * low_threshold;
 
-  llcv_canny7_precomputed_sobel(src, dst, dx, dy, low_threshold, high_threshold);
+  llcv_canny7_precomputed_sobel(src, dst, dx, dy, low_threshold, high_threshold, workspace);
 }
 
 #endif
@@ -3,9 +3,23 @@
 
 #include "opencv2/core/core_c.h" // for IplImage
 #include "dmz_macros.h"
+#include "image_util.h"
 
-// Canny on an image, with aperature 7.
-DMZ_INTERNAL void llcv_canny7(IplImage *src, IplImage *dst, double low_thresh, double high_thresh);
-DMZ_INTERNAL void llcv_adaptive_canny7_precomputed_sobel(IplImage *src, IplImage *dst, IplImage *dx, IplImage *dy);
+// Memory reused across canny calls: the magnitude ring buffer, and the bitmaps for hysteresis.
+// Zero-initialize before first use.
+typedef struct {
+  llcv_buffer magnitude;
+  llcv_buffer bits;
+} llcv_canny_workspace;
+
+DMZ_INTERNAL void llcv_canny_workspace_release(llcv_canny_workspace *workspace);
+
+// Canny with thresholds derived from the mean gradient. abs_gradient_sum is cvSum(cvAbs(dx)) + cvSum(cvAbs(dy)),
+// as computed by llcv_sobel7_dx_dy or sum_abs_magnitude.
+// workspace may be NULL, in which case the memory is allocated (and freed) by each call.
+DMZ_INTERNAL void llcv_adaptive_canny7_precomputed_sobel(IplImage *src, IplImage *dst, IplImage *dx, IplImage *dy, double abs_gradient_sum, llcv_canny_workspace *workspace);
+
+// Calculate sum of abs(image), for a 16SC1 image. Same result as cvSum(cvAbs(image)).
+DMZ_INTERNAL double sum_abs_magnitude(IplImage *image);
 
 #endif
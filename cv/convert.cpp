@@ -14,6 +14,14 @@
 #include <arm_neon.h>
 #endif
 
+#if DMZ_HAS_SSE2_COMPILETIME
+#include <emmintrin.h>
+#endif
+
+#if DMZ_HAS_AVX2_COMPILETIME
+#include <immintrin.h>
+#endif
+
 typedef uint16_t uint8x2_t;
 
 DMZ_INTERNAL void llcv_split_u8_neon(IplImage *interleaved, IplImage *channel1, IplImage *channel2) {
@@ -94,9 +102,11 @@ DMZ_INTERNAL void llcv_split_u8(IplImage *interleaved, IplImage *channel1, IplIm
   assert(interleaved_size.width == channel2_size.width && interleaved_size.height == channel2_size.height);
 #endif
 
-  if(dmz_has_neon_runtime()) {
-    llcv_split_u8_neon(interleaved, channel1, channel2);
+  const dmz_kernel_table *kernels = dmz_kernels();
+  kernels->split_u8(interleaved, channel1, channel2);
+
 #if TEST_DEINTERLACE_NEON
+  if(kernels->isa == DMZ_ISA_NEON) {
     CvSize image_size = cvGetSize(interleaved);
 
     IplImage *channel1_c = cvCreateImage(image_size, IPL_DEPTH_8U, 1);
@@ -120,319 +130,320 @@ DMZ_INTERNAL void llcv_split_u8(IplImage *interleaved, IplImage *channel1, IplIm
 
     cvReleaseImage(&channel1_c);
     cvReleaseImage(&channel2_c);
-#endif
-  } else {
-    llcv_split_u8_c(interleaved, channel1, channel2);
   }
+#endif
 }
 
-#if DMZ_HAS_NEON_COMPILETIME
-// linear2 support functions
-
-static inline void vec_lineardown2_1d_u8_q(const uint8_t *src, uint8_t *dst) {
-  asm volatile
-  (
-   // load src pixels
-   "mov r0, %[src]" "\n\t"
-   "vld2.8 {q0-q1}, [r0]" "\n\t"
-
-   // halving rounding add
-   "vrhadd.u8 q2, q0, q1" "\n\t"
-
-   // write to dst
-   "mov r0, %[dst]" "\n\t"
-   "vst1.8 {q2}, [r0]" "\n\t"
-   
-   : // output
-   
-   : // input
-   [src]"r" (src),
-   [dst]"r" (dst)
-   
-   : // clobbered
-   "r0", // used for src, dst pointers
-   "q0", "q1", "q2",
-   "memory"
-   );
+// llcv_grad3_down2_norm_u8_to_f32 takes the morphological gradient of a row (max less min over three
+// pixels), downsamples it by 2 (rounding average of each pair), and normalizes it to [0, 1] as floats,
+// without any intermediate images.
+//
+// The first pass takes the gradient and downsamples it in registers, tracking the min and max,
+// and writes the unnormalized values to dst as floats. The second pass normalizes dst in place.
+// Subtracting small integers as floats is exact, so every implementation matches the C one bit for bit.
+
+DMZ_INTERNAL inline uint8_t llcv_grad3_u8_pixel(const uint8_t *src, int src_width, int index) {
+  uint8_t l = src[MAX(index - 1, 0)];
+  uint8_t c = src[index];
+  uint8_t r = src[MIN(index + 1, src_width - 1)];
+  return MAX(l, MAX(c, r)) - MIN(l, MIN(c, r));
 }
 
-#endif
+// Returns a pointer to block_size pixels of src, starting at index, with a readable pixel on either side.
+// At src's ends, these are copied into padded with the edge pixels replicated, so that the gradient there
+// is over the two pixels that exist (as in llcv_grad3_u8_pixel).
+DMZ_INTERNAL inline const uint8_t *llcv_grad3_block(const uint8_t *src, int src_width, int index, int block_size, uint8_t *padded) {
+  if(index > 0 && index + block_size < src_width) {
+    return src + index;
+  }
+  padded[0] = src[MAX(index - 1, 0)];
+  memcpy(padded + 1, src + index, block_size);
+  padded[block_size + 1] = src[MIN(index + block_size, src_width - 1)];
+  return padded + 1;
+}
 
-DMZ_INTERNAL void llcv_lineardown2_1d_u8_neon(IplImage *src, IplImage *dst) {
-#if DMZ_HAS_NEON_COMPILETIME
+DMZ_INTERNAL inline float llcv_norm_multiplier(uint8_t min_val, uint8_t max_val) {
+  uint8_t delta = max_val - min_val;
+  return delta == 0 ? 0.5f : 1.0f / delta; // if delta == 0, they're *all* identical, so it doesn't really matter where we map them
+}
 
-  uint8_t *src_data = (uint8_t *)src->imageData;
-  if(dmz_unlikely(NULL != src->roi)) {
-    src_data += src->roi->yOffset * src->widthStep + src->roi->xOffset * sizeof(uint8_t);
+DMZ_INTERNAL void llcv_grad3_down2_norm_u8_to_f32_row_c(const uint8_t *src, float *dst, int dst_width) {
+  int src_width = dst_width * 2;
+  uint8_t dst_min = UINT8_MAX;
+  uint8_t dst_max = 0;
+  for(int dst_index = 0; dst_index < dst_width; dst_index++) {
+    uint8_t down = (uint8_t)((llcv_grad3_u8_pixel(src, src_width, 2 * dst_index) + llcv_grad3_u8_pixel(src, src_width, 2 * dst_index + 1) + 1) >> 1);
+    dst_min = MIN(dst_min, down);
+    dst_max = MAX(dst_max, down);
+    dst[dst_index] = (float)down;
   }
-  
-  uint8_t *dst_data = (uint8_t *)dst->imageData;
-  if(dmz_unlikely(NULL != dst->roi)) {
-    dst_data += dst->roi->yOffset * dst->widthStep + dst->roi->xOffset * sizeof(uint8_t);
+
+  float min_f = (float)dst_min;
+  float multiplier = llcv_norm_multiplier(dst_min, dst_max);
+  for(int dst_index = 0; dst_index < dst_width; dst_index++) {
+    dst[dst_index] = (dst[dst_index] - min_f) * multiplier;
   }
-  
-  CvSize src_size = cvGetSize(src);
-  
-  uint16_t src_index = 0;
+}
+
+#if DMZ_HAS_SSE2_COMPILETIME
+// Gradient, then downsampling, of the 32 pixels at center (see llcv_grad3_block).
+static inline __m128i llcv_grad3_down2_u8_sse2(const uint8_t *center) {
+  const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+  __m128i grad[2];
+  for(int half = 0; half < 2; half++) {
+    __m128i left = _mm_loadu_si128((const __m128i *)(center + 16 * half - 1));
+    __m128i middle = _mm_loadu_si128((const __m128i *)(center + 16 * half));
+    __m128i right = _mm_loadu_si128((const __m128i *)(center + 16 * half + 1));
+    grad[half] = _mm_sub_epi8(_mm_max_epu8(left, _mm_max_epu8(middle, right)), _mm_min_epu8(left, _mm_min_epu8(middle, right)));
+  }
+  __m128i even = _mm_packus_epi16(_mm_and_si128(grad[0], low_bytes), _mm_and_si128(grad[1], low_bytes));
+  __m128i odd = _mm_packus_epi16(_mm_srli_epi16(grad[0], 8), _mm_srli_epi16(grad[1], 8));
+  return _mm_avg_epu8(even, odd);
+}
 
+static inline void llcv_hminmax_u8_sse2(__m128i running_min, __m128i running_max, uint8_t *min_val, uint8_t *max_val) {
+  // fold the upper half onto the lower half, until all 16 lanes are collapsed into lane 0
+  running_min = _mm_min_epu8(running_min, _mm_srli_si128(running_min, 8));
+  running_min = _mm_min_epu8(running_min, _mm_srli_si128(running_min, 4));
+  running_min = _mm_min_epu8(running_min, _mm_srli_si128(running_min, 2));
+  running_min = _mm_min_epu8(running_min, _mm_srli_si128(running_min, 1));
+  running_max = _mm_max_epu8(running_max, _mm_srli_si128(running_max, 8));
+  running_max = _mm_max_epu8(running_max, _mm_srli_si128(running_max, 4));
+  running_max = _mm_max_epu8(running_max, _mm_srli_si128(running_max, 2));
+  running_max = _mm_max_epu8(running_max, _mm_srli_si128(running_max, 1));
+  *min_val = (uint8_t)_mm_cvtsi128_si32(running_min);
+  *max_val = (uint8_t)_mm_cvtsi128_si32(running_max);
+}
+#endif
+
+DMZ_INTERNAL void llcv_grad3_down2_norm_u8_to_f32_row_sse2(const uint8_t *src, float *dst, int dst_width) {
+#if DMZ_HAS_SSE2_COMPILETIME
+#define kVectorSize 32
+  int src_width = dst_width * 2;
+  uint8_t padded[kVectorSize + 2];
+  const __m128i zero = _mm_setzero_si128();
+  __m128i running_min = _mm_set1_epi8((char)UINT8_MAX);
+  __m128i running_max = zero;
+
+  int src_index = 0;
   bool done = false;
   while(!done) {
-    // calc using 2 q registers at a time
-    vec_lineardown2_1d_u8_q(src_data + src_index, dst_data + (src_index >> 1));
-    src_index += (kQRegisterElements8 << 1);
-    
-    if(src_index == src_size.width) {
+    __m128i down = llcv_grad3_down2_u8_sse2(llcv_grad3_block(src, src_width, src_index, kVectorSize, padded));
+    running_min = _mm_min_epu8(running_min, down);
+    running_max = _mm_max_epu8(running_max, down);
+
+    float *dst_block = dst + (src_index >> 1);
+    __m128i down16l = _mm_unpacklo_epi8(down, zero);
+    __m128i down16h = _mm_unpackhi_epi8(down, zero);
+    _mm_storeu_ps(dst_block, _mm_cvtepi32_ps(_mm_unpacklo_epi16(down16l, zero)));
+    _mm_storeu_ps(dst_block + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(down16l, zero)));
+    _mm_storeu_ps(dst_block + 8, _mm_cvtepi32_ps(_mm_unpacklo_epi16(down16h, zero)));
+    _mm_storeu_ps(dst_block + 12, _mm_cvtepi32_ps(_mm_unpackhi_epi16(down16h, zero)));
+
+    src_index += kVectorSize;
+    if(src_index == src_width) {
       done = true;
-    } else if(src_index > src_size.width - (kQRegisterElements8 << 1)) {
-      // backtrack to handle leftovers
-      src_index = (uint16_t)(src_size.width - (kQRegisterElements8 << 1));
+    } else if(src_index > src_width - kVectorSize) {
+      // backtrack to handle leftovers; the overlap just gets written twice
+      src_index = src_width - kVectorSize;
     }
   }
 
+  uint8_t dst_min;
+  uint8_t dst_max;
+  llcv_hminmax_u8_sse2(running_min, running_max, &dst_min, &dst_max);
+  float min_f = (float)dst_min;
+  float multiplier = llcv_norm_multiplier(dst_min, dst_max);
+  __m128 vec_min = _mm_set1_ps(min_f);
+  __m128 vec_mult = _mm_set1_ps(multiplier);
+  int dst_index = 0;
+  for(; dst_index + 4 <= dst_width; dst_index += 4) {
+    _mm_storeu_ps(dst + dst_index, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(dst + dst_index), vec_min), vec_mult));
+  }
+  for(; dst_index < dst_width; dst_index++) {
+    dst[dst_index] = (dst[dst_index] - min_f) * multiplier;
+  }
+#undef kVectorSize
 #endif
 }
 
-DMZ_INTERNAL void llcv_lineardown2_1d_u8_c(IplImage *src, IplImage *dst) {
-  cvResize(src, dst, CV_INTER_LINEAR);
-}
-
-#define TEST_LINEAR_DOWN2 0
-
-DMZ_INTERNAL void llcv_lineardown2_1d_u8(IplImage *src, IplImage *dst) {
-  assert(src->depth == IPL_DEPTH_8U);
-  assert(dst->depth == IPL_DEPTH_8U);
-  assert(src != dst);
-  assert(src->nChannels == 1);
-  assert(dst->nChannels == 1);
-#if DMZ_DEBUG
-  CvSize src_size = cvGetSize(src);
-  CvSize dst_size = cvGetSize(dst);
-  assert(src_size.height == dst_size.height);
-  assert(src_size.height == 1);  // 1d!
-  assert(src_size.width >= (kQRegisterElements8 << 1));
-  assert(src_size.width % 2 == 0);
-  assert(src_size.width / 2 == dst_size.width);
-#endif
-  
-  if(dmz_has_neon_runtime()) {
-    llcv_lineardown2_1d_u8_neon(src, dst);
-#if TEST_LINEAR_DOWN2
-    IplImage *dst_c = cvCreateImage(dst_size, IPL_DEPTH_8U, 1);
-    
-    llcv_lineardown2_1d_u8_c(src, dst_c);
-    
-    IplImage *delta = cvCreateImage(dst_size, IPL_DEPTH_8U, 1);
-    
-    cvAbsDiff(dst, dst_c, delta);
-    
-    int n_errors = cvCountNonZero(delta);
-    if(n_errors > 0) {
-      fprintf(stderr, "llcv_lineardown2_1d_u8 errors: %i\n", n_errors);
-      // for (uint16_t x = 0; x < dst_size.width; x++) {
-      //   fprintf(stderr, "%d, ", int(cvGet1D(dst_c, x).val[0]));
-      // }
-      // fprintf(stderr, "\n");
-    }
-    
-    cvReleaseImage(&dst_c);
-    cvReleaseImage(&delta);
-#endif
-  } else {
-    llcv_lineardown2_1d_u8_c(src, dst);
+#if DMZ_HAS_AVX2_COMPILETIME
+// Gradient, then downsampling, of the 64 pixels at center (see llcv_grad3_block).
+static inline DMZ_TARGET_AVX2 __m256i llcv_grad3_down2_u8_avx2(const uint8_t *center) {
+  const __m256i low_bytes = _mm256_set1_epi16(0x00FF);
+  __m256i grad[2];
+  for(int half = 0; half < 2; half++) {
+    __m256i left = _mm256_loadu_si256((const __m256i *)(center + 32 * half - 1));
+    __m256i middle = _mm256_loadu_si256((const __m256i *)(center + 32 * half));
+    __m256i right = _mm256_loadu_si256((const __m256i *)(center + 32 * half + 1));
+    grad[half] = _mm256_sub_epi8(_mm256_max_epu8(left, _mm256_max_epu8(middle, right)), _mm256_min_epu8(left, _mm256_min_epu8(middle, right)));
   }
+  __m256i even = _mm256_packus_epi16(_mm256_and_si256(grad[0], low_bytes), _mm256_and_si256(grad[1], low_bytes));
+  __m256i odd = _mm256_packus_epi16(_mm256_srli_epi16(grad[0], 8), _mm256_srli_epi16(grad[1], 8));
+  // packus works within 128 bit lanes; put the quarters back in order
+  return _mm256_permute4x64_epi64(_mm256_avg_epu8(even, odd), 0xD8);
 }
+#endif
 
+DMZ_INTERNAL DMZ_TARGET_AVX2 void llcv_grad3_down2_norm_u8_to_f32_row_avx2(const uint8_t *src, float *dst, int dst_width) {
+#if DMZ_HAS_AVX2_COMPILETIME
+#define kVectorSize 64
+  int src_width = dst_width * 2;
+  if(src_width < kVectorSize) {
+    llcv_grad3_down2_norm_u8_to_f32_row_sse2(src, dst, dst_width);
+    return;
+  }
+  uint8_t padded[kVectorSize + 2];
+  __m256i running_min = _mm256_set1_epi8((char)UINT8_MAX);
+  __m256i running_max = _mm256_setzero_si256();
 
-#define TEST_NORM_CONVERT 0
-
-DMZ_INTERNAL void llcv_minmax_1d_u8_neon(uint8_t *src_data, uint16_t src_length, uint8_t *min_val, uint8_t *max_val) {
-#if DMZ_HAS_NEON_COMPILETIME
-  uint8x16_t running_min = vdupq_n_u8(UINT8_MAX);
-  uint8x16_t running_max = vdupq_n_u8(0);
-
-  uint16_t index = 0;
+  int src_index = 0;
   bool done = false;
   while(!done) {
-    uint8x16_t chunk = vld1q_u8(src_data + index);
-    running_min = vminq_u8(running_min, chunk);
-    running_max = vmaxq_u8(running_max, chunk);
-    index += kQRegisterElements8;
-  
-    if(index == src_length) {
+    __m256i down = llcv_grad3_down2_u8_avx2(llcv_grad3_block(src, src_width, src_index, kVectorSize, padded));
+    running_min = _mm256_min_epu8(running_min, down);
+    running_max = _mm256_max_epu8(running_max, down);
+
+    float *dst_block = dst + (src_index >> 1);
+    __m128i down_low = _mm256_castsi256_si128(down);
+    __m128i down_high = _mm256_extracti128_si256(down, 1);
+    _mm256_storeu_ps(dst_block, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(down_low)));
+    _mm256_storeu_ps(dst_block + 8, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(down_low, 8))));
+    _mm256_storeu_ps(dst_block + 16, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(down_high)));
+    _mm256_storeu_ps(dst_block + 24, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(down_high, 8))));
+
+    src_index += kVectorSize;
+    if(src_index == src_width) {
       done = true;
-    } else if(index > src_length - kQRegisterElements8) {
-      // backtrack to handle leftovers
-      index = src_length - kQRegisterElements8;
+    } else if(src_index > src_width - kVectorSize) {
+      // backtrack to handle leftovers; the overlap just gets written twice
+      src_index = src_width - kVectorSize;
     }
   }
 
-  // collapse q registers (16) to d registers (8)
-  uint8x8_t max_8 = vmax_u8(vget_low_u8(running_max), vget_high_u8(running_max));
-  uint8x8_t min_8 = vmin_u8(vget_low_u8(running_min), vget_high_u8(running_min));
-
-  // see diagrams at http://blogs.arm.com/software-enablement/684-coding-for-neon-part-5-rearranging-vectors/
-  
-  // collapse adjacent pairs: 0-1, 2-3, 4-5, 6-7
-  max_8 = vmax_u8(max_8, vrev16_u8(max_8));
-  min_8 = vmin_u8(min_8, vrev16_u8(min_8));
-
-  // collapse adjacent pairs-of-pairs, so now: 0-3, 4-7
-  max_8 = vmax_u8(max_8, vrev32_u8(max_8));
-  min_8 = vmin_u8(min_8, vrev32_u8(min_8));
-
-  // now a simple scalar max 0, 4 is enough
-  uint8_t max_first = vget_lane_u8(max_8, 0);
-  uint8_t max_second = vget_lane_u8(max_8, 4);
-  *max_val = MAX(max_first, max_second);
-
-  uint8_t min_first = vget_lane_u8(min_8, 0);
-  uint8_t min_second = vget_lane_u8(min_8, 4);
-  *min_val = MIN(min_first, min_second);
+  uint8_t dst_min;
+  uint8_t dst_max;
+  llcv_hminmax_u8_sse2(_mm_min_epu8(_mm256_castsi256_si128(running_min), _mm256_extracti128_si256(running_min, 1)),
+                       _mm_max_epu8(_mm256_castsi256_si128(running_max), _mm256_extracti128_si256(running_max, 1)),
+                       &dst_min, &dst_max);
+  float min_f = (float)dst_min;
+  float multiplier = llcv_norm_multiplier(dst_min, dst_max);
+  __m256 vec_min = _mm256_set1_ps(min_f);
+  __m256 vec_mult = _mm256_set1_ps(multiplier);
+  int dst_index = 0;
+  for(; dst_index + 8 <= dst_width; dst_index += 8) {
+    _mm256_storeu_ps(dst + dst_index, _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(dst + dst_index), vec_min), vec_mult));
+  }
+  for(; dst_index < dst_width; dst_index++) {
+    dst[dst_index] = (dst[dst_index] - min_f) * multiplier;
+  }
+#undef kVectorSize
 #endif
 }
 
-
-DMZ_INTERNAL void llcv_norm_convert_1d_u8_to_f32_neon(IplImage *src, IplImage *dst) {
 #if DMZ_HAS_NEON_COMPILETIME
-  // Find min/max
-  
-  uint8_t *src_data = (uint8_t *)src->imageData;
-  if(dmz_unlikely(NULL != src->roi)) {
-    src_data += src->roi->yOffset * src->widthStep + src->roi->xOffset * sizeof(uint8_t);
-  }
-  
-  uint8_t *dst_data_origin = (uint8_t *)dst->imageData;
-  if(dmz_unlikely(NULL != dst->roi)) {
-    dst_data_origin += dst->roi->yOffset * dst->widthStep + dst->roi->xOffset * sizeof(float32_t);
-  }
-  float32_t *dst_data = (float32_t *)dst_data_origin;
-
-  CvSize src_size = cvGetSize(src);
-  
-  uint8_t src_min;
-  uint8_t src_max;
-  llcv_minmax_1d_u8_neon(src_data, (uint16_t)src_size.width, &src_min, &src_max);
-
-#if TEST_NORM_CONVERT
-  double cv_min, cv_max;
-  cvMinMaxLoc(src, &cv_min, &cv_max, NULL, NULL);
-  if(int(cv_min) != src_min || int(cv_max) != src_max) {
-    fprintf(stderr, "cv_min %f src_min %d; cv_max %f, src_max %d\n", cv_min, src_min, cv_max, src_max);
+// Gradient, then downsampling, of the 32 pixels at center (see llcv_grad3_block).
+static inline uint8x16_t llcv_grad3_down2_u8_neon(const uint8_t *center) {
+  uint8x16_t grad[2];
+  for(int half = 0; half < 2; half++) {
+    uint8x16_t left = vld1q_u8(center + 16 * half - 1);
+    uint8x16_t middle = vld1q_u8(center + 16 * half);
+    uint8x16_t right = vld1q_u8(center + 16 * half + 1);
+    grad[half] = vsubq_u8(vmaxq_u8(left, vmaxq_u8(middle, right)), vminq_u8(left, vminq_u8(middle, right)));
   }
+  // deinterleave even and odd pixels, then rounding average
+  uint8x16x2_t deinterleaved = vuzpq_u8(grad[0], grad[1]);
+  return vrhaddq_u8(deinterleaved.val[0], deinterleaved.val[1]);
+}
 #endif
 
-  uint8_t delta = src_max - src_min;
-  float32_t multiplier = delta == 0 ? 0.5f : 1.0f / delta; // if delta == 0, they're *all* identical, so it doesn't really matter where we map them, it's going to be bad...
-  
-  uint8x16_t vec_min = vdupq_n_u8(src_min);
-  float32x4_t vec_mult = vdupq_n_f32(multiplier);
+DMZ_INTERNAL void llcv_grad3_down2_norm_u8_to_f32_row_neon(const uint8_t *src, float *dst, int dst_width) {
+#if DMZ_HAS_NEON_COMPILETIME
+#define kVectorSize 32
+  int src_width = dst_width * 2;
+  uint8_t padded[kVectorSize + 2];
+  uint8x16_t running_min = vdupq_n_u8(UINT8_MAX);
+  uint8x16_t running_max = vdupq_n_u8(0);
 
-  uint16_t src_index = 0;
+  int src_index = 0;
   bool done = false;
   while(!done) {
-    // calc using a q register
-    uint8x16_t chunk8 = vld1q_u8(src_data + src_index);
-
-    // subtract off min value
-    if(src_min > 0) {
-      // src_min == 0 is a common case, so optimize it away
-      chunk8 = vsubq_u8(chunk8, vec_min);
-    }
-
-    // scale up from uint8_t to uint32_t
-    uint16x8_t chunk16l = vmovl_u8(vget_low_u8(chunk8));
-    uint16x8_t chunk16h = vmovl_u8(vget_high_u8(chunk8));
-    uint32x4_t chunk32ll = vmovl_u16(vget_low_u16(chunk16l));
-    uint32x4_t chunk32lh = vmovl_u16(vget_high_u16(chunk16l));
-    uint32x4_t chunk32hl = vmovl_u16(vget_low_u16(chunk16h));
-    uint32x4_t chunk32hh = vmovl_u16(vget_high_u16(chunk16h));
-
-    // convert from uint32_t to float32_t
-    float32x4_t float32ll = vcvtq_f32_u32(chunk32ll);
-    float32x4_t float32lh = vcvtq_f32_u32(chunk32lh);
-    float32x4_t float32hl = vcvtq_f32_u32(chunk32hl);
-    float32x4_t float32hh = vcvtq_f32_u32(chunk32hh);
-
-    // multiply out by the normalization factor
-    float32ll = vmulq_f32(float32ll, vec_mult);
-    float32lh = vmulq_f32(float32lh, vec_mult);
-    float32hl = vmulq_f32(float32hl, vec_mult);
-    float32hh = vmulq_f32(float32hh, vec_mult);
-
-    // store to the destination
-    vst1q_f32(dst_data + src_index, float32ll);
-    vst1q_f32(dst_data + src_index + 4, float32lh);
-    vst1q_f32(dst_data + src_index + 8, float32hl);
-    vst1q_f32(dst_data + src_index + 12, float32hh);
-
-    src_index += kQRegisterElements8;
-
-    if(src_index == src_size.width) {
+    uint8x16_t down = llcv_grad3_down2_u8_neon(llcv_grad3_block(src, src_width, src_index, kVectorSize, padded));
+    running_min = vminq_u8(running_min, down);
+    running_max = vmaxq_u8(running_max, down);
+
+    float32_t *dst_block = dst + (src_index >> 1);
+    uint16x8_t down16l = vmovl_u8(vget_low_u8(down));
+    uint16x8_t down16h = vmovl_u8(vget_high_u8(down));
+    vst1q_f32(dst_block, vcvtq_f32_u32(vmovl_u16(vget_low_u16(down16l))));
+    vst1q_f32(dst_block + 4, vcvtq_f32_u32(vmovl_u16(vget_high_u16(down16l))));
+    vst1q_f32(dst_block + 8, vcvtq_f32_u32(vmovl_u16(vget_low_u16(down16h))));
+    vst1q_f32(dst_block + 12, vcvtq_f32_u32(vmovl_u16(vget_high_u16(down16h))));
+
+    src_index += kVectorSize;
+    if(src_index == src_width) {
       done = true;
-    } else if(src_index > src_size.width - kQRegisterElements8) {
-      // backtrack to handle leftovers
-      src_index = (uint16_t)(src_size.width - kQRegisterElements8);
+    } else if(src_index > src_width - kVectorSize) {
+      // backtrack to handle leftovers; the overlap just gets written twice
+      src_index = src_width - kVectorSize;
     }
   }
+
+  // pairwise min/max, three times over, collapses all 16 lanes into lane 0
+  uint8x8_t min_8 = vpmin_u8(vget_low_u8(running_min), vget_high_u8(running_min));
+  uint8x8_t max_8 = vpmax_u8(vget_low_u8(running_max), vget_high_u8(running_max));
+  for(int round = 0; round < 2; round++) {
+    min_8 = vpmin_u8(min_8, min_8);
+    max_8 = vpmax_u8(max_8, max_8);
+  }
+  uint8_t dst_min = vget_lane_u8(min_8, 0);
+  uint8_t dst_max = vget_lane_u8(max_8, 0);
+  float32_t min_f = (float32_t)dst_min;
+  float32_t multiplier = llcv_norm_multiplier(dst_min, dst_max);
+  float32x4_t vec_min = vdupq_n_f32(min_f);
+  float32x4_t vec_mult = vdupq_n_f32(multiplier);
+  int dst_index = 0;
+  for(; dst_index + 4 <= dst_width; dst_index += 4) {
+    vst1q_f32(dst + dst_index, vmulq_f32(vsubq_f32(vld1q_f32(dst + dst_index), vec_min), vec_mult));
+  }
+  for(; dst_index < dst_width; dst_index++) {
+    dst[dst_index] = (dst[dst_index] - min_f) * multiplier;
+  }
+#undef kVectorSize
 #endif
 }
 
-DMZ_INTERNAL void llcv_norm_convert_1d_u8_to_f32_c(IplImage *src, IplImage *dst) {
-  cvConvertScale(src, dst, 1.0f / 255.0f, 0);
-  cvNormalize(dst, dst, 0.0f, 1.0f, CV_MINMAX, NULL);
-}
+#define TEST_GRAD3_DOWN2_NORM 0
 
-DMZ_INTERNAL void llcv_norm_convert_1d_u8_to_f32(IplImage *src, IplImage *dst) {
-  assert(src->depth == IPL_DEPTH_8U);
-  assert(dst->depth == IPL_DEPTH_32F);
-  assert(src->nChannels == 1);
-  assert(dst->nChannels == 1);
-#if DMZ_DEBUG
-  CvSize src_size = cvGetSize(src);
-  CvSize dst_size = cvGetSize(dst);
-  assert(src_size.height == dst_size.height);
-  assert(src_size.height == 1);  // 1d!
-  assert(src_size.width >= kQRegisterElements8);
-  assert(src_size.width == dst_size.width);
-#endif
-  
-  if(dmz_has_neon_runtime()) {
-    llcv_norm_convert_1d_u8_to_f32_neon(src, dst);
-#if TEST_NORM_CONVERT
-    IplImage *dst_c = cvCreateImage(dst_size, IPL_DEPTH_32F, 1);
-    
-    llcv_norm_convert_1d_u8_to_f32_c(src, dst_c);
-    
-    IplImage *delta = cvCreateImage(dst_size, IPL_DEPTH_32F, 1);
-    
-    cvAbsDiff(dst, dst_c, delta);
-    float epsilon = 0.0001f;
-    cvThreshold(delta, delta, epsilon, 1.0, CV_THRESH_TOZERO);
-    
-    int n_errors = cvCountNonZero(delta);
-    if(n_errors > 0) {
-      fprintf(stderr, "llcv_norm_convert_1d_u8_to_f32 errors: %i\n", n_errors);
-      for(uint16_t x = 0; x < dst_size.width; x++) {
-        if(cvGet1D(delta, x).val[0] > epsilon) {
-          fprintf(stderr, "<%i: %f, %f, %f>, ", x, cvGet1D(src, x).val[0], cvGet1D(dst, x).val[0], cvGet1D(dst_c, x).val[0]);
-        }
+DMZ_INTERNAL void llcv_grad3_down2_norm_u8_to_f32(const uint8_t *src, float *dst, int dst_width) {
+  assert(dst_width * 2 >= 32);
+
+  const dmz_kernel_table *kernels = dmz_kernels();
+  kernels->grad3_down2_norm_u8_to_f32_row(src, dst, dst_width);
+
+#if TEST_GRAD3_DOWN2_NORM
+  if(kernels->isa != DMZ_ISA_SCALAR) {
+    float *dst_c = (float *)malloc(dst_width * sizeof(float));
+    llcv_grad3_down2_norm_u8_to_f32_row_c(src, dst_c, dst_width);
+    int n_errors = 0;
+    for(int x = 0; x < dst_width; x++) {
+      if(dst_c[x] != dst[x]) {
+        n_errors++;
       }
-      fprintf(stderr, "\n");
     }
-    
-    cvReleaseImage(&dst_c);
-    cvReleaseImage(&delta);
-#endif
-  } else {
-    llcv_norm_convert_1d_u8_to_f32_c(src, dst);
+    if(n_errors > 0) {
+      fprintf(stderr, "llcv_grad3_down2_norm_u8_to_f32 errors: %i\n", n_errors);
+    }
+    free(dst_c);
   }
+#endif
 }
 
 #define TEST_YCbCr2RGB 0
 #define TIME_YCbCr2RGB 0
 
 #if TIME_YCbCr2RGB
-static clock_t fastest_c = CLOCKS_PER_SEC * 1000;
+static clock_t fastest_dmz = CLOCKS_PER_SEC * 1000;
 static clock_t fastest_opencv = CLOCKS_PER_SEC * 1000;
 #define TIME_YCbCr2RGB_TIMING_ITERATIONS 100
 #endif
@@ -446,66 +457,223 @@ DMZ_INTERNAL void llcv_YCbCr2RGB_u8_opencv(IplImage *y, IplImage *cb, IplImage *
 }
 #endif
 
-DMZ_INTERNAL void llcv_YCbCr2RGB_u8_c(IplImage *y, IplImage *cb, IplImage *cr, IplImage *dst) {
-  // Could vectorize this, but the math gets ugly, and we only do it once, and really, it's fast enough.
 #define DESCALE_14(x) ((x + (1 << 13)) >> 14)
 #define SATURATED_BYTE(x) (uint8_t)((x < 0) ? 0 : ((x > 255) ? 255 : x))
 
-  bool addAlpha = (dst->nChannels == 4);
+DMZ_INTERNAL void llcv_YCbCr2RGB_u8_pixel(uint8_t pix_y, uint8_t pix_cb, uint8_t pix_cr, uint8_t *dst, bool add_alpha) {
+  int8_t sCb = pix_cb - 128;
+  int8_t sCr = pix_cr - 128;
+  int32_t pix_b = pix_y + DESCALE_14(sCb * kYCbCr2RGBCbToB);
+  int32_t pix_g = pix_y + DESCALE_14(sCb * kYCbCr2RGBCbToG + sCr * kYCbCr2RGBCrToG);
+  int32_t pix_r = pix_y + DESCALE_14(sCr * kYCbCr2RGBCrToR);
+
+  // the SATURATED_BYTE macro is necessary to ensure that we're really only writing one
+  // byte, and that we stay within it's limits. It appears that the clang (and possibly
+  // gcc 4.6 vs 4.4.3) differ in how the shift/cast combo behaves.
+  dst[0] = SATURATED_BYTE(pix_r);
+  dst[1] = SATURATED_BYTE(pix_g);
+  dst[2] = SATURATED_BYTE(pix_b);
+
+  if (add_alpha) {
+    dst[3] = 0xff; // make an opaque image
+  }
+}
 
-  CvSize src_size = cvGetSize(y);
-  
-  uint8_t *y_data_origin = (uint8_t *)llcv_get_data_origin(y);
-  uint16_t y_width_step = (uint16_t)y->widthStep;
+// The rows are converted 16 pixels at a time, in 16 bit lanes. Each pair of (Cb - 128, Cr - 128) lanes is
+// multiplied and summed into 32 bits, so that the rounding, and the saturation at the end, are the same as
+// in llcv_YCbCr2RGB_u8_pixel.
 
-  uint8_t *cb_data_origin = (uint8_t *)llcv_get_data_origin(cb);
-  uint16_t cb_width_step = (uint16_t)cb->widthStep;
+DMZ_INTERNAL void llcv_YCbCr2RGB_u8_row_c(const uint8_t *y, const uint8_t *cb, const uint8_t *cr, uint8_t *dst, int dst_channels, int width) {
+  if(dst_channels == 4) {
+    for(int col_index = 0; col_index < width; col_index++) {
+      llcv_YCbCr2RGB_u8_pixel(y[col_index], cb[col_index], cr[col_index], dst + col_index * 4, true);
+    }
+  } else {
+    for(int col_index = 0; col_index < width; col_index++) {
+      llcv_YCbCr2RGB_u8_pixel(y[col_index], cb[col_index], cr[col_index], dst + col_index * 3, false);
+    }
+  }
+}
 
-  uint8_t *cr_data_origin = (uint8_t *)llcv_get_data_origin(cr);
-  uint16_t cr_width_step = (uint16_t)cr->widthStep;
+#if DMZ_HAS_SSE2_COMPILETIME
+// Eight pixels' R, G and B, from Y and from Cb and Cr less 128, in 16 bit lanes.
+static inline void llcv_YCbCr2RGB_s16_sse2(__m128i y, __m128i cb, __m128i cr, __m128i *r, __m128i *g, __m128i *b) {
+  const __m128i round = _mm_set1_epi32(1 << (kYCbCr2RGBShift - 1));
+  const __m128i to_r = _mm_setr_epi16(0, kYCbCr2RGBCrToR, 0, kYCbCr2RGBCrToR, 0, kYCbCr2RGBCrToR, 0, kYCbCr2RGBCrToR);
+  const __m128i to_g = _mm_setr_epi16(kYCbCr2RGBCbToG, kYCbCr2RGBCrToG, kYCbCr2RGBCbToG, kYCbCr2RGBCrToG,
+                                      kYCbCr2RGBCbToG, kYCbCr2RGBCrToG, kYCbCr2RGBCbToG, kYCbCr2RGBCrToG);
+  const __m128i to_b = _mm_setr_epi16(kYCbCr2RGBCbToB, 0, kYCbCr2RGBCbToB, 0, kYCbCr2RGBCbToB, 0, kYCbCr2RGBCbToB, 0);
+  __m128i cbcr_lo = _mm_unpacklo_epi16(cb, cr);
+  __m128i cbcr_hi = _mm_unpackhi_epi16(cb, cr);
+#define DESCALED_SUMS(coefficients) \
+    _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cbcr_lo, coefficients), round), kYCbCr2RGBShift), \
+                    _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cbcr_hi, coefficients), round), kYCbCr2RGBShift))
+  *r = _mm_add_epi16(y, DESCALED_SUMS(to_r));
+  *g = _mm_add_epi16(y, DESCALED_SUMS(to_g));
+  *b = _mm_add_epi16(y, DESCALED_SUMS(to_b));
+#undef DESCALED_SUMS
+}
+#endif
 
-  uint8_t *dst_data_origin = (uint8_t *)llcv_get_data_origin(dst);
-  uint16_t dst_width_step = (uint16_t)dst->widthStep;
+DMZ_INTERNAL void llcv_YCbCr2RGB_u8_row_sse2(const uint8_t *y, const uint8_t *cb, const uint8_t *cr, uint8_t *dst, int dst_channels, int width) {
+#if DMZ_HAS_SSE2_COMPILETIME
+#define kVectorSize 16
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i chroma_offset = _mm_set1_epi16(128);
+  const __m128i alpha = _mm_set1_epi8((char)0xff);
+  int col_index = 0;
+  for(; col_index + kVectorSize <= width; col_index += kVectorSize) {
+    __m128i y8 = _mm_loadu_si128((const __m128i *)(y + col_index));
+    __m128i cb8 = _mm_loadu_si128((const __m128i *)(cb + col_index));
+    __m128i cr8 = _mm_loadu_si128((const __m128i *)(cr + col_index));
+    __m128i r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+    llcv_YCbCr2RGB_s16_sse2(_mm_unpacklo_epi8(y8, zero),
+                            _mm_sub_epi16(_mm_unpacklo_epi8(cb8, zero), chroma_offset),
+                            _mm_sub_epi16(_mm_unpacklo_epi8(cr8, zero), chroma_offset), &r_lo, &g_lo, &b_lo);
+    llcv_YCbCr2RGB_s16_sse2(_mm_unpackhi_epi8(y8, zero),
+                            _mm_sub_epi16(_mm_unpackhi_epi8(cb8, zero), chroma_offset),
+                            _mm_sub_epi16(_mm_unpackhi_epi8(cr8, zero), chroma_offset), &r_hi, &g_hi, &b_hi);
+    __m128i r = _mm_packus_epi16(r_lo, r_hi);
+    __m128i g = _mm_packus_epi16(g_lo, g_hi);
+    __m128i b = _mm_packus_epi16(b_lo, b_hi);
+
+    __m128i rg_lo = _mm_unpacklo_epi8(r, g);
+    __m128i rg_hi = _mm_unpackhi_epi8(r, g);
+    __m128i ba_lo = _mm_unpacklo_epi8(b, alpha);
+    __m128i ba_hi = _mm_unpackhi_epi8(b, alpha);
+    __m128i rgba[4] = {
+      _mm_unpacklo_epi16(rg_lo, ba_lo), _mm_unpackhi_epi16(rg_lo, ba_lo),
+      _mm_unpacklo_epi16(rg_hi, ba_hi), _mm_unpackhi_epi16(rg_hi, ba_hi),
+    };
+    if(dst_channels == 4) {
+      for(int i = 0; i < 4; i++) {
+        _mm_storeu_si128((__m128i *)(dst + col_index * 4 + i * 16), rgba[i]);
+      }
+    } else {
+      // SSE2 can't shuffle bytes, so drop the alphas on the way out.
+      uint8_t pixels[kVectorSize * 4];
+      memcpy(pixels, rgba, sizeof(pixels));
+      for(int i = 0; i < kVectorSize; i++) {
+        memcpy(dst + (col_index + i) * 3, pixels + i * 4, 3);
+      }
+    }
+  }
+  llcv_YCbCr2RGB_u8_row_c(y + col_index, cb + col_index, cr + col_index, dst + col_index * dst_channels, dst_channels, width - col_index);
+#undef kVectorSize
+#endif
+}
 
-  for(uint16_t row_index = 0; row_index < src_size.height; row_index++) {
-    const uint8_t *y_row_origin = y_data_origin + row_index * y_width_step;
-    const uint8_t *cb_row_origin = cb_data_origin + row_index * cb_width_step;
-    const uint8_t *cr_row_origin = cr_data_origin + row_index * cr_width_step;
-    
-    uint8_t *dst_row_origin = dst_data_origin + row_index * dst_width_step;
-    
-    uint16_t col_index = 0;
-    while(col_index < src_size.width) {
-      uint8_t pix_y = y_row_origin[col_index];
-      uint8_t pix_cb = cb_row_origin[col_index];
-      uint8_t pix_cr = cr_row_origin[col_index];
-      int8_t sCb = pix_cb - 128;
-      int8_t sCr = pix_cr - 128;
-      int32_t pix_b = pix_y + DESCALE_14(sCb * 29049);
-      int32_t pix_g = pix_y + DESCALE_14(sCb * -5636 + sCr * -11698);
-      int32_t pix_r = pix_y + DESCALE_14(sCr * 22987);
-
-      uint16_t col_pixel_pos = (uint16_t)(col_index * dst->nChannels);
-
-      // the SATURATED_BYTE macro is necessary to ensure that we're really only writing one
-      // byte, and that we stay within it's limits. It appears that the clang (and possibly
-      // gcc 4.6 vs 4.4.3) differ in how the shift/cast combo behaves.
-      dst_row_origin[col_pixel_pos] = SATURATED_BYTE(pix_r);
-      dst_row_origin[col_pixel_pos + 1] = SATURATED_BYTE(pix_g);
-      dst_row_origin[col_pixel_pos + 2] = SATURATED_BYTE(pix_b);
-
-      if (addAlpha) {
-        dst_row_origin[col_pixel_pos + 3] = 0xff; // make an opaque image
+#if DMZ_HAS_AVX2_COMPILETIME
+// As llcv_YCbCr2RGB_s16_sse2, for sixteen pixels.
+static inline DMZ_TARGET_AVX2 void llcv_YCbCr2RGB_s16_avx2(__m256i y, __m256i cb, __m256i cr, __m256i *r, __m256i *g, __m256i *b) {
+  const __m256i round = _mm256_set1_epi32(1 << (kYCbCr2RGBShift - 1));
+  const __m256i to_r = _mm256_set1_epi32((int32_t)((uint32_t)(uint16_t)kYCbCr2RGBCrToR << 16));
+  const __m256i to_g = _mm256_set1_epi32((int32_t)(((uint32_t)(uint16_t)kYCbCr2RGBCrToG << 16) | (uint16_t)kYCbCr2RGBCbToG));
+  const __m256i to_b = _mm256_set1_epi32((uint16_t)kYCbCr2RGBCbToB);
+  // unpacklo/hi work within each 128 bit lane, and packs undoes them, so the pixels stay in order.
+  __m256i cbcr_lo = _mm256_unpacklo_epi16(cb, cr);
+  __m256i cbcr_hi = _mm256_unpackhi_epi16(cb, cr);
+#define DESCALED_SUMS(coefficients) \
+    _mm256_packs_epi32(_mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(cbcr_lo, coefficients), round), kYCbCr2RGBShift), \
+                       _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(cbcr_hi, coefficients), round), kYCbCr2RGBShift))
+  *r = _mm256_add_epi16(y, DESCALED_SUMS(to_r));
+  *g = _mm256_add_epi16(y, DESCALED_SUMS(to_g));
+  *b = _mm256_add_epi16(y, DESCALED_SUMS(to_b));
+#undef DESCALED_SUMS
+}
+#endif
+
+DMZ_INTERNAL DMZ_TARGET_AVX2 void llcv_YCbCr2RGB_u8_row_avx2(const uint8_t *y, const uint8_t *cb, const uint8_t *cr, uint8_t *dst, int dst_channels, int width) {
+#if DMZ_HAS_AVX2_COMPILETIME
+#define kVectorSize 16
+  const __m256i chroma_offset = _mm256_set1_epi16(128);
+  const __m256i alpha = _mm256_set1_epi16(0xff);
+  // Packs each 128 bit lane's four RGBA pixels into its first 12 bytes.
+  const __m128i drop_alpha = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  int col_index = 0;
+  for(; col_index + kVectorSize <= width; col_index += kVectorSize) {
+    __m256i r, g, b;
+    llcv_YCbCr2RGB_s16_avx2(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(y + col_index))),
+                            _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(cb + col_index))), chroma_offset),
+                            _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(cr + col_index))), chroma_offset),
+                            &r, &g, &b);
+    // Each lane: R, B of its eight pixels, then G, A, then (R, G) and (B, A) pairs, then RGBA.
+    __m256i rb = _mm256_packus_epi16(r, b);
+    __m256i ga = _mm256_packus_epi16(g, alpha);
+    __m256i rg = _mm256_unpacklo_epi8(rb, ga);
+    __m256i ba = _mm256_unpackhi_epi8(rb, ga);
+    __m256i rgba_lo = _mm256_unpacklo_epi16(rg, ba); // pixels 0 to 3, 8 to 11
+    __m256i rgba_hi = _mm256_unpackhi_epi16(rg, ba); // pixels 4 to 7, 12 to 15
+    __m256i rgba_first = _mm256_permute2x128_si256(rgba_lo, rgba_hi, 0x20);
+    __m256i rgba_second = _mm256_permute2x128_si256(rgba_lo, rgba_hi, 0x31);
+    if(dst_channels == 4) {
+      _mm256_storeu_si256((__m256i *)(dst + col_index * 4), rgba_first);
+      _mm256_storeu_si256((__m256i *)(dst + col_index * 4 + 32), rgba_second);
+    } else {
+      __m128i quads[4] = {
+        _mm256_castsi256_si128(rgba_first), _mm256_extracti128_si256(rgba_first, 1),
+        _mm256_castsi256_si128(rgba_second), _mm256_extracti128_si256(rgba_second, 1),
+      };
+      for(int i = 0; i < 4; i++) {
+        __m128i rgb = _mm_shuffle_epi8(quads[i], drop_alpha);
+        uint8_t *quad_dst = dst + (col_index + i * 4) * 3;
+        _mm_storel_epi64((__m128i *)quad_dst, rgb);
+        int32_t last_four = _mm_cvtsi128_si32(_mm_srli_si128(rgb, 8));
+        memcpy(quad_dst + 8, &last_four, sizeof(last_four));
       }
+    }
+  }
+  llcv_YCbCr2RGB_u8_row_c(y + col_index, cb + col_index, cr + col_index, dst + col_index * dst_channels, dst_channels, width - col_index);
+#undef kVectorSize
+#endif
+}
 
-      col_index++;
+DMZ_INTERNAL void llcv_YCbCr2RGB_u8_row_neon(const uint8_t *y, const uint8_t *cb, const uint8_t *cr, uint8_t *dst, int dst_channels, int width) {
+#if DMZ_HAS_NEON_COMPILETIME
+#define kVectorSize 16
+  const uint8x16_t chroma_offset = vdupq_n_u8(128);
+  int col_index = 0;
+  for(; col_index + kVectorSize <= width; col_index += kVectorSize) {
+    uint8x16_t y8 = vld1q_u8(y + col_index);
+    uint8x16_t cb8 = vld1q_u8(cb + col_index);
+    uint8x16_t cr8 = vld1q_u8(cr + col_index);
+    uint8x16x4_t rgba;
+    uint8x8_t channels[3][2];
+    for(int half = 0; half < 2; half++) {
+      uint8x8_t y_half = half ? vget_high_u8(y8) : vget_low_u8(y8);
+      int16x8_t y16 = vreinterpretq_s16_u16(vmovl_u8(y_half));
+      int16x8_t cb16 = vreinterpretq_s16_u16(vsubl_u8(half ? vget_high_u8(cb8) : vget_low_u8(cb8), vget_low_u8(chroma_offset)));
+      int16x8_t cr16 = vreinterpretq_s16_u16(vsubl_u8(half ? vget_high_u8(cr8) : vget_low_u8(cr8), vget_low_u8(chroma_offset)));
+      // vrshrn rounds as DESCALE_14 does: add half, then shift.
+      int16x8_t r = vcombine_s16(vrshrn_n_s32(vmull_n_s16(vget_low_s16(cr16), kYCbCr2RGBCrToR), kYCbCr2RGBShift),
+                                 vrshrn_n_s32(vmull_n_s16(vget_high_s16(cr16), kYCbCr2RGBCrToR), kYCbCr2RGBShift));
+      int16x8_t g = vcombine_s16(vrshrn_n_s32(vmlal_n_s16(vmull_n_s16(vget_low_s16(cb16), kYCbCr2RGBCbToG), vget_low_s16(cr16), kYCbCr2RGBCrToG), kYCbCr2RGBShift),
+                                 vrshrn_n_s32(vmlal_n_s16(vmull_n_s16(vget_high_s16(cb16), kYCbCr2RGBCbToG), vget_high_s16(cr16), kYCbCr2RGBCrToG), kYCbCr2RGBShift));
+      int16x8_t b = vcombine_s16(vrshrn_n_s32(vmull_n_s16(vget_low_s16(cb16), kYCbCr2RGBCbToB), kYCbCr2RGBShift),
+                                 vrshrn_n_s32(vmull_n_s16(vget_high_s16(cb16), kYCbCr2RGBCbToB), kYCbCr2RGBShift));
+      channels[0][half] = vqmovun_s16(vaddq_s16(y16, r));
+      channels[1][half] = vqmovun_s16(vaddq_s16(y16, g));
+      channels[2][half] = vqmovun_s16(vaddq_s16(y16, b));
+    }
+    for(int c = 0; c < 3; c++) {
+      rgba.val[c] = vcombine_u8(channels[c][0], channels[c][1]);
+    }
+    if(dst_channels == 4) {
+      rgba.val[3] = vdupq_n_u8(0xff);
+      vst4q_u8(dst + col_index * 4, rgba);
+    } else {
+      uint8x16x3_t rgb = {{rgba.val[0], rgba.val[1], rgba.val[2]}};
+      vst3q_u8(dst + col_index * 3, rgb);
     }
   }
+  llcv_YCbCr2RGB_u8_row_c(y + col_index, cb + col_index, cr + col_index, dst + col_index * dst_channels, dst_channels, width - col_index);
+#undef kVectorSize
+#endif
 }
 
 DMZ_INTERNAL void llcv_YCbCr2RGB_u8(IplImage *y, IplImage *cb, IplImage *cr, IplImage *dst) {
-#if DMZ_DEBUG
   CvSize y_size = cvGetSize(y);
+#if DMZ_DEBUG
   CvSize cb_size = cvGetSize(cb);
   CvSize cr_size = cvGetSize(cr);
   CvSize dst_size = cvGetSize(dst);
@@ -528,22 +696,30 @@ DMZ_INTERNAL void llcv_YCbCr2RGB_u8(IplImage *y, IplImage *cb, IplImage *cr, Ipl
   assert(cr->depth == IPL_DEPTH_8U);
   assert(dst->depth == IPL_DEPTH_8U);
 
+  const dmz_kernel_table *kernels = dmz_kernels();
+  const uint8_t *y_data_origin = (const uint8_t *)llcv_get_data_origin(y);
+  const uint8_t *cb_data_origin = (const uint8_t *)llcv_get_data_origin(cb);
+  const uint8_t *cr_data_origin = (const uint8_t *)llcv_get_data_origin(cr);
+  uint8_t *dst_data_origin = (uint8_t *)llcv_get_data_origin(dst);
 
 #if TIME_YCbCr2RGB
-  clock_t start_c, end_c;
-  start_c = clock();
+  clock_t start_dmz, end_dmz;
+  start_dmz = clock();
   for(int iter = 0; iter < TIME_YCbCr2RGB_TIMING_ITERATIONS; iter++) {
 #endif
     
-    llcv_YCbCr2RGB_u8_c(y, cb, cr, dst);
+    for(int row_index = 0; row_index < y_size.height; row_index++) {
+      kernels->YCbCr2RGB_u8_row(y_data_origin + row_index * y->widthStep, cb_data_origin + row_index * cb->widthStep, cr_data_origin + row_index * cr->widthStep,
+                                dst_data_origin + row_index * dst->widthStep, dst->nChannels, y_size.width);
+    }
     
 #if TIME_YCbCr2RGB
   }
-  end_c = clock();
-  clock_t elapsed_c = end_c - start_c;
-  if(elapsed_c < fastest_c) {
-    fastest_c = elapsed_c;
-    dmz_debug_log("(llcv_YCbCr2RGB_u8) fastest c: %f ms", (1000.0 * (double)fastest_c / (double)CLOCKS_PER_SEC) / (double)TIME_YCbCr2RGB_TIMING_ITERATIONS);
+  end_dmz = clock();
+  clock_t elapsed_dmz = end_dmz - start_dmz;
+  if(elapsed_dmz < fastest_dmz) {
+    fastest_dmz = elapsed_dmz;
+    dmz_debug_log("(llcv_YCbCr2RGB_u8) fastest dmz: %f ms", (1000.0 * (double)fastest_dmz / (double)CLOCKS_PER_SEC) / (double)TIME_YCbCr2RGB_TIMING_ITERATIONS);
   }
 #endif
   
@@ -596,4 +772,114 @@ DMZ_INTERNAL void llcv_YCbCr2RGB_u8(IplImage *y, IplImage *cb, IplImage *cr, Ipl
 }
 
 
+
+#pragma mark gather
+
+// dst[i] = src[i * pixel_step], for i < width
+DMZ_INTERNAL void llcv_gather_u8_row_c(const uint8_t *src, int pixel_step, uint8_t *dst, int width) {
+  if(pixel_step == 1) {
+    memcpy(dst, src, width);
+    return;
+  }
+  for(int col_index = 0; col_index < width; col_index++) {
+    dst[col_index] = src[col_index * pixel_step];
+  }
+}
+
+// The vectorized versions handle pixel steps of 2 (NV21 / NV12 chroma, YUYV luma) and 4 (YUYV chroma).
+// Each load takes in kVectorSize whole pixel steps, so it only goes ahead while that ends at or
+// before the row's last pixel; the bytes after the last pixel may not be there to read.
+
+DMZ_INTERNAL void llcv_gather_u8_row_sse2(const uint8_t *src, int pixel_step, uint8_t *dst, int width) {
+#if DMZ_HAS_SSE2_COMPILETIME
+#define kVectorSize 16
+  int last_pixel_offset = (width - 1) * pixel_step;
+  int col_index = 0;
+  if(pixel_step == 2) {
+    const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+    for(; col_index * 2 + 2 * kVectorSize - 1 <= last_pixel_offset; col_index += kVectorSize) {
+      const uint8_t *pixels = src + col_index * 2;
+      __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i *)pixels), low_bytes);
+      __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i *)(pixels + 16)), low_bytes);
+      _mm_storeu_si128((__m128i *)(dst + col_index), _mm_packus_epi16(a, b));
+    }
+  } else if(pixel_step == 4) {
+    const __m128i low_bytes = _mm_set1_epi32(0x000000FF);
+    for(; col_index * 4 + 4 * kVectorSize - 1 <= last_pixel_offset; col_index += kVectorSize) {
+      const uint8_t *pixels = src + col_index * 4;
+      __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i *)pixels), low_bytes);
+      __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i *)(pixels + 16)), low_bytes);
+      __m128i c = _mm_and_si128(_mm_loadu_si128((const __m128i *)(pixels + 32)), low_bytes);
+      __m128i d = _mm_and_si128(_mm_loadu_si128((const __m128i *)(pixels + 48)), low_bytes);
+      _mm_storeu_si128((__m128i *)(dst + col_index), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+    }
+  }
+  llcv_gather_u8_row_c(src + col_index * pixel_step, pixel_step, dst + col_index, width - col_index);
+#undef kVectorSize
+#endif
+}
+
+DMZ_INTERNAL void llcv_gather_u8_row_neon(const uint8_t *src, int pixel_step, uint8_t *dst, int width) {
+#if DMZ_HAS_NEON_COMPILETIME
+#define kVectorSize 16
+  int last_pixel_offset = (width - 1) * pixel_step;
+  int col_index = 0;
+  if(pixel_step == 2) {
+    for(; col_index * 2 + 2 * kVectorSize - 1 <= last_pixel_offset; col_index += kVectorSize) {
+      vst1q_u8(dst + col_index, vld2q_u8(src + col_index * 2).val[0]);
+    }
+  } else if(pixel_step == 4) {
+    for(; col_index * 4 + 4 * kVectorSize - 1 <= last_pixel_offset; col_index += kVectorSize) {
+      vst1q_u8(dst + col_index, vld4q_u8(src + col_index * 4).val[0]);
+    }
+  }
+  llcv_gather_u8_row_c(src + col_index * pixel_step, pixel_step, dst + col_index, width - col_index);
+#undef kVectorSize
+#endif
+}
+
+DMZ_INTERNAL void llcv_gather_u8(const uint8_t *origin, int row_step, int pixel_step, IplImage *dst) {
+  assert(dst->nChannels == 1);
+  assert(dst->depth == IPL_DEPTH_8U);
+
+  const dmz_kernel_table *kernels = dmz_kernels();
+  CvSize dst_size = cvGetSize(dst);
+  uint8_t *dst_data_origin = (uint8_t *)llcv_get_data_origin(dst);
+
+  for(int row_index = 0; row_index < dst_size.height; row_index++) {
+    kernels->gather_u8_row(origin + row_index * row_step, pixel_step, dst_data_origin + row_index * dst->widthStep, dst_size.width);
+  }
+}
+
+DMZ_INTERNAL void llcv_gather_BGRA_to_YCbCr_u8(const uint8_t *origin, int row_step, int pixel_step, int component, IplImage *dst) {
+  assert(dst->nChannels == 1);
+  assert(dst->depth == IPL_DEPTH_8U);
+  assert(component >= 0 && component <= 2);
+
+  CvSize dst_size = cvGetSize(dst);
+  uint8_t *dst_data_origin = (uint8_t *)llcv_get_data_origin(dst);
+
+  for(int row_index = 0; row_index < dst_size.height; row_index++) {
+    const uint8_t *src_row_origin = origin + row_index * row_step;
+    uint8_t *dst_row_origin = dst_data_origin + row_index * dst->widthStep;
+    for(int col_index = 0; col_index < dst_size.width; col_index++) {
+      const uint8_t *bgra = src_row_origin + col_index * pixel_step;
+      // the inverse of llcv_YCbCr2RGB_u8 (and the same arithmetic as cvCvtColor's CV_BGR2YCrCb)
+      int32_t pix_y = DESCALE_14(bgra[2] * 4899 + bgra[1] * 9617 + bgra[0] * 1868);
+      int32_t value;
+      if(component == 0) {
+        value = pix_y;
+      } else if(component == 1) {
+        value = DESCALE_14((bgra[0] - pix_y) * 9241 + (128 << 14));
+      } else {
+        value = DESCALE_14((bgra[2] - pix_y) * 11682 + (128 << 14));
+      }
+      dst_row_origin[col_index] = SATURATED_BYTE(value);
+    }
+  }
+}
+
+#undef DESCALE_14
+#undef SATURATED_BYTE
+
 #endif
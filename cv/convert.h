@@ -7,8 +7,29 @@
 #include "dmz_macros.h"
 
 DMZ_INTERNAL void llcv_split_u8(IplImage *interleaved, IplImage *channel1, IplImage *channel2);
-DMZ_INTERNAL void llcv_lineardown2_1d_u8(IplImage *src, IplImage *dst);
-DMZ_INTERNAL void llcv_norm_convert_1d_u8_to_f32(IplImage *src, IplImage *dst);
+
+// Writes the morphological gradient of the dst_width * 2 pixels at src, downsampled by 2 and
+// normalized to [0, 1], to dst.
+DMZ_INTERNAL void llcv_grad3_down2_norm_u8_to_f32(const uint8_t *src, float *dst, int dst_width);
 DMZ_INTERNAL void llcv_YCbCr2RGB_u8(IplImage *y, IplImage *cb, IplImage *cr, IplImage *dst);
 
+// llcv_YCbCr2RGB_u8 for a single pixel, writing R, G, B and, if add_alpha, an opaque alpha to dst.
+DMZ_INTERNAL void llcv_YCbCr2RGB_u8_pixel(uint8_t pix_y, uint8_t pix_cb, uint8_t pix_cr, uint8_t *dst, bool add_alpha);
+
+// The conversion's coefficients, in 14 bit fixed point (the same as cvCvtColor's CV_YCrCb2RGB).
+// Each applies to Cb or Cr less 128, and is added to Y.
+#define kYCbCr2RGBCbToB 29049
+#define kYCbCr2RGBCbToG -5636
+#define kYCbCr2RGBCrToG -11698
+#define kYCbCr2RGBCrToR 22987
+#define kYCbCr2RGBShift 14
+
+// Fills dst with the plane whose top left pixel is at origin, with pixel_step bytes between its pixels
+// and row_step bytes between its rows: for instance, one channel of an interleaved camera buffer.
+DMZ_INTERNAL void llcv_gather_u8(const uint8_t *origin, int row_step, int pixel_step, IplImage *dst);
+
+// As llcv_gather_u8, for a plane of BGRA pixels, filling dst with one of their YCbCr components
+// (0 for Y, 1 for Cb, 2 for Cr), as llcv_YCbCr2RGB_u8 would convert back.
+DMZ_INTERNAL void llcv_gather_BGRA_to_YCbCr_u8(const uint8_t *origin, int row_step, int pixel_step, int component, IplImage *dst);
+
 #endif
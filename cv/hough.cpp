@@ -45,11 +45,375 @@
 #if COMPILE_DMZ
 
 #include "hough.h"
+#include "processor_support.h"
 #include "opencv2/core/core.hpp"
 
+#if DMZ_HAS_NEON_COMPILETIME
+  #include <arm_neon.h>
+#endif
+
+#if DMZ_HAS_SSE2_COMPILETIME
+  #include <emmintrin.h>
+#endif
+#if DMZ_HAS_AVX2_COMPILETIME
+  #include <immintrin.h>
+#endif
+
 #define TO_RADIANS(in_degrees) (CV_PI * (in_degrees) / 180.0f)
 
-DMZ_INTERNAL CvLinePolar llcv_hough(const CvArr *src_image, IplImage *dx, IplImage *dy, float rho, float theta, int threshold, float theta_min, float theta_max, bool vertical, float gradient_angle_threshold) {
+#define FIXED_POINT_EXPONENT 10
+#define FIXED_POINT_MULTIPLIER (1 << FIXED_POINT_EXPONENT)
+
+DMZ_INTERNAL void llcv_hough_workspace_release(llcv_hough_workspace *workspace) {
+  llcv_buffer_release(&workspace->accum);
+  llcv_buffer_release(&workspace->tabs);
+  llcv_buffer_release(&workspace->points);
+}
+
+#pragma mark voting
+
+// Every hough_vote implementation casts, for each point (x, y) and each angle n, one vote at
+// accum[n * accum_step + ((x * cos[n] + y * sin[n]) >> FIXED_POINT_EXPONENT) + r_offset].
+// points holds (x, y) pairs and tabs holds (cos, sin) pairs, all int16. Angles never share
+// accumulator rows, so the vectorized versions compute several angles' indices at once and then
+// increment them one by one, with no conflicts between lanes.
+
+DMZ_INTERNAL void llcv_hough_vote_c(int *accum, int accum_step, const int16_t *points, int n_points, const int16_t *tabs, int numangle, int r_offset) {
+  for(int point = 0; point < n_points; point++) {
+    int x = points[2 * point];
+    int y = points[2 * point + 1];
+    int *accum_row = accum + r_offset;
+    for(int n = 0; n < numangle; n++, accum_row += accum_step) {
+      int r = (x * tabs[2 * n] + y * tabs[2 * n + 1]) >> FIXED_POINT_EXPONENT;
+      accum_row[r]++;
+    }
+  }
+}
+
+DMZ_INTERNAL void llcv_hough_vote_neon(int *accum, int accum_step, const int16_t *points, int n_points, const int16_t *tabs, int numangle, int r_offset) {
+#if DMZ_HAS_NEON_COMPILETIME
+#define kVectorSize 4
+  int32_t lane_offsets[kVectorSize] = {r_offset, accum_step + r_offset, 2 * accum_step + r_offset, 3 * accum_step + r_offset};
+  const int32x4_t first_offsets = vld1q_s32(lane_offsets);
+  const int32x4_t chunk_step = vdupq_n_s32(kVectorSize * accum_step);
+  int32_t indices[kVectorSize];
+
+  for(int point = 0; point < n_points; point++) {
+    int16_t x = points[2 * point];
+    int16_t y = points[2 * point + 1];
+    int32x4_t offsets = first_offsets;
+    int n = 0;
+    for(; n + kVectorSize <= numangle; n += kVectorSize) {
+      int16x4x2_t cos_sin = vld2_s16(tabs + 2 * n); // deinterleaves into cos and sin
+      int32x4_t dot = vmull_n_s16(cos_sin.val[0], x);
+      dot = vmlal_n_s16(dot, cos_sin.val[1], y);
+      vst1q_s32(indices, vaddq_s32(vshrq_n_s32(dot, FIXED_POINT_EXPONENT), offsets));
+      accum[indices[0]]++;
+      accum[indices[1]]++;
+      accum[indices[2]]++;
+      accum[indices[3]]++;
+      offsets = vaddq_s32(offsets, chunk_step);
+    }
+    for(; n < numangle; n++) {
+      int r = (x * tabs[2 * n] + y * tabs[2 * n + 1]) >> FIXED_POINT_EXPONENT;
+      accum[n * accum_step + r_offset + r]++;
+    }
+  }
+#undef kVectorSize
+#endif
+}
+
+DMZ_INTERNAL void llcv_hough_vote_sse2(int *accum, int accum_step, const int16_t *points, int n_points, const int16_t *tabs, int numangle, int r_offset) {
+#if DMZ_HAS_SSE2_COMPILETIME
+#define kVectorSize 4
+  const __m128i first_offsets = _mm_setr_epi32(r_offset, accum_step + r_offset, 2 * accum_step + r_offset, 3 * accum_step + r_offset);
+  const __m128i chunk_step = _mm_set1_epi32(kVectorSize * accum_step);
+  int32_t indices[kVectorSize];
+
+  for(int point = 0; point < n_points; point++) {
+    int32_t xy;
+    memcpy(&xy, points + 2 * point, sizeof(xy));
+    const __m128i point_vector = _mm_set1_epi32(xy); // (x, y) pairs, to line up with the (cos, sin) pairs
+    __m128i offsets = first_offsets;
+    int n = 0;
+    for(; n + kVectorSize <= numangle; n += kVectorSize) {
+      __m128i dot = _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(tabs + 2 * n)), point_vector);
+      _mm_storeu_si128((__m128i *)indices, _mm_add_epi32(_mm_srai_epi32(dot, FIXED_POINT_EXPONENT), offsets));
+      accum[indices[0]]++;
+      accum[indices[1]]++;
+      accum[indices[2]]++;
+      accum[indices[3]]++;
+      offsets = _mm_add_epi32(offsets, chunk_step);
+    }
+    int x = points[2 * point];
+    int y = points[2 * point + 1];
+    for(; n < numangle; n++) {
+      int r = (x * tabs[2 * n] + y * tabs[2 * n + 1]) >> FIXED_POINT_EXPONENT;
+      accum[n * accum_step + r_offset + r]++;
+    }
+  }
+#undef kVectorSize
+#endif
+}
+
+DMZ_INTERNAL DMZ_TARGET_AVX2 void llcv_hough_vote_avx2(int *accum, int accum_step, const int16_t *points, int n_points, const int16_t *tabs, int numangle, int r_offset) {
+#if DMZ_HAS_AVX2_COMPILETIME
+#define kVectorSize 8
+  const __m256i first_offsets = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(accum_step)),
+                                                 _mm256_set1_epi32(r_offset));
+  const __m256i chunk_step = _mm256_set1_epi32(kVectorSize * accum_step);
+  int32_t indices[kVectorSize];
+
+  for(int point = 0; point < n_points; point++) {
+    int32_t xy;
+    memcpy(&xy, points + 2 * point, sizeof(xy));
+    const __m256i point_vector = _mm256_set1_epi32(xy);
+    __m256i offsets = first_offsets;
+    int n = 0;
+    for(; n + kVectorSize <= numangle; n += kVectorSize) {
+      __m256i dot = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i *)(tabs + 2 * n)), point_vector);
+      _mm256_storeu_si256((__m256i *)indices, _mm256_add_epi32(_mm256_srai_epi32(dot, FIXED_POINT_EXPONENT), offsets));
+      accum[indices[0]]++;
+      accum[indices[1]]++;
+      accum[indices[2]]++;
+      accum[indices[3]]++;
+      accum[indices[4]]++;
+      accum[indices[5]]++;
+      accum[indices[6]]++;
+      accum[indices[7]]++;
+      offsets = _mm256_add_epi32(offsets, chunk_step);
+    }
+    if(n + kVectorSize / 2 <= numangle) {
+      __m128i dot = _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(tabs + 2 * n)), _mm256_castsi256_si128(point_vector));
+      _mm_storeu_si128((__m128i *)indices, _mm_add_epi32(_mm_srai_epi32(dot, FIXED_POINT_EXPONENT), _mm256_castsi256_si128(offsets)));
+      accum[indices[0]]++;
+      accum[indices[1]]++;
+      accum[indices[2]]++;
+      accum[indices[3]]++;
+      n += kVectorSize / 2;
+    }
+    int x = points[2 * point];
+    int y = points[2 * point + 1];
+    for(; n < numangle; n++) {
+      int r = (x * tabs[2 * n] + y * tabs[2 * n + 1]) >> FIXED_POINT_EXPONENT;
+      accum[n * accum_step + r_offset + r]++;
+    }
+  }
+#undef kVectorSize
+#endif
+}
+
+#pragma mark argmax
+
+// Every hough_argmax implementation returns the largest value in accum[n * accum_step + r], for
+// 0 <= n < numangle and first_r <= r <= last_r, and its location. Ties go to the smallest r, and then
+// to the smallest n, which is the order the original scalar loop visited them in. If the largest
+// value is 0, the location is left alone.
+//
+// The vectorized versions find the maximum first, and then look for its first occurrence,
+// only scanning each row up to the best r found so far.
+
+DMZ_INTERNAL int llcv_hough_argmax_c(const int *accum, int accum_step, int numangle, int first_r, int last_r, int *max_n, int *max_r) {
+  int max_val = 0;
+  for(int r = first_r; r <= last_r; r++) {
+    for(int n = 0; n < numangle; n++) {
+      int accum_val = accum[n * accum_step + r];
+      if(accum_val > max_val) {
+        max_val = accum_val;
+        *max_n = n;
+        *max_r = r;
+      }
+    }
+  }
+  return max_val;
+}
+
+#if DMZ_HAS_NEON_COMPILETIME
+DMZ_INTERNAL void llcv_hough_first_occurrence_neon(const int *accum, int accum_step, int numangle, int first_r, int last_r, int value, int *max_n, int *max_r) {
+  int best_r = last_r + 1;
+  for(int n = 0; n < numangle && best_r > first_r; n++) {
+    const int *accum_row = accum + n * accum_step;
+    for(int r = first_r; r < best_r; r++) {
+      if(accum_row[r] == value) {
+        best_r = r;
+        *max_n = n;
+        *max_r = r;
+        break;
+      }
+    }
+  }
+}
+#endif
+
+DMZ_INTERNAL int llcv_hough_argmax_neon(const int *accum, int accum_step, int numangle, int first_r, int last_r, int *max_n, int *max_r) {
+#if DMZ_HAS_NEON_COMPILETIME
+#define kVectorSize 4
+  int32x4_t max_vector = vdupq_n_s32(0);
+  int max_val = 0;
+  for(int n = 0; n < numangle; n++) {
+    const int *accum_row = accum + n * accum_step;
+    int r = first_r;
+    for(; r + kVectorSize <= last_r + 1; r += kVectorSize) {
+      max_vector = vmaxq_s32(max_vector, vld1q_s32(accum_row + r));
+    }
+    for(; r <= last_r; r++) {
+      max_val = MAX(max_val, accum_row[r]);
+    }
+  }
+  int32x2_t max_pair = vpmax_s32(vget_low_s32(max_vector), vget_high_s32(max_vector));
+  max_pair = vpmax_s32(max_pair, max_pair);
+  max_val = MAX(max_val, vget_lane_s32(max_pair, 0));
+
+  if(max_val > 0) {
+    llcv_hough_first_occurrence_neon(accum, accum_step, numangle, first_r, last_r, max_val, max_n, max_r);
+  }
+  return max_val;
+#undef kVectorSize
+#else
+  return 0;
+#endif
+}
+
+DMZ_INTERNAL int llcv_hough_argmax_sse2(const int *accum, int accum_step, int numangle, int first_r, int last_r, int *max_n, int *max_r) {
+#if DMZ_HAS_SSE2_COMPILETIME
+#define kVectorSize 4
+  __m128i max_vector = _mm_setzero_si128();
+  int max_val = 0;
+  for(int n = 0; n < numangle; n++) {
+    const int *accum_row = accum + n * accum_step;
+    int r = first_r;
+    for(; r + kVectorSize <= last_r + 1; r += kVectorSize) {
+      __m128i accum_vector = _mm_loadu_si128((const __m128i *)(accum_row + r));
+      __m128i greater = _mm_cmpgt_epi32(accum_vector, max_vector); // no _mm_max_epi32 before SSE4.1
+      max_vector = _mm_or_si128(_mm_and_si128(greater, accum_vector), _mm_andnot_si128(greater, max_vector));
+    }
+    for(; r <= last_r; r++) {
+      max_val = MAX(max_val, accum_row[r]);
+    }
+  }
+  int32_t lanes[kVectorSize];
+  _mm_storeu_si128((__m128i *)lanes, max_vector);
+  for(uint8_t lane = 0; lane < kVectorSize; lane++) {
+    max_val = MAX(max_val, lanes[lane]);
+  }
+  if(max_val <= 0) {
+    return max_val;
+  }
+
+  const __m128i max_val_vector = _mm_set1_epi32(max_val);
+  int best_r = last_r + 1;
+  for(int n = 0; n < numangle && best_r > first_r; n++) {
+    const int *accum_row = accum + n * accum_step;
+    int r = first_r;
+    for(; r + kVectorSize <= best_r; r += kVectorSize) {
+      __m128i equal = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(accum_row + r)), max_val_vector);
+      if(_mm_movemask_epi8(equal) != 0) {
+        break;
+      }
+    }
+    for(; r < best_r; r++) {
+      if(accum_row[r] == max_val) {
+        best_r = r;
+        *max_n = n;
+        *max_r = r;
+        break;
+      }
+    }
+  }
+  return max_val;
+#undef kVectorSize
+#else
+  return 0;
+#endif
+}
+
+DMZ_INTERNAL DMZ_TARGET_AVX2 int llcv_hough_argmax_avx2(const int *accum, int accum_step, int numangle, int first_r, int last_r, int *max_n, int *max_r) {
+#if DMZ_HAS_AVX2_COMPILETIME
+#define kVectorSize 8
+  __m256i max_vector = _mm256_setzero_si256();
+  int max_val = 0;
+  for(int n = 0; n < numangle; n++) {
+    const int *accum_row = accum + n * accum_step;
+    int r = first_r;
+    for(; r + kVectorSize <= last_r + 1; r += kVectorSize) {
+      max_vector = _mm256_max_epi32(max_vector, _mm256_loadu_si256((const __m256i *)(accum_row + r)));
+    }
+    for(; r <= last_r; r++) {
+      max_val = MAX(max_val, accum_row[r]);
+    }
+  }
+  int32_t lanes[kVectorSize];
+  _mm256_storeu_si256((__m256i *)lanes, max_vector);
+  for(uint8_t lane = 0; lane < kVectorSize; lane++) {
+    max_val = MAX(max_val, lanes[lane]);
+  }
+  if(max_val <= 0) {
+    return max_val;
+  }
+
+  const __m256i max_val_vector = _mm256_set1_epi32(max_val);
+  int best_r = last_r + 1;
+  for(int n = 0; n < numangle && best_r > first_r; n++) {
+    const int *accum_row = accum + n * accum_step;
+    int r = first_r;
+    for(; r + kVectorSize <= best_r; r += kVectorSize) {
+      __m256i equal = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(accum_row + r)), max_val_vector);
+      if(_mm256_movemask_epi8(equal) != 0) {
+        break;
+      }
+    }
+    for(; r < best_r; r++) {
+      if(accum_row[r] == max_val) {
+        best_r = r;
+        *max_n = n;
+        *max_r = r;
+        break;
+      }
+    }
+  }
+  return max_val;
+#undef kVectorSize
+#else
+  return 0;
+#endif
+}
+
+#pragma mark hough
+
+// Whether the quotient del_y / del_x, as computed in float, is greater than the float whose lower
+// (or upper) rounding boundary is bound; see llcv_hough for how the bounds are set up. The exact
+// quotient of two int16s is never a midpoint between two floats, so comparing it against the midpoint
+// gives the same answer as rounding it first, and del_x * bound is exact in double, so there's no
+// need to divide at all.
+static inline bool llcv_slope_above(int16_t del_x, int16_t del_y, double bound) {
+  return del_x > 0 ? del_y > bound * del_x : del_y < bound * del_x;
+}
+
+// The midpoints between value and the floats on either side of it.
+static inline double llcv_float_lower_boundary(float value) {
+  return 0.5 * ((double)value + (double)nextafterf(value, -FLT_MAX));
+}
+
+static inline double llcv_float_upper_boundary(float value) {
+  return 0.5 * ((double)value + (double)nextafterf(value, FLT_MAX));
+}
+
+#define TEST_HOUGH_VECTORIZED 0
+
+// The accumulator's largest value within the rho window, and where it is; see llcv_hough_find_peak.
+typedef struct {
+  int max_val;
+  int max_n;
+  int max_r;
+  int numangle;
+  int numrho;
+  const int *accum_origin; // row n = 0, column r = 0
+  int accum_step;
+} llcv_hough_peak;
+
+// Stage 1 of llcv_hough: collect the edge pixels whose gradients have the right angle, as (x, y) pairs
+// in workspace's points. Returns how many there are, and sets *size to the image's.
+DMZ_INTERNAL int llcv_hough_collect_points(const CvArr *src_image, IplImage *dx, IplImage *dy, bool vertical, float gradient_angle_threshold, llcv_hough_workspace *workspace, CvSize *size) {
     CvMat img_stub, *img = (CvMat*)src_image;
     img = cvGetMat(img, &img_stub);
 
@@ -63,25 +427,9 @@ DMZ_INTERNAL CvLinePolar llcv_hough(const CvArr *src_image, IplImage *dx, IplIma
       CV_Error(CV_StsBadArg, "The source image must be 8-bit, single-channel");
     }
 
-    if(rho <= 0 || theta <= 0 || threshold <= 0) {
-      CV_Error(CV_StsOutOfRange, "rho, theta and threshold must be positive");
-    }
-
-    if(theta_max < theta_min + theta) {
-      CV_Error(CV_StsBadArg, "theta + theta_min (param1) must be <= theta_max (param2)");
-    }
-
-    cv::AutoBuffer<int> _accum;
-    cv::AutoBuffer<int> _tabSin, _tabCos;
-
     const uchar* image;
     int step, width, height;
-    int numangle, numrho;
-    float ang;
-    int r, n;
     int i, j;
-    float irho = 1 / rho;
-    float scale;
 
     CV_Assert( CV_IS_MAT(img) && CV_MAT_TYPE(img->type) == CV_8UC1 );
 
@@ -90,29 +438,15 @@ DMZ_INTERNAL CvLinePolar llcv_hough(const CvArr *src_image, IplImage *dx, IplIma
     width = img->cols;
     height = img->rows;
 
+    // Points are int16, for multiplying pairs of them at once.
+    assert(width <= INT16_MAX && height <= INT16_MAX);
+
     const uint8_t *dx_mat_ptr = (uint8_t *)(dx_mat->data.ptr);
     int dx_step = dx_mat->step;
     const uint8_t *dy_mat_ptr = (uint8_t *)(dy_mat->data.ptr);
     int dy_step = dy_mat->step;
 
-    numangle = cvRound((theta_max - theta_min) / theta);
-    numrho = cvRound(((width + height) * 2 + 1) / rho);
-
-    _accum.allocate((numangle+2) * (numrho+2));
-    _tabSin.allocate(numangle);
-    _tabCos.allocate(numangle);
-    int *accum = _accum;
-    int *tabSin = _tabSin, *tabCos = _tabCos;
-    
-    memset(accum, 0, sizeof(accum[0]) * (numangle + 2) * (numrho + 2));
-
-#define FIXED_POINT_EXPONENT 10
-#define FIXED_POINT_MULTIPLIER (1 << FIXED_POINT_EXPONENT)
-
-    for(ang = theta_min, n = 0; n < numangle; ang += theta, n++) {
-        tabSin[n] = (int)floorf(FIXED_POINT_MULTIPLIER * sinf(ang) * irho);
-        tabCos[n] = (int)floorf(FIXED_POINT_MULTIPLIER * cosf(ang) * irho);
-    }
+    int16_t *points = (int16_t *)llcv_buffer_reserve(&workspace->points, sizeof(int16_t) * 2 * width * height); // (x, y) pairs
 
     float slope_bound_a, slope_bound_b;
     if(vertical) {
@@ -122,76 +456,252 @@ DMZ_INTERNAL CvLinePolar llcv_hough(const CvArr *src_image, IplImage *dx, IplIma
         slope_bound_a = tanf((float)TO_RADIANS(90 - gradient_angle_threshold));
         slope_bound_b = tanf((float)TO_RADIANS(90 + gradient_angle_threshold));
     }
+    // slope >= a is the same as "slope above a's lower boundary", and slope <= b is the same as
+    // "slope not above b's upper boundary"
+    double slope_boundary_a = llcv_float_lower_boundary(slope_bound_a);
+    double slope_boundary_b = llcv_float_upper_boundary(slope_bound_b);
 
-    // stage 1. fill accumulator
+    // stage 1. collect the edge pixels whose gradients have the right angle
+    int n_points = 0;
     for(i = 0; i < height; i++) {
-        int16_t *dx_row_ptr = (int16_t *)(dx_mat_ptr + i * dx_step);
-        int16_t *dy_row_ptr = (int16_t *)(dy_mat_ptr + i * dy_step);
+        const uint8_t *image_row_ptr = image + i * step;
+        const int16_t *dx_row_ptr = (const int16_t *)(dx_mat_ptr + i * dx_step);
+        const int16_t *dy_row_ptr = (const int16_t *)(dy_mat_ptr + i * dy_step);
         for(j = 0; j < width; j++) {
-            if(image[i * step + j] != 0) {
+            // Canny output is mostly zeros, so skip over them eight at a time
+            if(j + 8 <= width) {
+                uint64_t eight_pixels;
+                memcpy(&eight_pixels, image_row_ptr + j, sizeof(eight_pixels));
+                if(eight_pixels == 0) {
+                    j += 7;
+                    continue;
+                }
+            }
+            if(image_row_ptr[j] != 0) {
                 int16_t del_x = dx_row_ptr[j];
                 int16_t del_y = dy_row_ptr[j];
 
-                bool use_pixel = false;
-
-                if(dmz_likely(del_x != 0)) { // avoid div by 0
-                  float slope = (float)del_y / (float)del_x;
+                bool use_pixel;
+                if(dmz_likely(del_x != 0)) {
                   if(vertical) {
-                    if(slope >= slope_bound_a && slope <= slope_bound_b) {
-                      use_pixel = true;
-                    }
+                    use_pixel = llcv_slope_above(del_x, del_y, slope_boundary_a) && !llcv_slope_above(del_x, del_y, slope_boundary_b);
                   } else {
-                    if(slope >= slope_bound_a || slope <= slope_bound_b) {
-                      use_pixel = true;
-                    }
+                    use_pixel = llcv_slope_above(del_x, del_y, slope_boundary_a) || !llcv_slope_above(del_x, del_y, slope_boundary_b);
                   }
                 } else {
                   use_pixel = !vertical;
                 }
 
                 if(use_pixel) {
-                    for(n = 0; n < numangle; n++) {
-                        r = (j * tabCos[n] + i * tabSin[n]) >> FIXED_POINT_EXPONENT;
-                        r += (numrho - 1) / 2;
-                        accum[(n+1) * (numrho+2) + r+1]++;
-                    }
+                    points[2 * n_points] = (int16_t)j;
+                    points[2 * n_points + 1] = (int16_t)i;
+                    n_points++;
                 }
             }
         }
     }
 
-    // stage 2. find maximum
-    // TODO: NEON implementation of max/argmax to use here
-    int maxVal = 0;
-    int maxBase = 0;
-    for( r = 0; r < numrho; r++ ) {
-        for( n = 0; n < numangle; n++ ) {
-            int base = (n + 1) * (numrho + 2) + r + 1;
-            int accumVal = accum[base];
-            if(accumVal > maxVal) {
-                maxVal = accumVal;
-                maxBase = base;
-            }
-        }
+    *size = cvSize(width, height);
+    return n_points;
+}
+
+// Stages 2 and 3 of llcv_hough, voting with points from llcv_hough_collect_points in an image of the given size.
+// The accumulator that peak points into lives in workspace.
+DMZ_INTERNAL void llcv_hough_find_peak(CvSize size, const int16_t *points, int n_points, float rho, float theta, int threshold, float theta_min, float theta_max, float rho_min, float rho_max, llcv_hough_workspace *workspace, llcv_hough_peak *peak) {
+    if(rho <= 0 || theta <= 0 || threshold <= 0) {
+      CV_Error(CV_StsOutOfRange, "rho, theta and threshold must be positive");
     }
 
+    if(theta_max < theta_min + theta) {
+      CV_Error(CV_StsBadArg, "theta + theta_min (param1) must be <= theta_max (param2)");
+    }
+
+    const dmz_kernel_table *kernels = dmz_kernels();
+
+    int numangle, numrho;
+    float ang;
+    int n;
+    float irho = 1 / rho;
+
+    // The sin/cos table is int16, like the points.
+    assert(FIXED_POINT_MULTIPLIER * irho <= INT16_MAX);
+
+    numangle = cvRound((theta_max - theta_min) / theta);
+    numrho = cvRound(((size.width + size.height) * 2 + 1) / rho);
+
+    int accum_step = numrho + 2;
+    int *accum = (int *)llcv_buffer_reserve(&workspace->accum, sizeof(int) * (numangle + 2) * accum_step);
+    int16_t *tabs = (int16_t *)llcv_buffer_reserve(&workspace->tabs, sizeof(int16_t) * 2 * numangle); // (cos, sin) pairs
+
+    memset(accum, 0, sizeof(accum[0]) * (numangle + 2) * accum_step);
 
-    // stage 3. if local maximum is above threshold, add it
+    for(ang = theta_min, n = 0; n < numangle; ang += theta, n++) {
+        tabs[2 * n] = (int16_t)floorf(FIXED_POINT_MULTIPLIER * cosf(ang) * irho);
+        tabs[2 * n + 1] = (int16_t)floorf(FIXED_POINT_MULTIPLIER * sinf(ang) * irho);
+    }
+
+    // stage 2. fill accumulator
+    int *accum_origin = accum + accum_step + 1; // row n = 0, column r = 0
+    int r_offset = (numrho - 1) / 2;
+    kernels->hough_vote(accum_origin, accum_step, points, n_points, tabs, numangle, r_offset);
+
+    // stage 3. find maximum, within [rho_min, rho_max]
+    float r_min = rho_min * irho + (numrho - 1) * 0.5f;
+    float r_max = rho_max * irho + (numrho - 1) * 0.5f;
+    int first_r = r_min <= 0 ? 0 : (int)ceilf(r_min);
+    int last_r = r_max >= numrho - 1 ? numrho - 1 : (int)floorf(r_max);
+
+    int max_n = 0;
+    int max_r = 0;
+    int maxVal = kernels->hough_argmax(accum_origin, accum_step, numangle, first_r, last_r, &max_n, &max_r);
+
+#if TEST_HOUGH_VECTORIZED
+    if(kernels->isa != DMZ_ISA_SCALAR) {
+      size_t accum_size = sizeof(int) * (numangle + 2) * accum_step;
+      int *test_accum = (int *)calloc(1, accum_size);
+      llcv_hough_vote_c(test_accum + accum_step + 1, accum_step, points, n_points, tabs, numangle, r_offset);
+      int test_n = 0, test_r = 0;
+      int test_max_val = llcv_hough_argmax_c(test_accum + accum_step + 1, accum_step, numangle, first_r, last_r, &test_n, &test_r);
+      if(memcmp(test_accum, accum, accum_size) != 0 || test_max_val != maxVal || (maxVal > 0 && (test_n != max_n || test_r != max_r))) {
+        fprintf(stderr, "llcv_hough C: %i at (%i, %i), vector: %i at (%i, %i), accumulators %s\n",
+                test_max_val, test_n, test_r, maxVal, max_n, max_r, memcmp(test_accum, accum, accum_size) ? "differ" : "match");
+      }
+      free(test_accum);
+    }
+#endif
+
+    peak->max_val = maxVal;
+    peak->max_n = max_n;
+    peak->max_r = max_r;
+    peak->numangle = numangle;
+    peak->numrho = numrho;
+    peak->accum_origin = accum_origin;
+    peak->accum_step = accum_step;
+}
+
+// Stage 4 of llcv_hough: if the peak is above threshold, return its line. rho_offset and angle_offset,
+// in bins, are added to the peak's location.
+DMZ_INTERNAL CvLinePolar llcv_hough_line_for_peak(const llcv_hough_peak *peak, float rho, float theta, int threshold, float theta_min, float rho_offset, float angle_offset) {
     CvLinePolar line;
     line.rho = 0.0f;
     line.angle = 0.0f;
     line.is_null = true;
 
-    if(maxVal > threshold) {
-      scale = 1.0f / (numrho + 2);
-      int idx = maxBase;
+    if(peak->max_val > threshold) {
+      int numrho = peak->numrho;
+      float scale = 1.0f / (numrho + 2);
+      int idx = (peak->max_n + 1) * peak->accum_step + peak->max_r + 1;
       int n = cvFloor(idx * scale) - 1;
       int r = idx - (n + 1) * (numrho + 2) - 1;
-      line.rho = (r - (numrho - 1) * 0.5f) * rho;
-      line.angle = n * theta + theta_min;
+      line.rho = (r + rho_offset - (numrho - 1) * 0.5f) * rho;
+      line.angle = (n + angle_offset) * theta + theta_min;
       line.is_null = false;
     }
     return line;
 }
 
+DMZ_INTERNAL CvLinePolar llcv_hough(const CvArr *src_image, IplImage *dx, IplImage *dy, float rho, float theta, int threshold, float theta_min, float theta_max, float rho_min, float rho_max, bool vertical, float gradient_angle_threshold, llcv_hough_workspace *workspace) {
+    llcv_hough_workspace local_workspace = {};
+    if(workspace == NULL) {
+      workspace = &local_workspace;
+    }
+
+    CvSize size;
+    int n_points = llcv_hough_collect_points(src_image, dx, dy, vertical, gradient_angle_threshold, workspace, &size);
+    const int16_t *points = (const int16_t *)workspace->points.data;
+
+    llcv_hough_peak peak;
+    llcv_hough_find_peak(size, points, n_points, rho, theta, threshold, theta_min, theta_max, rho_min, rho_max, workspace, &peak);
+    CvLinePolar line = llcv_hough_line_for_peak(&peak, rho, theta, threshold, theta_min, 0.0f, 0.0f);
+
+    llcv_hough_workspace_release(&local_workspace);
+    return line;
+}
+
+#pragma mark coarse to fine
+
+// How much coarser, in both rho and theta, the first pass of llcv_hough_coarse_to_fine is.
+#define kHoughCoarseFactor 2
+
+// The offset, in bins, of the vertex of the parabola through (-1, below), (0, at), (1, above),
+// or 0 if at isn't a strict local maximum.
+static inline float llcv_parabolic_peak_offset(int below, int at, int above) {
+  int curvature = below - 2 * at + above;
+  if(at <= below || at <= above || curvature >= 0) {
+    return 0.0f;
+  }
+  float offset = 0.5f * (below - above) / curvature;
+  return MAX(-0.5f, MIN(0.5f, offset));
+}
+
+DMZ_INTERNAL CvLinePolar llcv_hough_coarse_to_fine(const CvArr *src_image, IplImage *dx, IplImage *dy, float rho, float theta, int threshold, float theta_min, float theta_max, float rho_min, float rho_max, bool vertical, float gradient_angle_threshold, llcv_hough_workspace *workspace) {
+    llcv_hough_workspace local_workspace = {};
+    if(workspace == NULL) {
+      workspace = &local_workspace;
+    }
+
+    int numangle = cvRound((theta_max - theta_min) / theta);
+    float coarse_rho = rho * kHoughCoarseFactor;
+    float coarse_theta = numangle >= 2 * kHoughCoarseFactor ? theta * kHoughCoarseFactor : theta;
+
+    // Both searches vote with the same points, so collect them only once.
+    CvSize size;
+    int n_points = llcv_hough_collect_points(src_image, dx, dy, vertical, gradient_angle_threshold, workspace, &size);
+    const int16_t *points = (const int16_t *)workspace->points.data;
+
+    // stage 1. coarse search, over everything. Votes for a line that falls between coarse bins get
+    // spread over several of them, so the coarse peak may well be under threshold; the fine search decides.
+    llcv_hough_peak peak;
+    llcv_hough_find_peak(size, points, n_points, coarse_rho, coarse_theta, threshold, theta_min, theta_max, rho_min, rho_max, workspace, &peak);
+    CvLinePolar line;
+    line.rho = 0.0f;
+    line.angle = 0.0f;
+    line.is_null = true;
+    if(peak.max_val > 0) {
+      CvLinePolar coarse_line = llcv_hough_line_for_peak(&peak, coarse_rho, coarse_theta, 0, theta_min, 0.0f, 0.0f);
+
+      // stage 2. fine search, within a coarse bin of the coarse peak's angle, sticking to llcv_hough's theta grid.
+      // There's no narrowing rho, which would save little (each point votes in every rho bin either way) and
+      // would be wrong for lines far from the origin, whose rho changes a lot from one angle to the next.
+      int first_angle = MAX(0, (int)floorf((coarse_line.angle - coarse_theta - theta_min) / theta));
+      int last_angle = MIN(numangle, (int)ceilf((coarse_line.angle + coarse_theta - theta_min) / theta));
+      float fine_theta_min = theta_min + first_angle * theta;
+      float fine_theta_max = theta_min + last_angle * theta;
+      llcv_hough_find_peak(size, points, n_points, rho, theta, threshold, fine_theta_min, fine_theta_max, rho_min, rho_max, workspace, &peak);
+
+      // stage 3. sub-bin refinement, wherever the peak has neighbours on both sides. The same line's votes
+      // in the neighbouring angles land at somewhat different rhos, so compare against the best of those
+      // within as far as any line's rho can move from one angle to the next (at most (width + height) * theta).
+      float rho_offset = 0.0f;
+      float angle_offset = 0.0f;
+      if(peak.max_val > threshold) {
+        const int *at = peak.accum_origin + peak.max_n * peak.accum_step + peak.max_r;
+        if(peak.max_r > 0 && peak.max_r < peak.numrho - 1) {
+          rho_offset = llcv_parabolic_peak_offset(at[-1], at[0], at[1]);
+        }
+        if(peak.max_n > 0 && peak.max_n < peak.numangle - 1) {
+          int rho_drift = cvCeil(0.5f * peak.numrho * theta);
+          int first_dr = MAX(-rho_drift, -peak.max_r);
+          int last_dr = MIN(rho_drift, peak.numrho - 1 - peak.max_r);
+          int below = 0;
+          int above = 0;
+          for(int dr = first_dr; dr <= last_dr; dr++) {
+            below = MAX(below, at[dr - peak.accum_step]);
+            above = MAX(above, at[dr + peak.accum_step]);
+          }
+          angle_offset = llcv_parabolic_peak_offset(below, at[0], above);
+        }
+      }
+      line = llcv_hough_line_for_peak(&peak, rho, theta, threshold, fine_theta_min, rho_offset, angle_offset);
+    }
+
+    llcv_hough_workspace_release(&local_workspace);
+    return line;
+}
+
+#undef kHoughCoarseFactor
+
+#undef FIXED_POINT_EXPONENT
+#undef FIXED_POINT_MULTIPLIER
+
 #endif
@@ -3,6 +3,7 @@
 
 #include "opencv2/core/core_c.h" // for IplImage
 #include "dmz_macros.h"
+#include "image_util.h"
 
 typedef struct CvLinePolar {
     float rho;
@@ -10,6 +11,26 @@ typedef struct CvLinePolar {
     bool is_null;
 } CvLinePolar;
 
-DMZ_INTERNAL CvLinePolar llcv_hough(const CvArr *src_image, IplImage *dx, IplImage *dy, float rho, float theta, int threshold, float theta_min, float theta_max, bool vertical, float gradient_angle_threshold);
+// Memory reused across hough calls: the accumulator, the sin/cos table and the edge points.
+// Zero-initialize before first use.
+typedef struct {
+  llcv_buffer accum;
+  llcv_buffer tabs;
+  llcv_buffer points;
+} llcv_hough_workspace;
+
+DMZ_INTERNAL void llcv_hough_workspace_release(llcv_hough_workspace *workspace);
+
+// Only lines with rho_min <= rho <= rho_max are considered; pass -FLT_MAX and FLT_MAX to consider all of them.
+// workspace may be NULL, in which case the memory is allocated (and freed) by each call.
+DMZ_INTERNAL CvLinePolar llcv_hough(const CvArr *src_image, IplImage *dx, IplImage *dy, float rho, float theta, int threshold, float theta_min, float theta_max, float rho_min, float rho_max, bool vertical, float gradient_angle_threshold, llcv_hough_workspace *workspace);
+
+// As llcv_hough, but cheaper: searches at coarser rho and theta resolution first, and then at full resolution
+// only around the coarse peak. The peak is then refined to a fraction of a bin, by fitting parabolas through it
+// and its neighbours, so the line is generally not on llcv_hough's grid (and occasionally not the same line).
+DMZ_INTERNAL CvLinePolar llcv_hough_coarse_to_fine(const CvArr *src_image, IplImage *dx, IplImage *dy, float rho, float theta, int threshold, float theta_min, float theta_max, float rho_min, float rho_max, bool vertical, float gradient_angle_threshold, llcv_hough_workspace *workspace);
+
+// llcv_hough or llcv_hough_coarse_to_fine
+typedef CvLinePolar (*llcv_hough_fn)(const CvArr *src_image, IplImage *dx, IplImage *dy, float rho, float theta, int threshold, float theta_min, float theta_max, float rho_min, float rho_max, bool vertical, float gradient_angle_threshold, llcv_hough_workspace *workspace);
 
 #endif
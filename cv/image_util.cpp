@@ -36,4 +36,45 @@ DMZ_INTERNAL void* llcv_get_data_origin(IplImage *image) {
   return data_origin;
 }
 
+DMZ_INTERNAL void *llcv_buffer_reserve(llcv_buffer *buffer, size_t size) {
+  if(dmz_unlikely(size > buffer->size)) {
+    void *data = cvAlloc(size);
+    if(buffer->data != NULL) {
+      memcpy(data, buffer->data, buffer->size);
+      cvFree(&buffer->data);
+    }
+    buffer->data = data;
+    buffer->size = size;
+  }
+  return buffer->data;
+}
+
+DMZ_INTERNAL void llcv_buffer_release(llcv_buffer *buffer) {
+  if(buffer->data != NULL) {
+    cvFree(&buffer->data);
+  }
+  buffer->size = 0;
+}
+
+DMZ_INTERNAL IplImage *llcv_image_in_buffer(IplImage *header, llcv_buffer *buffer, CvSize size, int depth, int channels) {
+  cvInitImageHeader(header, size, depth, channels, IPL_ORIGIN_TL, 4 /* same row alignment as cvCreateImage */);
+  header->imageData = header->imageDataOrigin = (char *)llcv_buffer_reserve(buffer, header->imageSize);
+  return header;
+}
+
+DMZ_INTERNAL IplImage *llcv_image_view(IplImage *header, IplROI *roi, IplImage *image, CvRect rect) {
+  assert(image->roi == NULL);
+  *header = *image;
+
+  int right = MIN(rect.x + rect.width, image->width);
+  int bottom = MIN(rect.y + rect.height, image->height);
+  roi->coi = 0;
+  roi->xOffset = MAX(rect.x, 0);
+  roi->yOffset = MAX(rect.y, 0);
+  roi->width = right - roi->xOffset;
+  roi->height = bottom - roi->yOffset;
+  header->roi = roi;
+  return header;
+}
+
 #endif
\ No newline at end of file
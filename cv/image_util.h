@@ -12,4 +12,25 @@
 DMZ_INTERNAL void* llcv_get_data_origin(IplImage *image);
 DMZ_INTERNAL uint8_t llcv_get_pixel_step(IplImage *image);
 
+// A heap buffer that is kept around and reused, only growing when asked for more than it has.
+// Zero-initialize before first use; free with llcv_buffer_release.
+typedef struct {
+  void *data;
+  size_t size;
+} llcv_buffer;
+
+// Returns buffer->data, after growing it to at least size bytes if needed.
+// Existing contents are preserved when growing.
+DMZ_INTERNAL void *llcv_buffer_reserve(llcv_buffer *buffer, size_t size);
+DMZ_INTERNAL void llcv_buffer_release(llcv_buffer *buffer);
+
+// Sets up header as an image of the given size and type (laid out as by cvCreateImage), with its
+// pixels in buffer. The image is only valid until buffer is next reserved or released.
+DMZ_INTERNAL IplImage *llcv_image_in_buffer(IplImage *header, llcv_buffer *buffer, CvSize size, int depth, int channels);
+
+// Sets up header as a copy of image's header, with its ROI set to rect (clipped as by cvSetImageROI)
+// and stored in roi. The view shares image's pixels but leaves image itself untouched, so several
+// threads can work on different parts of one image. image must have no ROI.
+DMZ_INTERNAL IplImage *llcv_image_view(IplImage *header, IplROI *roi, IplImage *image, CvRect rect);
+
 #endif
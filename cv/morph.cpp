@@ -16,144 +16,10 @@
 #include <arm_neon.h>
 #endif
 
-#if DMZ_HAS_NEON_COMPILETIME
-// Morph NEON support functions
-
-static inline void vec_morph3_1d_u8_q(const uint8_t *src, uint8_t *dst) {
-  asm volatile
-  (
-   // load src pixel vectors (src - 1, src, src + 1)
-   "mov r0, %[src]" "\n\t"
-   "sub r0, r0, #1" "\n\t"
-   "vld1.8 {q0}, [r0]" "\n\t"
-   "add r0, r0, #1" "\n\t"
-   "vld1.8 {q1}, [r0]" "\n\t"
-   "add r0, r0, #1" "\n\t"
-   "vld1.8 {q2}, [r0]" "\n\t"
-
-   // pairwise max, pairwise min
-   "vmax.u8 q3, q0, q1" "\n\t"
-   "vmin.u8 q8, q0, q1" "\n\t"
-   "vmax.u8 q9, q3, q2" "\n\t"
-   "vmin.u8 q10, q8, q2" "\n\t"
-
-   // subtract
-   "vsub.u8 q11, q9, q10" "\n\t"
-
-   // write to dst
-   "mov r0, %[dst]" "\n\t"
-   "vst1.8 {q11}, [r0]" "\n\t"
-   
-   : // output
-   
-   : // input
-   [src]"r" (src),
-   [dst]"r" (dst)
-   
-   : // clobbered
-   "r0", // used for src, dst pointers
-   // skip q4-q7, since then gcc will have to save them, see http://stackoverflow.com/questions/261419/arm-to-c-calling-convention-registers-to-save
-   "q0", "q1", "q2", "q3", "q8", "q9", "q10", "q11", //
-   "memory"
-   );
-}
-
+#if DMZ_HAS_SSE2_COMPILETIME
+#include <emmintrin.h>
 #endif
 
-DMZ_INTERNAL void llcv_morph_grad3_1d_u8_neon(IplImage *src, IplImage *dst) {
-#if DMZ_HAS_NEON_COMPILETIME
-
-  uint8_t *src_data = (uint8_t *)src->imageData;
-  if(dmz_likely(NULL != src->roi)) {
-    src_data += src->roi->yOffset * src->widthStep + src->roi->xOffset * sizeof(uint8_t);
-  }
-
-  uint8_t *dst_data = (uint8_t *)dst->imageData;
-  if(dmz_unlikely(NULL != dst->roi)) {
-    dst_data += dst->roi->yOffset * dst->widthStep + dst->roi->xOffset * sizeof(uint8_t);
-  }
-
-  CvSize dst_size = cvGetSize(dst);
-
-  // Calc first output (special, due to edge effects)
-  uint16_t dst_index = 0;
-  uint8_t f0 = src_data[dst_index];
-  uint8_t f1 = src_data[dst_index + 1];  // safe b/c already asserted src width > 1
-  dst_data[0] = MAX(f0, f1) - MIN(f0, f1);
-  dst_index++;
-
-  // + 1 in the below because size 3 kernel involves dst_index - 1, dst_index, dst_index + 1 (and we can assume dst_index - 1 is available)
-  // strictly < below, because the last pixel is special
-  bool done = false;
-  while(!done) {
-     // calc using q registers
-    vec_morph3_1d_u8_q(src_data + dst_index, dst_data + dst_index);
-    dst_index += kQRegisterElements8;
-
-    if(dst_index + 1 == dst_size.width) {
-      done = true;
-    } else if(dst_index + 1 > dst_size.width - kQRegisterElements8) {
-      // backtrack to handle leftovers
-      dst_index = (uint16_t)(dst_size.width - kQRegisterElements8 - 1);
-    }
-  }
-
-  // Calc last output (special, due to edge effects)
-  uint8_t l0 = src_data[dst_index - 1];
-  uint8_t l1 = src_data[dst_index];
-  dst_data[dst_index] = MAX(l0, l1) - MIN(l0, l1);
-#endif
-}
-
-DMZ_INTERNAL void llcv_morph_grad3_1d_u8_c(IplImage *src, IplImage *dst) {
-  IplConvKernel *kernel = cvCreateStructuringElementEx(3, 3, 1, 1, CV_SHAPE_CROSS, NULL);
-  cvMorphologyEx(src, dst, NULL, kernel, CV_MOP_GRADIENT, 1);
-  cvReleaseStructuringElement(&kernel);
-}
-
-#define TEST_MORPH_NEON 0
-
-DMZ_INTERNAL void llcv_morph_grad3_1d_u8(IplImage *src, IplImage *dst) {
-  assert(src->depth == IPL_DEPTH_8U);
-  assert(dst->depth == IPL_DEPTH_8U);
-  assert(src != dst);
-  assert(src->nChannels == 1);
-  assert(dst->nChannels == 1);
-#if DMZ_DEBUG
-  CvSize src_size = cvGetSize(src);
-  CvSize dst_size = cvGetSize(dst);
-  assert(src_size.width == dst_size.width);
-  assert(src_size.height == dst_size.height);
-  assert(src_size.height == 1);  // 1d!
-  assert(src_size.width > 1); // sanity
-#endif
-  
-  if(dmz_has_neon_runtime()) {
-    llcv_morph_grad3_1d_u8_neon(src, dst);
-#if TEST_MORPH_NEON
-    IplImage *dst_c = cvCreateImage(dst_size, IPL_DEPTH_8U, 1);
-    
-    llcv_morph_grad3_1d_u8_c(src, dst_c);
-    
-    IplImage *delta = cvCreateImage(dst_size, IPL_DEPTH_8U, 1);
-    
-    cvAbsDiff(dst, dst_c, delta);
-    
-    int n_errors = cvCountNonZero(delta);
-    if(n_errors > 0) {
-      fprintf(stderr, "llcv_morph_grad3_1d_u8 errors: %i\n", n_errors);
-    }
-    
-    cvReleaseImage(&dst_c);
-    cvReleaseImage(&delta);
-#endif
-  } else {
-    llcv_morph_grad3_1d_u8_c(src, dst);
-  }
-}
-
-
-
 #define TEST_MORPH2D 0
 #define TIME_MORPH2D 0
 
@@ -174,7 +40,7 @@ DMZ_INTERNAL void llcv_morph_grad3_2d_cross_u8_opencv(IplImage *src, IplImage *d
 #define MAX5(a, b, c, d, e) MAX(a, MAX(b, MAX(c, MAX(d, e))))
 #define MIN5(a, b, c, d, e) MIN(a, MIN(b, MIN(c, MIN(d, e))))
 
-DMZ_INTERNAL void llcv_morph_grad3_2d_cross_u8_c_neon(IplImage *src, IplImage *dst) {
+DMZ_INTERNAL void llcv_morph_grad3_2d_cross_u8_c_neon(IplImage *src, IplImage *dst, bool use_vector_unit) {
 #define kMorphGrad3Cross2DVectorSize 16
 
   CvSize src_size = cvGetSize(src);
@@ -185,7 +51,6 @@ DMZ_INTERNAL void llcv_morph_grad3_2d_cross_u8_c_neon(IplImage *src, IplImage *d
   
   uint8_t *dst_data_origin = (uint8_t *)llcv_get_data_origin(dst);
   uint16_t dst_width_step = (uint16_t)dst->widthStep;
-  bool can_use_neon = dmz_has_neon_runtime();
   
   for(uint16_t row_index = 0; row_index < src_size.height; row_index++) {
     uint16_t row1_index = row_index == 0 ? row_index : row_index - 1;
@@ -204,7 +69,7 @@ DMZ_INTERNAL void llcv_morph_grad3_2d_cross_u8_c_neon(IplImage *src, IplImage *d
       uint16_t last_col_index = (uint16_t)(src_size.width - 1);
       bool is_last_col = col_index == last_col_index;
       bool can_process_next_chunk_as_vector = col_index + kMorphGrad3Cross2DVectorSize < last_col_index;
-      if(is_first_col || is_last_col || !can_use_neon || !can_process_next_chunk_as_vector) {
+      if(is_first_col || is_last_col || !use_vector_unit || !can_process_next_chunk_as_vector) {
         // scalar step
         uint16_t col1_index = is_first_col ? col_index : col_index - 1;
         uint16_t col2_index = col_index;
@@ -247,6 +112,17 @@ DMZ_INTERNAL void llcv_morph_grad3_2d_cross_u8_c_neon(IplImage *src, IplImage *d
         dst_row_origin[col_index + 14] = vgetq_lane_u8(grad_vec, 14);
         dst_row_origin[col_index + 15] = vgetq_lane_u8(grad_vec, 15);
         col_index += kMorphGrad3Cross2DVectorSize;
+#elif DMZ_HAS_SSE2_COMPILETIME
+        // north, east, center, west, south
+        __m128i n = _mm_loadu_si128((const __m128i *)(src_row1_origin + col_index));
+        __m128i w = _mm_loadu_si128((const __m128i *)(src_row2_origin + col_index - 1));
+        __m128i c = _mm_loadu_si128((const __m128i *)(src_row2_origin + col_index));
+        __m128i e = _mm_loadu_si128((const __m128i *)(src_row2_origin + col_index + 1));
+        __m128i s = _mm_loadu_si128((const __m128i *)(src_row3_origin + col_index));
+        __m128i max_vec = _mm_max_epu8(n, _mm_max_epu8(w, _mm_max_epu8(c, _mm_max_epu8(e, s))));
+        __m128i min_vec = _mm_min_epu8(n, _mm_min_epu8(w, _mm_min_epu8(c, _mm_min_epu8(e, s))));
+        _mm_storeu_si128((__m128i *)(dst_row_origin + col_index), _mm_sub_epi8(max_vec, min_vec));
+        col_index += kMorphGrad3Cross2DVectorSize;
 #endif
       }
     }
@@ -254,6 +130,15 @@ DMZ_INTERNAL void llcv_morph_grad3_2d_cross_u8_c_neon(IplImage *src, IplImage *d
 #undef kMorphGrad3Cross2DVectorSize
 }
 
+DMZ_INTERNAL void llcv_morph_grad3_2d_cross_u8_c(IplImage *src, IplImage *dst) {
+  llcv_morph_grad3_2d_cross_u8_c_neon(src, dst, false);
+}
+
+// NEON or SSE2, whichever was compiled in
+DMZ_INTERNAL void llcv_morph_grad3_2d_cross_u8_vectorized(IplImage *src, IplImage *dst) {
+  llcv_morph_grad3_2d_cross_u8_c_neon(src, dst, true);
+}
+
 DMZ_INTERNAL void llcv_morph_grad3_2d_cross_u8(IplImage *src, IplImage *dst) {
 #if DMZ_DEBUG
   assert(src->nChannels == 1);
@@ -275,7 +160,7 @@ DMZ_INTERNAL void llcv_morph_grad3_2d_cross_u8(IplImage *src, IplImage *dst) {
   for(int iter = 0; iter < TIME_MORPH2D_TIMING_ITERATIONS; iter++) {
 #endif
     
-    llcv_morph_grad3_2d_cross_u8_c_neon(src, dst);
+    dmz_kernels()->morph_grad3_2d_cross_u8(src, dst);
     
 #if TIME_MORPH2D
   }
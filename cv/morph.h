@@ -9,7 +9,6 @@
 #include "opencv2/imgproc/imgproc_c.h"
 #include "dmz_macros.h"
 
-DMZ_INTERNAL void llcv_morph_grad3_1d_u8(IplImage *src, IplImage *dst);
 DMZ_INTERNAL void llcv_morph_grad3_2d_cross_u8(IplImage *src, IplImage *dst);
 
 #endif
@@ -4,14 +4,27 @@
 #if COMPILE_DMZ
 
 #include "sobel.h"
+#include "canny.h"
 #include "processor_support.h"
 #include "image_util.h"
 #include "eigen.h"
 #include "dmz_debug.h"
 
-#if DMZ_HAS_NEON_COMPILETIME
+#if DMZ_HAS_SSE2_COMPILETIME
+#include <emmintrin.h>
+#endif
+#if DMZ_HAS_AVX2_COMPILETIME
+#include <immintrin.h>
+#endif
 
+#if DMZ_HAS_NEON_COMPILETIME
 #include <arm_neon.h>
+#endif
+
+// llcv_sobel7, and the NEON transposing convolution behind it, are only built as the reference for this test.
+#define TEST_SOBEL7_DX_DY 0
+
+#if DMZ_HAS_NEON_COMPILETIME && TEST_SOBEL7_DX_DY
 
 static inline void convolve_eight_pixels_u8(const uint8_t *source_pixels, size_t source_stride, int16_t *dest_pixel, size_t dest_stride, const int16_t *kernel) {
   asm volatile
@@ -469,11 +482,140 @@ DMZ_INTERNAL void vectorized_convolve_transpose7(IplImage *image, IplImage *dest
 #undef kEndBorderSize
 }
 
-#endif // DMZ_HAS_NEON_COMPILETIME
+#endif // DMZ_HAS_NEON_COMPILETIME && TEST_SOBEL7_DX_DY
+
+#pragma mark sobel7 rows
+
+// Row kernels for llcv_sobel7_dx_dy, below: the source rows go through a vertical pass, exact in int16,
+// since no partial sum of 7 uint8 pixels can overflow for these kernels; the result is then padded
+// by the border size on each side for the horizontal pass, which accumulates in int32 and saturates
+// on the way back to int16.
+
+#define kSobel7KernelSize 7
+#define kSobel7BorderSize 3
+
+// Returns the sum of abs(dst), saturated like dst itself, as cvSum(cvAbs(dst)) would.
+typedef uint32_t (*sobel7_horizontal_fn)(const int16_t *src, const int16_t *kernel, int16_t *dst, uint16_t width);
+
+static const int16_t sobel7_edge_kernel[kSobel7KernelSize] = {-1, -4, -5, 0, 5, 4, 1};
+static const int16_t sobel7_smooth_kernel[kSobel7KernelSize] = {1, 6, 15, 20, 15, 6, 1};
+
+// src is a padded row: src[0] corresponds to column -kSobel7BorderSize.
+static inline uint32_t sobel7_horizontal_c(const int16_t *src, const int16_t *kernel, int16_t *dst, uint16_t start_col, uint16_t width) {
+  uint32_t abs_sum = 0;
+  for(uint16_t col_index = start_col; col_index < width; col_index++) {
+    int32_t sum = 0;
+    for(uint8_t k = 0; k < kSobel7KernelSize; k++) {
+      sum += kernel[k] * src[col_index + k];
+    }
+    dst[col_index] = (int16_t)(sum < INT16_MIN ? INT16_MIN : (sum > INT16_MAX ? INT16_MAX : sum));
+    abs_sum += MIN(abs(sum), INT16_MAX);
+  }
+  return abs_sum;
+}
+
+#if DMZ_HAS_SSE2_COMPILETIME
+
+DMZ_INTERNAL uint32_t sobel7_horizontal_row_sse2(const int16_t *src, const int16_t *kernel, int16_t *dst, uint16_t width) {
+#define kVectorSize 8
+  // Pair up taps k and 6 - k, so that each _mm_madd_epi16 does two of them at once, in int32.
+  __m128i k06 = _mm_set_epi16(kernel[6], kernel[0], kernel[6], kernel[0], kernel[6], kernel[0], kernel[6], kernel[0]);
+  __m128i k15 = _mm_set_epi16(kernel[5], kernel[1], kernel[5], kernel[1], kernel[5], kernel[1], kernel[5], kernel[1]);
+  __m128i k24 = _mm_set_epi16(kernel[4], kernel[2], kernel[4], kernel[2], kernel[4], kernel[2], kernel[4], kernel[2]);
+  __m128i k3 = _mm_set_epi16(0, kernel[3], 0, kernel[3], 0, kernel[3], 0, kernel[3]);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+  __m128i abs_sums = zero;
+
+  uint16_t col_index = 0;
+  for(; col_index + kVectorSize <= width; col_index += kVectorSize) {
+    const int16_t *s = src + col_index;
+    __m128i p0 = _mm_loadu_si128((const __m128i *)(s + 0));
+    __m128i p1 = _mm_loadu_si128((const __m128i *)(s + 1));
+    __m128i p2 = _mm_loadu_si128((const __m128i *)(s + 2));
+    __m128i p3 = _mm_loadu_si128((const __m128i *)(s + 3));
+    __m128i p4 = _mm_loadu_si128((const __m128i *)(s + 4));
+    __m128i p5 = _mm_loadu_si128((const __m128i *)(s + 5));
+    __m128i p6 = _mm_loadu_si128((const __m128i *)(s + 6));
+
+    __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(p0, p6), k06);
+    lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(p1, p5), k15));
+    lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(p2, p4), k24));
+    lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(p3, zero), k3));
+
+    __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(p0, p6), k06);
+    hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(p1, p5), k15));
+    hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(p2, p4), k24));
+    hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(p3, zero), k3));
+
+    __m128i result = _mm_packs_epi32(lo, hi);
+    _mm_storeu_si128((__m128i *)(dst + col_index), result);
+    // max(x, -x), with -(-32768) saturating to 32767
+    __m128i abs_result = _mm_max_epi16(result, _mm_subs_epi16(zero, result));
+    abs_sums = _mm_add_epi32(abs_sums, _mm_madd_epi16(abs_result, ones));
+  }
+  abs_sums = _mm_add_epi32(abs_sums, _mm_shuffle_epi32(abs_sums, _MM_SHUFFLE(1, 0, 3, 2)));
+  abs_sums = _mm_add_epi32(abs_sums, _mm_shuffle_epi32(abs_sums, _MM_SHUFFLE(2, 3, 0, 1)));
+  return (uint32_t)_mm_cvtsi128_si32(abs_sums) + sobel7_horizontal_c(src, kernel, dst, col_index, width);
+#undef kVectorSize
+}
+
+#if DMZ_HAS_AVX2_COMPILETIME
+
+DMZ_INTERNAL DMZ_TARGET_AVX2 uint32_t sobel7_horizontal_row_avx2(const int16_t *src, const int16_t *kernel, int16_t *dst, uint16_t width) {
+#define kVectorSize 16
+  // Same tap pairing as the SSE2 version. unpacklo/unpackhi/packs all work within 128-bit lanes,
+  // so the lane interleaving they introduce cancels out.
+  __m256i k06 = _mm256_set1_epi32((int32_t)(((uint32_t)(uint16_t)kernel[6] << 16) | (uint16_t)kernel[0]));
+  __m256i k15 = _mm256_set1_epi32((int32_t)(((uint32_t)(uint16_t)kernel[5] << 16) | (uint16_t)kernel[1]));
+  __m256i k24 = _mm256_set1_epi32((int32_t)(((uint32_t)(uint16_t)kernel[4] << 16) | (uint16_t)kernel[2]));
+  __m256i k3 = _mm256_set1_epi32((int32_t)(uint16_t)kernel[3]);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi16(1);
+  __m256i abs_sums = zero;
+
+  uint16_t col_index = 0;
+  for(; col_index + kVectorSize <= width; col_index += kVectorSize) {
+    const int16_t *s = src + col_index;
+    __m256i p0 = _mm256_loadu_si256((const __m256i *)(s + 0));
+    __m256i p1 = _mm256_loadu_si256((const __m256i *)(s + 1));
+    __m256i p2 = _mm256_loadu_si256((const __m256i *)(s + 2));
+    __m256i p3 = _mm256_loadu_si256((const __m256i *)(s + 3));
+    __m256i p4 = _mm256_loadu_si256((const __m256i *)(s + 4));
+    __m256i p5 = _mm256_loadu_si256((const __m256i *)(s + 5));
+    __m256i p6 = _mm256_loadu_si256((const __m256i *)(s + 6));
+
+    __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(p0, p6), k06);
+    lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(p1, p5), k15));
+    lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(p2, p4), k24));
+    lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(p3, zero), k3));
+
+    __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(p0, p6), k06);
+    hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(p1, p5), k15));
+    hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(p2, p4), k24));
+    hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(p3, zero), k3));
+
+    __m256i result = _mm256_packs_epi32(lo, hi);
+    _mm256_storeu_si256((__m256i *)(dst + col_index), result);
+    __m256i abs_result = _mm256_max_epi16(result, _mm256_subs_epi16(zero, result));
+    abs_sums = _mm256_add_epi32(abs_sums, _mm256_madd_epi16(abs_result, ones));
+  }
+  __m128i abs_sums128 = _mm_add_epi32(_mm256_castsi256_si128(abs_sums), _mm256_extracti128_si256(abs_sums, 1));
+  abs_sums128 = _mm_add_epi32(abs_sums128, _mm_shuffle_epi32(abs_sums128, _MM_SHUFFLE(1, 0, 3, 2)));
+  abs_sums128 = _mm_add_epi32(abs_sums128, _mm_shuffle_epi32(abs_sums128, _MM_SHUFFLE(2, 3, 0, 1)));
+  return (uint32_t)_mm_cvtsi128_si32(abs_sums128) + sobel7_horizontal_c(src, kernel, dst, col_index, width);
+#undef kVectorSize
+}
+
+#endif // DMZ_HAS_AVX2_COMPILETIME
+
+#endif // DMZ_HAS_SSE2_COMPILETIME
+
+#if TEST_SOBEL7_DX_DY
 
 #pragma mark llcv_sobel7_c
 
-DMZ_INTERNAL void llcv_sobel7_c(IplImage *src, IplImage *dst, bool dx, bool dy) {
+DMZ_INTERNAL void llcv_sobel7_c(IplImage *src, IplImage *dst, IplImage *scratch, bool dx, bool dy) {
   cvSobel(src, dst, !!dx, !!dy, 7); // !! to ensure 0/1-ness of dx, dy
 }
 
@@ -484,6 +626,20 @@ DMZ_INTERNAL void llcv_sobel7_neon(IplImage *src, IplImage *dst, IplImage *scrat
   int16_t edge_kernel[7] = {-1, -4, -5, 0, 5, 4, 1};
   int16_t smooth_kernel[7] = {1, 6, 15, 20, 15, 6, 1};
 
+  bool scratch_provided = scratch != NULL;
+  CvSize src_size = cvGetSize(src);
+  if(scratch_provided) {
+    CvSize scratch_size = cvGetSize(scratch);
+    (void)scratch_size; // only used in asserts
+    assert(scratch->nChannels == 1);
+    assert(scratch->depth == IPL_DEPTH_16S);
+    assert(scratch_size.width == src_size.height);
+    assert(scratch_size.height == src_size.width);
+  }
+  if(!scratch_provided) {
+    scratch = cvCreateImage(cvSize(src_size.height, src_size.width), IPL_DEPTH_16S, 1);
+  }
+
   if(dx) {
     vectorized_convolve_transpose7(src, scratch, edge_kernel);
     vectorized_convolve_transpose7(scratch, dst, smooth_kernel);
@@ -492,11 +648,17 @@ DMZ_INTERNAL void llcv_sobel7_neon(IplImage *src, IplImage *dst, IplImage *scrat
     vectorized_convolve_transpose7(src, scratch, smooth_kernel);
     vectorized_convolve_transpose7(scratch, dst, edge_kernel);
   } 
+
+  if(!scratch_provided) {
+    cvReleaseImage(&scratch);
+  }
 #endif
 }
 
 #pragma mark llcv_sobel7
 
+// One gradient at a time, through the transposed scratch image on NEON. Nothing outside the tests
+// needs this anymore, llcv_sobel7_dx_dy being the faster way to get both; it stays as their reference.
 DMZ_INTERNAL void llcv_sobel7(IplImage *src, IplImage *dst, IplImage *scratch, bool dx, bool dy) {
   assert(src != NULL);
   assert(dst != NULL);
@@ -506,29 +668,312 @@ DMZ_INTERNAL void llcv_sobel7(IplImage *src, IplImage *dst, IplImage *scratch, b
   assert(dst->nChannels == 1);
   assert(dst->depth == IPL_DEPTH_16S);
 
-  if(dmz_has_neon_runtime()) {
-    bool scratch_provided = scratch != NULL;
-    CvSize src_size = cvGetSize(src);
-    if(scratch_provided) {
-      CvSize scratch_size = cvGetSize(scratch);
-#pragma unused(scratch_size) // work around broken compiler warnings
-      assert(scratch->nChannels == 1);
-      assert(scratch->depth == IPL_DEPTH_16S);
-      assert(scratch_size.width == src_size.height);
-      assert(scratch_size.height == src_size.width);
+  if(dmz_kernels()->isa == DMZ_ISA_NEON) {
+    llcv_sobel7_neon(src, dst, scratch, dx, dy);
+  } else {
+    llcv_sobel7_c(src, dst, scratch, dx, dy);
+  }
+}
+#endif // TEST_SOBEL7_DX_DY
+
+
+#pragma mark llcv_sobel7_dx_dy
+
+// Both gradients in one sweep down the rows. For each row, the 7 source rows are read once, for both
+// vertical passes (smooth for dx, edge for dy); each horizontal pass then reads back just one padded
+// int16 row, which is still in L1. No transposed scratch image, and no full-size intermediates.
+// The horizontal passes also add up abs(dx) + abs(dy) as they go, for llcv_adaptive_canny7_precomputed_sobel.
+// The vertical passes use the kernels' symmetry, which is still exact in int16.
+
+typedef void (*sobel7_dx_dy_vertical_fn)(const uint8_t **src_rows, int16_t *smooth_dst, int16_t *edge_dst, uint16_t width);
+
+static inline void sobel7_dx_dy_vertical_c(const uint8_t **src_rows, int16_t *smooth_dst, int16_t *edge_dst, uint16_t start_col, uint16_t width) {
+  for(uint16_t col_index = start_col; col_index < width; col_index++) {
+    int16_t smooth_sum = 0;
+    int16_t edge_sum = 0;
+    for(uint8_t k = 0; k < kSobel7KernelSize; k++) {
+      smooth_sum += sobel7_smooth_kernel[k] * src_rows[k][col_index];
+      edge_sum += sobel7_edge_kernel[k] * src_rows[k][col_index];
+    }
+    smooth_dst[col_index] = smooth_sum;
+    edge_dst[col_index] = edge_sum;
+  }
+}
+
+#if DMZ_HAS_NEON_COMPILETIME || DMZ_HAS_SSE2_COMPILETIME
+
+// If within_roi, the edge pixels of the ROI are replicated, as by vectorized_convolve_transpose7 (so the
+// results are bit-exact with llcv_sobel7_neon). Otherwise, as cvSobel does, the pixels beyond the ROI
+// are read where the image has them, and only the edge pixels of the whole image are replicated
+// (so the results are bit-exact with llcv_sobel7_dx_dy_c).
+DMZ_INTERNAL void llcv_sobel7_dx_dy_rows(IplImage *src, IplImage *dx, IplImage *dy, double *abs_sum, llcv_buffer *rows, bool within_roi, sobel7_dx_dy_vertical_fn vertical, sobel7_horizontal_fn horizontal) {
+  CvSize src_size = cvGetSize(src);
+  assert(src_size.width > kSobel7KernelSize);
+
+  const uint8_t *src_data_origin = (const uint8_t *)llcv_get_data_origin(src);
+  uint16_t src_width_step = (uint16_t)src->widthStep;
+
+  uint8_t *dx_data_origin = (uint8_t *)llcv_get_data_origin(dx);
+  uint16_t dx_width_step = (uint16_t)dx->widthStep;
+  uint8_t *dy_data_origin = (uint8_t *)llcv_get_data_origin(dy);
+  uint16_t dy_width_step = (uint16_t)dy->widthStep;
+
+  uint16_t width = (uint16_t)src_size.width;
+  uint16_t padded_width = width + 2 * kSobel7BorderSize;
+  int16_t *smooth_padded_row = (int16_t *)llcv_buffer_reserve(rows, 2 * padded_width * sizeof(int16_t));
+  int16_t *edge_padded_row = smooth_padded_row + padded_width;
+  int16_t *smooth_row = smooth_padded_row + kSobel7BorderSize;
+  int16_t *edge_row = edge_padded_row + kSobel7BorderSize;
+  int64_t total_abs_sum = 0;
+
+  // The source rows and columns that can be read, relative to the ROI
+  int first_row_index = 0;
+  int last_row_index = src_size.height - 1;
+  uint16_t left_cols = 0;
+  uint16_t right_cols = 0;
+  if(!within_roi && src->roi != NULL) {
+    first_row_index = -src->roi->yOffset;
+    last_row_index = src->height - 1 - src->roi->yOffset;
+    left_cols = (uint16_t)MIN(src->roi->xOffset, kSobel7BorderSize);
+    right_cols = (uint16_t)MIN(src->width - src->roi->xOffset - width, kSobel7BorderSize);
+  }
+
+  for(int row_index = 0; row_index < src_size.height; row_index++) {
+    const uint8_t *src_rows[kSobel7KernelSize];
+    for(int k = 0; k < kSobel7KernelSize; k++) {
+      int src_row_index = row_index + k - kSobel7BorderSize;
+      src_row_index = src_row_index < first_row_index ? first_row_index : (src_row_index > last_row_index ? last_row_index : src_row_index);
+      src_rows[k] = src_data_origin + src_row_index * src_width_step - left_cols;
     }
-    if(!scratch_provided) {
-      scratch = cvCreateImage(cvSize(src_size.height, src_size.width), IPL_DEPTH_16S, 1);
+
+    vertical(src_rows, smooth_row - left_cols, edge_row - left_cols, width + left_cols + right_cols);
+
+    for(int k = left_cols; k < kSobel7BorderSize; k++) {
+      smooth_row[-k - 1] = smooth_row[-left_cols];
+      edge_row[-k - 1] = edge_row[-left_cols];
     }
-    llcv_sobel7_neon(src, dst, scratch, dx, dy);
-    if(!scratch_provided) {
-      cvReleaseImage(&scratch);
+    for(int k = right_cols; k < kSobel7BorderSize; k++) {
+      smooth_row[width + k] = smooth_row[width + right_cols - 1];
+      edge_row[width + k] = edge_row[width + right_cols - 1];
+    }
+
+    total_abs_sum += horizontal(smooth_padded_row, sobel7_edge_kernel, (int16_t *)(dx_data_origin + row_index * dx_width_step), width);
+    total_abs_sum += horizontal(edge_padded_row, sobel7_smooth_kernel, (int16_t *)(dy_data_origin + row_index * dy_width_step), width);
+  }
+
+  if(abs_sum != NULL) {
+    *abs_sum = (double)total_abs_sum;
+  }
+}
+
+#endif // DMZ_HAS_NEON_COMPILETIME || DMZ_HAS_SSE2_COMPILETIME
+
+#if DMZ_HAS_NEON_COMPILETIME
+
+DMZ_INTERNAL void sobel7_dx_dy_vertical_row_neon(const uint8_t **src_rows, int16_t *smooth_dst, int16_t *edge_dst, uint16_t width) {
+#define kVectorSize 8
+  uint16_t col_index = 0;
+  for(; col_index + kVectorSize <= width; col_index += kVectorSize) {
+    int16x8_t p0 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(src_rows[0] + col_index)));
+    int16x8_t p1 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(src_rows[1] + col_index)));
+    int16x8_t p2 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(src_rows[2] + col_index)));
+    int16x8_t p3 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(src_rows[3] + col_index)));
+    int16x8_t p4 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(src_rows[4] + col_index)));
+    int16x8_t p5 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(src_rows[5] + col_index)));
+    int16x8_t p6 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(src_rows[6] + col_index)));
+
+    int16x8_t smooth = vaddq_s16(p0, p6);
+    smooth = vmlaq_n_s16(smooth, vaddq_s16(p1, p5), 6);
+    smooth = vmlaq_n_s16(smooth, vaddq_s16(p2, p4), 15);
+    smooth = vmlaq_n_s16(smooth, p3, 20);
+
+    int16x8_t edge = vsubq_s16(p6, p0);
+    edge = vmlaq_n_s16(edge, vsubq_s16(p5, p1), 4);
+    edge = vmlaq_n_s16(edge, vsubq_s16(p4, p2), 5);
+
+    vst1q_s16(smooth_dst + col_index, smooth);
+    vst1q_s16(edge_dst + col_index, edge);
+  }
+  sobel7_dx_dy_vertical_c(src_rows, smooth_dst, edge_dst, col_index, width);
+#undef kVectorSize
+}
+
+DMZ_INTERNAL uint32_t sobel7_horizontal_row_neon(const int16_t *src, const int16_t *kernel, int16_t *dst, uint16_t width) {
+#define kVectorSize 8
+  uint32x4_t abs_sums = vdupq_n_u32(0);
+  uint16_t col_index = 0;
+  for(; col_index + kVectorSize <= width; col_index += kVectorSize) {
+    const int16_t *s = src + col_index;
+    int32x4_t lo = vdupq_n_s32(0);
+    int32x4_t hi = vdupq_n_s32(0);
+    for(uint8_t k = 0; k < kSobel7KernelSize; k++) {
+      int16x8_t pixels = vld1q_s16(s + k);
+      lo = vmlal_n_s16(lo, vget_low_s16(pixels), kernel[k]);
+      hi = vmlal_n_s16(hi, vget_high_s16(pixels), kernel[k]);
+    }
+    int16x8_t result = vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi));
+    vst1q_s16(dst + col_index, result);
+    abs_sums = vpadalq_u16(abs_sums, vreinterpretq_u16_s16(vqabsq_s16(result)));
+  }
+  uint64x2_t abs_sums64 = vpaddlq_u32(abs_sums);
+  uint32_t abs_sum = (uint32_t)(vgetq_lane_u64(abs_sums64, 0) + vgetq_lane_u64(abs_sums64, 1));
+  return abs_sum + sobel7_horizontal_c(src, kernel, dst, col_index, width);
+#undef kVectorSize
+}
+
+#endif // DMZ_HAS_NEON_COMPILETIME
+
+#if DMZ_HAS_SSE2_COMPILETIME
+
+DMZ_INTERNAL void sobel7_dx_dy_vertical_row_sse2(const uint8_t **src_rows, int16_t *smooth_dst, int16_t *edge_dst, uint16_t width) {
+#define kVectorSize 8
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i six = _mm_set1_epi16(6);
+  const __m128i fifteen = _mm_set1_epi16(15);
+  const __m128i twenty = _mm_set1_epi16(20);
+  const __m128i four = _mm_set1_epi16(4);
+  const __m128i five = _mm_set1_epi16(5);
+  uint16_t col_index = 0;
+  for(; col_index + kVectorSize <= width; col_index += kVectorSize) {
+    __m128i p0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src_rows[0] + col_index)), zero);
+    __m128i p1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src_rows[1] + col_index)), zero);
+    __m128i p2 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src_rows[2] + col_index)), zero);
+    __m128i p3 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src_rows[3] + col_index)), zero);
+    __m128i p4 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src_rows[4] + col_index)), zero);
+    __m128i p5 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src_rows[5] + col_index)), zero);
+    __m128i p6 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src_rows[6] + col_index)), zero);
+
+    __m128i smooth = _mm_add_epi16(p0, p6);
+    smooth = _mm_add_epi16(smooth, _mm_mullo_epi16(_mm_add_epi16(p1, p5), six));
+    smooth = _mm_add_epi16(smooth, _mm_mullo_epi16(_mm_add_epi16(p2, p4), fifteen));
+    smooth = _mm_add_epi16(smooth, _mm_mullo_epi16(p3, twenty));
+
+    __m128i edge = _mm_sub_epi16(p6, p0);
+    edge = _mm_add_epi16(edge, _mm_mullo_epi16(_mm_sub_epi16(p5, p1), four));
+    edge = _mm_add_epi16(edge, _mm_mullo_epi16(_mm_sub_epi16(p4, p2), five));
+
+    _mm_storeu_si128((__m128i *)(smooth_dst + col_index), smooth);
+    _mm_storeu_si128((__m128i *)(edge_dst + col_index), edge);
+  }
+  sobel7_dx_dy_vertical_c(src_rows, smooth_dst, edge_dst, col_index, width);
+#undef kVectorSize
+}
+
+#if DMZ_HAS_AVX2_COMPILETIME
+
+DMZ_INTERNAL DMZ_TARGET_AVX2 void sobel7_dx_dy_vertical_row_avx2(const uint8_t **src_rows, int16_t *smooth_dst, int16_t *edge_dst, uint16_t width) {
+#define kVectorSize 16
+  const __m256i six = _mm256_set1_epi16(6);
+  const __m256i fifteen = _mm256_set1_epi16(15);
+  const __m256i twenty = _mm256_set1_epi16(20);
+  const __m256i four = _mm256_set1_epi16(4);
+  const __m256i five = _mm256_set1_epi16(5);
+  uint16_t col_index = 0;
+  for(; col_index + kVectorSize <= width; col_index += kVectorSize) {
+    __m256i p0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src_rows[0] + col_index)));
+    __m256i p1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src_rows[1] + col_index)));
+    __m256i p2 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src_rows[2] + col_index)));
+    __m256i p3 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src_rows[3] + col_index)));
+    __m256i p4 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src_rows[4] + col_index)));
+    __m256i p5 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src_rows[5] + col_index)));
+    __m256i p6 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src_rows[6] + col_index)));
+
+    __m256i smooth = _mm256_add_epi16(p0, p6);
+    smooth = _mm256_add_epi16(smooth, _mm256_mullo_epi16(_mm256_add_epi16(p1, p5), six));
+    smooth = _mm256_add_epi16(smooth, _mm256_mullo_epi16(_mm256_add_epi16(p2, p4), fifteen));
+    smooth = _mm256_add_epi16(smooth, _mm256_mullo_epi16(p3, twenty));
+
+    __m256i edge = _mm256_sub_epi16(p6, p0);
+    edge = _mm256_add_epi16(edge, _mm256_mullo_epi16(_mm256_sub_epi16(p5, p1), four));
+    edge = _mm256_add_epi16(edge, _mm256_mullo_epi16(_mm256_sub_epi16(p4, p2), five));
+
+    _mm256_storeu_si256((__m256i *)(smooth_dst + col_index), smooth);
+    _mm256_storeu_si256((__m256i *)(edge_dst + col_index), edge);
+  }
+  sobel7_dx_dy_vertical_c(src_rows, smooth_dst, edge_dst, col_index, width);
+#undef kVectorSize
+}
+
+#endif // DMZ_HAS_AVX2_COMPILETIME
+
+#endif // DMZ_HAS_SSE2_COMPILETIME
+
+DMZ_INTERNAL void llcv_sobel7_dx_dy_neon(IplImage *src, IplImage *dx, IplImage *dy, double *abs_sum, llcv_buffer *rows) {
+#if DMZ_HAS_NEON_COMPILETIME
+  llcv_sobel7_dx_dy_rows(src, dx, dy, abs_sum, rows, true, sobel7_dx_dy_vertical_row_neon, sobel7_horizontal_row_neon);
+#endif
+}
+
+DMZ_INTERNAL void llcv_sobel7_dx_dy_sse2(IplImage *src, IplImage *dx, IplImage *dy, double *abs_sum, llcv_buffer *rows) {
+#if DMZ_HAS_SSE2_COMPILETIME
+  llcv_sobel7_dx_dy_rows(src, dx, dy, abs_sum, rows, false, sobel7_dx_dy_vertical_row_sse2, sobel7_horizontal_row_sse2);
+#endif
+}
+
+DMZ_INTERNAL void llcv_sobel7_dx_dy_avx2(IplImage *src, IplImage *dx, IplImage *dy, double *abs_sum, llcv_buffer *rows) {
+#if DMZ_HAS_AVX2_COMPILETIME
+  llcv_sobel7_dx_dy_rows(src, dx, dy, abs_sum, rows, false, sobel7_dx_dy_vertical_row_avx2, sobel7_horizontal_row_avx2);
+#endif
+}
+
+// cvSobel doesn't stop at the ROI: near its edges, it reads whatever pixels lie beyond it. The x86 row
+// kernels do the same, and match it exactly; the NEON ones replicate the ROI's edge pixels instead,
+// as llcv_sobel7_neon always has.
+DMZ_INTERNAL void llcv_sobel7_dx_dy_c(IplImage *src, IplImage *dx, IplImage *dy, double *abs_sum, llcv_buffer *rows) {
+  cvSobel(src, dx, 1, 0, 7);
+  cvSobel(src, dy, 0, 1, 7);
+  if(abs_sum != NULL) {
+    *abs_sum = sum_abs_magnitude(dx) + sum_abs_magnitude(dy);
+  }
+}
+
+DMZ_INTERNAL void llcv_sobel7_dx_dy(IplImage *src, IplImage *dx, IplImage *dy, double *abs_sum, llcv_buffer *rows) {
+  assert(src != NULL);
+  assert(dx != NULL);
+  assert(dy != NULL);
+  assert(src->nChannels == 1);
+  assert(src->depth == IPL_DEPTH_8U);
+  assert(dx->nChannels == 1);
+  assert(dx->depth == IPL_DEPTH_16S);
+  assert(dy->nChannels == 1);
+  assert(dy->depth == IPL_DEPTH_16S);
+
+  llcv_buffer local_rows = {};
+  if(rows == NULL) {
+    rows = &local_rows;
+  }
+
+  const dmz_kernel_table *kernels = dmz_kernels();
+  kernels->sobel7_dx_dy(src, dx, dy, abs_sum, rows);
+
+#if TEST_SOBEL7_DX_DY
+  CvSize dst_size = cvGetSize(dx);
+  IplImage *reference_dst = cvCreateImage(dst_size, IPL_DEPTH_16S, 1);
+  IplImage *delta = cvCreateImage(dst_size, IPL_DEPTH_16S, 1);
+  for(int gradient = 0; gradient < 2; gradient++) {
+    llcv_sobel7(src, reference_dst, NULL, gradient == 0, gradient == 1);
+    cvSub(gradient == 0 ? dx : dy, reference_dst, delta);
+    int n_errors = cvCountNonZero(delta);
+    if(n_errors > 0) {
+      dmz_debug_log("llcv_sobel7_dx_dy %s errors: %i", gradient == 0 ? "dx" : "dy", n_errors);
     }
-  } else {
-    llcv_sobel7_c(src, dst, dx, dy);
   }
+  if(abs_sum != NULL) {
+    double reference_abs_sum = sum_abs_magnitude(dx) + sum_abs_magnitude(dy);
+    if(*abs_sum != reference_abs_sum) {
+      dmz_debug_log("llcv_sobel7_dx_dy abs_sum %f, should be %f", *abs_sum, reference_abs_sum);
+    }
+  }
+  cvReleaseImage(&delta);
+  cvReleaseImage(&reference_dst);
+#endif
+
+  llcv_buffer_release(&local_rows);
 }
 
+#undef kSobel7KernelSize
+#undef kSobel7BorderSize
+
 
 #define TEST_SOBEL3 0
 #define TIME_SOBEL3 0
@@ -553,7 +998,7 @@ DMZ_INTERNAL void llcv_sobel3_dx_dy_opencv(IplImage *src, IplImage *dst) {
 //  1,  0, -1
 //  0,  0,  0
 // -1,  0,  1
-DMZ_INTERNAL void llcv_sobel3_dx_dy_c_neon(IplImage *src, IplImage *dst) {
+DMZ_INTERNAL void llcv_sobel3_dx_dy_c_neon(IplImage *src, IplImage *dst, bool use_vector_unit) {
 #define kSobel3VectorSize 8
 
   CvSize src_size = cvGetSize(src);
@@ -566,7 +1011,9 @@ DMZ_INTERNAL void llcv_sobel3_dx_dy_c_neon(IplImage *src, IplImage *dst) {
   uint16_t dst_width_step = (uint16_t)dst->widthStep;
 
   uint16_t last_col_index = (uint16_t)(src_size.width - 1);
-  bool can_use_neon = dmz_has_neon_runtime();
+#if DMZ_HAS_SSE2_COMPILETIME
+  const __m128i zero = _mm_setzero_si128();
+#endif
   
   for(uint16_t row_index = 0; row_index < src_size.height; row_index++) {
     uint16_t row1_index = row_index == 0 ? 0 : row_index - 1;
@@ -583,7 +1030,7 @@ DMZ_INTERNAL void llcv_sobel3_dx_dy_c_neon(IplImage *src, IplImage *dst) {
       bool is_first_col = col_index == 0;
       bool is_last_col = col_index == last_col_index;
       bool can_process_next_chunk_as_vector = col_index + kSobel3VectorSize < last_col_index;
-      if(is_first_col || is_last_col || !can_use_neon || !can_process_next_chunk_as_vector) {
+      if(is_first_col || is_last_col || !use_vector_unit || !can_process_next_chunk_as_vector) {
         // scalar step
         int16_t sum;
         if(dmz_unlikely(is_first_col)) {
@@ -619,6 +1066,14 @@ DMZ_INTERNAL void llcv_sobel3_dx_dy_c_neon(IplImage *src, IplImage *dst) {
         dst_row_origin[col_index + 6] = vgetq_lane_s16(sums, 6);
         dst_row_origin[col_index + 7] = vgetq_lane_s16(sums, 7);
         col_index += kSobel3VectorSize;
+#elif DMZ_HAS_SSE2_COMPILETIME
+        __m128i tl = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src_row1_origin + col_index - 1)), zero);
+        __m128i tr = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src_row1_origin + col_index + 1)), zero);
+        __m128i bl = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src_row2_origin + col_index - 1)), zero);
+        __m128i br = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src_row2_origin + col_index + 1)), zero);
+        __m128i sums = _mm_add_epi16(_mm_sub_epi16(tl, tr), _mm_sub_epi16(br, bl));
+        _mm_storeu_si128((__m128i *)(dst_row_origin + col_index), sums);
+        col_index += kSobel3VectorSize;
 #endif
       }
     }
@@ -627,6 +1082,15 @@ DMZ_INTERNAL void llcv_sobel3_dx_dy_c_neon(IplImage *src, IplImage *dst) {
 #undef kSobel3VectorSize
 }
 
+DMZ_INTERNAL void llcv_sobel3_dx_dy_c(IplImage *src, IplImage *dst) {
+  llcv_sobel3_dx_dy_c_neon(src, dst, false);
+}
+
+// NEON or SSE2, whichever was compiled in
+DMZ_INTERNAL void llcv_sobel3_dx_dy_vectorized(IplImage *src, IplImage *dst) {
+  llcv_sobel3_dx_dy_c_neon(src, dst, true);
+}
+
 #pragma mark llcv_sobel3_dx_dy
 
 DMZ_INTERNAL void llcv_sobel3_dx_dy(IplImage *src, IplImage *dst) {
@@ -638,7 +1102,7 @@ DMZ_INTERNAL void llcv_sobel3_dx_dy(IplImage *src, IplImage *dst) {
 
   CvSize src_size = cvGetSize(src);
   CvSize dst_size = cvGetSize(dst);
-#pragma unused(src_size, dst_size) // work around broken compiler warnings
+  (void)src_size; (void)dst_size; // only used in asserts
 
   assert(dst_size.width == src_size.width);
   assert(dst_size.height == src_size.height);
@@ -649,7 +1113,7 @@ DMZ_INTERNAL void llcv_sobel3_dx_dy(IplImage *src, IplImage *dst) {
   for(int iter = 0; iter < TIMING_ITERATIONS; iter++) {
 #endif
     
-    llcv_sobel3_dx_dy_c_neon(src, dst);
+    dmz_kernels()->sobel3_dx_dy(src, dst);
     
 #if TIME_SOBEL3
   }
@@ -703,7 +1167,7 @@ DMZ_INTERNAL void llcv_sobel3_dx_dy(IplImage *src, IplImage *dst) {
 //  -3,  0,  +3                                                    |  +3 |
 //
 // Note that this function actually returns the ABSOLUTE VALUE of each Scharr score.
-DMZ_INTERNAL void llcv_scharr3_dx_abs_c_neon(IplImage *src, IplImage *dst) {
+DMZ_INTERNAL void llcv_scharr3_dx_abs_c_neon(IplImage *src, IplImage *dst, bool use_vector_unit) {
 #define kScharr3VectorSize 8
   
   CvSize src_size = cvGetSize(src);
@@ -719,7 +1183,6 @@ DMZ_INTERNAL void llcv_scharr3_dx_abs_c_neon(IplImage *src, IplImage *dst) {
 #endif
   
   uint16_t last_col_index = (uint16_t)(src_size.width - 1);
-  bool can_use_neon = dmz_has_neon_runtime();
   int16_t intermediate[src_size.width][src_size.height];  // note: intermediate[col][row]
   
   for(uint16_t row_index = 0; row_index < src_size.height; row_index++) {
@@ -729,7 +1192,7 @@ DMZ_INTERNAL void llcv_scharr3_dx_abs_c_neon(IplImage *src, IplImage *dst) {
       uint16_t col_left_index = col_index == 0 ? 0 : col_index - 1;
       uint16_t col_right_index = col_index == last_col_index ? last_col_index : col_index + 1;
       bool can_process_next_chunk_as_vector = col_index + kScharr3VectorSize - 1 <= last_col_index;
-      if (!can_use_neon || !can_process_next_chunk_as_vector) {
+      if (!use_vector_unit || !can_process_next_chunk_as_vector) {
         // scalar step
         intermediate[col_index][row_index] = (int16_t)abs(src_row_origin[col_right_index] - src_row_origin[col_left_index]);
         col_index++;
@@ -765,7 +1228,7 @@ DMZ_INTERNAL void llcv_scharr3_dx_abs_c_neon(IplImage *src, IplImage *dst) {
       uint16_t row_top_index = row_index == 0 ? 0 : row_index - 1;
       uint16_t row_bot_index = row_index == last_row_index ? last_row_index : row_index + 1;
       bool can_process_next_chunk_as_vector = row_index + kScharr3VectorSize - 1 <= last_row_index;
-      if (!can_use_neon || !can_process_next_chunk_as_vector) {
+      if (!use_vector_unit || !can_process_next_chunk_as_vector) {
         // scalar step
         dst_row_origin[col_index] = 3 * (intermediate[col_index][row_top_index] + intermediate[col_index][row_bot_index]) + 10 * intermediate[col_index][row_index];
         row_index++;
@@ -803,9 +1266,127 @@ DMZ_INTERNAL void llcv_scharr3_dx_abs_c_neon(IplImage *src, IplImage *dst) {
   #undef kScharr3VectorSize
 }
 
+DMZ_INTERNAL void llcv_scharr3_dx_abs_c(IplImage *src, IplImage *dst) {
+  llcv_scharr3_dx_abs_c_neon(src, dst, false);
+}
+
+DMZ_INTERNAL void llcv_scharr3_dx_abs_neon(IplImage *src, IplImage *dst) {
+  llcv_scharr3_dx_abs_c_neon(src, dst, true);
+}
+
+#if DMZ_HAS_SSE2_COMPILETIME
+
+// dst[i] = |b[i] - a[i]|
+static inline void scharr3_abs_diff_row_sse2(const uint8_t *a, const uint8_t *b, int16_t *dst, uint16_t n) {
+#define kVectorSize 16
+  const __m128i zero = _mm_setzero_si128();
+  uint16_t index = 0;
+  for(; index + kVectorSize <= n; index += kVectorSize) {
+    __m128i va = _mm_loadu_si128((const __m128i *)(a + index));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b + index));
+    __m128i abs_diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+    _mm_storeu_si128((__m128i *)(dst + index), _mm_unpacklo_epi8(abs_diff, zero));
+    _mm_storeu_si128((__m128i *)(dst + index + 8), _mm_unpackhi_epi8(abs_diff, zero));
+  }
+  for(; index < n; index++) {
+    dst[index] = (int16_t)abs(b[index] - a[index]);
+  }
+#undef kVectorSize
+}
+
+// dst[i] = 3 * (outer1[i] + outer2[i]) + 10 * center[i]
+static inline void scharr3_combine_row_sse2(const int16_t *outer1, const int16_t *center, const int16_t *outer2, int16_t *dst, uint16_t n) {
+#define kVectorSize 8
+  const __m128i three = _mm_set1_epi16(3);
+  const __m128i ten = _mm_set1_epi16(10);
+  uint16_t index = 0;
+  for(; index + kVectorSize <= n; index += kVectorSize) {
+    __m128i outer = _mm_add_epi16(_mm_loadu_si128((const __m128i *)(outer1 + index)), _mm_loadu_si128((const __m128i *)(outer2 + index)));
+    __m128i sums = _mm_add_epi16(_mm_mullo_epi16(outer, three), _mm_mullo_epi16(_mm_loadu_si128((const __m128i *)(center + index)), ten));
+    _mm_storeu_si128((__m128i *)(dst + index), sums);
+  }
+  for(; index < n; index++) {
+    dst[index] = 3 * (outer1[index] + outer2[index]) + 10 * center[index];
+  }
+#undef kVectorSize
+}
+
+#endif // DMZ_HAS_SSE2_COMPILETIME
+
+// Same results as llcv_scharr3_dx_abs_c_neon, computed row by row with a ring of three
+// horizontal-difference rows instead of a transposed intermediate image.
+DMZ_INTERNAL void llcv_scharr3_dx_abs_sse2(IplImage *src, IplImage *dst) {
+#if DMZ_HAS_SSE2_COMPILETIME
+  CvSize src_size = cvGetSize(src);
+  assert(src_size.width > 2);
+
+  uint8_t *src_data_origin = (uint8_t *)llcv_get_data_origin(src);
+  uint16_t src_width_step = (uint16_t)src->widthStep;
+
+  uint8_t *dst_data_origin = (uint8_t *)llcv_get_data_origin(dst);
+  uint16_t dst_width_step = (uint16_t)dst->widthStep;
+
+  uint16_t width = (uint16_t)src_size.width;
+  uint16_t last_col_index = (uint16_t)(width - 1);
+  uint16_t last_row_index = (uint16_t)(src_size.height - 1);
+  int16_t abs_diff_rows[3][width];
+
+  for(uint16_t row_index = 0; row_index <= last_row_index; row_index++) {
+    // make sure this row and the next are available; the previous one is still in the ring
+    uint16_t first_needed_row = row_index == 0 ? 0 : MIN(row_index + 1, last_row_index);
+    for(uint16_t diff_row_index = first_needed_row; diff_row_index <= MIN(row_index + 1, last_row_index); diff_row_index++) {
+      const uint8_t *src_row_origin = src_data_origin + diff_row_index * src_width_step;
+      int16_t *diff_row = abs_diff_rows[diff_row_index % 3];
+      diff_row[0] = (int16_t)abs(src_row_origin[1] - src_row_origin[0]);
+      scharr3_abs_diff_row_sse2(src_row_origin, src_row_origin + 2, diff_row + 1, (uint16_t)(width - 2));
+      diff_row[last_col_index] = (int16_t)abs(src_row_origin[last_col_index] - src_row_origin[last_col_index - 1]);
+    }
+
+    uint16_t row_top_index = row_index == 0 ? 0 : row_index - 1;
+    uint16_t row_bot_index = row_index == last_row_index ? last_row_index : row_index + 1;
+    int16_t *dst_row_origin = (int16_t *)(dst_data_origin + row_index * dst_width_step);
+    scharr3_combine_row_sse2(abs_diff_rows[row_top_index % 3], abs_diff_rows[row_index % 3], abs_diff_rows[row_bot_index % 3], dst_row_origin, width);
+  }
+#endif
+}
+
+// Same results as llcv_scharr3_dy_abs_c_neon, computed row by row.
+DMZ_INTERNAL void llcv_scharr3_dy_abs_sse2(IplImage *src, IplImage *dst) {
+#if DMZ_HAS_SSE2_COMPILETIME
+  CvSize src_size = cvGetSize(src);
+  assert(src_size.width > 2);
+
+  uint8_t *src_data_origin = (uint8_t *)llcv_get_data_origin(src);
+  uint16_t src_width_step = (uint16_t)src->widthStep;
+
+  uint8_t *dst_data_origin = (uint8_t *)llcv_get_data_origin(dst);
+  uint16_t dst_width_step = (uint16_t)dst->widthStep;
+
+  uint16_t width = (uint16_t)src_size.width;
+  uint16_t last_col_index = (uint16_t)(width - 1);
+  uint16_t last_row_index = (uint16_t)(src_size.height - 1);
+  int16_t abs_diff_row[width];
+
+  for(uint16_t row_index = 0; row_index <= last_row_index; row_index++) {
+    uint16_t row_top_index = row_index == 0 ? 0 : row_index - 1;
+    uint16_t row_bot_index = row_index == last_row_index ? last_row_index : row_index + 1;
+    const uint8_t *top_row_origin = src_data_origin + row_top_index * src_width_step;
+    const uint8_t *bot_row_origin = src_data_origin + row_bot_index * src_width_step;
+    scharr3_abs_diff_row_sse2(top_row_origin, bot_row_origin, abs_diff_row, width);
+
+    int16_t *dst_row_origin = (int16_t *)(dst_data_origin + row_index * dst_width_step);
+    dst_row_origin[0] = 3 * (abs_diff_row[0] + abs_diff_row[1]) + 10 * abs_diff_row[0];
+    scharr3_combine_row_sse2(abs_diff_row, abs_diff_row + 1, abs_diff_row + 2, dst_row_origin + 1, (uint16_t)(width - 2));
+    dst_row_origin[last_col_index] = 3 * (abs_diff_row[last_col_index - 1] + abs_diff_row[last_col_index]) + 10 * abs_diff_row[last_col_index];
+  }
+#endif
+}
+
 #pragma mark llcv_scharr3_dx_abs
 
 // Note that this function actually returns the ABSOLUTE VALUE of each Scharr score.
+// Only expiry segmentation and the Cython bindings use it.
+#if SCAN_EXPIRY || CYTHON_DMZ
 #if DMZ_DEBUG
 void llcv_scharr3_dx_abs(IplImage *src, IplImage *dst) {
 #else
@@ -819,13 +1400,14 @@ DMZ_INTERNAL_UNLESS_CYTHON void llcv_scharr3_dx_abs(IplImage *src, IplImage *dst
 
   CvSize src_size = cvGetSize(src);
   CvSize dst_size = cvGetSize(dst);
-#pragma unused(src_size, dst_size) // work around broken compiler warnings
+  (void)src_size; (void)dst_size; // only used in asserts
 
   assert(dst_size.width == src_size.width);
   assert(dst_size.height == src_size.height);
 
-  llcv_scharr3_dx_abs_c_neon(src, dst);
+  dmz_kernels()->scharr3_dx_abs(src, dst);
 }
+#endif // SCAN_EXPIRY || CYTHON_DMZ
 
 #pragma mark llcv_scharr3_dy_abs_c_neon
 
@@ -901,6 +1483,8 @@ DMZ_INTERNAL void llcv_scharr3_dy_abs_c_neon(IplImage *src, IplImage *dst) {
 
 #pragma mark llcv_scharr3_dy_abs
 // Note that this function actually returns the ABSOLUTE VALUE of each Scharr score.
+// Only the Cython bindings use it.
+#if CYTHON_DMZ
 #if DMZ_DEBUG
 void llcv_scharr3_dy_abs(IplImage *src, IplImage *dst) {
 #else
@@ -914,12 +1498,13 @@ DMZ_INTERNAL_UNLESS_CYTHON void llcv_scharr3_dy_abs(IplImage *src, IplImage *dst
   
   CvSize src_size = cvGetSize(src);
   CvSize dst_size = cvGetSize(dst);
-#pragma unused(src_size, dst_size) // work around broken compiler warnings
+  (void)src_size; (void)dst_size; // only used in asserts
   
   assert(dst_size.width == src_size.width);
   assert(dst_size.height == src_size.height);
   
-  llcv_scharr3_dy_abs_c_neon(src, dst);
+  dmz_kernels()->scharr3_dy_abs(src, dst);
 }
+#endif // CYTHON_DMZ
 
 #endif
@@ -6,22 +6,30 @@
 #include "opencv2/core/core_c.h" // for IplImage
 #include "opencv2/imgproc/imgproc_c.h"
 #include "dmz_macros.h"
+#include "image_util.h"
 
-// Convolve with a sobel kernel of size 7.
-// src must be of type 8UC1; dst must be of type 16SC1.
-// (dx, dy) must be either (0, 1) or (1, 0).
-// scratch space may be NULL (in which it will be allocated internally), or it may be
-// an image of size (src_height, src_width) -- yes, transposed! -- of type 16SC1.
-DMZ_INTERNAL void llcv_sobel7(IplImage *src, IplImage *dst, IplImage *scratch, bool dx, bool dy);
+// Both gradients of a sobel kernel of size 7, in a single pass over src.
+// src must be of type 8UC1; dx and dy must be of type 16SC1.
+// If abs_sum is not NULL, it is set to cvSum(cvAbs(dx)) + cvSum(cvAbs(dy)), at little extra cost.
+// rows holds two padded int16 rows between calls; it may be NULL, in which case they are allocated (and freed) by each call.
+DMZ_INTERNAL void llcv_sobel7_dx_dy(IplImage *src, IplImage *dx, IplImage *dy, double *abs_sum, llcv_buffer *rows);
 
 // Note that this function actually returns the ABSOLUTE VALUE of each Scharr score.
+#if SCAN_EXPIRY || CYTHON_DMZ
 #if DMZ_DEBUG
 void llcv_scharr3_dx_abs(IplImage *src, IplImage *dst);
-void llcv_scharr3_dy_abs(IplImage *src, IplImage *dst);
 #else
 DMZ_INTERNAL_UNLESS_CYTHON void llcv_scharr3_dx_abs(IplImage *src, IplImage *dst);
+#endif
+#endif
+
+#if CYTHON_DMZ
+#if DMZ_DEBUG
+void llcv_scharr3_dy_abs(IplImage *src, IplImage *dst);
+#else
 DMZ_INTERNAL_UNLESS_CYTHON void llcv_scharr3_dy_abs(IplImage *src, IplImage *dst);
 #endif
+#endif
 
 void llcv_scharr3_dx(IplImage *src, IplImage *dst);
 
@@ -6,6 +6,7 @@
 #include "dmz_macros.h"
 #include "stats.h"
 #include "processor_support.h"
+#include "image_util.h"
 
 #include "opencv2/core/core.hpp"
 #include "opencv2/core/internal.hpp"  // used in llcv_equalize_hist
@@ -14,6 +15,13 @@
   #include <arm_neon.h>
 #endif
 
+#if DMZ_HAS_SSE2_COMPILETIME
+  #include <emmintrin.h>
+#endif
+#if DMZ_HAS_AVX2_COMPILETIME
+  #include <immintrin.h>
+#endif
+
 DMZ_INTERNAL float llcv_stddev_of_abs_neon(IplImage *image) {
 #if DMZ_HAS_NEON_COMPILETIME
 #define kVectorSize 8
@@ -84,6 +92,120 @@ DMZ_INTERNAL float llcv_stddev_of_abs_neon(IplImage *image) {
 #endif
 }
 
+#if DMZ_HAS_SSE2_COMPILETIME
+// The x86 implementations match llcv_stddev_of_abs_c exactly: they take the saturating absolute
+// value (as cvAbs does), accumulate exact integer sums, and finish with cvAvgSdv's double math.
+DMZ_INTERNAL float llcv_stddev_from_sums(int64_t sum, int64_t sum_squared, int n_elements) {
+  double scale = 1.0 / n_elements;
+  double mean = sum * scale;
+  double variance = (double)sum_squared * scale - mean * mean;
+  return (float)sqrt(MAX(variance, 0.0));
+}
+
+static inline int16_t saturating_abs_s16(int16_t value) {
+  return value == INT16_MIN ? INT16_MAX : (int16_t)abs(value);
+}
+#endif
+
+DMZ_INTERNAL float llcv_stddev_of_abs_sse2(IplImage *image) {
+#if DMZ_HAS_SSE2_COMPILETIME
+#define kVectorSize 8
+  CvSize image_size = cvGetSize(image);
+  const uint8_t *image_origin = (const uint8_t *)llcv_get_data_origin(image);
+  uint16_t image_width_step = (uint16_t)image->widthStep;
+
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+  __m128i vector_sum_squared = zero;
+  int64_t sum = 0;
+  int64_t sum_squared = 0;
+
+  for(uint16_t row_index = 0; row_index < image_size.height; row_index++) {
+    const int16_t *image_row_origin = (const int16_t *)(image_origin + row_index * image_width_step);
+    __m128i row_sum = zero; // int32 lanes can't overflow within a single row
+
+    uint16_t col_index = 0;
+    for(; col_index + kVectorSize <= image_size.width; col_index += kVectorSize) {
+      __m128i image_vector = _mm_loadu_si128((const __m128i *)(image_row_origin + col_index));
+      image_vector = _mm_max_epi16(image_vector, _mm_subs_epi16(zero, image_vector)); // saturating absolute value
+      row_sum = _mm_add_epi32(row_sum, _mm_madd_epi16(image_vector, ones));
+      // each pair of squares fits in an int32, but not a sum of two pairs, so widen right away
+      __m128i squared = _mm_madd_epi16(image_vector, image_vector);
+      vector_sum_squared = _mm_add_epi64(vector_sum_squared, _mm_unpacklo_epi32(squared, zero));
+      vector_sum_squared = _mm_add_epi64(vector_sum_squared, _mm_unpackhi_epi32(squared, zero));
+    }
+    for(; col_index < image_size.width; col_index++) {
+      int16_t pixel_val = saturating_abs_s16(image_row_origin[col_index]);
+      sum += pixel_val;
+      sum_squared += pixel_val * pixel_val;
+    }
+
+    int32_t row_sums[4];
+    _mm_storeu_si128((__m128i *)row_sums, row_sum);
+    sum += (int64_t)row_sums[0] + row_sums[1] + row_sums[2] + row_sums[3];
+  }
+
+  int64_t sums_squared[2];
+  _mm_storeu_si128((__m128i *)sums_squared, vector_sum_squared);
+  sum_squared += sums_squared[0] + sums_squared[1];
+
+  return llcv_stddev_from_sums(sum, sum_squared, image_size.width * image_size.height);
+#undef kVectorSize
+#else
+  return 0.0f;
+#endif
+}
+
+DMZ_INTERNAL DMZ_TARGET_AVX2 float llcv_stddev_of_abs_avx2(IplImage *image) {
+#if DMZ_HAS_AVX2_COMPILETIME
+#define kVectorSize 16
+  CvSize image_size = cvGetSize(image);
+  const uint8_t *image_origin = (const uint8_t *)llcv_get_data_origin(image);
+  uint16_t image_width_step = (uint16_t)image->widthStep;
+
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi16(1);
+  __m256i vector_sum_squared = zero;
+  int64_t sum = 0;
+  int64_t sum_squared = 0;
+
+  for(uint16_t row_index = 0; row_index < image_size.height; row_index++) {
+    const int16_t *image_row_origin = (const int16_t *)(image_origin + row_index * image_width_step);
+    __m256i row_sum = zero;
+
+    uint16_t col_index = 0;
+    for(; col_index + kVectorSize <= image_size.width; col_index += kVectorSize) {
+      __m256i image_vector = _mm256_loadu_si256((const __m256i *)(image_row_origin + col_index));
+      image_vector = _mm256_max_epi16(image_vector, _mm256_subs_epi16(zero, image_vector));
+      row_sum = _mm256_add_epi32(row_sum, _mm256_madd_epi16(image_vector, ones));
+      __m256i squared = _mm256_madd_epi16(image_vector, image_vector);
+      vector_sum_squared = _mm256_add_epi64(vector_sum_squared, _mm256_unpacklo_epi32(squared, zero));
+      vector_sum_squared = _mm256_add_epi64(vector_sum_squared, _mm256_unpackhi_epi32(squared, zero));
+    }
+    for(; col_index < image_size.width; col_index++) {
+      int16_t pixel_val = saturating_abs_s16(image_row_origin[col_index]);
+      sum += pixel_val;
+      sum_squared += pixel_val * pixel_val;
+    }
+
+    int32_t row_sums[8];
+    _mm256_storeu_si256((__m256i *)row_sums, row_sum);
+    for(uint8_t lane = 0; lane < 8; lane++) {
+      sum += row_sums[lane];
+    }
+  }
+
+  int64_t sums_squared[4];
+  _mm256_storeu_si256((__m256i *)sums_squared, vector_sum_squared);
+  sum_squared += sums_squared[0] + sums_squared[1] + sums_squared[2] + sums_squared[3];
+
+  return llcv_stddev_from_sums(sum, sum_squared, image_size.width * image_size.height);
+#undef kVectorSize
+#else
+  return 0.0f;
+#endif
+}
+
 DMZ_INTERNAL float llcv_stddev_of_abs_c(IplImage *image) {
   cvAbs(image, image);
   CvScalar stddev;
@@ -92,22 +214,39 @@ DMZ_INTERNAL float llcv_stddev_of_abs_c(IplImage *image) {
 }
 
 #define TEST_STDDEV_NEON 0
+#define TEST_STDDEV_X86 0
 
 DMZ_INTERNAL float llcv_stddev_of_abs(IplImage *image) {
   assert(image->depth == IPL_DEPTH_16S);
   assert(image->nChannels == 1);
 
-  if(dmz_has_neon_runtime()) {
-    // NB for testing: must do neon calc before c calc, because c calc changes the image!
-    float neon_ret = llcv_stddev_of_abs_neon(image);
+  const dmz_kernel_table *kernels = dmz_kernels();
+
 #if TEST_STDDEV_NEON
+  if(kernels->isa != DMZ_ISA_SCALAR) {
+    // NB for testing: must do vector calc before c calc, because c calc changes the image!
+    float vector_ret = kernels->stddev_of_abs(image);
     double c_ret = llcv_stddev_of_abs_c(image);
-    fprintf(stderr, "llcv_stddev C: %f, NEON: %f, DELTA: %f (%f %%)\n", c_ret, neon_ret, c_ret - neon_ret, 100.0f * (c_ret - neon_ret) / c_ret);
+    fprintf(stderr, "llcv_stddev C: %f, vector: %f, DELTA: %f (%f %%)\n", c_ret, vector_ret, c_ret - vector_ret, 100.0f * (c_ret - vector_ret) / c_ret);
+    return vector_ret;
+  }
 #endif
-    return neon_ret;
-  } else {
-    return llcv_stddev_of_abs_c(image);
+
+#if TEST_STDDEV_X86
+  if(kernels->isa == DMZ_ISA_SSE2 || kernels->isa == DMZ_ISA_AVX2) {
+    // Unlike NEON, the x86 implementations should match the C calc exactly. Give the C calc a copy, since it changes the image.
+    float x86_ret = kernels->stddev_of_abs(image);
+    IplImage *c_image = cvCloneImage(image);
+    float c_ret = llcv_stddev_of_abs_c(c_image);
+    cvReleaseImage(&c_image);
+    if(c_ret != x86_ret) {
+      fprintf(stderr, "llcv_stddev C: %f, x86: %f\n", c_ret, x86_ret);
+    }
+    return x86_ret;
   }
+#endif
+
+  return kernels->stddev_of_abs(image);
 }
 
 
@@ -9,6 +9,8 @@
 #include "warp.h"
 #include "dmz_debug.h"
 #include "processor_support.h"
+#include "image_util.h"
+#include "convert.h"
 
 #include "eigen.h"
 #include "opencv2/imgproc/types_c.h"
@@ -23,6 +25,21 @@
 #include "mz_android.h"
 #endif
 
+#if DMZ_HAS_NEON_COMPILETIME
+#include <arm_neon.h>
+#endif
+
+#if DMZ_HAS_SSE2_COMPILETIME
+#include <emmintrin.h>
+#endif
+
+#if DMZ_HAS_AVX2_COMPILETIME
+#include <immintrin.h>
+#endif
+
+#include <limits.h>
+#include <math.h>
+
 bool llcv_warp_auto_upsamples() {
 #ifdef IOS_DMZ
   return true;
@@ -31,55 +48,125 @@ bool llcv_warp_auto_upsamples() {
 #endif
 }
 
-void llcv_calc_persp_transform(float *matrixData, int matrixDataSize, bool rowMajor, const dmz_point sourcePoints[], const dmz_point destPoints[]) {
+// Every caller maps the card's corners to the corners of an axis-aligned rectangle (in dmz_rect_get_points order),
+// and for that the transform has a closed form: invert the transform that takes the unit square to the card's
+// corners, then scale and shift the square to the rectangle. See Heckbert, "Fundamentals of Texture Mapping
+// and Image Warping", section 2.2.3.
+// Writes the eight coefficients in the order llcv_calc_persp_transform solves for them.
+// Returns false if destPoints aren't such a rectangle, or if the corners are degenerate.
+static bool llcv_calc_persp_transform_to_rect(const dmz_point sourcePoints[], const dmz_point destPoints[], float coefficients[8]) {
+  if(destPoints[0].y != destPoints[1].y || destPoints[2].y != destPoints[3].y ||
+     destPoints[0].x != destPoints[2].x || destPoints[1].x != destPoints[3].x) {
+    return false;
+  }
+  double rect_x = destPoints[0].x;
+  double rect_y = destPoints[0].y;
+  double rect_w = (double)destPoints[1].x - destPoints[0].x;
+  double rect_h = (double)destPoints[2].y - destPoints[0].y;
+
+  // Unit square to corners: (u, v) -> ((a u + b v + c) / (g u + h v + 1), (d u + e v + f) / (g u + h v + 1)),
+  // with (0, 0), (1, 0), (0, 1), (1, 1) going to sourcePoints 0 to 3.
+  const dmz_point *p = sourcePoints;
+  double sum_x = (double)p[0].x - p[1].x + p[3].x - p[2].x;
+  double sum_y = (double)p[0].y - p[1].y + p[3].y - p[2].y;
+  double square[9];
+  if(sum_x == 0 && sum_y == 0) {
+    // parallelogram
+    square[6] = 0;
+    square[7] = 0;
+  } else {
+    double dx1 = (double)p[1].x - p[3].x;
+    double dx2 = (double)p[2].x - p[3].x;
+    double dy1 = (double)p[1].y - p[3].y;
+    double dy2 = (double)p[2].y - p[3].y;
+    double determinant = dx1 * dy2 - dx2 * dy1;
+    if(determinant == 0) {
+      return false;
+    }
+    square[6] = (sum_x * dy2 - dx2 * sum_y) / determinant;
+    square[7] = (dx1 * sum_y - sum_x * dy1) / determinant;
+  }
+  square[0] = p[1].x - p[0].x + square[6] * p[1].x;
+  square[1] = p[2].x - p[0].x + square[7] * p[2].x;
+  square[2] = p[0].x;
+  square[3] = p[1].y - p[0].y + square[6] * p[1].y;
+  square[4] = p[2].y - p[0].y + square[7] * p[2].y;
+  square[5] = p[0].y;
+  square[8] = 1;
+
+  // Corners to unit square, up to scale: the adjugate.
+  double inverse[9] = {
+    square[4] * square[8] - square[5] * square[7], square[2] * square[7] - square[1] * square[8], square[1] * square[5] - square[2] * square[4],
+    square[5] * square[6] - square[3] * square[8], square[0] * square[8] - square[2] * square[6], square[2] * square[3] - square[0] * square[5],
+    square[3] * square[7] - square[4] * square[6], square[1] * square[6] - square[0] * square[7], square[0] * square[4] - square[1] * square[3],
+  };
+  if(inverse[8] == 0) {
+    return false;
+  }
+
+  // Unit square to rectangle, then normalize so that the bottom right entry is 1.
+  for(int c = 0; c < 3; c++) {
+    inverse[c] = rect_w * inverse[c] + rect_x * inverse[6 + c];
+    inverse[3 + c] = rect_h * inverse[3 + c] + rect_y * inverse[6 + c];
+  }
+  for(int i = 0; i < 8; i++) {
+    coefficients[i] = (float)(inverse[i] / inverse[8]);
+  }
+  return true;
+}
 
-  // Set up matrices a and b so we can solve for x from ax = b
-  // See http://xenia.media.mit.edu/~cwren/interpolator/ for a
-  // good explanation of the basic math behind this.
+void llcv_calc_persp_transform(float *matrixData, int matrixDataSize, bool rowMajor, const dmz_point sourcePoints[], const dmz_point destPoints[]) {
 
   typedef Eigen::Matrix<float, 8, 8> Matrix8x8;
   typedef Eigen::Matrix<float, 8, 1> Matrix8x1;
 
-  Matrix8x8 a;
-  Matrix8x1 b;
+  Matrix8x1 x;
+  if(!llcv_calc_persp_transform_to_rect(sourcePoints, destPoints, x.data())) {
+    // Set up matrices a and b so we can solve for x from ax = b
+    // See http://xenia.media.mit.edu/~cwren/interpolator/ for a
+    // good explanation of the basic math behind this.
+
+    Matrix8x8 a;
+    Matrix8x1 b;
+
+    for(int i = 0; i < 4; i++) {
+      a(i, 0) = sourcePoints[i].x;
+      a(i, 1) = sourcePoints[i].y;
+      a(i, 2) = 1;
+      a(i, 3) = 0;
+      a(i, 4) = 0;
+      a(i, 5) = 0;
+      a(i, 6) = -sourcePoints[i].x * destPoints[i].x;
+      a(i, 7) = -sourcePoints[i].y * destPoints[i].x;
+
+      a(i + 4, 0) = 0;
+      a(i + 4, 1) = 0;
+      a(i + 4, 2) = 0;
+      a(i + 4, 3) = sourcePoints[i].x;
+      a(i + 4, 4) = sourcePoints[i].y;
+      a(i + 4, 5) = 1;
+      a(i + 4, 6) = -sourcePoints[i].x * destPoints[i].y;
+      a(i + 4, 7) = -sourcePoints[i].y * destPoints[i].y;
+
+      b(i, 0) = destPoints[i].x;
+      b(i + 4, 0) = destPoints[i].y;
+    }
 
-  for(int i = 0; i < 4; i++) {
-    a(i, 0) = sourcePoints[i].x;
-    a(i, 1) = sourcePoints[i].y;
-    a(i, 2) = 1;
-    a(i, 3) = 0;
-    a(i, 4) = 0;
-    a(i, 5) = 0;
-    a(i, 6) = -sourcePoints[i].x * destPoints[i].x;
-    a(i, 7) = -sourcePoints[i].y * destPoints[i].x;
-
-    a(i + 4, 0) = 0;
-    a(i + 4, 1) = 0;
-    a(i + 4, 2) = 0;
-    a(i + 4, 3) = sourcePoints[i].x;
-    a(i + 4, 4) = sourcePoints[i].y;
-    a(i + 4, 5) = 1;
-    a(i + 4, 6) = -sourcePoints[i].x * destPoints[i].y;
-    a(i + 4, 7) = -sourcePoints[i].y * destPoints[i].y;
-
-    b(i, 0) = destPoints[i].x;
-    b(i + 4, 0) = destPoints[i].y;
-  }
-
-  // Solving ax = b for x, we get the values needed for our perspective
-  // matrix. Table of options on the eigen site at
-  // /dox/TutorialLinearAlgebra.html#TutorialLinAlgBasicSolve
-  //
-  // We use householderQr because it places no restrictions on matrix A,
-  // is moderately fast, and seems to be sufficiently accurate.
-  //
-  // partialPivLu() seems to work as well, but I am wary of it because I
-  // am unsure of A is invertible. According to the documenation and basic
-  // performance testing, they are both roughly equivalent in speed.
-  //
-  // - @burnto
-
-  Matrix8x1 x = a.householderQr().solve(b);
+    // Solving ax = b for x, we get the values needed for our perspective
+    // matrix. Table of options on the eigen site at
+    // /dox/TutorialLinearAlgebra.html#TutorialLinAlgBasicSolve
+    //
+    // We use householderQr because it places no restrictions on matrix A,
+    // is moderately fast, and seems to be sufficiently accurate.
+    //
+    // partialPivLu() seems to work as well, but I am wary of it because I
+    // am unsure of A is invertible. According to the documenation and basic
+    // performance testing, they are both roughly equivalent in speed.
+    //
+    // - @burnto
+
+    x = a.householderQr().solve(b);
+  }
 
   // Initialize matrixData
   for (int i = 0; i < matrixDataSize; i++) {
@@ -125,11 +212,688 @@ void llcv_calc_persp_transform(float *matrixData, int matrixDataSize, bool rowMa
 }
 
 
+#pragma mark bilinear perspective warp
+
+// Source positions are fixed point with kWarpInterBits fractional bits, as in OpenCV's remap,
+// so the four bilinear weights are integers summing to 1 << kWarpWeightBits.
+#define kWarpInterBits 5
+#define kWarpInterScale (1 << kWarpInterBits)
+#define kWarpWeightBits (2 * kWarpInterBits)
+#define kWarpWeightRound (1 << (kWarpWeightBits - 1))
+
+// Out-of-range (and NaN) positions become INT_MIN, which is what cvtps gives on x86,
+// and which is far outside any image.
+static inline int llcv_warp_fixed_position(float position) {
+  return (position >= -2147483648.0f && position < 2147483648.0f) ? (int)lrintf(position) : INT_MIN;
+}
+
+// Blends the 2x2 neighbourhood of the fixed point position (x, y), which must lie entirely inside src.
+static inline void llcv_warp_blend(const uint8_t *src, int src_step, int channels, int x, int y, uint8_t *dst) {
+  int fx = x & (kWarpInterScale - 1);
+  int fy = y & (kWarpInterScale - 1);
+  int w00 = (kWarpInterScale - fx) * (kWarpInterScale - fy);
+  int w01 = fx * (kWarpInterScale - fy);
+  int w10 = (kWarpInterScale - fx) * fy;
+  int w11 = fx * fy;
+  const uint8_t *top = src + (y >> kWarpInterBits) * src_step + (x >> kWarpInterBits) * channels;
+  const uint8_t *bottom = top + src_step;
+  for(int c = 0; c < channels; c++) {
+    dst[c] = (uint8_t)((top[c] * w00 + top[c + channels] * w01 + bottom[c] * w10 + bottom[c + channels] * w11 + kWarpWeightRound) >> kWarpWeightBits);
+  }
+}
+
+// As llcv_warp_blend, for any position. Neighbours outside src count as 0, like OpenCV's BORDER_CONSTANT.
+static inline void llcv_warp_blend_border(const uint8_t *src, int src_step, int src_width, int src_height, int channels, int x, int y, uint8_t *dst) {
+  int ix = x >> kWarpInterBits;
+  int iy = y >> kWarpInterBits;
+  if(ix >= src_width || ix + 1 < 0 || iy >= src_height || iy + 1 < 0) {
+    memset(dst, 0, channels);
+    return;
+  }
+  int fx = x & (kWarpInterScale - 1);
+  int fy = y & (kWarpInterScale - 1);
+  int weights[4] = {
+    (kWarpInterScale - fx) * (kWarpInterScale - fy), fx * (kWarpInterScale - fy),
+    (kWarpInterScale - fx) * fy, fx * fy
+  };
+  int sums[4] = {0, 0, 0, 0};
+  for(int tap = 0; tap < 4; tap++) {
+    int tap_x = ix + (tap & 1);
+    int tap_y = iy + (tap >> 1);
+    if(tap_x >= 0 && tap_x < src_width && tap_y >= 0 && tap_y < src_height) {
+      const uint8_t *pixel = src + tap_y * src_step + tap_x * channels;
+      for(int c = 0; c < channels; c++) {
+        sums[c] += pixel[c] * weights[tap];
+      }
+    }
+  }
+  for(int c = 0; c < channels; c++) {
+    dst[c] = (uint8_t)((sums[c] + kWarpWeightRound) >> kWarpWeightBits);
+  }
+}
+
+static inline void llcv_warp_sample(const uint8_t *src, int src_step, int src_width, int src_height, int channels, int x, int y, uint8_t *dst) {
+  int ix = x >> kWarpInterBits;
+  int iy = y >> kWarpInterBits;
+  if((unsigned int)ix < (unsigned int)(src_width - 1) && (unsigned int)iy < (unsigned int)(src_height - 1)) {
+    llcv_warp_blend(src, src_step, channels, x, y, dst);
+  } else {
+    llcv_warp_blend_border(src, src_step, src_width, src_height, channels, x, y, dst);
+  }
+}
+
+// Output pixels [first_col, end_col) of one row. Output pixel col comes from source position
+// (origin + col * step) in homogeneous coordinates; see llcv_warp_perspective_bilinear.
+// The vectorized rows use this for the groups that touch the border, and for the tail,
+// so it computes positions in exactly the same order as they do.
+static inline void llcv_warp_perspective_pixels_c(const uint8_t *src, int src_step, int src_width, int src_height, int channels, const float origin[3], const float step[3], uint8_t *dst, int first_col, int end_col) {
+  for(int col_index = first_col; col_index < end_col; col_index++) {
+    float col = (float)col_index;
+    float w = origin[2] + col * step[2];
+    float inv_w = (w != 0) ? (float)kWarpInterScale / w : 0.0f;
+    int x = llcv_warp_fixed_position((origin[0] + col * step[0]) * inv_w);
+    int y = llcv_warp_fixed_position((origin[1] + col * step[1]) * inv_w);
+    llcv_warp_sample(src, src_step, src_width, src_height, channels, x, y, dst + col_index * channels);
+  }
+}
+
+DMZ_INTERNAL void llcv_warp_perspective_row_c(const uint8_t *src, int src_step, int src_width, int src_height, int channels, const float origin[3], const float step[3], uint8_t *dst, int width) {
+  llcv_warp_perspective_pixels_c(src, src_step, src_width, src_height, channels, origin, step, dst, 0, width);
+}
+
+// The vectorized rows work out positions and weights for kVectorSize pixels at a time, and fall back
+// to the scalar code for any group with a pixel whose neighbourhood isn't entirely inside src.
+// Taps are loaded per pixel, since neither instruction set can gather, and then blended together.
+
+#if DMZ_HAS_SSE2_COMPILETIME
+// Interleaves the left and right neighbours of a pixel, widened to 16 bits, so that _mm_madd_epi16
+// against (left weight, right weight) pairs blends them.
+static inline __m128i llcv_warp_taps_sse2(const uint8_t *pixel, int channels) {
+  __m128i taps = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)pixel), _mm_setzero_si128());
+  return _mm_unpacklo_epi16(taps, channels == 4 ? _mm_srli_si128(taps, 8) : _mm_srli_si128(taps, 6));
+}
+
+static inline uint16_t llcv_warp_load_pair(const uint8_t *pixel) {
+  uint16_t pair;
+  memcpy(&pair, pixel, sizeof(pair));
+  return pair;
+}
+
+// Lanes whose positions have their 2x2 neighbourhood inside [0, x_limit] x [0, y_limit].
+static inline __m128i llcv_warp_inside_sse2(__m128i x, __m128i y, int x_limit, int y_limit) {
+  const __m128i minus_one = _mm_set1_epi32(-1);
+  __m128i ix = _mm_srai_epi32(x, kWarpInterBits);
+  __m128i iy = _mm_srai_epi32(y, kWarpInterBits);
+  return _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi32(ix, minus_one), _mm_cmplt_epi32(ix, _mm_set1_epi32(x_limit))),
+                       _mm_and_si128(_mm_cmpgt_epi32(iy, minus_one), _mm_cmplt_epi32(iy, _mm_set1_epi32(y_limit))));
+}
+
+// The weights are at most kWarpInterScale squared, so they fit in the low half of each lane,
+// and 16 bit multiplies do. Each lane gets a (left weight, right weight) pair.
+static inline void llcv_warp_weights_sse2(__m128i x, __m128i y, __m128i *top_weights, __m128i *bottom_weights) {
+  const __m128i inter_scale = _mm_set1_epi32(kWarpInterScale);
+  const __m128i fraction_mask = _mm_set1_epi32(kWarpInterScale - 1);
+  __m128i fx = _mm_and_si128(x, fraction_mask);
+  __m128i fy = _mm_and_si128(y, fraction_mask);
+  __m128i inv_fx = _mm_sub_epi32(inter_scale, fx);
+  __m128i inv_fy = _mm_sub_epi32(inter_scale, fy);
+  *top_weights = _mm_or_si128(_mm_mullo_epi16(inv_fx, inv_fy), _mm_slli_epi32(_mm_mullo_epi16(fx, inv_fy), 16));
+  *bottom_weights = _mm_or_si128(_mm_mullo_epi16(inv_fx, fy), _mm_slli_epi32(_mm_mullo_epi16(fx, fy), 16));
+}
+
+// Top left taps of the four positions.
+static inline void llcv_warp_taps_origins_sse2(const uint8_t *src, int src_step, int channels, __m128i x, __m128i y, const uint8_t *top[4]) {
+  int32_t xs[4], ys[4];
+  _mm_storeu_si128((__m128i *)xs, _mm_srai_epi32(x, kWarpInterBits));
+  _mm_storeu_si128((__m128i *)ys, _mm_srai_epi32(y, kWarpInterBits));
+  for(int i = 0; i < 4; i++) {
+    top[i] = src + ys[i] * src_step + xs[i] * channels;
+  }
+}
+
+// Blends a single channel at four positions, one in each lane.
+static inline __m128i llcv_warp_blend_u8_sse2(const uint8_t *const top[4], int src_step, __m128i top_weights, __m128i bottom_weights) {
+  __m128i pairs = _mm_setr_epi16(llcv_warp_load_pair(top[0]), llcv_warp_load_pair(top[1]),
+                                 llcv_warp_load_pair(top[2]), llcv_warp_load_pair(top[3]),
+                                 llcv_warp_load_pair(top[0] + src_step), llcv_warp_load_pair(top[1] + src_step),
+                                 llcv_warp_load_pair(top[2] + src_step), llcv_warp_load_pair(top[3] + src_step));
+  __m128i sums = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(pairs, _mm_setzero_si128()), top_weights),
+                               _mm_madd_epi16(_mm_unpackhi_epi8(pairs, _mm_setzero_si128()), bottom_weights));
+  return _mm_srai_epi32(_mm_add_epi32(sums, _mm_set1_epi32(kWarpWeightRound)), kWarpWeightBits);
+}
+#endif
+
+DMZ_INTERNAL void llcv_warp_perspective_row_sse2(const uint8_t *src, int src_step, int src_width, int src_height, int channels, const float origin[3], const float step[3], uint8_t *dst, int width) {
+#if DMZ_HAS_SSE2_COMPILETIME
+#define kVectorSize 4
+  const __m128 origin_x = _mm_set1_ps(origin[0]);
+  const __m128 origin_y = _mm_set1_ps(origin[1]);
+  const __m128 origin_w = _mm_set1_ps(origin[2]);
+  const __m128 step_x = _mm_set1_ps(step[0]);
+  const __m128 step_y = _mm_set1_ps(step[1]);
+  const __m128 step_w = _mm_set1_ps(step[2]);
+  const __m128 scale = _mm_set1_ps((float)kWarpInterScale);
+  const __m128i round = _mm_set1_epi32(kWarpWeightRound);
+  // Three channel pixels are loaded 8 bytes at a time, so they need a spare pixel on the right.
+  const int x_limit = src_width - (channels == 3 ? 2 : 1);
+  __m128 cols = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+  const __m128 cols_step = _mm_set1_ps((float)kVectorSize);
+
+  int col_index = 0;
+  for(; col_index + kVectorSize <= width; col_index += kVectorSize, cols = _mm_add_ps(cols, cols_step)) {
+    __m128 w = _mm_add_ps(origin_w, _mm_mul_ps(cols, step_w));
+    __m128 inv_w = _mm_and_ps(_mm_div_ps(scale, w), _mm_cmpneq_ps(w, _mm_setzero_ps()));
+    __m128i x = _mm_cvtps_epi32(_mm_mul_ps(_mm_add_ps(origin_x, _mm_mul_ps(cols, step_x)), inv_w));
+    __m128i y = _mm_cvtps_epi32(_mm_mul_ps(_mm_add_ps(origin_y, _mm_mul_ps(cols, step_y)), inv_w));
+    if(_mm_movemask_epi8(llcv_warp_inside_sse2(x, y, x_limit, src_height - 1)) != 0xFFFF) {
+      llcv_warp_perspective_pixels_c(src, src_step, src_width, src_height, channels, origin, step, dst, col_index, col_index + kVectorSize);
+      continue;
+    }
+
+    __m128i top_weights, bottom_weights;
+    llcv_warp_weights_sse2(x, y, &top_weights, &bottom_weights);
+    const uint8_t *top[kVectorSize];
+    llcv_warp_taps_origins_sse2(src, src_step, channels, x, y, top);
+
+    if(channels == 1) {
+      __m128i values = llcv_warp_blend_u8_sse2(top, src_step, top_weights, bottom_weights);
+      values = _mm_packs_epi32(values, values);
+      int32_t packed = _mm_cvtsi128_si32(_mm_packus_epi16(values, values));
+      memcpy(dst + col_index, &packed, sizeof(packed));
+    } else {
+      __m128i values[kVectorSize];
+#define WARP_PIXEL(i) \
+      do { \
+        __m128i sums = _mm_add_epi32(_mm_madd_epi16(llcv_warp_taps_sse2(top[i], channels), _mm_shuffle_epi32(top_weights, _MM_SHUFFLE(i, i, i, i))), \
+                                     _mm_madd_epi16(llcv_warp_taps_sse2(top[i] + src_step, channels), _mm_shuffle_epi32(bottom_weights, _MM_SHUFFLE(i, i, i, i)))); \
+        values[i] = _mm_srai_epi32(_mm_add_epi32(sums, round), kWarpWeightBits); \
+      } while(0)
+      WARP_PIXEL(0);
+      WARP_PIXEL(1);
+      WARP_PIXEL(2);
+      WARP_PIXEL(3);
+#undef WARP_PIXEL
+      __m128i packed = _mm_packus_epi16(_mm_packs_epi32(values[0], values[1]), _mm_packs_epi32(values[2], values[3]));
+      if(channels == 4) {
+        _mm_storeu_si128((__m128i *)(dst + col_index * 4), packed);
+      } else {
+        uint8_t pixels[4 * kVectorSize];
+        _mm_storeu_si128((__m128i *)pixels, packed);
+        for(int i = 0; i < kVectorSize; i++) {
+          memcpy(dst + (col_index + i) * 3, pixels + i * 4, 3);
+        }
+      }
+    }
+  }
+  llcv_warp_perspective_pixels_c(src, src_step, src_width, src_height, channels, origin, step, dst, col_index, width);
+#undef kVectorSize
+#endif
+}
+
+#if DMZ_HAS_AVX2_COMPILETIME
+// As llcv_warp_blend_u8_sse2, for eight positions, gathering the taps. Each gather reads 4 bytes from the
+// left tap, so the positions need two spare pixels on the right.
+static inline DMZ_TARGET_AVX2 __m256i llcv_warp_blend_u8_avx2(const uint8_t *src, int src_step, __m256i x, __m256i y) {
+  const __m256i inter_scale = _mm256_set1_epi32(kWarpInterScale);
+  const __m256i fraction_mask = _mm256_set1_epi32(kWarpInterScale - 1);
+  // Spreads the first two bytes of each lane into its two 16 bit halves.
+  const __m256i spread_pair = _mm256_setr_epi8(0, -1, 1, -1, 4, -1, 5, -1, 8, -1, 9, -1, 12, -1, 13, -1,
+                                               0, -1, 1, -1, 4, -1, 5, -1, 8, -1, 9, -1, 12, -1, 13, -1);
+  __m256i fx = _mm256_and_si256(x, fraction_mask);
+  __m256i fy = _mm256_and_si256(y, fraction_mask);
+  __m256i inv_fx = _mm256_sub_epi32(inter_scale, fx);
+  __m256i inv_fy = _mm256_sub_epi32(inter_scale, fy);
+  __m256i top_weights = _mm256_or_si256(_mm256_mullo_epi16(inv_fx, inv_fy), _mm256_slli_epi32(_mm256_mullo_epi16(fx, inv_fy), 16));
+  __m256i bottom_weights = _mm256_or_si256(_mm256_mullo_epi16(inv_fx, fy), _mm256_slli_epi32(_mm256_mullo_epi16(fx, fy), 16));
+
+  __m256i offsets = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srai_epi32(y, kWarpInterBits), _mm256_set1_epi32(src_step)),
+                                     _mm256_srai_epi32(x, kWarpInterBits));
+  __m256i top = _mm256_shuffle_epi8(_mm256_i32gather_epi32((const int *)src, offsets, 1), spread_pair);
+  __m256i bottom = _mm256_shuffle_epi8(_mm256_i32gather_epi32((const int *)(src + src_step), offsets, 1), spread_pair);
+  __m256i sums = _mm256_add_epi32(_mm256_madd_epi16(top, top_weights), _mm256_madd_epi16(bottom, bottom_weights));
+  return _mm256_srai_epi32(_mm256_add_epi32(sums, _mm256_set1_epi32(kWarpWeightRound)), kWarpWeightBits);
+}
+
+// Lanes whose positions have their 2x2 neighbourhood inside [0, x_limit] x [0, y_limit].
+static inline DMZ_TARGET_AVX2 __m256i llcv_warp_inside_avx2(__m256i x, __m256i y, int x_limit, int y_limit) {
+  const __m256i minus_one = _mm256_set1_epi32(-1);
+  __m256i ix = _mm256_srai_epi32(x, kWarpInterBits);
+  __m256i iy = _mm256_srai_epi32(y, kWarpInterBits);
+  return _mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(ix, minus_one), _mm256_cmpgt_epi32(_mm256_set1_epi32(x_limit), ix)),
+                          _mm256_and_si256(_mm256_cmpgt_epi32(iy, minus_one), _mm256_cmpgt_epi32(_mm256_set1_epi32(y_limit), iy)));
+}
+#endif
+
+// Single channel rows are the common case (the Y, Cb and Cr planes), and AVX2 can gather their taps.
+// Other rows take the SSE2 path.
+DMZ_INTERNAL DMZ_TARGET_AVX2 void llcv_warp_perspective_row_avx2(const uint8_t *src, int src_step, int src_width, int src_height, int channels, const float origin[3], const float step[3], uint8_t *dst, int width) {
+#if DMZ_HAS_AVX2_COMPILETIME
+  if(channels != 1) {
+    llcv_warp_perspective_row_sse2(src, src_step, src_width, src_height, channels, origin, step, dst, width);
+    return;
+  }
+#define kVectorSize 8
+  const __m256 origin_x = _mm256_set1_ps(origin[0]);
+  const __m256 origin_y = _mm256_set1_ps(origin[1]);
+  const __m256 origin_w = _mm256_set1_ps(origin[2]);
+  const __m256 step_x = _mm256_set1_ps(step[0]);
+  const __m256 step_y = _mm256_set1_ps(step[1]);
+  const __m256 step_w = _mm256_set1_ps(step[2]);
+  const __m256 scale = _mm256_set1_ps((float)kWarpInterScale);
+  __m256 cols = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+  const __m256 cols_step = _mm256_set1_ps((float)kVectorSize);
+
+  int col_index = 0;
+  for(; col_index + kVectorSize <= width; col_index += kVectorSize, cols = _mm256_add_ps(cols, cols_step)) {
+    __m256 w = _mm256_add_ps(origin_w, _mm256_mul_ps(cols, step_w));
+    __m256 inv_w = _mm256_and_ps(_mm256_div_ps(scale, w), _mm256_cmp_ps(w, _mm256_setzero_ps(), _CMP_NEQ_UQ));
+    __m256i x = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_add_ps(origin_x, _mm256_mul_ps(cols, step_x)), inv_w));
+    __m256i y = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_add_ps(origin_y, _mm256_mul_ps(cols, step_y)), inv_w));
+    __m256i inside = llcv_warp_inside_avx2(x, y, src_width - 3, src_height - 1);
+    if(_mm256_movemask_epi8(inside) != -1) {
+      llcv_warp_perspective_pixels_c(src, src_step, src_width, src_height, channels, origin, step, dst, col_index, col_index + kVectorSize);
+      continue;
+    }
+
+    __m256i values = llcv_warp_blend_u8_avx2(src, src_step, x, y);
+    values = _mm256_packs_epi32(values, values);
+    values = _mm256_packus_epi16(values, values);
+    int32_t packed[2] = {_mm_cvtsi128_si32(_mm256_castsi256_si128(values)), _mm_cvtsi128_si32(_mm256_extracti128_si256(values, 1))};
+    memcpy(dst + col_index, packed, sizeof(packed));
+  }
+  llcv_warp_perspective_pixels_c(src, src_step, src_width, src_height, channels, origin, step, dst, col_index, width);
+#undef kVectorSize
+#endif
+}
+
+DMZ_INTERNAL void llcv_warp_perspective_row_neon(const uint8_t *src, int src_step, int src_width, int src_height, int channels, const float origin[3], const float step[3], uint8_t *dst, int width) {
+#if DMZ_HAS_NEON_COMPILETIME
+#define kVectorSize 4
+  const float32x4_t scale = vdupq_n_f32((float)kWarpInterScale);
+  const float32x4_t half = vdupq_n_f32(0.5f);
+  const uint32x4_t sign_bit = vdupq_n_u32(0x80000000);
+  const int32x4_t x_limit = vdupq_n_s32(src_width - 1);
+  const int32x4_t y_limit = vdupq_n_s32(src_height - 1);
+  const float cols_init[kVectorSize] = {0.0f, 1.0f, 2.0f, 3.0f};
+  float32x4_t cols = vld1q_f32(cols_init);
+  const float32x4_t cols_step = vdupq_n_f32((float)kVectorSize);
+
+  int col_index = 0;
+  for(; col_index + kVectorSize <= width; col_index += kVectorSize, cols = vaddq_f32(cols, cols_step)) {
+    float32x4_t w = vmlaq_n_f32(vdupq_n_f32(origin[2]), cols, step[2]);
+    // NEON has no divide, so refine the reciprocal estimate twice, which gets it to within a float ulp or two.
+    float32x4_t recip = vrecpeq_f32(w);
+    recip = vmulq_f32(recip, vrecpsq_f32(w, recip));
+    recip = vmulq_f32(recip, vrecpsq_f32(w, recip));
+    float32x4_t inv_w = vreinterpretq_f32_u32(vbicq_u32(vreinterpretq_u32_f32(vmulq_f32(scale, recip)), vceqq_f32(w, vdupq_n_f32(0.0f))));
+    float32x4_t fx_f = vmulq_f32(vmlaq_n_f32(vdupq_n_f32(origin[0]), cols, step[0]), inv_w);
+    float32x4_t fy_f = vmulq_f32(vmlaq_n_f32(vdupq_n_f32(origin[1]), cols, step[1]), inv_w);
+    // vcvtq truncates; round half away from zero instead. NaNs convert to 0, which the inside test can't tell
+    // from a real position, so they take the scalar path.
+    int32x4_t x = vcvtq_s32_f32(vaddq_f32(fx_f, vreinterpretq_f32_u32(vorrq_u32(vandq_u32(vreinterpretq_u32_f32(fx_f), sign_bit), vreinterpretq_u32_f32(half)))));
+    int32x4_t y = vcvtq_s32_f32(vaddq_f32(fy_f, vreinterpretq_f32_u32(vorrq_u32(vandq_u32(vreinterpretq_u32_f32(fy_f), sign_bit), vreinterpretq_u32_f32(half)))));
+    int32x4_t ix = vshrq_n_s32(x, kWarpInterBits);
+    int32x4_t iy = vshrq_n_s32(y, kWarpInterBits);
+    uint32x4_t inside = vandq_u32(vandq_u32(vcltq_u32(vreinterpretq_u32_s32(ix), vreinterpretq_u32_s32(x_limit)),
+                                            vcltq_u32(vreinterpretq_u32_s32(iy), vreinterpretq_u32_s32(y_limit))),
+                                  vandq_u32(vceqq_f32(fx_f, fx_f), vceqq_f32(fy_f, fy_f)));
+    uint32x2_t inside_half = vand_u32(vget_low_u32(inside), vget_high_u32(inside));
+    if((vget_lane_u32(inside_half, 0) & vget_lane_u32(inside_half, 1)) != 0xFFFFFFFF) {
+      llcv_warp_perspective_pixels_c(src, src_step, src_width, src_height, channels, origin, step, dst, col_index, col_index + kVectorSize);
+      continue;
+    }
+
+    int32_t xs[kVectorSize], ys[kVectorSize];
+    vst1q_s32(xs, x);
+    vst1q_s32(ys, y);
+    for(int i = 0; i < kVectorSize; i++) {
+      llcv_warp_blend(src, src_step, channels, xs[i], ys[i], dst + (col_index + i) * channels);
+    }
+  }
+  llcv_warp_perspective_pixels_c(src, src_step, src_width, src_height, channels, origin, step, dst, col_index, width);
+#undef kVectorSize
+#endif
+}
+
+// Output pixels look up their source positions through the inverse matrix.
+// Returns false if matrix isn't invertible.
+static bool llcv_warp_invert_matrix(const float matrix[9], double inverse[9]) {
+  const float *m = matrix;
+  inverse[0] = (double)m[4] * m[8] - (double)m[5] * m[7];
+  inverse[1] = (double)m[2] * m[7] - (double)m[1] * m[8];
+  inverse[2] = (double)m[1] * m[5] - (double)m[2] * m[4];
+  inverse[3] = (double)m[5] * m[6] - (double)m[3] * m[8];
+  inverse[4] = (double)m[0] * m[8] - (double)m[2] * m[6];
+  inverse[5] = (double)m[2] * m[3] - (double)m[0] * m[5];
+  inverse[6] = (double)m[3] * m[7] - (double)m[4] * m[6];
+  inverse[7] = (double)m[1] * m[6] - (double)m[0] * m[7];
+  inverse[8] = (double)m[0] * m[4] - (double)m[1] * m[3];
+  double determinant = m[0] * inverse[0] + m[1] * inverse[3] + m[2] * inverse[6];
+  if(determinant == 0) {
+    return false;
+  }
+  for(int i = 0; i < 9; i++) {
+    inverse[i] /= determinant;
+  }
+  return true;
+}
+
+DMZ_INTERNAL void llcv_warp_perspective_bilinear(IplImage *src, IplImage *dst, const float matrix[9]) {
+  assert(src->depth == IPL_DEPTH_8U);
+  assert(dst->depth == IPL_DEPTH_8U);
+  assert(src->nChannels == dst->nChannels);
+  assert(dst->nChannels == 1 || dst->nChannels == 3 || dst->nChannels == 4);
+
+  double inverse[9];
+  if(!llcv_warp_invert_matrix(matrix, inverse)) {
+    cvSetZero(dst);
+    return;
+  }
+
+  const dmz_kernel_table *kernels = dmz_kernels();
+  CvSize src_size = cvGetSize(src);
+  CvSize dst_size = cvGetSize(dst);
+  const uint8_t *src_data_origin = (const uint8_t *)llcv_get_data_origin(src);
+  uint8_t *dst_data_origin = (uint8_t *)llcv_get_data_origin(dst);
+
+  // Source position of output pixel (col, row), in homogeneous coordinates, is
+  // row_origin + col * col_step, and row_origin moves along the inverse's middle column from row to row.
+  const float col_step[3] = {(float)inverse[0], (float)inverse[3], (float)inverse[6]};
+  double row_origin[3] = {inverse[2], inverse[5], inverse[8]};
+  for(int row_index = 0; row_index < dst_size.height; row_index++) {
+    const float origin[3] = {(float)row_origin[0], (float)row_origin[1], (float)row_origin[2]};
+    kernels->warp_perspective_row(src_data_origin, src->widthStep, src_size.width, src_size.height, src->nChannels,
+                                  origin, col_step, dst_data_origin + row_index * dst->widthStep, dst_size.width);
+    for(int i = 0; i < 3; i++) {
+      row_origin[i] += inverse[3 * i + 1];
+    }
+  }
+}
+
+#pragma mark fused YCbCr warp
+
+// The fused warp samples Y at each output pixel's source position, and the half size Cb and Cr at half that
+// position, then converts to RGB (with an opaque alpha, for 4 channel output) as llcv_YCbCr2RGB_u8 does.
+// Halving a position is exact in floating point, so this matches warping each plane separately and then converting.
+
+static inline void llcv_warp_perspective_YCbCr_to_RGB_pixels_c(IplImage *y, IplImage *cb, IplImage *cr, const float origin[3], const float step[3], uint8_t *dst, int dst_channels, int first_col, int end_col) {
+  CvSize y_size = cvGetSize(y);
+  CvSize cbcr_size = cvGetSize(cb);
+  const uint8_t *y_data_origin = (const uint8_t *)llcv_get_data_origin(y);
+  const uint8_t *cb_data_origin = (const uint8_t *)llcv_get_data_origin(cb);
+  const uint8_t *cr_data_origin = (const uint8_t *)llcv_get_data_origin(cr);
+
+  for(int col_index = first_col; col_index < end_col; col_index++) {
+    float col = (float)col_index;
+    float w = origin[2] + col * step[2];
+    float inv_w = (w != 0) ? (float)kWarpInterScale / w : 0.0f;
+    float source_x = (origin[0] + col * step[0]) * inv_w;
+    float source_y = (origin[1] + col * step[1]) * inv_w;
+    int chroma_x = llcv_warp_fixed_position(0.5f * source_x);
+    int chroma_y = llcv_warp_fixed_position(0.5f * source_y);
+    uint8_t pix_y, pix_cb, pix_cr;
+    llcv_warp_sample(y_data_origin, y->widthStep, y_size.width, y_size.height, 1, llcv_warp_fixed_position(source_x), llcv_warp_fixed_position(source_y), &pix_y);
+    llcv_warp_sample(cb_data_origin, cb->widthStep, cbcr_size.width, cbcr_size.height, 1, chroma_x, chroma_y, &pix_cb);
+    llcv_warp_sample(cr_data_origin, cr->widthStep, cbcr_size.width, cbcr_size.height, 1, chroma_x, chroma_y, &pix_cr);
+    llcv_YCbCr2RGB_u8_pixel(pix_y, pix_cb, pix_cr, dst + col_index * dst_channels, dst_channels == 4);
+  }
+}
+
+DMZ_INTERNAL void llcv_warp_perspective_YCbCr_to_RGB_row_c(IplImage *y, IplImage *cb, IplImage *cr, const float origin[3], const float step[3], uint8_t *dst, int dst_channels, int width) {
+  llcv_warp_perspective_YCbCr_to_RGB_pixels_c(y, cb, cr, origin, step, dst, dst_channels, 0, width);
+}
+
+#if DMZ_HAS_SSE2_COMPILETIME
+// Converts four pixels, one in each lane, and writes them to dst.
+static inline void llcv_YCbCr2RGB_u8_sse2(__m128i y, __m128i cb, __m128i cr, uint8_t *dst, int dst_channels) {
+  const __m128i chroma_offset = _mm_set1_epi32(128);
+  const __m128i round = _mm_set1_epi32(1 << (kYCbCr2RGBShift - 1));
+  // Each lane gets a (Cb, Cr) pair, for _mm_madd_epi16 against the pair of coefficients for each output.
+  __m128i cbcr = _mm_or_si128(_mm_and_si128(_mm_sub_epi32(cb, chroma_offset), _mm_set1_epi32(0xFFFF)),
+                              _mm_slli_epi32(_mm_sub_epi32(cr, chroma_offset), 16));
+  __m128i r = _mm_madd_epi16(cbcr, _mm_setr_epi16(0, kYCbCr2RGBCrToR, 0, kYCbCr2RGBCrToR, 0, kYCbCr2RGBCrToR, 0, kYCbCr2RGBCrToR));
+  __m128i g = _mm_madd_epi16(cbcr, _mm_setr_epi16(kYCbCr2RGBCbToG, kYCbCr2RGBCrToG, kYCbCr2RGBCbToG, kYCbCr2RGBCrToG,
+                                                  kYCbCr2RGBCbToG, kYCbCr2RGBCrToG, kYCbCr2RGBCbToG, kYCbCr2RGBCrToG));
+  __m128i b = _mm_madd_epi16(cbcr, _mm_setr_epi16(kYCbCr2RGBCbToB, 0, kYCbCr2RGBCbToB, 0, kYCbCr2RGBCbToB, 0, kYCbCr2RGBCbToB, 0));
+  r = _mm_add_epi32(y, _mm_srai_epi32(_mm_add_epi32(r, round), kYCbCr2RGBShift));
+  g = _mm_add_epi32(y, _mm_srai_epi32(_mm_add_epi32(g, round), kYCbCr2RGBShift));
+  b = _mm_add_epi32(y, _mm_srai_epi32(_mm_add_epi32(b, round), kYCbCr2RGBShift));
+
+  // R R R R B B B B G G G G A A A A, then R G R G ... B A B A ..., then R G B A ...
+  __m128i planar = _mm_packus_epi16(_mm_packs_epi32(r, b), _mm_packs_epi32(g, _mm_set1_epi32(0xff)));
+  __m128i pairs = _mm_unpacklo_epi8(planar, _mm_srli_si128(planar, 8));
+  __m128i pixels = _mm_unpacklo_epi16(pairs, _mm_srli_si128(pairs, 8));
+  if(dst_channels == 4) {
+    _mm_storeu_si128((__m128i *)dst, pixels);
+  } else {
+    uint8_t rgba[16];
+    _mm_storeu_si128((__m128i *)rgba, pixels);
+    for(int i = 0; i < 4; i++) {
+      memcpy(dst + i * 3, rgba + i * 4, 3);
+    }
+  }
+}
+#endif
+
+DMZ_INTERNAL void llcv_warp_perspective_YCbCr_to_RGB_row_sse2(IplImage *y, IplImage *cb, IplImage *cr, const float origin[3], const float step[3], uint8_t *dst, int dst_channels, int width) {
+#if DMZ_HAS_SSE2_COMPILETIME
+#define kVectorSize 4
+  CvSize y_size = cvGetSize(y);
+  CvSize cbcr_size = cvGetSize(cb);
+  const uint8_t *y_data_origin = (const uint8_t *)llcv_get_data_origin(y);
+  const uint8_t *cb_data_origin = (const uint8_t *)llcv_get_data_origin(cb);
+  const uint8_t *cr_data_origin = (const uint8_t *)llcv_get_data_origin(cr);
+  const __m128 origin_x = _mm_set1_ps(origin[0]);
+  const __m128 origin_y = _mm_set1_ps(origin[1]);
+  const __m128 origin_w = _mm_set1_ps(origin[2]);
+  const __m128 step_x = _mm_set1_ps(step[0]);
+  const __m128 step_y = _mm_set1_ps(step[1]);
+  const __m128 step_w = _mm_set1_ps(step[2]);
+  const __m128 scale = _mm_set1_ps((float)kWarpInterScale);
+  const __m128 half = _mm_set1_ps(0.5f);
+  __m128 cols = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+  const __m128 cols_step = _mm_set1_ps((float)kVectorSize);
+
+  int col_index = 0;
+  for(; col_index + kVectorSize <= width; col_index += kVectorSize, cols = _mm_add_ps(cols, cols_step)) {
+    __m128 w = _mm_add_ps(origin_w, _mm_mul_ps(cols, step_w));
+    __m128 inv_w = _mm_and_ps(_mm_div_ps(scale, w), _mm_cmpneq_ps(w, _mm_setzero_ps()));
+    __m128 source_x = _mm_mul_ps(_mm_add_ps(origin_x, _mm_mul_ps(cols, step_x)), inv_w);
+    __m128 source_y = _mm_mul_ps(_mm_add_ps(origin_y, _mm_mul_ps(cols, step_y)), inv_w);
+    __m128i luma_x = _mm_cvtps_epi32(source_x);
+    __m128i luma_y = _mm_cvtps_epi32(source_y);
+    __m128i chroma_x = _mm_cvtps_epi32(_mm_mul_ps(source_x, half));
+    __m128i chroma_y = _mm_cvtps_epi32(_mm_mul_ps(source_y, half));
+    __m128i inside = _mm_and_si128(llcv_warp_inside_sse2(luma_x, luma_y, y_size.width - 1, y_size.height - 1),
+                                   llcv_warp_inside_sse2(chroma_x, chroma_y, cbcr_size.width - 1, cbcr_size.height - 1));
+    if(_mm_movemask_epi8(inside) != 0xFFFF) {
+      llcv_warp_perspective_YCbCr_to_RGB_pixels_c(y, cb, cr, origin, step, dst, dst_channels, col_index, col_index + kVectorSize);
+      continue;
+    }
+
+    __m128i top_weights, bottom_weights;
+    const uint8_t *top[kVectorSize];
+    llcv_warp_weights_sse2(luma_x, luma_y, &top_weights, &bottom_weights);
+    llcv_warp_taps_origins_sse2(y_data_origin, y->widthStep, 1, luma_x, luma_y, top);
+    __m128i pix_y = llcv_warp_blend_u8_sse2(top, y->widthStep, top_weights, bottom_weights);
+
+    llcv_warp_weights_sse2(chroma_x, chroma_y, &top_weights, &bottom_weights);
+    llcv_warp_taps_origins_sse2(cb_data_origin, cb->widthStep, 1, chroma_x, chroma_y, top);
+    __m128i pix_cb = llcv_warp_blend_u8_sse2(top, cb->widthStep, top_weights, bottom_weights);
+    llcv_warp_taps_origins_sse2(cr_data_origin, cr->widthStep, 1, chroma_x, chroma_y, top);
+    __m128i pix_cr = llcv_warp_blend_u8_sse2(top, cr->widthStep, top_weights, bottom_weights);
+
+    llcv_YCbCr2RGB_u8_sse2(pix_y, pix_cb, pix_cr, dst + col_index * dst_channels, dst_channels);
+  }
+  llcv_warp_perspective_YCbCr_to_RGB_pixels_c(y, cb, cr, origin, step, dst, dst_channels, col_index, width);
+#undef kVectorSize
+#endif
+}
+
+DMZ_INTERNAL DMZ_TARGET_AVX2 void llcv_warp_perspective_YCbCr_to_RGB_row_avx2(IplImage *y, IplImage *cb, IplImage *cr, const float origin[3], const float step[3], uint8_t *dst, int dst_channels, int width) {
+#if DMZ_HAS_AVX2_COMPILETIME
+#define kVectorSize 8
+  CvSize y_size = cvGetSize(y);
+  CvSize cbcr_size = cvGetSize(cb);
+  const uint8_t *y_data_origin = (const uint8_t *)llcv_get_data_origin(y);
+  const uint8_t *cb_data_origin = (const uint8_t *)llcv_get_data_origin(cb);
+  const uint8_t *cr_data_origin = (const uint8_t *)llcv_get_data_origin(cr);
+  const __m256 origin_x = _mm256_set1_ps(origin[0]);
+  const __m256 origin_y = _mm256_set1_ps(origin[1]);
+  const __m256 origin_w = _mm256_set1_ps(origin[2]);
+  const __m256 step_x = _mm256_set1_ps(step[0]);
+  const __m256 step_y = _mm256_set1_ps(step[1]);
+  const __m256 step_w = _mm256_set1_ps(step[2]);
+  const __m256 scale = _mm256_set1_ps((float)kWarpInterScale);
+  const __m256 half = _mm256_set1_ps(0.5f);
+  __m256 cols = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+  const __m256 cols_step = _mm256_set1_ps((float)kVectorSize);
+
+  int col_index = 0;
+  for(; col_index + kVectorSize <= width; col_index += kVectorSize, cols = _mm256_add_ps(cols, cols_step)) {
+    __m256 w = _mm256_add_ps(origin_w, _mm256_mul_ps(cols, step_w));
+    __m256 inv_w = _mm256_and_ps(_mm256_div_ps(scale, w), _mm256_cmp_ps(w, _mm256_setzero_ps(), _CMP_NEQ_UQ));
+    __m256 source_x = _mm256_mul_ps(_mm256_add_ps(origin_x, _mm256_mul_ps(cols, step_x)), inv_w);
+    __m256 source_y = _mm256_mul_ps(_mm256_add_ps(origin_y, _mm256_mul_ps(cols, step_y)), inv_w);
+    __m256i luma_x = _mm256_cvtps_epi32(source_x);
+    __m256i luma_y = _mm256_cvtps_epi32(source_y);
+    __m256i chroma_x = _mm256_cvtps_epi32(_mm256_mul_ps(source_x, half));
+    __m256i chroma_y = _mm256_cvtps_epi32(_mm256_mul_ps(source_y, half));
+    __m256i inside = _mm256_and_si256(llcv_warp_inside_avx2(luma_x, luma_y, y_size.width - 3, y_size.height - 1),
+                                      llcv_warp_inside_avx2(chroma_x, chroma_y, cbcr_size.width - 3, cbcr_size.height - 1));
+    if(_mm256_movemask_epi8(inside) != -1) {
+      llcv_warp_perspective_YCbCr_to_RGB_pixels_c(y, cb, cr, origin, step, dst, dst_channels, col_index, col_index + kVectorSize);
+      continue;
+    }
+
+    __m256i pix_y = llcv_warp_blend_u8_avx2(y_data_origin, y->widthStep, luma_x, luma_y);
+    __m256i pix_cb = llcv_warp_blend_u8_avx2(cb_data_origin, cb->widthStep, chroma_x, chroma_y);
+    __m256i pix_cr = llcv_warp_blend_u8_avx2(cr_data_origin, cr->widthStep, chroma_x, chroma_y);
+    llcv_YCbCr2RGB_u8_sse2(_mm256_castsi256_si128(pix_y), _mm256_castsi256_si128(pix_cb), _mm256_castsi256_si128(pix_cr),
+                           dst + col_index * dst_channels, dst_channels);
+    llcv_YCbCr2RGB_u8_sse2(_mm256_extracti128_si256(pix_y, 1), _mm256_extracti128_si256(pix_cb, 1), _mm256_extracti128_si256(pix_cr, 1),
+                           dst + (col_index + kVectorSize / 2) * dst_channels, dst_channels);
+  }
+  llcv_warp_perspective_YCbCr_to_RGB_pixels_c(y, cb, cr, origin, step, dst, dst_channels, col_index, width);
+#undef kVectorSize
+#endif
+}
+
+DMZ_INTERNAL void llcv_warp_perspective_YCbCr_to_RGB(IplImage *y, IplImage *cb, IplImage *cr, IplImage *dst, const float matrix[9]) {
+  assert(y->nChannels == 1 && cb->nChannels == 1 && cr->nChannels == 1);
+  assert(y->depth == IPL_DEPTH_8U && cb->depth == IPL_DEPTH_8U && cr->depth == IPL_DEPTH_8U);
+  assert(cb->width == cr->width && cb->height == cr->height);
+  assert(dst->depth == IPL_DEPTH_8U);
+  assert(dst->nChannels == 3 || dst->nChannels == 4);
+
+  double inverse[9];
+  if(!llcv_warp_invert_matrix(matrix, inverse)) {
+    cvSetZero(dst);
+    return;
+  }
+
+  const dmz_kernel_table *kernels = dmz_kernels();
+  CvSize dst_size = cvGetSize(dst);
+  uint8_t *dst_data_origin = (uint8_t *)llcv_get_data_origin(dst);
+
+  // As in llcv_warp_perspective_bilinear
+  const float col_step[3] = {(float)inverse[0], (float)inverse[3], (float)inverse[6]};
+  double row_origin[3] = {inverse[2], inverse[5], inverse[8]};
+  for(int row_index = 0; row_index < dst_size.height; row_index++) {
+    const float origin[3] = {(float)row_origin[0], (float)row_origin[1], (float)row_origin[2]};
+    kernels->warp_perspective_YCbCr_to_RGB_row(y, cb, cr, origin, col_step, dst_data_origin + row_index * dst->widthStep, dst->nChannels, dst_size.width);
+    for(int i = 0; i < 3; i++) {
+      row_origin[i] += inverse[3 * i + 1];
+    }
+  }
+}
+
+#define TEST_WARP_PERSPECTIVE 0
+#define TIME_WARP_PERSPECTIVE 0
+
+#if TIME_WARP_PERSPECTIVE
+static clock_t fastest_dmz = CLOCKS_PER_SEC * 1000;
+static clock_t fastest_opencv = CLOCKS_PER_SEC * 1000;
+#define TIME_WARP_PERSPECTIVE_TIMING_ITERATIONS 100
+#endif
+
+#if TEST_WARP_PERSPECTIVE
+DMZ_INTERNAL void llcv_warp_perspective_opencv(IplImage *src, IplImage *dst, const float matrix[9]) {
+  CvMat *cv_persp_mat = cvCreateMat(3, 3, CV_32FC1);
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 3; c++) {
+      CV_MAT_ELEM(*cv_persp_mat, float, r, c) = matrix[3 * r + c];
+    }
+  }
+  cvWarpPerspective(src, dst, cv_persp_mat, CV_INTER_LINEAR + CV_WARP_FILL_OUTLIERS, cvScalarAll(0));
+  cvReleaseMat(&cv_persp_mat);
+}
+#endif
+
+// llcv_warp_perspective_bilinear, plus the timing and comparison against OpenCV that the flags above turn on.
+DMZ_INTERNAL void llcv_warp_perspective(IplImage *src, IplImage *dst, const float matrix[9]) {
+#if TIME_WARP_PERSPECTIVE
+  clock_t start_dmz = clock();
+  for(int iter = 0; iter < TIME_WARP_PERSPECTIVE_TIMING_ITERATIONS; iter++) {
+#endif
+    llcv_warp_perspective_bilinear(src, dst, matrix);
+#if TIME_WARP_PERSPECTIVE
+  }
+  clock_t elapsed_dmz = clock() - start_dmz;
+  if(elapsed_dmz < fastest_dmz) {
+    fastest_dmz = elapsed_dmz;
+    dmz_debug_log("(llcv_warp_perspective) fastest dmz: %f ms", (1000.0 * (double)fastest_dmz / (double)CLOCKS_PER_SEC) / (double)TIME_WARP_PERSPECTIVE_TIMING_ITERATIONS);
+  }
+#endif
+
+#if TEST_WARP_PERSPECTIVE
+  IplImage *opencv_dst = cvCreateImage(cvGetSize(dst), dst->depth, dst->nChannels);
+#if TIME_WARP_PERSPECTIVE
+  clock_t start_opencv = clock();
+  for(int iter = 0; iter < TIME_WARP_PERSPECTIVE_TIMING_ITERATIONS; iter++) {
+#endif
+    llcv_warp_perspective_opencv(src, opencv_dst, matrix);
+#if TIME_WARP_PERSPECTIVE
+  }
+  clock_t elapsed_opencv = clock() - start_opencv;
+  if(elapsed_opencv < fastest_opencv) {
+    fastest_opencv = elapsed_opencv;
+    dmz_debug_log("(llcv_warp_perspective) fastest opencv: %f ms", (1000.0 * (double)fastest_opencv / (double)CLOCKS_PER_SEC) / (double)TIME_WARP_PERSPECTIVE_TIMING_ITERATIONS);
+  }
+#endif
+
+  // Rounding differs a little between the two, so only count differences of more than 1.
+  int n_errors = 0;
+  int max_error = 0;
+  for(int row_index = 0; row_index < dst->height; row_index++) {
+    const uint8_t *dst_row = (const uint8_t *)(dst->imageData + row_index * dst->widthStep);
+    const uint8_t *opencv_row = (const uint8_t *)(opencv_dst->imageData + row_index * opencv_dst->widthStep);
+    for(int i = 0; i < dst->width * dst->nChannels; i++) {
+      int error = abs(dst_row[i] - opencv_row[i]);
+      n_errors += error > 1;
+      max_error = MAX(max_error, error);
+    }
+  }
+  if(n_errors > 0) {
+    dmz_debug_log("(llcv_warp_perspective) errors: %i, max error: %i", n_errors, max_error);
+  }
+  cvReleaseImage(&opencv_dst);
+#endif
+}
+
 
 
 void llcv_unwarp(dmz_context *dmz, IplImage *input, const dmz_point source_points[4], const dmz_rect to_rect, IplImage *output) {
-	//  dmz_point source_points[4], dest_points[4];
+  float matrix[9];
+  dmz_point dest_points[4];
+  dmz_rect_get_points(to_rect, dest_points);
 
+  // Calculate row-major matrix
+  llcv_calc_persp_transform(matrix, 9, true, source_points, dest_points);
+  llcv_unwarp_with_transform(dmz, input, source_points, matrix, output);
+}
+
+void llcv_unwarp_with_transform(dmz_context *dmz, IplImage *input, const dmz_point source_points[4], const float matrix[9], IplImage *output) {
 #ifdef IOS_DMZ
 	ios_gpu_unwarp(dmz, input, source_points, output);
 #else
@@ -148,27 +912,14 @@ void llcv_unwarp(dmz_context *dmz, IplImage *input, const dmz_point source_point
 #endif
 	if (!dmz_use_gles_warp()) {
 		/* if dmz_use_gles_warp() has changed from above, then we've encountered an error and are falling back to the old way.*/
-
-		// Old-fashioned openCV
-		float matrix[16];
-		dmz_point dest_points[4];
-		dmz_rect_get_points(to_rect, dest_points);
-
-		// Calculate row-major matrix
-		llcv_calc_persp_transform(matrix, 9, true, source_points, dest_points);
-		CvMat *cv_persp_mat = cvCreateMat(3, 3, CV_32FC1);
-		for (int r = 0; r < 3; r++) {
-			for (int c = 0; c < 3; c++) {
-				CV_MAT_ELEM(*cv_persp_mat, float, r, c) = matrix[3 * r + c];
-			}
-		}
-		cvWarpPerspective(input, output, cv_persp_mat, CV_INTER_LINEAR + CV_WARP_FILL_OUTLIERS, cvScalarAll(0));
-		cvReleaseMat(&cv_persp_mat);
+		llcv_warp_perspective(input, output, matrix);
 	}
 #endif // !IOS_DMZ
 }
 
-
+#undef kWarpInterBits
+#undef kWarpInterScale
+#undef kWarpWeightBits
+#undef kWarpWeightRound
 
 #endif
-
@@ -19,6 +19,21 @@ DMZ_INTERNAL bool llcv_warp_auto_upsamples();
 // Image is written to output IplImage.
 void llcv_unwarp(void *dmz, IplImage *input, const dmz_point src_points[4], const dmz_rect dst_rect, IplImage *output);
 
+// As llcv_unwarp, with the transform from src_points to the output already solved by llcv_calc_persp_transform
+// (row-major, 3x3), for callers that warp several planes with the same corners.
+void llcv_unwarp_with_transform(dmz_context *dmz, IplImage *input, const dmz_point src_points[4], const float matrix[9], IplImage *output);
+
+// Warps src into dst with bilinear interpolation, where matrix is a row-major 3x3 perspective transform
+// taking src positions to dst positions. Positions outside src read as 0. Matches
+// cvWarpPerspective(src, dst, matrix, CV_INTER_LINEAR + CV_WARP_FILL_OUTLIERS, cvScalarAll(0)) to within rounding.
+// src and dst are 8 bit, with 1, 3 or 4 channels (the same number for both).
+DMZ_INTERNAL void llcv_warp_perspective_bilinear(IplImage *src, IplImage *dst, const float matrix[9]);
+
+// Warps the card into dst, as llcv_warp_perspective_bilinear would warp each of y, cb and cr, and then
+// converts to RGB, as llcv_YCbCr2RGB_u8 does, in one pass. matrix takes y positions to dst positions;
+// cb and cr are half the size of y. dst is 8 bit, with 3 or 4 channels.
+DMZ_INTERNAL void llcv_warp_perspective_YCbCr_to_RGB(IplImage *y, IplImage *cb, IplImage *cr, IplImage *dst, const float matrix[9]);
+
 // Solves and writes perpsective matrix to the matrixData buffer. 
 // If matrixDataSize >= 16, uses a 4x4 matrix. Otherwise a 3x3. 
 // Specifying rowMajor true writes to the buffer in row major format.
@@ -7,29 +7,106 @@
 #include "dmz.h"
 #include "eigen.h"
 #include "processor_support.h"
+#include "dmz_pool.h"
 #include "geometry.h"
 #include "cv/canny.h"
 #include "cv/convert.h"
 #include "cv/hough.h"
+#include "cv/image_util.h"
 #include "cv/sobel.h"
 #include "cv/stats.h"
 #include "cv/warp.h"
 #include "opencv2/core/core_c.h" // needed for IplImage
 #include "opencv2/imgproc/imgproc.hpp"
 
+// Everything best_line_for_sample needs, kept around so that edge detection doesn't allocate on every frame.
+// The images are headers over the buffers, re-initialized for each detection rect;
+// the buffers grow to fit the largest rect seen, and then stay put.
+// There is one workspace per edge, so that the edges can be searched for concurrently.
+struct dmz_edge_workspace {
+  IplImage dx;
+  IplImage dy;
+  IplImage canny_image;
+  IplImage box; // pixels gathered from a dmz_frame plane that can't be searched in place
+  llcv_buffer dx_data;
+  llcv_buffer dy_data;
+  llcv_buffer canny_image_data;
+  llcv_buffer box_data;
+  llcv_buffer sobel_rows;
+  llcv_canny_workspace canny;
+  llcv_hough_workspace hough;
+};
+
+DMZ_INTERNAL void dmz_edge_workspace_release(dmz_edge_workspace *workspace) {
+  llcv_buffer_release(&workspace->dx_data);
+  llcv_buffer_release(&workspace->dy_data);
+  llcv_buffer_release(&workspace->canny_image_data);
+  llcv_buffer_release(&workspace->box_data);
+  llcv_buffer_release(&workspace->sobel_rows);
+  llcv_canny_workspace_release(&workspace->canny);
+  llcv_hough_workspace_release(&workspace->hough);
+}
+
+// The part of a dmz_frame plane that dmz_transform_card_frame warps, when it can't be warped in place.
+struct dmz_frame_workspace {
+  IplImage image;
+  llcv_buffer image_data;
+};
+
+#define kNumEdges 4
+#define kNumColorPlanes 3
+#define kNumEdgeWorkspaces (kNumEdges * kNumColorPlanes) // one per edge and plane, for speculative plane search
+
 #pragma mark life cycle
 
 dmz_context *dmz_context_create(void) {
   dmz_context *dmz = (dmz_context *) calloc(1, sizeof(dmz_context));
   dmz->mz = mz_create();
+  dmz->edge_workspace = (dmz_edge_workspace *) calloc(kNumEdgeWorkspaces, sizeof(dmz_edge_workspace));
+  dmz->frame_workspace = (dmz_frame_workspace *) calloc(1, sizeof(dmz_frame_workspace));
+  dmz->edge_pool = NULL;
+  dmz->speculative_plane_search = false;
+  dmz->edge_tracking = false;
+  dmz->coarse_to_fine_hough = false;
+  dmz->card_transform.valid = false;
+  dmz_init_kernels();
   return dmz;
 }
 
 void dmz_context_destroy(dmz_context *dmz) {
   mz_destroy(dmz->mz);
+  dmz_pool_destroy(dmz->edge_pool);
+  for(uint8_t i = 0; i < kNumEdgeWorkspaces; i++) {
+    dmz_edge_workspace_release(&dmz->edge_workspace[i]);
+  }
+  free(dmz->edge_workspace);
+  llcv_buffer_release(&dmz->frame_workspace->image_data);
+  free(dmz->frame_workspace);
   free(dmz);
 }
 
+void dmz_context_set_edge_threads(dmz_context *dmz, uint8_t n_threads) {
+  dmz_pool_destroy(dmz->edge_pool);
+  // There are at most twelve searches (four edges, three planes each) to run at once,
+  // and the calling thread takes one of them.
+  uint8_t n_workers = MIN(n_threads, kNumEdgeWorkspaces);
+  n_workers = n_workers > 0 ? n_workers - 1 : 0;
+  dmz->edge_pool = dmz_pool_create(n_workers);
+}
+
+void dmz_context_set_speculative_plane_search(dmz_context *dmz, bool speculative) {
+  dmz->speculative_plane_search = speculative;
+}
+
+void dmz_context_set_edge_tracking(dmz_context *dmz, bool tracking) {
+  dmz->edge_tracking = tracking;
+  memset(&dmz->tracked_edges, 0, sizeof(dmz->tracked_edges)); // start from scratch
+}
+
+void dmz_context_set_coarse_to_fine_hough(dmz_context *dmz, bool coarse_to_fine) {
+  dmz->coarse_to_fine_hough = coarse_to_fine;
+}
+
 void dmz_prepare_for_backgrounding(dmz_context *dmz) {
   mz_prepare_for_backgrounding(dmz->mz);
 }
@@ -64,7 +141,7 @@ void dmz_YCbCr_to_RGB(IplImage *y, IplImage *cb, IplImage *cr, IplImage **rgb) {
 
 void dmz_deinterleave_RGBA_to_R(uint8_t *source, uint8_t *dest, int size) {
 #if DMZ_HAS_NEON_COMPILETIME
-  if (dmz_has_neon_runtime()) {
+  if (dmz_kernels()->isa == DMZ_ISA_NEON) {
     assert(size >= 16); // required for the vectorized handling of leftover_bytes; also, a reasonable expectation!
 
     for (int offset = 0; offset + 15 < size; offset += 16) {
@@ -219,27 +296,32 @@ enum {
 };
 typedef uint8_t LineOrientation;
 
+// How best_line_for_sample runs the hough transform.
+typedef struct {
+  bool coarse_to_fine; // see dmz_context_set_coarse_to_fine_hough
+} HoughOptions;
+
+// When tracking, first look within this much of where the edge was last frame
+#define kEdgeTrackingThetaSlop ((float)(2.0f * (CV_PI / 180.0f)))
+#define kEdgeTrackingRhoSlop 4.0f
+
 #pragma mark: best_line_for_sample
-ParametricLine best_line_for_sample(IplImage *image, LineOrientation expectedOrientation) {
+// If tracked_line is not NULL, lines near it are tried first, and the full search is done only if none is found.
+ParametricLine best_line_for_sample(IplImage *image, LineOrientation expectedOrientation, const ParametricLine *tracked_line, HoughOptions hough_options, dmz_edge_workspace *workspace) {
   bool expected_vertical = expectedOrientation == LineOrientationVertical;
 
   // Calculate dx and dy derivatives; they'll be reused a lot throughout
   CvSize image_size = cvGetSize(image);
   assert(image_size.width > 0 && image_size.height > 0);
   dmz_trace_log("looking for best line in %ix%i patch with orientation:%i", image_size.width, image_size.height, expectedOrientation);
-  IplImage *sobel_scratch = cvCreateImage(cvSize(image_size.height, image_size.width), IPL_DEPTH_16S, 1);
-  assert(sobel_scratch != NULL);
-  IplImage *dx = cvCreateImage(image_size, IPL_DEPTH_16S, 1);
-  assert(dx != NULL);
-  IplImage *dy = cvCreateImage(image_size, IPL_DEPTH_16S, 1);
-  assert(dy != NULL);
-  llcv_sobel7(image, dx, sobel_scratch, 1, 0);
-  llcv_sobel7(image, dy, sobel_scratch, 0, 1);
-  cvReleaseImage(&sobel_scratch);
+  IplImage *dx = llcv_image_in_buffer(&workspace->dx, &workspace->dx_data, image_size, IPL_DEPTH_16S, 1);
+  IplImage *dy = llcv_image_in_buffer(&workspace->dy, &workspace->dy_data, image_size, IPL_DEPTH_16S, 1);
+  double abs_gradient_sum;
+  llcv_sobel7_dx_dy(image, dx, dy, &abs_gradient_sum, &workspace->sobel_rows);
 
   // Calculate the canny image
-  IplImage *canny_image = cvCreateImage(image_size, IPL_DEPTH_8U, 1);
-  llcv_adaptive_canny7_precomputed_sobel(image, canny_image, dx, dy);
+  IplImage *canny_image = llcv_image_in_buffer(&workspace->canny_image, &workspace->canny_image_data, image_size, IPL_DEPTH_8U, 1);
+  llcv_adaptive_canny7_precomputed_sobel(image, canny_image, dx, dy, abs_gradient_sum, &workspace->canny);
 
   // Calculate the hough transform, throwing away edge components with the wrong gradient angles
   int hough_accumulator_threshold = MAX(image_size.width, image_size.height) / kHoughThresholdLengthDivisor;
@@ -247,15 +329,47 @@ ParametricLine best_line_for_sample(IplImage *image, LineOrientation expectedOri
   float theta_min = base_angle - kMaxAngleDeviationAllowed;
   float theta_max = base_angle + kMaxAngleDeviationAllowed;
 
-  CvLinePolar best_line = llcv_hough(canny_image,
-                                     dx, dy,
-                                     1, // rho resolution
-                                     (float)CV_PI / 180.0f, // theta resolution
-                                     hough_accumulator_threshold,
-                                     theta_min,
-                                     theta_max,
-                                     expected_vertical,
-                                     kHoughGradientAngleThreshold);
+  float theta_resolution = (float)CV_PI / 180.0f;
+  llcv_hough_fn hough = hough_options.coarse_to_fine ? llcv_hough_coarse_to_fine : llcv_hough;
+  CvLinePolar best_line;
+  best_line.is_null = true;
+
+  if(tracked_line != NULL) {
+    // Stick to the full search's theta grid, so that we can only find lines that it could have.
+    int n_angles = cvRound((theta_max - theta_min) / theta_resolution);
+    int first_angle = MAX(0, (int)floorf((tracked_line->theta - kEdgeTrackingThetaSlop - theta_min) / theta_resolution));
+    int last_angle = MIN(n_angles, (int)ceilf((tracked_line->theta + kEdgeTrackingThetaSlop - theta_min) / theta_resolution));
+    if(last_angle > first_angle) {
+      best_line = hough(canny_image,
+                             dx, dy,
+                             1, // rho resolution
+                             theta_resolution,
+                             hough_accumulator_threshold,
+                             theta_min + first_angle * theta_resolution,
+                             theta_min + last_angle * theta_resolution,
+                             tracked_line->rho - kEdgeTrackingRhoSlop,
+                             tracked_line->rho + kEdgeTrackingRhoSlop,
+                             expected_vertical,
+                             kHoughGradientAngleThreshold,
+                             &workspace->hough);
+    }
+    dmz_trace_log("tracked line %s", best_line.is_null ? "lost" : "found");
+  }
+
+  if(best_line.is_null) {
+    best_line = hough(canny_image,
+                           dx, dy,
+                           1, // rho resolution
+                           theta_resolution,
+                           hough_accumulator_threshold,
+                           theta_min,
+                           theta_max,
+                           -FLT_MAX,
+                           FLT_MAX,
+                           expected_vertical,
+                           kHoughGradientAngleThreshold,
+                           &workspace->hough);
+  }
   
   ParametricLine ret = ParametricLineNone();
   if(!best_line.is_null) {
@@ -263,9 +377,6 @@ ParametricLine best_line_for_sample(IplImage *image, LineOrientation expectedOri
     ret.theta = best_line.angle;
   }
 
-  cvReleaseImage(&dx);
-  cvReleaseImage(&dy);
-  cvReleaseImage(&canny_image);
   return ret;
 }
 
@@ -275,8 +386,7 @@ bool dmz_found_all_edges(dmz_edges found_edges) {
 }
 
 #pragma mark: detection_boxes_for_sample
-DetectionBoxes detection_boxes_for_sample(IplImage *sample, FrameOrientation orientation) {
-  CvSize size = cvGetSize(sample);
+DetectionBoxes detection_boxes_for_sample(CvSize size, FrameOrientation orientation) {
   dmz_trace_log("detection_boxes_for_sample sized %ix%i with orientation:%i", size.width, size.height, orientation);
   int absolute_inset_vert, absolute_slop_vert, absolute_inset_horiz, absolute_slop_horiz;
 
@@ -339,50 +449,226 @@ DetectionBoxes detection_boxes_for_sample(IplImage *sample, FrameOrientation ori
   return boxes;
 }
 
-#define kNumColorPlanes 3
+#pragma mark: frame planes
+
+#define kSobelBorderSize 3 // how far beyond a detection box the sobel filter may look
+#define kWarpBorderSize 2 // how far beyond the card's corners the warp may look
+
+// One plane (Y, Cb or Cr) to look for edges in or to warp: either an image, or pixels spread
+// through a camera buffer, which have to be gathered into an image first.
+typedef struct {
+  IplImage *image; // the plane, if it can be looked at in place; NULL if it must be gathered
+  IplImage header; // what image points to, for in place planes of a dmz_frame
+  CvSize size;
+  const uint8_t *origin; // for gathering, the plane's top left pixel,
+  int row_step; // the bytes between its rows,
+  int pixel_step; // the bytes between its pixels,
+  int bgra_component; // and for BGRA frames, the YCbCr component to convert to (-1 for other frames)
+} FramePlaneView;
+
+DMZ_INTERNAL void frame_plane_view_for_image(FramePlaneView *view, IplImage *image) {
+  view->image = image;
+  view->size = cvGetSize(image);
+}
+
+// Returns false, leaving view unusable, if the frame's format or the plane is unknown.
+DMZ_INTERNAL bool frame_plane_view_for_frame(FramePlaneView *view, const dmz_frame *frame, FramePlane plane) {
+  if(plane > FramePlaneCr) {
+    return false;
+  }
+
+  bool chroma = plane != FramePlaneY;
+  view->size = chroma ? cvSize((frame->width + 1) / 2, (frame->height + 1) / 2) : cvSize(frame->width, frame->height);
+  view->bgra_component = -1;
+
+  switch(frame->format) {
+    case FramePixelFormatNV21:
+    /* no break */
+    case FramePixelFormatNV12:
+      if(chroma) {
+        bool cb_first = frame->format == FramePixelFormatNV12;
+        view->origin = frame->planes[1] + ((plane == FramePlaneCb) == cb_first ? 0 : 1);
+        view->row_step = frame->strides[1];
+        view->pixel_step = 2;
+      } else {
+        view->origin = frame->planes[0];
+        view->row_step = frame->strides[0];
+        view->pixel_step = 1;
+      }
+      break;
+    case FramePixelFormatI420:
+      view->origin = frame->planes[plane];
+      view->row_step = frame->strides[plane];
+      view->pixel_step = 1;
+      break;
+    case FramePixelFormatYUYV:
+      // chroma is only half size horizontally, so take every other row of it
+      view->origin = frame->planes[0] + (chroma ? (plane == FramePlaneCb ? 1 : 3) : 0);
+      view->row_step = chroma ? 2 * frame->strides[0] : frame->strides[0];
+      view->pixel_step = chroma ? 4 : 2;
+      break;
+    case FramePixelFormatBGRA:
+      // chroma is taken from every other pixel of every other row
+      view->origin = frame->planes[0];
+      view->row_step = chroma ? 2 * frame->strides[0] : frame->strides[0];
+      view->pixel_step = chroma ? 8 : 4;
+      view->bgra_component = plane;
+      break;
+    default:
+      return false;
+  }
+
+  if(view->pixel_step == 1) {
+    view->image = cvInitImageHeader(&view->header, view->size, IPL_DEPTH_8U, 1, IPL_ORIGIN_TL, 4);
+    cvSetData(view->image, (void *)view->origin, view->row_step);
+  } else {
+    view->image = NULL;
+  }
+  return true;
+}
+
+// Returns rect, less any part of it outside of an image of the given size.
+DMZ_INTERNAL CvRect rect_within_size(CvRect rect, CvSize size) {
+  int left = MAX(rect.x, 0);
+  int top = MAX(rect.y, 0);
+  int right = MIN(rect.x + rect.width, size.width);
+  int bottom = MIN(rect.y + rect.height, size.height);
+  return cvRect(left, top, MAX(right - left, 0), MAX(bottom - top, 0));
+}
+
+// Gathers the pixels of a plane that isn't in place within rect (which must lie within the plane) into an image in buffer.
+DMZ_INTERNAL IplImage *frame_plane_gather(const FramePlaneView *view, CvRect rect, IplImage *header, llcv_buffer *buffer) {
+  assert(view->image == NULL);
+  IplImage *image = llcv_image_in_buffer(header, buffer, cvSize(rect.width, rect.height), IPL_DEPTH_8U, 1);
+  const uint8_t *origin = view->origin + rect.y * view->row_step + rect.x * view->pixel_step;
+  if(view->bgra_component >= 0) {
+    llcv_gather_BGRA_to_YCbCr_u8(origin, view->row_step, view->pixel_step, view->bgra_component, image);
+  } else {
+    llcv_gather_u8(origin, view->row_step, view->pixel_step, image);
+  }
+  return image;
+}
 
 #pragma mark: find_line_in_detection_rects
-void find_line_in_detection_rects(IplImage **samples, float *rho_multiplier, CvRect *detection_rects, dmz_found_edge *found_edge, LineOrientation line_orientation) {
+// tracked_edge, if found, is where the edge was last frame, in the same coordinates as the result.
+DMZ_INTERNAL dmz_found_edge find_line_in_detection_rect(const FramePlaneView *plane, float rho_multiplier, CvRect detection_rect, LineOrientation line_orientation,
+                                                        const dmz_found_edge *tracked_edge, HoughOptions hough_options, dmz_edge_workspace *workspace) {
+  assert(plane != NULL);
+  #if DMZ_TRACE
+  dmz_trace_log("sample has size %ix%i", plane->size.width, plane->size.height);
+  dmz_trace_log("detection_rect {x:%i y:%i w:%i h:%i}", detection_rect.x, detection_rect.y, detection_rect.width, detection_rect.height);
+  #endif
+  // Look through a view, rather than setting the sample's ROI, since other searches may be
+  // looking at the same sample at the same time.
+  IplImage image;
+  IplROI image_roi;
+  if(plane->image != NULL) {
+    llcv_image_view(&image, &image_roi, plane->image, detection_rect);
+  } else {
+    // Gather just the detection rect, and what the sobel filter looks at around it, and look at the rect within that.
+    CvRect gather_rect = rect_within_size(cvInsetRect(detection_rect, -kSobelBorderSize, -kSobelBorderSize), plane->size);
+    IplImage *box = frame_plane_gather(plane, gather_rect, &workspace->box, &workspace->box_data);
+    CvRect box_rect = cvRect(detection_rect.x - gather_rect.x, detection_rect.y - gather_rect.y, detection_rect.width, detection_rect.height);
+    llcv_image_view(&image, &image_roi, box, box_rect);
+  }
+
+  // Move the tracked edge into the detection rect's coordinates (the inverse of what we do to local_edge below).
+  ParametricLine local_tracked_line;
+  bool tracking = tracked_edge != NULL && tracked_edge->found;
+  if(tracking) {
+    local_tracked_line.theta = tracked_edge->location.theta;
+    local_tracked_line.rho = tracked_edge->location.rho / rho_multiplier
+                             - detection_rect.x * cosf(local_tracked_line.theta)
+                             - detection_rect.y * sinf(local_tracked_line.theta);
+  }
+
+  ParametricLine local_edge = best_line_for_sample(&image, line_orientation, tracking ? &local_tracked_line : NULL, hough_options, workspace);
+  dmz_trace_log("local_edge - {rho:%f theta:%f}", local_edge.rho, local_edge.theta);
+
+  dmz_found_edge found_edge;
+  found_edge.location = lineByShiftingOrigin(local_edge, detection_rect.x, detection_rect.y);
+  found_edge.location.rho *= rho_multiplier;
+  found_edge.found = !is_parametric_line_none(found_edge.location);
+  return found_edge;
+}
+
+void find_line_in_detection_rects(const FramePlaneView *planes, float *rho_multiplier, CvRect *detection_rects, dmz_found_edge *found_edge, LineOrientation line_orientation,
+                                  const dmz_found_edge *tracked_edge, HoughOptions hough_options, dmz_edge_workspace *workspace) {
   assert(detection_rects != NULL);
   assert(found_edge != NULL);
-  assert(samples != NULL);
+  assert(planes != NULL);
   dmz_trace_log("inputs to find_line_in_detection_rects are valid");
   for(int i = 0; i < kNumColorPlanes && !found_edge->found; i++) {
-    IplImage *image = samples[i];
-    assert(image != NULL);
-    #if DMZ_TRACE
-    CvSize imageSize = cvGetSize(image);
-    dmz_trace_log("sample %i has size %ix%i", i, imageSize.width, imageSize.height);
-    CvRect r = detection_rects[i];
-    dmz_trace_log("detection_rect {x:%i y:%i w:%i h:%i}", r.x, r.y, r.width, r.height);
-    #endif
-    cvSetImageROI(image, detection_rects[i]);
-    ParametricLine local_edge = best_line_for_sample(image, line_orientation);
-    dmz_trace_log("local_edge - {rho:%f theta:%f}", local_edge.rho, local_edge.theta);
-    cvResetImageROI(image);
-    found_edge->location = lineByShiftingOrigin(local_edge, detection_rects[i].x, detection_rects[i].y);
-    found_edge->location.rho *= rho_multiplier[i];
-    found_edge->found = !is_parametric_line_none(found_edge->location);
+    *found_edge = find_line_in_detection_rect(&planes[i], rho_multiplier[i], detection_rects[i], line_orientation, tracked_edge, hough_options, workspace);
   }
   dmz_trace_log("resulting edge - {found:%i ...}", found_edge->found);
 }
 
+typedef struct {
+  const FramePlaneView *planes;
+  float *rho_multiplier;
+  CvRect detection_rects[kNumEdges][kNumColorPlanes];
+  dmz_found_edge *found_edges[kNumEdges];
+  LineOrientation line_orientations[kNumEdges];
+  dmz_found_edge tracked_edges[kNumEdges]; // from the previous frame, when tracking; otherwise none found
+  HoughOptions hough_options;
+  dmz_edge_workspace *workspaces; // kNumEdgeWorkspaces of them, indexed by edge * kNumColorPlanes + plane
+  dmz_found_edge plane_edges[kNumEdges][kNumColorPlanes]; // for speculative plane search only
+} EdgeSearch;
+
+// One task per edge; tries each plane in turn, as needed.
+DMZ_INTERNAL void find_line_for_edge_search(void *context, uint32_t edge) {
+  EdgeSearch *search = (EdgeSearch *)context;
+  find_line_in_detection_rects(search->planes, search->rho_multiplier, search->detection_rects[edge],
+                               search->found_edges[edge], search->line_orientations[edge],
+                               &search->tracked_edges[edge], search->hough_options, &search->workspaces[edge * kNumColorPlanes]);
+}
+
+// One task per edge and plane, for speculative plane search.
+DMZ_INTERNAL void find_line_in_plane_for_edge_search(void *context, uint32_t edge_plane) {
+  EdgeSearch *search = (EdgeSearch *)context;
+  uint32_t edge = edge_plane / kNumColorPlanes;
+  uint32_t plane = edge_plane % kNumColorPlanes;
+  search->plane_edges[edge][plane] = find_line_in_detection_rect(&search->planes[plane], search->rho_multiplier[plane],
+                                                                 search->detection_rects[edge][plane], search->line_orientations[edge],
+                                                                 &search->tracked_edges[edge], search->hough_options, &search->workspaces[edge_plane]);
+}
+
 bool dmz_detect_edges(IplImage *y_sample, IplImage *cb_sample, IplImage *cr_sample,
                       FrameOrientation orientation, dmz_edges *found_edges, dmz_corner_points *corner_points) {
-  assert(y_sample != NULL);
-  assert(cb_sample != NULL);
-  assert(cr_sample != NULL);
+  dmz_edge_workspace edge_workspaces[kNumEdgeWorkspaces];
+  memset(edge_workspaces, 0, sizeof(edge_workspaces));
+  dmz_context dmz;
+  dmz.mz = NULL;
+  dmz.edge_workspace = edge_workspaces;
+  dmz.frame_workspace = NULL;
+  dmz.edge_pool = NULL;
+  dmz.speculative_plane_search = false;
+  dmz.edge_tracking = false;
+  dmz.coarse_to_fine_hough = false;
+
+  bool found_all_corners = dmz_detect_edges_with_context(&dmz, y_sample, cb_sample, cr_sample, orientation, found_edges, corner_points);
+
+  for(uint8_t i = 0; i < kNumEdgeWorkspaces; i++) {
+    dmz_edge_workspace_release(&edge_workspaces[i]);
+  }
+  return found_all_corners;
+}
+
+// The guts of dmz_detect_edges_with_context and dmz_detect_edges_in_frame.
+DMZ_INTERNAL bool dmz_detect_edges_in_planes(dmz_context *dmz, const FramePlaneView *planes,
+                                             FrameOrientation orientation, dmz_edges *found_edges, dmz_corner_points *corner_points) {
+  assert(dmz != NULL && dmz->edge_workspace != NULL);
   assert(found_edges != NULL);
   assert(corner_points != NULL);
 
   dmz_trace_log("dmz_detect_edges");
 
-  IplImage *samples[kNumColorPlanes] = {y_sample, cb_sample, cr_sample};
   DetectionBoxes boxes[kNumColorPlanes];
   float rho_multiplier[kNumColorPlanes] = {1.0f, 2.0f, 2.0f}; // cb and cr are half the size of Y
 
   for(int i = 0; i < kNumColorPlanes; i++) {
-    boxes[i] = detection_boxes_for_sample(samples[i], orientation);
+    boxes[i] = detection_boxes_for_sample(planes[i].size, orientation);
   }
 
   dmz_trace_log("got boxes, looking for lines...");
@@ -392,31 +678,58 @@ bool dmz_detect_edges(IplImage *y_sample, IplImage *cb_sample, IplImage *cr_samp
   found_edges->left.found = 0;
   found_edges->right.found = 0;
 
-  CvRect detection_rects[kNumColorPlanes];
-
-  for(uint8_t i = 0; i < kNumColorPlanes; i++) {
-    detection_rects[i] = boxes[i].top;
+  EdgeSearch search;
+  search.planes = planes;
+  search.rho_multiplier = rho_multiplier;
+  search.workspaces = dmz->edge_workspace;
+  search.found_edges[0] = &found_edges->top;
+  search.found_edges[1] = &found_edges->bottom;
+  search.found_edges[2] = &found_edges->left;
+  search.found_edges[3] = &found_edges->right;
+  search.line_orientations[0] = LineOrientationHorizontal;
+  search.line_orientations[1] = LineOrientationHorizontal;
+  search.line_orientations[2] = LineOrientationVertical;
+  search.line_orientations[3] = LineOrientationVertical;
+  for(uint8_t edge = 0; edge < kNumEdges; edge++) {
+    search.tracked_edges[edge].found = 0;
+  }
+  search.hough_options.coarse_to_fine = dmz->coarse_to_fine_hough;
+  if(dmz->edge_tracking) {
+    search.tracked_edges[0] = dmz->tracked_edges.top;
+    search.tracked_edges[1] = dmz->tracked_edges.bottom;
+    search.tracked_edges[2] = dmz->tracked_edges.left;
+    search.tracked_edges[3] = dmz->tracked_edges.right;
   }
-  find_line_in_detection_rects(samples, rho_multiplier, detection_rects, &found_edges->top, LineOrientationHorizontal);
-  dmz_trace_log("dmz top edge? %i", found_edges->top.found);
-
   for(uint8_t i = 0; i < kNumColorPlanes; i++) {
-    detection_rects[i] = boxes[i].bottom;
+    search.detection_rects[0][i] = boxes[i].top;
+    search.detection_rects[1][i] = boxes[i].bottom;
+    search.detection_rects[2][i] = boxes[i].left;
+    search.detection_rects[3][i] = boxes[i].right;
   }
-  find_line_in_detection_rects(samples, rho_multiplier, detection_rects, &found_edges->bottom, LineOrientationHorizontal);
-  dmz_trace_log("dmz bottom edge? %i", found_edges->bottom.found);
 
-  for(uint8_t i = 0; i < kNumColorPlanes; i++) {
-    detection_rects[i] = boxes[i].left;
+  // The edges are independent of each other, so look for them all at once if we have the threads for it.
+  if(dmz->speculative_plane_search) {
+    // Look in every plane at once, then keep what the in-order search would have found:
+    // the first plane with a line, or else the last plane's (empty) result.
+    dmz_pool_run(dmz->edge_pool, find_line_in_plane_for_edge_search, &search, kNumEdgeWorkspaces);
+    for(uint8_t edge = 0; edge < kNumEdges; edge++) {
+      for(uint8_t plane = 0; plane < kNumColorPlanes && !search.found_edges[edge]->found; plane++) {
+        *search.found_edges[edge] = search.plane_edges[edge][plane];
+      }
+    }
+  } else {
+    dmz_pool_run(dmz->edge_pool, find_line_for_edge_search, &search, kNumEdges);
   }
-  find_line_in_detection_rects(samples, rho_multiplier, detection_rects, &found_edges->left, LineOrientationVertical);
+
+  dmz_trace_log("dmz top edge? %i", found_edges->top.found);
+  dmz_trace_log("dmz bottom edge? %i", found_edges->bottom.found);
   dmz_trace_log("dmz left edge? %i", found_edges->left.found);
+  dmz_trace_log("dmz right edge? %i", found_edges->right.found);
 
-  for(uint8_t i = 0; i < kNumColorPlanes; i++) {
-    detection_rects[i] = boxes[i].right;
+  if(dmz->edge_tracking) {
+    // An edge that wasn't found this frame gets the full search next frame.
+    dmz->tracked_edges = *found_edges;
   }
-  find_line_in_detection_rects(samples, rho_multiplier, detection_rects, &found_edges->right, LineOrientationVertical);
-  dmz_trace_log("dmz right edge? %i", found_edges->right.found);
 
   // Find corner intersections
   bool found_all_corners = true;
@@ -437,11 +750,36 @@ bool dmz_detect_edges(IplImage *y_sample, IplImage *cb_sample, IplImage *cr_samp
   return found_all_corners;
 }
 
+bool dmz_detect_edges_with_context(dmz_context *dmz, IplImage *y_sample, IplImage *cb_sample, IplImage *cr_sample,
+                                   FrameOrientation orientation, dmz_edges *found_edges, dmz_corner_points *corner_points) {
+  assert(y_sample != NULL);
+  assert(cb_sample != NULL);
+  assert(cr_sample != NULL);
+
+  FramePlaneView planes[kNumColorPlanes];
+  frame_plane_view_for_image(&planes[0], y_sample);
+  frame_plane_view_for_image(&planes[1], cb_sample);
+  frame_plane_view_for_image(&planes[2], cr_sample);
+  return dmz_detect_edges_in_planes(dmz, planes, orientation, found_edges, corner_points);
+}
+
+bool dmz_detect_edges_in_frame(dmz_context *dmz, const dmz_frame *frame,
+                               FrameOrientation orientation, dmz_edges *found_edges, dmz_corner_points *corner_points) {
+  assert(frame != NULL);
+
+  FramePlaneView planes[kNumColorPlanes];
+  for(uint8_t i = 0; i < kNumColorPlanes; i++) {
+    if(!frame_plane_view_for_frame(&planes[i], frame, i)) {
+      return false;
+    }
+  }
+  return dmz_detect_edges_in_planes(dmz, planes, orientation, found_edges, corner_points);
+}
+
 #pragma mark transform
 
-void dmz_transform_card(dmz_context *dmz, IplImage *sample, dmz_corner_points corner_points, FrameOrientation orientation, bool upsample, IplImage **transformed) {
-  
-  dmz_point src_points[4];
+// The card's corners, in the order that dmz_rect_get_points lists the corners of the card image.
+DMZ_INTERNAL void dmz_card_source_points(dmz_corner_points corner_points, FrameOrientation orientation, dmz_point src_points[4]) {
   switch(orientation) {
     case FrameOrientationPortrait:
       src_points[0] = corner_points.bottom_left;
@@ -468,20 +806,48 @@ void dmz_transform_card(dmz_context *dmz, IplImage *sample, dmz_corner_points co
       src_points[3] = corner_points.bottom_left;
       break;
   }
-  
-  if(upsample) {
-    if(!llcv_warp_auto_upsamples()) {
-      // upsample source_points, since CbCr are half size.
-      for(unsigned int i = 0; i < sizeof(dmz_corner_points) / sizeof(dmz_point); i++) {
-        src_points[i].x /= 2.0f;
-        src_points[i].y /= 2.0f;
-      }    
-    }
+}
+
+// The transform from full size coordinates to the card image, solved only when the corners change,
+// so that Y, Cb and Cr share one solve. Without a dmz_context (as from the python bindings), it is solved every time.
+DMZ_INTERNAL void dmz_card_transform_matrix(dmz_context *dmz, dmz_corner_points corner_points, FrameOrientation orientation, float matrix[9]) {
+  dmz_card_transform local_transform;
+  local_transform.valid = false;
+  dmz_card_transform *card_transform = (dmz != NULL) ? &dmz->card_transform : &local_transform;
+  if(!card_transform->valid || card_transform->orientation != orientation ||
+     memcmp(&card_transform->corner_points, &corner_points, sizeof(corner_points)) != 0) {
+    dmz_point src_points[4];
+    dmz_point dst_points[4];
+    dmz_card_source_points(corner_points, orientation, src_points);
+    // Destination rectangle is the same as the size of the image
+    dmz_rect_get_points(dmz_create_rect(0, 0, kCreditCardTargetWidth - 1, kCreditCardTargetHeight - 1), dst_points);
+    llcv_calc_persp_transform(card_transform->matrix, 9, true, src_points, dst_points);
+    card_transform->corner_points = corner_points;
+    card_transform->orientation = orientation;
+    card_transform->valid = true;
   }
-  
-  // Destination rectangle is the same as the size of the image
-  dmz_rect dst_rect = dmz_create_rect(0, 0, kCreditCardTargetWidth - 1, kCreditCardTargetHeight - 1);
-  
+  memcpy(matrix, card_transform->matrix, sizeof(card_transform->matrix));
+}
+
+// Warps a sample whose coordinates are full size coordinates * scale - offset.
+DMZ_INTERNAL void dmz_transform_card_plane(dmz_context *dmz, IplImage *sample, dmz_corner_points corner_points, FrameOrientation orientation, float scale, dmz_point offset, IplImage **transformed) {
+  dmz_point src_points[4];
+  dmz_card_source_points(corner_points, orientation, src_points);
+  for(int i = 0; i < 4; i++) {
+    src_points[i].x = src_points[i].x * scale - offset.x;
+    src_points[i].y = src_points[i].y * scale - offset.y;
+  }
+
+  // Full size coordinates are (sample coordinates + offset) / scale; fold that into the full size transform.
+  float card_matrix[9];
+  dmz_card_transform_matrix(dmz, corner_points, orientation, card_matrix);
+  float matrix[9];
+  for(int r = 0; r < 3; r++) {
+    matrix[3 * r] = card_matrix[3 * r] / scale;
+    matrix[3 * r + 1] = card_matrix[3 * r + 1] / scale;
+    matrix[3 * r + 2] = card_matrix[3 * r + 2] + (card_matrix[3 * r] * offset.x + card_matrix[3 * r + 1] * offset.y) / scale;
+  }
+
   int nChannels = sample->nChannels;
 #if ANDROID_USE_GLES_WARP
   // override because OpenGLES 1.1 only supports RGBA in glReadPixels!!
@@ -492,7 +858,62 @@ void dmz_transform_card(dmz_context *dmz, IplImage *sample, dmz_corner_points co
   if (*transformed == NULL) {
 	  *transformed = cvCreateImage(cvSize(kCreditCardTargetWidth, kCreditCardTargetHeight), sample->depth, nChannels);
   }
-  llcv_unwarp(dmz, sample, src_points, dst_rect, *transformed);
+  llcv_unwarp_with_transform(dmz, sample, src_points, matrix, *transformed);
+}
+
+void dmz_transform_card(dmz_context *dmz, IplImage *sample, dmz_corner_points corner_points, FrameOrientation orientation, bool upsample, IplImage **transformed) {
+  // upsample source_points, since CbCr are half size.
+  float scale = (upsample && !llcv_warp_auto_upsamples()) ? 0.5f : 1.0f;
+  dmz_transform_card_plane(dmz, sample, corner_points, orientation, scale, dmz_create_point(0, 0), transformed);
+}
+
+void dmz_transform_card_frame(dmz_context *dmz, const dmz_frame *frame, FramePlane plane, dmz_corner_points corner_points, FrameOrientation orientation, IplImage **transformed) {
+  assert(frame != NULL);
+  FramePlaneView view;
+  if(!frame_plane_view_for_frame(&view, frame, plane)) {
+    return;
+  }
+  bool upsample = plane != FramePlaneY;
+
+  if(view.image != NULL) {
+    dmz_transform_card(dmz, view.image, corner_points, orientation, upsample, transformed);
+    return;
+  }
+
+  // Gather only the part of the plane that the card covers, and offset the corners to match.
+  // A warp that does its own upsampling needs the whole plane.
+  CvRect gather_rect = cvRect(0, 0, view.size.width, view.size.height);
+  float scale = (upsample && !llcv_warp_auto_upsamples()) ? 0.5f : 1.0f; // corner points are in Y's coordinates
+  if(!llcv_warp_auto_upsamples()) {
+    float min_x = scale * MIN(MIN(corner_points.top_left.x, corner_points.bottom_left.x), MIN(corner_points.top_right.x, corner_points.bottom_right.x));
+    float max_x = scale * MAX(MAX(corner_points.top_left.x, corner_points.bottom_left.x), MAX(corner_points.top_right.x, corner_points.bottom_right.x));
+    float min_y = scale * MIN(MIN(corner_points.top_left.y, corner_points.bottom_left.y), MIN(corner_points.top_right.y, corner_points.bottom_right.y));
+    float max_y = scale * MAX(MAX(corner_points.top_left.y, corner_points.bottom_left.y), MAX(corner_points.top_right.y, corner_points.bottom_right.y));
+    CvRect card_rect = cvRect((int)floorf(min_x) - kWarpBorderSize, (int)floorf(min_y) - kWarpBorderSize,
+                              (int)ceilf(max_x) - (int)floorf(min_x) + 2 * kWarpBorderSize + 1,
+                              (int)ceilf(max_y) - (int)floorf(min_y) + 2 * kWarpBorderSize + 1);
+    card_rect = rect_within_size(card_rect, view.size);
+    if(card_rect.width > 0 && card_rect.height > 0) {
+      gather_rect = card_rect;
+    }
+  }
+
+  // Like dmz_transform_card, this works without a context (or with one that has no frame workspace),
+  // at the cost of a buffer allocated and freed by each call.
+  dmz_frame_workspace local_workspace = {};
+  dmz_frame_workspace *workspace = (dmz != NULL && dmz->frame_workspace != NULL) ? dmz->frame_workspace : &local_workspace;
+  IplImage *gathered = frame_plane_gather(&view, gather_rect, &workspace->image, &workspace->image_data);
+  dmz_transform_card_plane(dmz, gathered, corner_points, orientation, scale, dmz_create_point(gather_rect.x, gather_rect.y), transformed);
+  llcv_buffer_release(&local_workspace.image_data);
+}
+
+void dmz_transform_card_rgb(dmz_context *dmz, IplImage *y, IplImage *cb, IplImage *cr, dmz_corner_points corner_points, FrameOrientation orientation, IplImage **rgb) {
+  float matrix[9];
+  dmz_card_transform_matrix(dmz, corner_points, orientation, matrix);
+  if (*rgb == NULL) {
+    *rgb = cvCreateImage(cvSize(kCreditCardTargetWidth, kCreditCardTargetHeight), IPL_DEPTH_8U, 3);
+  }
+  llcv_warp_perspective_YCbCr_to_RGB(y, cb, cr, *rgb, matrix);
 }
 
 void dmz_blur_card(IplImage* cardImageRGB, ScannerState* state, int unblurDigits)
@@ -605,7 +1026,10 @@ void dmz_best_expiry_seg(IplImage *card_y, uint16_t starting_y_offset, CythonGro
   GroupedRectsList expiry_groups;
   GroupedRectsList name_groups;
   
-  best_expiry_seg(card_y, starting_y_offset, expiry_groups, name_groups);
+  ScanScratch scratch;
+  scan_scratch_initialize(&scratch);
+  best_expiry_seg(card_y, starting_y_offset, expiry_groups, name_groups, &scratch);
+  scan_scratch_destroy(&scratch);
 
   *cython_expiry_groups = (CythonGroupedRects *) malloc(expiry_groups.size() * sizeof(CythonGroupedRects));
   
@@ -637,7 +1061,10 @@ void dmz_expiry_extract(IplImage *card_y,
     new_groups.push_back(cythonGroupedRects_to_GroupedRects(*cython_new_groups + index));
   }
   
-  expiry_extract(card_y, expiry_groups, new_groups, expiry_month, expiry_year);
+  ScanScratch scratch;
+  scan_scratch_initialize(&scratch);
+  expiry_extract(card_y, expiry_groups, new_groups, expiry_month, expiry_year, &scratch);
+  scan_scratch_destroy(&scratch);
   
   *number_of_expiry_groups = expiry_groups.size();
   
@@ -662,7 +1089,10 @@ void dmz_expiry_extract_group(IplImage *card_y,
 
   ExpiryGroupScores old_scores = cythonScores_to_ExpiryGroupScores(cython_group.scores);
   
-  expiry_extract_group(card_y, group, old_scores, expiry_month, expiry_year);
+  ScanScratch scratch;
+  scan_scratch_initialize(&scratch);
+  expiry_extract_group(card_y, group, old_scores, expiry_month, expiry_year, &scratch);
+  scan_scratch_destroy(&scratch);
 
   for (int character_index = 0; character_index < kExpiryMaxValidLength; character_index++) {
     for (int digit_value = 0; digit_value < 10; digit_value++) {
@@ -15,10 +15,35 @@
 
 /******* Types *******/
 
+typedef struct dmz_edge_workspace dmz_edge_workspace; // Defined in dmz.cpp
+typedef struct dmz_frame_workspace dmz_frame_workspace; // Defined in dmz.cpp
+
+// Layouts of camera buffers that can be handed to the dmz as they are, in a dmz_frame.
+enum {
+  FramePixelFormatNV21 = 0, // a Y plane, then a half size plane of interleaved Cr, Cb (Android's default)
+  FramePixelFormatNV12 = 1, // a Y plane, then a half size plane of interleaved Cb, Cr (iOS's bi-planar YCbCr)
+  FramePixelFormatI420 = 2, // a Y plane, then half size Cb and Cr planes
+  FramePixelFormatYUYV = 3, // a single plane of Y0 Cb Y1 Cr, for each pair of pixels
+  FramePixelFormatBGRA = 4, // a single plane of B G R A
+};
+typedef uint8_t FramePixelFormat;
+
+// The planes of a frame that the dmz works with. Chroma planes are half size, whatever the frame's format.
+enum {
+  FramePlaneY = 0,
+  FramePlaneCb = 1,
+  FramePlaneCr = 2,
+};
+typedef uint8_t FramePlane;
+
+// A camera buffer, described rather than copied. The dmz only reads from it.
 typedef struct {
-  // TODO - add fields that persist over life of a dmz
-  void *mz; // Pointer to whatever is needed for your platform's mz implementation
-} dmz_context;
+  FramePixelFormat format;
+  int width; // in pixels, of the full size (Y) image
+  int height;
+  const uint8_t *planes[3]; // as many as the format has, in the order listed above
+  int strides[3]; // bytes from one row of each plane to the next
+} dmz_frame;
 
 typedef struct {
   float rho;
@@ -37,6 +62,27 @@ typedef struct {
   dmz_found_edge right;
 } dmz_edges;
 
+// The perspective transform that dmz_transform_card solved last, and the corners it was solved for.
+typedef struct {
+  bool valid;
+  dmz_corner_points corner_points;
+  FrameOrientation orientation;
+  float matrix[9]; // row-major, from full size (Y plane) coordinates to the card image
+} dmz_card_transform;
+
+typedef struct {
+  // TODO - add fields that persist over life of a dmz
+  void *mz; // Pointer to whatever is needed for your platform's mz implementation
+  dmz_edge_workspace *edge_workspace; // Edge detection images and buffers, one set per edge and color plane, reused from frame to frame
+  dmz_frame_workspace *frame_workspace; // Pixels gathered from a dmz_frame by dmz_transform_card_frame, reused from frame to frame
+  struct dmz_pool *edge_pool; // Worker threads for edge detection; NULL (the default) to detect edges on the calling thread
+  bool speculative_plane_search; // See dmz_context_set_speculative_plane_search
+  bool edge_tracking; // See dmz_context_set_edge_tracking
+  dmz_edges tracked_edges; // When edge_tracking, the edges found in the previous frame
+  bool coarse_to_fine_hough; // See dmz_context_set_coarse_to_fine_hough
+  dmz_card_transform card_transform; // Reused for every plane warped with the same corners
+} dmz_context;
+
 /******* Functions *******/
 
 
@@ -48,6 +94,31 @@ dmz_context *dmz_context_create(void);
 // Clean up and release dmz pointer created by dmz_init. Should be called once, after dmz use is complete.
 void dmz_context_destroy(dmz_context *dmz);
 
+// Detect the four card edges using up to n_threads threads at once (the calling thread, plus n_threads - 1
+// workers owned by dmz). 0 or 1, the default, detects edges on the calling thread only. Either way,
+// dmz_detect_edges_with_context gives identical results.
+void dmz_context_set_edge_threads(dmz_context *dmz, uint8_t n_threads);
+
+// Each edge is looked for in Y, and then only if need be in Cb, and then Cr. With speculative plane search,
+// all three planes are searched at once, and the first of them (in that order) with a line still wins,
+// so results are unchanged. Worthwhile only with edge threads to spare (up to 12 are useful): the worst case
+// then takes as long as the slowest plane rather than all three, at the cost of extra work when Y suffices.
+// Off by default.
+void dmz_context_set_speculative_plane_search(dmz_context *dmz, bool speculative);
+
+// With edge tracking, each edge is first looked for within a narrow window (a couple of degrees and a few
+// pixels) around where it was found in the previous frame, and the full search is done only if that fails.
+// Cheaper while the card is held steady, which is most of the time, but an edge found this way is not
+// necessarily the one the full search would have found. Off by default. Turning it on or off forgets the
+// previous frame.
+void dmz_context_set_edge_tracking(dmz_context *dmz, bool tracking);
+
+// With coarse to fine hough, each edge is first looked for at half the usual rho and theta resolution, and then
+// at full resolution only near the best coarse line. The line found is then refined to a fraction of a degree
+// and a fraction of a pixel. Less work, and usually more precise corners for dmz_transform_card, but a faint
+// edge next to a stronger one can occasionally be missed. Off by default.
+void dmz_context_set_coarse_to_fine_hough(dmz_context *dmz, bool coarse_to_fine);
+
 // Perform any necessary operations prior to app backgrounding (e.g., calling glFinish() on any OpenGL contexts)
 void dmz_prepare_for_backgrounding(dmz_context *dmz);
 
@@ -81,9 +152,21 @@ bool dmz_found_all_edges(dmz_edges found_edges);
 
 // Detect card edges, and calculate the corner points if all four edges have been detected.
 // The boolean return value indicates whether a card was successfully detected.
+bool dmz_detect_edges_with_context(dmz_context *dmz, IplImage *y_sample, IplImage *cb_sample, IplImage *cr_sample,
+                                   FrameOrientation orientation, dmz_edges *found_edges, dmz_corner_points *corner_points);
+
+// As above, but allocates (and frees) all of its working memory on every call. Prefer dmz_detect_edges_with_context.
 bool dmz_detect_edges(IplImage *y_sample, IplImage *cb_sample, IplImage *cr_sample,
                                        FrameOrientation orientation, dmz_edges *found_edges, dmz_corner_points *corner_points);
 
+// As dmz_detect_edges_with_context, straight from a camera buffer, with no need to split it into planes first.
+// Planes that are laid out as images (Y, except in YUYV and BGRA frames, and I420's Cb and Cr) are searched
+// in place; the others are gathered one detection box at a time, so only the pixels that are searched get copied.
+// Finds the same edges as splitting the frame into planes and calling dmz_detect_edges_with_context would.
+// Returns false, without looking (found_edges and corner_points are left as they are), if the frame's format is unknown.
+bool dmz_detect_edges_in_frame(dmz_context *dmz, const dmz_frame *frame,
+                               FrameOrientation orientation, dmz_edges *found_edges, dmz_corner_points *corner_points);
+
 
 // TRANSFORMATION
 
@@ -93,6 +176,20 @@ bool dmz_detect_edges(IplImage *y_sample, IplImage *cb_sample, IplImage *cr_samp
 // to free transformed.
 void dmz_transform_card(dmz_context *dmz, IplImage *sample, dmz_corner_points corner_points, FrameOrientation orientation, bool upsample, IplImage **transformed);
 
+// As dmz_transform_card, for one plane of a camera buffer (upsampling Cb and Cr). A plane that isn't laid out
+// as an image is gathered first, but only as much of it as the card covers (all of it where the warp is done on
+// the GPU). Use corner_points from dmz_detect_edges_in_frame. dmz may be NULL, as for dmz_transform_card; the gathered
+// pixels are then allocated afresh on each call instead of reusing the context's buffer.
+// Does nothing, leaving *transformed as it is, if the frame's format or the plane is unknown.
+void dmz_transform_card_frame(dmz_context *dmz, const dmz_frame *frame, FramePlane plane, dmz_corner_points corner_points, FrameOrientation orientation, IplImage **transformed);
+
+// Transforms the card from the Y, Cb and Cr planes of a sample (Cb and Cr half size) straight to RGB, in one pass:
+// the same result as dmz_transform_card on each plane followed by dmz_YCbCr_to_RGB, without the intermediate images.
+// Always done on the CPU. Use corner_points from dmz_detect_edges.
+// *rgb MUST be initialized to NULL (it is then created with 3 channels) or a valid IplImage with 3 or 4 channels.
+// It is the caller's responsibility to free rgb.
+void dmz_transform_card_rgb(dmz_context *dmz, IplImage *y, IplImage *cb, IplImage *cr, dmz_corner_points corner_points, FrameOrientation orientation, IplImage **rgb);
+
 // Blurs card number digits on a result image.
 // The 'unblurDigits' argument defines how many digits not to blur to remain visible.
 // If 'unblurDigits' is negative, the function will not blur any numbers.
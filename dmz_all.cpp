@@ -17,6 +17,7 @@
 #include "./cv/warp.cpp"
 #include "./dmz.cpp"
 #include "./dmz_olm.cpp"
+#include "./dmz_pool.cpp"
 #include "./geometry.cpp"
 #include "./models/generated/modelc_01266c1b.cpp"
 #include "./models/generated/modelc_5c241121.cpp"
@@ -31,6 +32,7 @@
 #include "./scan/n_vseg.cpp"
 #include "./scan/scan.cpp"
 #include "./scan/scan_analytics.cpp"
+#include "./scan/scan_scratch.cpp"
 
   #if SCAN_EXPIRY
     #include "./models/expiry/modelc_bf4dd6c8.cpp"
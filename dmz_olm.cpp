@@ -86,7 +86,7 @@ dmz_card_info dmz_card_info_for_prefix_and_length(uint8_t *number_array, uint8_t
     dmz_card_info card_info = card_type_unrecognized;
     int number_of_compatible_card_types = 0;
     
-    for (int i = 0; i < sizeof(card_types) / sizeof(dmz_card_info); i++) {
+    for (size_t i = 0; i < sizeof(card_types) / sizeof(dmz_card_info); i++) {
       dmz_card_info info = card_types[i];
       if (allow_incomplete_number) {
         if (number_length > info.number_length) {
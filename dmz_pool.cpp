@@ -0,0 +1,139 @@
+//  See the file "LICENSE.md" for the full license governing this code.
+
+#include "compile.h"
+#if COMPILE_DMZ
+
+#include "dmz_pool.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+#define kDmzPoolMaxWorkers 16
+
+struct dmz_pool {
+  pthread_t workers[kDmzPoolMaxWorkers];
+  uint8_t n_workers;
+
+  // Everything below is protected by lock.
+  pthread_mutex_t lock;
+  pthread_cond_t work_available; // signalled when there are new tasks, or when stopping
+  pthread_cond_t work_finished; // signalled when the last task of a run finishes
+  dmz_pool_task task;
+  void *context;
+  uint32_t n_tasks;
+  uint32_t next_task;
+  uint32_t n_finished_tasks;
+  bool stopping;
+};
+
+// Runs tasks until there are none left to claim. Called, and returns, with pool->lock held.
+DMZ_INTERNAL void dmz_pool_run_available_tasks(dmz_pool *pool) {
+  while(pool->next_task < pool->n_tasks) {
+    uint32_t task_index = pool->next_task++;
+    dmz_pool_task task = pool->task;
+    void *context = pool->context;
+
+    pthread_mutex_unlock(&pool->lock);
+    task(context, task_index);
+    pthread_mutex_lock(&pool->lock);
+
+    pool->n_finished_tasks++;
+    if(pool->n_finished_tasks == pool->n_tasks) {
+      pthread_cond_signal(&pool->work_finished);
+    }
+  }
+}
+
+DMZ_INTERNAL void *dmz_pool_worker_main(void *arg) {
+  dmz_pool *pool = (dmz_pool *)arg;
+  pthread_mutex_lock(&pool->lock);
+  while(!pool->stopping) {
+    dmz_pool_run_available_tasks(pool);
+    if(!pool->stopping) {
+      pthread_cond_wait(&pool->work_available, &pool->lock);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+DMZ_INTERNAL dmz_pool *dmz_pool_create(uint8_t n_workers) {
+  if(n_workers == 0) {
+    return NULL;
+  }
+
+  dmz_pool *pool = (dmz_pool *)calloc(1, sizeof(dmz_pool));
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work_available, NULL);
+  pthread_cond_init(&pool->work_finished, NULL);
+
+  if(n_workers > kDmzPoolMaxWorkers) {
+    n_workers = kDmzPoolMaxWorkers;
+  }
+  for(uint8_t i = 0; i < n_workers; i++) {
+    if(pthread_create(&pool->workers[pool->n_workers], NULL, dmz_pool_worker_main, pool) == 0) {
+      pool->n_workers++;
+    }
+  }
+
+  if(pool->n_workers == 0) {
+    dmz_debug_log("dmz_pool_create: could not start any workers");
+    dmz_pool_destroy(pool);
+    return NULL;
+  }
+  return pool;
+}
+
+DMZ_INTERNAL void dmz_pool_destroy(dmz_pool *pool) {
+  if(pool == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->stopping = true;
+  pthread_cond_broadcast(&pool->work_available);
+  pthread_mutex_unlock(&pool->lock);
+
+  for(uint8_t i = 0; i < pool->n_workers; i++) {
+    pthread_join(pool->workers[i], NULL);
+  }
+
+  pthread_cond_destroy(&pool->work_finished);
+  pthread_cond_destroy(&pool->work_available);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool);
+}
+
+DMZ_INTERNAL void dmz_pool_run(dmz_pool *pool, dmz_pool_task task, void *context, uint32_t n_tasks) {
+  if(pool == NULL || n_tasks < 2) {
+    for(uint32_t task_index = 0; task_index < n_tasks; task_index++) {
+      task(context, task_index);
+    }
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->task = task;
+  pool->context = context;
+  pool->n_tasks = n_tasks;
+  pool->next_task = 0;
+  pool->n_finished_tasks = 0;
+  pthread_cond_broadcast(&pool->work_available);
+
+  // Pitch in, rather than sit idle.
+  dmz_pool_run_available_tasks(pool);
+
+  while(pool->n_finished_tasks < pool->n_tasks) {
+    pthread_cond_wait(&pool->work_finished, &pool->lock);
+  }
+
+  // Leave nothing for late-waking workers to pick up.
+  pool->task = NULL;
+  pool->context = NULL;
+  pool->n_tasks = 0;
+  pool->next_task = 0;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+#undef kDmzPoolMaxWorkers
+
+#endif // COMPILE_DMZ
@@ -0,0 +1,33 @@
+//  See the file "LICENSE.md" for the full license governing this code.
+
+#ifndef DMZ_POOL_H
+#define DMZ_POOL_H
+
+#include "dmz_macros.h"
+#include <stdint.h>
+
+//
+// A small pool of worker threads, for running a handful of independent, coarse tasks
+// (e.g. one per card edge) at once.
+//
+// dmz_pool_run hands out tasks one at a time, to whichever thread is free next -- the
+// calling thread included -- so a slow task doesn't hold up the others. It returns
+// once every task has finished. Tasks must not call dmz_pool_run themselves.
+//
+// A NULL pool is valid everywhere, and just runs the tasks in order on the calling thread.
+//
+
+typedef struct dmz_pool dmz_pool; // Defined in dmz_pool.cpp
+
+typedef void (*dmz_pool_task)(void *context, uint32_t task_index);
+
+// Starts n_workers worker threads. Returns NULL if n_workers is 0 or no thread could be started.
+DMZ_INTERNAL dmz_pool *dmz_pool_create(uint8_t n_workers);
+
+// Stops and joins the workers. Safe to call with NULL.
+DMZ_INTERNAL void dmz_pool_destroy(dmz_pool *pool);
+
+// Runs task(context, i) for every i in [0, n_tasks), and waits for them all to finish.
+DMZ_INTERNAL void dmz_pool_run(dmz_pool *pool, dmz_pool_task task, void *context, uint32_t n_tasks);
+
+#endif
@@ -12692,8 +12692,8 @@ DMZ_INTERNAL ModelCSingleConvolved_bf4dd6c8_2 convc_bf4dd6c8_2(const ModelCConvI
 #if USE_OPTIMIZED_3x3_CONVOLUTION_bf4dd6c8
   ModelCSingleKernelPadded_bf4dd6c8_2 padded_kernel;
 
-  bool has_neon = dmz_has_neon_runtime();
-  if(has_neon) {
+  dmz_conv_3x3_f32_row_fn conv_3x3_f32_row = dmz_kernels()->conv_3x3_f32_row;
+  if(conv_3x3_f32_row != NULL) {
     padded_kernel = ModelCSingleKernelPadded_bf4dd6c8_2::Zero();
     padded_kernel.block<5, 5>(0, 0) = kernel;
   }
@@ -12703,13 +12703,13 @@ DMZ_INTERNAL ModelCSingleConvolved_bf4dd6c8_2 convc_bf4dd6c8_2(const ModelCConvI
     uint16_t vector_processed_cols = 0;
 
 #if USE_OPTIMIZED_3x3_CONVOLUTION_bf4dd6c8
-    if(has_neon) {
-      llcv_conv_3x3_f32_row(input.row(output_row).data(),
-                            input.row(output_row + 1).data(),
-                            input.row(output_row + 2).data(),
-                            padded_kernel.data(),
-                            output.row(output_row).data(),
-                            0);
+    if(conv_3x3_f32_row != NULL) {
+      conv_3x3_f32_row(input.row(output_row).data(),
+                       input.row(output_row + 1).data(),
+                       input.row(output_row + 2).data(),
+                       padded_kernel.data(),
+                       output.row(output_row).data(),
+                       0);
       vector_processed_cols = 0;
     }
 #endif
@@ -1847,8 +1847,8 @@ DMZ_INTERNAL ModelCSingleConvolved_01266c1b convc_01266c1b(const ModelCInput_012
 #if USE_OPTIMIZED_3x3_CONVOLUTION
   ModelCSingleKernelPadded_01266c1b padded_kernel;
 
-  bool has_neon = dmz_has_neon_runtime();
-  if(has_neon) {
+  dmz_conv_3x3_f32_row_fn conv_3x3_f32_row = dmz_kernels()->conv_3x3_f32_row;
+  if(conv_3x3_f32_row != NULL) {
     padded_kernel = ModelCSingleKernelPadded_01266c1b::Zero();
     padded_kernel.block<3, 3>(0, 0) = kernel;
   }
@@ -1858,13 +1858,13 @@ DMZ_INTERNAL ModelCSingleConvolved_01266c1b convc_01266c1b(const ModelCInput_012
     uint16_t vector_processed_cols = 0;
 
 #if USE_OPTIMIZED_3x3_CONVOLUTION
-    if(has_neon) {
-      llcv_conv_3x3_f32_row(input.row(output_row).data(),
-                            input.row(output_row + 1).data(),
-                            input.row(output_row + 2).data(),
-                            padded_kernel.data(),
-                            output.row(output_row).data(),
-                            12);
+    if(conv_3x3_f32_row != NULL) {
+      conv_3x3_f32_row(input.row(output_row).data(),
+                       input.row(output_row + 1).data(),
+                       input.row(output_row + 2).data(),
+                       padded_kernel.data(),
+                       output.row(output_row).data(),
+                       12);
       vector_processed_cols = 12;
     }
 #endif
@@ -1767,23 +1767,96 @@ typedef Eigen::Matrix<float, 50, 1, Eigen::ColMajor> ModelMIntermediateResult_be
 typedef Eigen::Matrix<float, 3, 50, Eigen::RowMajor> ModelMLogisticW_befe75da;
 typedef Eigen::Matrix<float, 3, 1, Eigen::ColMajor> ModelMLogisticB_befe75da;
 
-DMZ_INTERNAL ModelMOutput_befe75da applym_befe75da(const ModelMInput_befe75da& input) {
-  Eigen::Map<ModelMHiddenW_befe75da, Eigen::Aligned> hidden_W((float *)data_b3289e07);
-  Eigen::Map<ModelMHiddenB_befe75da, Eigen::Aligned> hidden_b((float *)data_dd02e979);
+#define kModelMBatchColumns_befe75da 4
+
+typedef Eigen::internal::packet_traits<float>::type ModelMPacket_befe75da;
+#define kModelMPacketSize_befe75da Eigen::internal::packet_traits<float>::size
+
+// The hidden layer loop takes whole packets of each row, with aligned loads from hidden W,
+// which is only aligned to 16 bytes (and each of its rows is 816 bytes long).
+static_assert(204 % kModelMPacketSize_befe75da == 0, "hidden W rows must be a whole number of packets");
+static_assert(kModelMPacketSize_befe75da * sizeof(float) <= 16, "hidden W rows must be aligned for pload");
+
+// Sums of hidden W row * input, kModelMPacketSize_befe75da interleaved partial sums per column,
+// for two rows of hidden W at a time.
+#define MODELM_MADD_BEFE75DA(sum_0, sum_1, column, k) { \
+  ModelMPacket_befe75da column_packet = Eigen::internal::ploadu<ModelMPacket_befe75da>(column + k); \
+  sum_0 = Eigen::internal::pmadd(W_packet_0, column_packet, sum_0); \
+  sum_1 = Eigen::internal::pmadd(W_packet_1, column_packet, sum_1); \
+}
 
-  ModelMIntermediateResult_befe75da intermediate_result = hidden_W * input + hidden_b;
-  intermediate_result = intermediate_result.unaryExpr(std::ptr_fun(tanhf));
+// Every input goes through the same column-blocked loop, so each output is independent of
+// how many other inputs it was batched with. Single evaluations are just batches of one.
+DMZ_INTERNAL void applym_batch_befe75da(const float *inputs, uint16_t n_inputs, ModelMOutput_befe75da *outputs) {
+  const float *hidden_W = (const float *)data_b3289e07;
+  const float *hidden_b = (const float *)data_dd02e979;
 
   Eigen::Map<ModelMLogisticW_befe75da, Eigen::Aligned> logistic_W((float *)data_209a6565);
   Eigen::Map<ModelMLogisticB_befe75da, Eigen::Aligned> logistic_b((float *)data_da0dff50);
 
-  ModelMOutput_befe75da output = logistic_W * intermediate_result + logistic_b;
-  output = output.unaryExpr(std::ptr_fun(expf));
-  float sum = output.sum();
-  output /= sum;
+  for(uint32_t first_column = 0; first_column < n_inputs; first_column += kModelMBatchColumns_befe75da) {
+    uint32_t n_columns = n_inputs - first_column;
+    if(n_columns > kModelMBatchColumns_befe75da) {
+      n_columns = kModelMBatchColumns_befe75da;
+    }
+
+    // Pad a short final block by repeating its last column, rather than taking a different code path.
+    const float *column_0 = inputs + first_column * 204;
+    const float *column_1 = inputs + (first_column + (n_columns > 1 ? 1 : 0)) * 204;
+    const float *column_2 = inputs + (first_column + (n_columns > 2 ? 2 : n_columns - 1)) * 204;
+    const float *column_3 = inputs + (first_column + (n_columns > 3 ? 3 : n_columns - 1)) * 204;
+
+    ModelMIntermediateResult_befe75da intermediate_results[kModelMBatchColumns_befe75da];
+
+    for(uint16_t row = 0; row < 50; row += 2) { // 50 % 2 == 0
+      const float *W_row_0 = hidden_W + row * 204;
+      const float *W_row_1 = W_row_0 + 204;
 
+      // Each packet of hidden W is loaded once for the whole block, and each packet of input once for both rows.
+      ModelMPacket_befe75da sum_0_0 = Eigen::internal::pset1<ModelMPacket_befe75da>(0.0f);
+      ModelMPacket_befe75da sum_0_1 = sum_0_0, sum_0_2 = sum_0_0, sum_0_3 = sum_0_0;
+      ModelMPacket_befe75da sum_1_0 = sum_0_0, sum_1_1 = sum_0_0, sum_1_2 = sum_0_0, sum_1_3 = sum_0_0;
+      for(uint16_t k = 0; k < 204; k += kModelMPacketSize_befe75da) {
+        ModelMPacket_befe75da W_packet_0 = Eigen::internal::pload<ModelMPacket_befe75da>(W_row_0 + k);
+        ModelMPacket_befe75da W_packet_1 = Eigen::internal::pload<ModelMPacket_befe75da>(W_row_1 + k);
+        MODELM_MADD_BEFE75DA(sum_0_0, sum_1_0, column_0, k);
+        MODELM_MADD_BEFE75DA(sum_0_1, sum_1_1, column_1, k);
+        MODELM_MADD_BEFE75DA(sum_0_2, sum_1_2, column_2, k);
+        MODELM_MADD_BEFE75DA(sum_0_3, sum_1_3, column_3, k);
+      }
+
+      intermediate_results[0](row) = tanhf(Eigen::internal::predux(sum_0_0) + hidden_b[row]);
+      intermediate_results[1](row) = tanhf(Eigen::internal::predux(sum_0_1) + hidden_b[row]);
+      intermediate_results[2](row) = tanhf(Eigen::internal::predux(sum_0_2) + hidden_b[row]);
+      intermediate_results[3](row) = tanhf(Eigen::internal::predux(sum_0_3) + hidden_b[row]);
+      intermediate_results[0](row + 1) = tanhf(Eigen::internal::predux(sum_1_0) + hidden_b[row + 1]);
+      intermediate_results[1](row + 1) = tanhf(Eigen::internal::predux(sum_1_1) + hidden_b[row + 1]);
+      intermediate_results[2](row + 1) = tanhf(Eigen::internal::predux(sum_1_2) + hidden_b[row + 1]);
+      intermediate_results[3](row + 1) = tanhf(Eigen::internal::predux(sum_1_3) + hidden_b[row + 1]);
+    }
+
+    for(uint16_t column = 0; column < n_columns; column++) {
+      ModelMOutput_befe75da output = logistic_W * intermediate_results[column] + logistic_b;
+      output = output.unaryExpr(std::ptr_fun(expf));
+      float sum = output.sum();
+      output /= sum;
+      outputs[first_column + column] = output;
+    }
+  }
+}
+
+#if TEST_GENERATED_MODELS
+// Only passm_befe75da evaluates single inputs; the scanner batches them through applym_batch_befe75da.
+DMZ_INTERNAL ModelMOutput_befe75da applym_befe75da(const ModelMInput_befe75da& input) {
+  ModelMOutput_befe75da output;
+  applym_batch_befe75da(input.data(), 1, &output);
   return output;
 }
+#endif  // TEST_GENERATED_MODELS
+
+#undef kModelMBatchColumns_befe75da
+#undef kModelMPacketSize_befe75da
+#undef MODELM_MADD_BEFE75DA
 
 
 #if TEST_GENERATED_MODELS
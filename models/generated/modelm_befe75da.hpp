@@ -15,11 +15,14 @@
 typedef Eigen::Matrix<float, 204, 1, Eigen::ColMajor> ModelMInput_befe75da;
 typedef Eigen::Matrix<float, 3, 1, Eigen::ColMajor> ModelMOutput_befe75da;
 
-DMZ_INTERNAL ModelMOutput_befe75da applym_befe75da(const ModelMInput_befe75da& input);
+// Evaluates n_inputs inputs, packed one after another (204 floats each), into outputs.
+// Each output is independent of the others it is batched with.
+DMZ_INTERNAL void applym_batch_befe75da(const float *inputs, uint16_t n_inputs, ModelMOutput_befe75da *outputs);
 
 
 #if TEST_GENERATED_MODELS
 
+DMZ_INTERNAL ModelMOutput_befe75da applym_befe75da(const ModelMInput_befe75da& input);
 bool passm_befe75da();
 
 #endif  // TEST_GENERATED_MODELS
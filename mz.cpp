@@ -6,7 +6,7 @@
 #include "stdint.h"
 #include "mz.h"
 
-#if CYTHON_DMZ
+#if CYTHON_DMZ || LINUX_DMZ
 
 // this is where we'll pre-allocate and setup OpenGL textures, compile our program,
 // and maintain a reference to all this. Return a reference to some allocated object or struct
@@ -24,6 +24,10 @@ void mz_destroy(void *mz) {
 void mz_prepare_for_backgrounding(void *mz) {
 }
 
+#endif
+
+#if CYTHON_DMZ
+
 IplImage *py_mz_create_from_cv_image_data(char *image_data, int image_size,
                                           int width, int height,
                                           int64_t depth, int n_channels,
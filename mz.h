@@ -24,9 +24,12 @@ void mz_destroy(void *mz);
 // Perform any necessary operations prior to app backgrounding (e.g., calling glFinish() on any OpenGL contexts)
 void mz_prepare_for_backgrounding(void *mz);
 
-// Analogues to this are CYTHON_DMZ and ANDROID_DMZ; they are currently defined explicitly by the
+// Analogues to this are CYTHON_DMZ, ANDROID_DMZ and LINUX_DMZ; they are currently defined explicitly by the
 // build systems for those platforms. If we come across built-in defines analogous to TARGET_OS_IPHONE,
 // we can define CYTHON_DMZ and ANDROID_DMZ here.
+//
+// LINUX_DMZ is a plain host build (see CMakeLists.txt), for batch processing, benchmarks and profiling.
+// It has no platform-specific mz state and, unlike CYTHON_DMZ, does not pull in Python.
 
 
 // Python helpers for bridging the gap between OpenCV's Python-wrapped images and OpenCV's C images.
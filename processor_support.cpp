@@ -14,6 +14,7 @@
  */
 
 #include "processor_support.h"
+#include <pthread.h>
 
 #if ANDROID_DMZ
 // use runtime checks.
@@ -107,7 +108,7 @@ int dmz_has_neon_runtime(void) {return 1;}
 int dmz_use_vfp3_16(void) {return 0;}
 int dmz_use_gles_warp(void) {return 1;}
 
-#else // not iOS, not Android. (i.e CYTHON)
+#else // not iOS, not Android. (i.e CYTHON or LINUX)
 
 int dmz_has_neon_runtime(void) {return 0;}
 
@@ -119,5 +120,174 @@ int dmz_use_gles_warp(void) {return 0;}
 
 #endif
 
+// x86 checks are shared by all clients.
+
+#if DMZ_HAS_SSE2_COMPILETIME
+// If the compiler was allowed to emit SSE2, the processor must have it.
+int dmz_has_sse2_runtime(void) {return 1;}
+#else
+int dmz_has_sse2_runtime(void) {return 0;}
+#endif
+
+#if DMZ_HAS_AVX2_COMPILETIME
+static int x86HasAVX2 = -1;
+
+int dmz_has_avx2_runtime(void) {
+  // Note that updates to this static variable are idempotent, so no thread protection required
+  if(x86HasAVX2 < 0) {
+    __builtin_cpu_init();
+    x86HasAVX2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    dmz_debug_log("x86HasAVX2: %i", x86HasAVX2);
+  }
+  return x86HasAVX2;
+}
+#else
+int dmz_has_avx2_runtime(void) {return 0;}
+#endif
+
+#pragma mark kernel table
+
+// The kernel implementations are all DMZ_INTERNAL, so filling in the table relies on
+// this file coming after the cv and model files in the unity build (dmz_all.cpp).
+
+// Every table is filled in once, up front, and never changed afterwards; picking an instruction set
+// just publishes a pointer to its table. So a thread that sees the pointer also sees a complete table.
+static dmz_isa requestedISA = DMZ_ISA_AUTO;
+static dmz_kernel_table kernelTables[DMZ_ISA_AVX2 + 1]; // indexed by dmz_isa; only those available are filled in
+static pthread_once_t kernelTablesOnce = PTHREAD_ONCE_INIT;
+static const dmz_kernel_table *kernelTable = NULL; // the one in use, once dmz_init_kernels has run
+
+static bool dmz_isa_available(dmz_isa isa) {
+  switch(isa) {
+    case DMZ_ISA_SCALAR:
+      return true;
+    case DMZ_ISA_NEON:
+      return DMZ_HAS_NEON_COMPILETIME && dmz_has_neon_runtime();
+    case DMZ_ISA_SSE2:
+      return DMZ_HAS_SSE2_COMPILETIME && dmz_has_sse2_runtime();
+    case DMZ_ISA_AVX2:
+      return DMZ_HAS_AVX2_COMPILETIME && dmz_has_avx2_runtime();
+    default:
+      return false;
+  }
+}
+
+static dmz_isa dmz_best_available_isa(void) {
+  if(dmz_isa_available(DMZ_ISA_NEON)) {
+    return DMZ_ISA_NEON;
+  } else if(dmz_isa_available(DMZ_ISA_AVX2)) {
+    return DMZ_ISA_AVX2;
+  } else if(dmz_isa_available(DMZ_ISA_SSE2)) {
+    return DMZ_ISA_SSE2;
+  } else {
+    return DMZ_ISA_SCALAR;
+  }
+}
+
+static void dmz_fill_kernel_table(dmz_isa isa, dmz_kernel_table *filled_table) {
+  dmz_kernel_table table;
+
+  // Scalar implementations, used for anything not overridden below
+  table.sobel7_dx_dy = llcv_sobel7_dx_dy_c;
+  table.sobel3_dx_dy = llcv_sobel3_dx_dy_c;
+  table.scharr3_dx_abs = llcv_scharr3_dx_abs_c;
+  table.scharr3_dy_abs = llcv_scharr3_dy_abs_c_neon;
+  table.sum_abs_magnitude = sum_abs_magnitude_c;
+  table.canny_magnitude_row = llcv_canny_magnitude_row_c;
+  table.canny_nms_row = llcv_canny_nms_row_c;
+  table.hough_vote = llcv_hough_vote_c;
+  table.hough_argmax = llcv_hough_argmax_c;
+  table.morph_grad3_2d_cross_u8 = llcv_morph_grad3_2d_cross_u8_c;
+  table.split_u8 = llcv_split_u8_c;
+  table.gather_u8_row = llcv_gather_u8_row_c;
+  table.grad3_down2_norm_u8_to_f32_row = llcv_grad3_down2_norm_u8_to_f32_row_c;
+  table.YCbCr2RGB_u8_row = llcv_YCbCr2RGB_u8_row_c;
+  table.warp_perspective_row = llcv_warp_perspective_row_c;
+  table.warp_perspective_YCbCr_to_RGB_row = llcv_warp_perspective_YCbCr_to_RGB_row_c;
+  table.stddev_of_abs = llcv_stddev_of_abs_c;
+  table.conv_3x3_f32_row = NULL;
+
+  if(isa == DMZ_ISA_NEON) {
+    table.sobel7_dx_dy = llcv_sobel7_dx_dy_neon;
+    table.sobel3_dx_dy = llcv_sobel3_dx_dy_vectorized;
+    table.scharr3_dx_abs = llcv_scharr3_dx_abs_neon;
+    table.sum_abs_magnitude = sum_abs_magnitude_neon;
+    table.canny_magnitude_row = llcv_canny_magnitude_row_neon;
+    table.canny_nms_row = llcv_canny_nms_row_neon;
+    table.hough_vote = llcv_hough_vote_neon;
+    table.hough_argmax = llcv_hough_argmax_neon;
+    table.morph_grad3_2d_cross_u8 = llcv_morph_grad3_2d_cross_u8_vectorized;
+    table.split_u8 = llcv_split_u8_neon;
+    table.gather_u8_row = llcv_gather_u8_row_neon;
+    table.grad3_down2_norm_u8_to_f32_row = llcv_grad3_down2_norm_u8_to_f32_row_neon;
+    table.YCbCr2RGB_u8_row = llcv_YCbCr2RGB_u8_row_neon;
+    table.warp_perspective_row = llcv_warp_perspective_row_neon;
+    table.stddev_of_abs = llcv_stddev_of_abs_neon;
+    table.conv_3x3_f32_row = llcv_conv_3x3_f32_row;
+  }
+
+  if(isa == DMZ_ISA_SSE2 || isa == DMZ_ISA_AVX2) {
+    table.sobel7_dx_dy = llcv_sobel7_dx_dy_sse2;
+    table.sobel3_dx_dy = llcv_sobel3_dx_dy_vectorized;
+    table.scharr3_dx_abs = llcv_scharr3_dx_abs_sse2;
+    table.scharr3_dy_abs = llcv_scharr3_dy_abs_sse2;
+    table.canny_magnitude_row = llcv_canny_magnitude_row_sse2;
+    table.canny_nms_row = llcv_canny_nms_row_sse2;
+    table.hough_vote = llcv_hough_vote_sse2;
+    table.hough_argmax = llcv_hough_argmax_sse2;
+    table.morph_grad3_2d_cross_u8 = llcv_morph_grad3_2d_cross_u8_vectorized;
+    table.gather_u8_row = llcv_gather_u8_row_sse2;
+    table.grad3_down2_norm_u8_to_f32_row = llcv_grad3_down2_norm_u8_to_f32_row_sse2;
+    table.YCbCr2RGB_u8_row = llcv_YCbCr2RGB_u8_row_sse2;
+    table.warp_perspective_row = llcv_warp_perspective_row_sse2;
+    table.warp_perspective_YCbCr_to_RGB_row = llcv_warp_perspective_YCbCr_to_RGB_row_sse2;
+    table.stddev_of_abs = llcv_stddev_of_abs_sse2;
+  }
+
+  if(isa == DMZ_ISA_AVX2) {
+    table.sobel7_dx_dy = llcv_sobel7_dx_dy_avx2;
+    table.stddev_of_abs = llcv_stddev_of_abs_avx2;
+    table.hough_vote = llcv_hough_vote_avx2;
+    table.hough_argmax = llcv_hough_argmax_avx2;
+    table.grad3_down2_norm_u8_to_f32_row = llcv_grad3_down2_norm_u8_to_f32_row_avx2;
+    table.YCbCr2RGB_u8_row = llcv_YCbCr2RGB_u8_row_avx2;
+    table.warp_perspective_row = llcv_warp_perspective_row_avx2;
+    table.warp_perspective_YCbCr_to_RGB_row = llcv_warp_perspective_YCbCr_to_RGB_row_avx2;
+  }
+
+  table.isa = isa;
+  *filled_table = table;
+}
+
+static void dmz_fill_kernel_tables(void) {
+  for(int isa = DMZ_ISA_SCALAR; isa <= DMZ_ISA_AVX2; isa++) {
+    if(dmz_isa_available((dmz_isa)isa)) {
+      dmz_fill_kernel_table((dmz_isa)isa, &kernelTables[isa]);
+    }
+  }
+}
+
+void dmz_init_kernels(void) {
+  pthread_once(&kernelTablesOnce, dmz_fill_kernel_tables);
+  dmz_isa requested_isa = __atomic_load_n(&requestedISA, __ATOMIC_RELAXED);
+  dmz_isa isa = dmz_isa_available(requested_isa) ? requested_isa : dmz_best_available_isa();
+  __atomic_store_n(&kernelTable, &kernelTables[isa], __ATOMIC_RELEASE);
+  dmz_debug_log("kernel isa: %i", isa);
+}
+
+dmz_isa dmz_force_isa(dmz_isa isa) {
+  __atomic_store_n(&requestedISA, isa, __ATOMIC_RELAXED);
+  dmz_init_kernels();
+  return dmz_kernels()->isa;
+}
+
+const dmz_kernel_table *dmz_kernels(void) {
+  const dmz_kernel_table *table = __atomic_load_n(&kernelTable, __ATOMIC_ACQUIRE);
+  if(dmz_unlikely(table == NULL)) {
+    dmz_init_kernels();
+    table = __atomic_load_n(&kernelTable, __ATOMIC_ACQUIRE);
+  }
+  return table;
+}
 
 #endif // COMPILE_DMZ
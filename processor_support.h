@@ -5,6 +5,8 @@
 
 #include "mz.h"
 #include "dmz_macros.h"
+#include "opencv2/core/core_c.h" // for IplImage, used in dmz_kernel_table
+#include "cv/image_util.h" // for llcv_buffer, likewise
 
 //
 // Wraps client-specific processor support checks
@@ -21,6 +23,21 @@
 //     // Scalar implementation
 // }
 //
+// Hot kernels don't repeat these checks on every call, though. Instead, they go through the
+// kernel table (see dmz_kernels() below), which is filled in once, for one instruction set.
+//
+// x86 SIMD follows the same pattern, with DMZ_HAS_SSE2_COMPILETIME / dmz_has_sse2_runtime()
+// and DMZ_HAS_AVX2_COMPILETIME / dmz_has_avx2_runtime(). When several are available,
+// prefer NEON, then AVX2, then SSE2, then the scalar implementation.
+//
+// AVX2 code must be compiled per function, since we don't require -mavx2 for the whole build:
+//
+// #if DMZ_HAS_AVX2_COMPILETIME
+// DMZ_INTERNAL DMZ_TARGET_AVX2 void foo_avx2(...) {
+//     // AVX2 implementation
+// }
+// #endif
+//
 
 // Enable simple compiletime checks for NEON support
 #if IOS_DMZ
@@ -36,7 +53,7 @@
     #else
         #define DMZ_HAS_NEON_COMPILETIME 0
     #endif
-#elif CYTHON_DMZ
+#elif CYTHON_DMZ || LINUX_DMZ
     #define DMZ_HAS_NEON_COMPILETIME 0
 #elif ANDROID_DMZ
     #if ANDROID_HAS_NEON
@@ -51,6 +68,22 @@
     #error "Encountered unknown dmz client. Make sure the right *_DMZ preprocessor macro is set."
 #endif
 
+// Enable simple compiletime checks for x86 SIMD support. These are independent of the client,
+// since Cython builds and Android x86 builds can both target these processors.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define DMZ_HAS_SSE2_COMPILETIME 1
+#else
+    #define DMZ_HAS_SSE2_COMPILETIME 0
+#endif
+
+#if DMZ_HAS_SSE2_COMPILETIME && (defined(__GNUC__) || defined(__clang__))
+    #define DMZ_HAS_AVX2_COMPILETIME 1
+    #define DMZ_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+    #define DMZ_HAS_AVX2_COMPILETIME 0
+    #define DMZ_TARGET_AVX2
+#endif
+
 /* For Android ARMv7a architectures:
  * gcc -mfpu=neon <=> DMZ_HAS_NEON_COMPILETME
  * else:
@@ -59,6 +92,77 @@
 extern int dmz_has_neon_runtime(void);
 extern int dmz_use_vfp3_16(void);
 
+// x86 runtime checks. These return 0 whenever the corresponding compiletime check is 0.
+extern int dmz_has_sse2_runtime(void);
+extern int dmz_has_avx2_runtime(void);
+
+// Instruction sets that the kernel table can be filled in for.
+typedef enum {
+  DMZ_ISA_AUTO = 0, // the best instruction set available on this processor
+  DMZ_ISA_SCALAR,
+  DMZ_ISA_NEON,
+  DMZ_ISA_SSE2,
+  DMZ_ISA_AVX2,
+} dmz_isa;
+
+// Only implemented for NEON; see cv/conv.h.
+typedef void (*dmz_conv_3x3_f32_row_fn)(const float *inrow0, const float *inrow1, const float *inrow2, float *kernel3x4, float *outrow, uint16_t length);
+
+// Implementations of each vectorized kernel for a single instruction set.
+// Kernels without an implementation for that instruction set point at the scalar one,
+// except for conv_3x3_f32_row, which is NULL if there is no vectorized implementation.
+typedef struct {
+  dmz_isa isa; // never DMZ_ISA_AUTO once filled in
+
+  // cv/sobel
+  void (*sobel7_dx_dy)(IplImage *src, IplImage *dx, IplImage *dy, double *abs_sum, llcv_buffer *rows);
+  void (*sobel3_dx_dy)(IplImage *src, IplImage *dst);
+  void (*scharr3_dx_abs)(IplImage *src, IplImage *dst);
+  void (*scharr3_dy_abs)(IplImage *src, IplImage *dst);
+
+  // cv/canny
+  double (*sum_abs_magnitude)(IplImage *image);
+  void (*canny_magnitude_row)(const int16_t *dx, const int16_t *dy, int *mag, int width);
+  void (*canny_nms_row)(const int *mag_prev, const int *mag, const int *mag_next, const int16_t *dx, const int16_t *dy, uint8_t *candidate, uint8_t *strong, int width, int low, int high);
+
+  // cv/hough
+  void (*hough_vote)(int *accum, int accum_step, const int16_t *points, int n_points, const int16_t *tabs, int numangle, int r_offset);
+  int (*hough_argmax)(const int *accum, int accum_step, int numangle, int first_r, int last_r, int *max_n, int *max_r);
+
+  // cv/morph
+  void (*morph_grad3_2d_cross_u8)(IplImage *src, IplImage *dst);
+
+  // cv/convert
+  void (*split_u8)(IplImage *interleaved, IplImage *channel1, IplImage *channel2);
+  void (*gather_u8_row)(const uint8_t *src, int pixel_step, uint8_t *dst, int width);
+  void (*grad3_down2_norm_u8_to_f32_row)(const uint8_t *src, float *dst, int dst_width);
+  void (*YCbCr2RGB_u8_row)(const uint8_t *y, const uint8_t *cb, const uint8_t *cr, uint8_t *dst, int dst_channels, int width);
+
+  // cv/warp
+  void (*warp_perspective_row)(const uint8_t *src, int src_step, int src_width, int src_height, int channels, const float origin[3], const float step[3], uint8_t *dst, int width);
+  void (*warp_perspective_YCbCr_to_RGB_row)(IplImage *y, IplImage *cb, IplImage *cr, const float origin[3], const float step[3], uint8_t *dst, int dst_channels, int width);
+
+  // cv/stats
+  float (*stddev_of_abs)(IplImage *image);
+
+  // cv/conv, used by the generated convolutional models
+  dmz_conv_3x3_f32_row_fn conv_3x3_f32_row;
+} dmz_kernel_table;
+
+// Fill in the kernel table. Called by dmz_context_create; if nothing calls it,
+// the table is filled in on first use. Safe to call from any thread.
+extern void dmz_init_kernels(void);
+
+// Force a specific instruction set, e.g. for A/B benchmarking. If the requested instruction set
+// isn't available (at compiletime or at runtime), the best available one is used instead.
+// DMZ_ISA_AUTO restores the default. Returns the instruction set now in use.
+// Only call this while nothing is scanning or detecting edges: a kernel looked up before the switch
+// and one looked up after it could come from different instruction sets, and give different results.
+extern dmz_isa dmz_force_isa(dmz_isa isa);
+
+// The current kernel table.
+extern const dmz_kernel_table *dmz_kernels(void);
+
 // Should we use OpenGL ES to do perspective (un)warping?
 extern int dmz_use_gles_warp(void);
 
@@ -34,7 +34,7 @@ typedef Eigen::Matrix<float, 1, 10, Eigen::RowMajor> DigitProbabilities;
 
 #pragma mark - image preparation
 
-DMZ_INTERNAL void prepare_image_for_cat(IplImage *image, IplImage *as_float, CharacterRectListIterator rect) {
+DMZ_INTERNAL void prepare_image_for_cat(IplImage *image, IplImage *as_float, CharacterRectListIterator rect, ScanScratch *scratch) {
   // Input image: IPL_DEPTH_8U [0 - 255]
   // Data for models: IPL_DEPTH_32F [0.0 - 1.0]
   
@@ -42,12 +42,12 @@ DMZ_INTERNAL void prepare_image_for_cat(IplImage *image, IplImage *as_float, Cha
   
   // TODO: optimize this a lot!
   
+  ScanScratchMark scratch_mark = scan_scratch_mark(scratch);
+
   // Gradient
-  IplImage *filtered_image = cvCreateImage(cvSize(kTrimmedCharacterImageWidth, kTrimmedCharacterImageHeight), IPL_DEPTH_8U, 1);
+  IplImage *filtered_image = scan_scratch_image(scratch, cvSize(kTrimmedCharacterImageWidth, kTrimmedCharacterImageHeight), IPL_DEPTH_8U, 1);
   //llcv_morph_grad3_2d_cross_u8(image, filtered_image);
-  IplConvKernel *kernel = cvCreateStructuringElementEx(3, 3, 1, 1, CV_SHAPE_CROSS, NULL);
-  cvMorphologyEx(image, filtered_image, NULL, kernel, CV_MOP_GRADIENT, 1);
-  cvReleaseStructuringElement(&kernel);
+  cvMorphologyEx(image, filtered_image, NULL, scratch->cross_kernel, CV_MOP_GRADIENT, 1);
   
   // Equalize
   llcv_equalize_hist(filtered_image, filtered_image);
@@ -56,14 +56,13 @@ DMZ_INTERNAL void prepare_image_for_cat(IplImage *image, IplImage *as_float, Cha
   int aperture = 3;
   double space_sigma = (aperture / 2.0 - 1) * 0.3 + 0.8;
   double color_sigma = (aperture - 1) / 3.0;
-  IplImage *smoothed_image = cvCreateImage(cvSize(kTrimmedCharacterImageWidth, kTrimmedCharacterImageHeight), IPL_DEPTH_8U, 1);
+  IplImage *smoothed_image = scan_scratch_image(scratch, cvSize(kTrimmedCharacterImageWidth, kTrimmedCharacterImageHeight), IPL_DEPTH_8U, 1);
   cvSmooth(filtered_image, smoothed_image, CV_BILATERAL, aperture, aperture, space_sigma, color_sigma);
   
   // Convert to float
   cvConvertScale(smoothed_image, as_float, 1.0f / 255.0f, 0);
   
-  cvReleaseImage(&smoothed_image);
-  cvReleaseImage(&filtered_image);
+  scan_scratch_release(scratch, scratch_mark);
   
   cvResetImageROI(image);
 
@@ -146,7 +145,7 @@ DMZ_INTERNAL inline ExpiryGroupScores combine_model_results(ExpiryGroupScores pr
 #endif
 }
 
-DMZ_INTERNAL inline ExpiryGroupScores categorize_expiry_digits(IplImage *card_y, IplImage *as_float, GroupedRects group, char *expiries_string) {
+DMZ_INTERNAL inline ExpiryGroupScores categorize_expiry_digits(IplImage *card_y, IplImage *as_float, GroupedRects &group, char *expiries_string, ScanScratch *scratch) {
   ExpiryGroupScores probability_vector[NUMBER_OF_MODELS + 1]; // one for each model, plus one for the combined results
   
   for (int character_index = 0; character_index < 5; character_index++) {
@@ -156,7 +155,7 @@ DMZ_INTERNAL inline ExpiryGroupScores categorize_expiry_digits(IplImage *card_y,
     
     CharacterRectListIterator rect = group.character_rects.begin() + character_index;
     
-    prepare_image_for_cat(card_y, as_float, rect);
+    prepare_image_for_cat(card_y, as_float, rect, scratch);
     DigitProbabilities *probabilities = digit_probabilities(as_float);
     
     for (int model_index = 0; model_index < NUMBER_OF_MODELS; model_index++) {
@@ -449,15 +448,14 @@ DMZ_INTERNAL void expiry_extract(IplImage *card_y,
                                  GroupedRectsList &expiry_groups,
                                  GroupedRectsList &new_groups,
                                  int *expiry_month,
-                                 int *expiry_year) {
+                                 int *expiry_year,
+                                 ScanScratch *scratch) {
   if (new_groups.empty()) {
     return;
   }
 
-  static IplImage *as_float = NULL;
-  if (as_float == NULL) {
-    as_float = cvCreateImage(cvSize(kTrimmedCharacterImageWidth, kTrimmedCharacterImageHeight), IPL_DEPTH_32F, 1);
-  }
+  ScanScratchMark scratch_mark = scan_scratch_mark(scratch);
+  IplImage *as_float = scan_scratch_image(scratch, cvSize(kTrimmedCharacterImageWidth, kTrimmedCharacterImageHeight), IPL_DEPTH_32F, 1);
 
 #if DEBUG_EXPIRY_CATEGORIZATION_PERFORMANCE
   dmz_debug_timer_start(2);
@@ -467,12 +465,14 @@ DMZ_INTERNAL void expiry_extract(IplImage *card_y,
   
   for (GroupedRectsListIterator group = new_groups.begin(); group != new_groups.end(); ++group) {
     char expiries_string[8192];
-    group->scores = categorize_expiry_digits(card_y, as_float, *group, expiries_string);
+    group->scores = categorize_expiry_digits(card_y, as_float, *group, expiries_string, scratch);
 #if DEBUG_EXPIRY_CATEGORIZATION_RESULTS
     dmz_debug_print("\n%s\n", expiries_string);
 #endif
   }
 
+  scan_scratch_release(scratch, scratch_mark);
+
   // Aggregate the newly found groups with those we've previously found:
   
   expiry_aggregate_grouped_rects(expiry_groups, new_groups);
@@ -506,14 +506,14 @@ DMZ_INTERNAL void expiry_extract_group(IplImage *card_y,
                                        GroupedRects &group,
                                        ExpiryGroupScores &old_scores,
                                        int *expiry_month,
-                                       int *expiry_year) {
-  static IplImage *as_float = NULL;
-  if (as_float == NULL) {
-    as_float = cvCreateImage(cvSize(kTrimmedCharacterImageWidth, kTrimmedCharacterImageHeight), IPL_DEPTH_32F, 1);
-  }
+                                       int *expiry_year,
+                                       ScanScratch *scratch) {
+  ScanScratchMark scratch_mark = scan_scratch_mark(scratch);
+  IplImage *as_float = scan_scratch_image(scratch, cvSize(kTrimmedCharacterImageWidth, kTrimmedCharacterImageHeight), IPL_DEPTH_32F, 1);
   
   char expiries_string[8192];
-  group.scores = categorize_expiry_digits(card_y, as_float, group, expiries_string);
+  group.scores = categorize_expiry_digits(card_y, as_float, group, expiries_string, scratch);
+  scan_scratch_release(scratch, scratch_mark);
 
   group.scores = (old_scores * kExpiryDecayFactor) + (group.scores * (1 - kExpiryDecayFactor));
   
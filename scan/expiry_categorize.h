@@ -10,19 +10,24 @@
 
 #include "opencv2/core/core_c.h" // needed for IplImage
 #include "dmz_macros.h"
+#include "scan_scratch.h"
 
+#if SCAN_EXPIRY || CYTHON_DMZ
 DMZ_INTERNAL void expiry_extract(IplImage *cardY,
                                  GroupedRectsList &expiry_groups,
                                  GroupedRectsList &new_groups,
                                  int *expiry_month,
-                                 int *expiry_year);
+                                 int *expiry_year,
+                                 ScanScratch *scratch);
+#endif
 
 #if CYTHON_DMZ
 DMZ_INTERNAL void expiry_extract_group(IplImage *card_y,
                                        GroupedRects &group,
                                        ExpiryGroupScores &old_scores,
                                        int *expiry_month,
-                                       int *expiry_year);
+                                       int *expiry_year,
+                                       ScanScratch *scratch);
 #endif
   
 #endif
@@ -703,7 +703,7 @@ DMZ_INTERNAL void find_character_groups_for_stripe(IplImage *card_y, IplImage *s
 #endif
 }
 
-DMZ_INTERNAL void best_expiry_seg(IplImage *card_y, uint16_t starting_y_offset, GroupedRectsList &expiry_groups, GroupedRectsList &name_groups) {
+DMZ_INTERNAL void best_expiry_seg(IplImage *card_y, uint16_t starting_y_offset, GroupedRectsList &expiry_groups, GroupedRectsList &name_groups, ScanScratch *scratch) {
 #if DEBUG_EXPIRY_SEGMENTATION_PERFORMANCE
   dmz_debug_timer_start();
 #endif
@@ -712,7 +712,8 @@ DMZ_INTERNAL void best_expiry_seg(IplImage *card_y, uint16_t starting_y_offset,
   
   // Look for vertical line segments -> sobel_image:
   
-  IplImage *sobel_image = cvCreateImage(card_image_size, IPL_DEPTH_16S, 1);
+  ScanScratchMark scratch_mark = scan_scratch_mark(scratch);
+  IplImage *sobel_image = scan_scratch_image(scratch, card_image_size, IPL_DEPTH_16S, 1);
   cvSetZero(sobel_image);
   
   CvRect below_numbers_rect = cvRect(0, starting_y_offset + kNumberHeight, card_image_size.width, card_image_size.height - (starting_y_offset + kNumberHeight));
@@ -898,7 +899,7 @@ DMZ_INTERNAL void best_expiry_seg(IplImage *card_y, uint16_t starting_y_offset,
   dmz_debug_print("Grand Total for Expiry segmentation: %.3f\n", ((float)dmz_debug_timer_stop()) / 1000.0);
 #endif
   
-  cvReleaseImage(&sobel_image);
+  scan_scratch_release(scratch, scratch_mark);
 }
 
 #endif // COMPILE_DMZ
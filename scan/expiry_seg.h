@@ -7,8 +7,11 @@
 #define DMZ_SCAN_EXPIRY_SEG_H
 
 #include "expiry_types.h"
+#include "scan_scratch.h"
 #include "opencv2/imgproc/types_c.h"
 
-DMZ_INTERNAL void best_expiry_seg(IplImage *card_y, uint16_t starting_y_offset, GroupedRectsList &expiry_groups, GroupedRectsList &name_groups);
+#if SCAN_EXPIRY || CYTHON_DMZ
+DMZ_INTERNAL void best_expiry_seg(IplImage *card_y, uint16_t starting_y_offset, GroupedRectsList &expiry_groups, GroupedRectsList &name_groups, ScanScratch *scratch);
+#endif
 
 #endif
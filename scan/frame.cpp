@@ -16,12 +16,12 @@
 // TODO: Experiment more, and put some rigor around these numbers!
 // TODO: Try harder to find good hseg criteria, consider y_offset criteria (what range is reasonable?, consider non-sum-based score criteria
 // TODO: Upside down card detection? (Use y_offset as a heuristic?)
+// kMinVSegScore lives in frame.h, since vseg tracking in scan.cpp shares it.
 
-#define kMinVSegScore 15  // non-lax value: 18?
 #define kMaxNumberScoreDelta 3 // non-lax value: 1? 2?
 #define kFlipVSegYOffsetCutoff ((kCreditCardTargetHeight - kNumberHeight) / 2)
 
-DMZ_INTERNAL void scan_card_image(IplImage *y, bool collect_card_number, bool scan_expiry, FrameScanResult *result) {
+DMZ_INTERNAL void scan_card_image_with_vseg(IplImage *y, NVerticalSegmentation vseg, bool collect_card_number, bool scan_expiry, FrameScanResult *result, ScanScratch *scratch) {
   assert(NULL == y->roi);
   assert(y->width == 428);
   assert(y->height == 270);
@@ -31,7 +31,7 @@ DMZ_INTERNAL void scan_card_image(IplImage *y, bool collect_card_number, bool sc
   result->upside_down = false;
   result->usable = false;
   
-  result->vseg = best_n_vseg(y); // TODO - report this
+  result->vseg = vseg;
 
   // If the best vseg is in the top half of the card,
   // return early and indicate that the card is upside-down.
@@ -47,9 +47,13 @@ DMZ_INTERNAL void scan_card_image(IplImage *y, bool collect_card_number, bool sc
   }
 
   if (collect_card_number) {
-    cvSetImageROI(y, cvRect(0, result->vseg.y_offset, kCreditCardTargetWidth, kNumberHeight));
+    // The number's rows, as a copy of y's header with an ROI of its own. Setting an ROI on y itself
+    // would allocate one (and number_scores moves the ROI around, which is fine for this one).
+    IplImage y_strip = *y;
+    IplROI y_strip_roi = {0, 0, result->vseg.y_offset, kCreditCardTargetWidth, kNumberHeight};
+    y_strip.roi = &y_strip_roi;
     
-    result->hseg = best_n_hseg(y, result->vseg);
+    result->hseg = best_n_hseg(&y_strip, result->vseg, scratch);
     // I've not found the hseg score to be a reliable indicator of quality at all
     // Unsurprising, since this is the hardest phase of the pipeline, and we're struggling
     // just to find anything at all!
@@ -59,18 +63,17 @@ DMZ_INTERNAL void scan_card_image(IplImage *y, bool collect_card_number, bool sc
     //    return result;
     //  }
     
-    result->scores = number_scores(y, result->hseg);
+    result->scores = number_scores(&y_strip, result->hseg, scratch);
     float number_score = result->hseg.n_offsets - result->scores.sum();
     result->usable = number_score < kMaxNumberScoreDelta;
     if (!result->usable) {
       dmz_debug_log("number_score %f unusable", number_score);
     }
-    cvResetImageROI(y);
   }
 
 #if SCAN_EXPIRY
   if (scan_expiry && result->vseg.y_offset < kCreditCardTargetHeight - 2 * kSmallCharacterHeight) {
-    best_expiry_seg(y, result->vseg.y_offset, result->expiry_groups, result->name_groups);
+    best_expiry_seg(y, result->vseg.y_offset, result->expiry_groups, result->name_groups, scratch);
   #if DMZ_DEBUG
     if (result->expiry_groups.empty()) {
       dmz_debug_log("Expiry segmentation failed.");
@@ -81,6 +84,11 @@ DMZ_INTERNAL void scan_card_image(IplImage *y, bool collect_card_number, bool sc
 }
 
 #if CYTHON_DMZ
+DMZ_INTERNAL void scan_card_image(IplImage *y, bool collect_card_number, bool scan_expiry, FrameScanResult *result, ScanScratch *scratch) {
+  NVerticalSegmentation vseg = best_n_vseg(y, scratch); // TODO - report this
+  scan_card_image_with_vseg(y, vseg, collect_card_number, scan_expiry, result, scratch);
+}
+
 void cython_scan_card_image(IplImage *y, CythonFrameScanResult *result) {
   FrameScanResult frameScanResult;
   frameScanResult.focus_score = 666;
@@ -90,7 +98,10 @@ void cython_scan_card_image(IplImage *y, CythonFrameScanResult *result) {
   frameScanResult.torch_is_on = 0;
   frameScanResult.flipped = 0;
 
-  scan_card_image(y, true, true, &frameScanResult);
+  ScanScratch scratch;
+  scan_scratch_initialize(&scratch);
+  scan_card_image(y, true, true, &frameScanResult, &scratch);
+  scan_scratch_destroy(&scratch);
   
   result->usable = frameScanResult.usable;
   result->hseg = frameScanResult.hseg;
@@ -8,9 +8,14 @@
 
 #include "expiry_seg.h"
 #include "n_categorize.h"
+#include "scan_scratch.h"
 #include "opencv2/core/core_c.h" // needed for IplImage
 #include "dmz_macros.h"
 
+// A frame is usable only if its vertical segmentation scores above this.
+// scan.cpp also uses it as the floor for tracking a previous frame's vseg.
+#define kMinVSegScore 15  // non-lax value: 18?
+
 typedef struct {
   float                   focus_score;
   NumberScores            scores;
@@ -28,12 +33,17 @@ typedef struct {
 } FrameScanResult;
 
 
-// Scans a single card image, returns a summary of all info gathered along the way.
+// Scans a single card image, whose vertical segmentation has already been found (see best_n_vseg_frames),
+// returns a summary of all info gathered along the way.
 // If usable is false, disregard all other info.
 // y must be 428x270, uint8_t, no roi, single channel greyscale.
-DMZ_INTERNAL void scan_card_image(IplImage *y, bool collect_card_number, bool scan_expiry, FrameScanResult *result);
+// Temporary images come from scratch, which is released back to where it was on entry.
+DMZ_INTERNAL void scan_card_image_with_vseg(IplImage *y, NVerticalSegmentation vseg, bool collect_card_number, bool scan_expiry, FrameScanResult *result, ScanScratch *scratch);
 
 #if CYTHON_DMZ
+// As scan_card_image_with_vseg, finding the vertical segmentation first.
+DMZ_INTERNAL void scan_card_image(IplImage *y, bool collect_card_number, bool scan_expiry, FrameScanResult *result, ScanScratch *scratch);
+
 typedef struct {
   NHorizontalSegmentation hseg;
   NVerticalSegmentation   vseg;
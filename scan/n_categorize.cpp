@@ -72,11 +72,11 @@ DMZ_INTERNAL inline SingleNumberScores scores_for_number_image(IplImage *number_
 }
 
 
-DMZ_INTERNAL NumberScores number_scores(IplImage *y_strip, NHorizontalSegmentation hseg) {
+DMZ_INTERNAL NumberScores number_scores(IplImage *y_strip, NHorizontalSegmentation hseg, ScanScratch *scratch) {
   // y_strip might have been made into a strip by using a vertical ROI -- must preserve and use y_offset in that case
   // though slightly complex, this is better than making an unneeded copy
   CvSize y_strip_size = cvGetSize(y_strip);
-#pragma unused(y_strip_size) // work around broken compiler warnings
+  (void)y_strip_size; // only used in asserts
   assert(y_strip_size.height == 27);
   uint16_t y_offset = 0;
   if(NULL != y_strip->roi) {
@@ -85,10 +85,9 @@ DMZ_INTERNAL NumberScores number_scores(IplImage *y_strip, NHorizontalSegmentati
     assert(y_strip->roi->xOffset == 0);
   }
 
-  // TODO: Set up these temporary variables once during initialization, and reuse?
-  // Would be nicer yet to just have static allocation...
-  IplImage *number_image = cvCreateImage(cvSize(19, 27), y_strip->depth, 1);
-  IplImage *number_image_float = cvCreateImage(cvSize(19, 27), IPL_DEPTH_32F, 1);
+  ScanScratchMark scratch_mark = scan_scratch_mark(scratch);
+  IplImage *number_image = scan_scratch_image(scratch, cvSize(19, 27), y_strip->depth, 1);
+  IplImage *number_image_float = scan_scratch_image(scratch, cvSize(19, 27), IPL_DEPTH_32F, 1);
   
   NumberScores scores = NumberScores::Zero();
   for(uint8_t offset_index = 0; offset_index < hseg.n_offsets; offset_index++) {
@@ -101,8 +100,7 @@ DMZ_INTERNAL NumberScores number_scores(IplImage *y_strip, NHorizontalSegmentati
     scores.row(offset_index) = single_number_scores;
   }
   
-  cvReleaseImage(&number_image_float);
-  cvReleaseImage(&number_image);
+  scan_scratch_release(scratch, scratch_mark);
   
   return scores;
 }
@@ -15,7 +15,7 @@ typedef Eigen::Matrix<float, 16, 10, Eigen::RowMajor> NumberScores;  // (up to)
 
 // May alter any roi that y_strip may have prior to returning. (The inbound roi will be respected,
 // it'll just be changed at the end.) If this is unwanted, pass in a copy of y_strip.
-DMZ_INTERNAL NumberScores number_scores(IplImage *y_strip, NHorizontalSegmentation hseg);
+DMZ_INTERNAL NumberScores number_scores(IplImage *y_strip, NHorizontalSegmentation hseg, ScanScratch *scratch);
 
 
 #endif
@@ -34,14 +34,89 @@ typedef struct {
 #define SliceU16_MAX UINT16_MAX
 
 typedef Eigen::Matrix<float, 1, 428, Eigen::RowMajor> HorizontalStripPattern;
-typedef Eigen::Matrix<float, 1, 19, Eigen::RowMajor> NumberGradSumPattern;
 
-DMZ_INTERNAL NHorizontalSegmentation best_n_hseg_constrained(float *grad_sums, NVerticalSegmentation vseg, NHorizontalSegmentation best, SliceF32 width_slice, SliceU16 offset_slice) {
-  
+// Every number's left edge is somewhere in [0, 409); kHSegTabulatedEdges of those get
+// precomputed scores (the rest, rarely needed, get computed on demand).
+#define kHSegTabulatedEdges 408
+#define kHSegMinTabulatedLength 16
+
+// How far hseg_pattern_score_estimate can be from hseg_pattern_score, with plenty to spare:
+// each sums a few hundred float terms, none much bigger than 1, in its own order.
+#define kHSegScoreEstimateError (428.0f * 428.0f * FLT_EPSILON)
+
+typedef Eigen::Array<float, 1, kHSegTabulatedEdges> NumberEdgeScores;
+
+// For scoring patterns without building them. The L1 distance from grad_sums to a pattern is
+// the distance to an all-zero pattern, plus the change from putting each number in place.
+typedef struct {
+  double zero_pattern_score;
+  // By the length of the number (when the next number overwrites the end of it), then left edge.
+  NumberEdgeScores number_scores[19 - kHSegMinTabulatedLength + 1];
+} HSegScoreTable;
+
+DMZ_INTERNAL void hseg_score_table_fill(float *grad_sums, HSegScoreTable *table) {
+  table->zero_pattern_score = 0.0;
+  for(uint16_t x = 0; x < 428; x++) {
+    table->zero_pattern_score += fabsf(grad_sums[x]);
+  }
+
+  // Each pass adds one pixel of the number, at every left edge at once.
+  NumberEdgeScores number_scores = NumberEdgeScores::Zero();
+  for(uint8_t pattern_index = 0; pattern_index < 19; pattern_index++) {
+    Eigen::Map<NumberEdgeScores> grad_sums_under_number(grad_sums + pattern_index);
+    number_scores += (grad_sums_under_number - number_grad_sum_pattern[pattern_index]).abs() - grad_sums_under_number.abs();
+    if(pattern_index + 1 >= kHSegMinTabulatedLength) {
+      table->number_scores[pattern_index + 1 - kHSegMinTabulatedLength] = number_scores;
+    }
+  }
+}
+
+// The change in L1 distance from putting the first length pixels of a number at left_edge.
+DMZ_INTERNAL float hseg_number_score(float *grad_sums, HSegScoreTable *table, uint16_t left_edge, uint8_t length) {
+  if(left_edge < kHSegTabulatedEdges && length >= kHSegMinTabulatedLength) {
+    return table->number_scores[length - kHSegMinTabulatedLength](left_edge);
+  }
+  float number_score = 0.0f;
+  for(uint8_t pattern_index = 0; pattern_index < length; pattern_index++) {
+    float grad_sum = grad_sums[left_edge + pattern_index];
+    number_score += fabsf(grad_sum - number_grad_sum_pattern[pattern_index]) - fabsf(grad_sum);
+  }
+  return number_score;
+}
+
+// The L1 distance between grad_sums and the pattern with a number_grad_sum_pattern at each of the
+// n_centers centers (each overwriting the previous one, where they overlap).
+DMZ_INTERNAL float hseg_pattern_score(float *grad_sums, uint16_t *centers, uint8_t n_centers) {
   HorizontalStripPattern pattern;
   Eigen::Map<HorizontalStripPattern> grad_sums_pattern(grad_sums);
-  Eigen::Map<NumberGradSumPattern> number_grad_sum_pattern_array(number_grad_sum_pattern);
+
+  pattern.setZero();
+  for(uint8_t center_index = 0; center_index < n_centers; center_index++) {
+    // Not pattern.segment<19>(...) = ...: Eigen's unaligned packet stores go through double pointers,
+    // which can leave the sum below reading stale floats under strict aliasing.
+    memcpy(pattern.data() + centers[center_index], number_grad_sum_pattern, sizeof(number_grad_sum_pattern));
+  }
+  return (grad_sums_pattern - pattern).cwiseAbs().sum();
+}
+
+// hseg_pattern_score, from table instead of building the pattern.
+// Only accurate to within kHSegScoreEstimateError, since it sums in a different order.
+DMZ_INTERNAL double hseg_pattern_score_estimate(float *grad_sums, HSegScoreTable *table, uint16_t *centers, uint8_t n_centers) {
+  double score = table->zero_pattern_score;
+  for(uint8_t center_index = 0; center_index < n_centers; center_index++) {
+    uint16_t length = 19;
+    if(center_index + 1 < n_centers && centers[center_index + 1] - centers[center_index] < length) {
+      length = centers[center_index + 1] - centers[center_index]; // overwritten by the next number
+    }
+    score += hseg_number_score(grad_sums, table, centers[center_index], (uint8_t)length);
+  }
+  return score;
+}
+
+DMZ_INTERNAL NHorizontalSegmentation best_n_hseg_constrained(float *grad_sums, HSegScoreTable *score_table, NVerticalSegmentation vseg, NHorizontalSegmentation best, SliceF32 width_slice, SliceU16 offset_slice) {
+  
   uint16_t temp_offsets[16];
+  long number_offsets[16]; // from the pattern offset, which only depend on the width
   
   for(float width = width_slice.min; width < width_slice.max; width += width_slice.step) {
     float pattern_width = vseg.number_pattern_length * width;
@@ -50,32 +125,36 @@ DMZ_INTERNAL NHorizontalSegmentation best_n_hseg_constrained(float *grad_sums, N
     if(pattern_offset_max == SliceU16_MAX || pattern_offset_max > maximum_pattern_offset_max) {
       pattern_offset_max = maximum_pattern_offset_max;
     }
+    uint8_t n_numbers = 0;
+    for(uint8_t pattern_index = 0; pattern_index < vseg.number_pattern_length; pattern_index++) {
+      if(vseg.number_pattern[pattern_index]) {
+        number_offsets[n_numbers] = lrintf(pattern_index * width);
+        n_numbers++;
+      }
+    }
     for(uint16_t offset = offset_slice.min; offset < pattern_offset_max; offset += offset_slice.step) {
-      pattern.setZero();
-      uint8_t offset_index = 0;
       bool in_bounds = true;
-      for(uint8_t pattern_index = 0; pattern_index < vseg.number_pattern_length; pattern_index++) {
-        if(vseg.number_pattern[pattern_index]) {
-          uint16_t center_of_number = (uint16_t)(offset + lrintf(pattern_index * width));
-          if(center_of_number + 19 < 428) { // shouldn't need this check, just being defensive
-            pattern.segment<19>(center_of_number) = number_grad_sum_pattern_array;
-          } else {
-            in_bounds = false;
-          }
-          temp_offsets[offset_index] = center_of_number;
-          offset_index++;
+      for(uint8_t offset_index = 0; offset_index < n_numbers; offset_index++) {
+        uint16_t center_of_number = (uint16_t)(offset + number_offsets[offset_index]);
+        if(center_of_number + 19 >= 428) { // shouldn't need this check, just being defensive
+          in_bounds = false;
         }
+        temp_offsets[offset_index] = center_of_number;
       }
       
       // Not a candidate if some of the numbers fall outside the card
       if(in_bounds) {
-        float score = (grad_sums_pattern - pattern).cwiseAbs().sum();
-        // lower scores are better -- they're errors/L1 distances
-        if(score < best.score) {
-          memcpy(&best.offsets, &temp_offsets, sizeof(temp_offsets));
-          best.score = score;
-          best.number_width = width;
-          best.pattern_offset = offset;
+        // lower scores are better -- they're errors/L1 distances.
+        // Most candidates are clearly worse than the best so far, which the estimate is enough to show.
+        // Score the rest exactly, so that close calls come out the same as always.
+        if(hseg_pattern_score_estimate(grad_sums, score_table, temp_offsets, n_numbers) - kHSegScoreEstimateError < best.score) {
+          float score = hseg_pattern_score(grad_sums, temp_offsets, n_numbers);
+          if(score < best.score) {
+            memcpy(&best.offsets, &temp_offsets, sizeof(temp_offsets));
+            best.score = score;
+            best.number_width = width;
+            best.pattern_offset = offset;
+          }
         }
       }
     }
@@ -85,17 +164,17 @@ DMZ_INTERNAL NHorizontalSegmentation best_n_hseg_constrained(float *grad_sums, N
 }
 
 
-DMZ_INTERNAL NHorizontalSegmentation best_n_hseg(IplImage *y_strip, NVerticalSegmentation vseg) {
+DMZ_INTERNAL NHorizontalSegmentation best_n_hseg(IplImage *y_strip, NVerticalSegmentation vseg, ScanScratch *scratch) {
+  ScanScratchMark scratch_mark = scan_scratch_mark(scratch);
+
   // Gradient
-  IplImage *grad = cvCreateImage(cvSize(428, 27), IPL_DEPTH_8U, 1);
+  IplImage *grad = scan_scratch_image(scratch, cvSize(428, 27), IPL_DEPTH_8U, 1);
   llcv_morph_grad3_2d_cross_u8(y_strip, grad);
   
   // Reduce (sum), normalize
-  IplImage *grad_sum = cvCreateImage(cvSize(428, 1), IPL_DEPTH_32F, 1); // could sum to IPL_DEPTH_16U and then convert to 32F for normalization, doing it this way for simplicity, will probably get changed during optimization
+  IplImage *grad_sum = scan_scratch_image(scratch, cvSize(428, 1), IPL_DEPTH_32F, 1); // could sum to IPL_DEPTH_16U and then convert to 32F for normalization, doing it this way for simplicity, will probably get changed during optimization
   cvReduce(grad, grad_sum, 0 /* reduce to single row */, CV_REDUCE_SUM);
   cvNormalize(grad_sum, grad_sum, 0.0f, 1.0f, CV_MINMAX, NULL);
-
-  cvReleaseImage(&grad);
   
   NHorizontalSegmentation best;
   best.n_offsets = vseg.number_length;
@@ -104,6 +183,9 @@ DMZ_INTERNAL NHorizontalSegmentation best_n_hseg(IplImage *y_strip, NVerticalSeg
   memset(&best.offsets, 0, 16 * sizeof(uint16_t));
   
   float *grad_sum_data = (float *)llcv_get_data_origin(grad_sum);
+  HSegScoreTable score_table;
+  hseg_score_table_fill(grad_sum_data, &score_table);
+
   SliceF32 width_slice;
   SliceU16 offset_slice;
   
@@ -113,7 +195,7 @@ DMZ_INTERNAL NHorizontalSegmentation best_n_hseg(IplImage *y_strip, NVerticalSeg
   offset_slice.min = 0;
   offset_slice.max = SliceU16_MAX;
   offset_slice.step = 10;
-  best = best_n_hseg_constrained(grad_sum_data, vseg, best, width_slice, offset_slice);
+  best = best_n_hseg_constrained(grad_sum_data, &score_table, vseg, best, width_slice, offset_slice);
 
   // In the following lines, there's some bounds checking on offset_slice.min.
   // It is needed because it prevents underflow due to using uints. (The uint/int issue
@@ -128,7 +210,7 @@ DMZ_INTERNAL NHorizontalSegmentation best_n_hseg(IplImage *y_strip, NVerticalSeg
   offset_slice.min = best.pattern_offset < 10 ? 0 : best.pattern_offset - 10;
   offset_slice.max = best.pattern_offset + 10;
   offset_slice.step = 1;
-  best = best_n_hseg_constrained(grad_sum_data, vseg, best, width_slice, offset_slice);
+  best = best_n_hseg_constrained(grad_sum_data, &score_table, vseg, best, width_slice, offset_slice);
   
   width_slice.min = best.number_width - 0.2f;
   width_slice.max = best.number_width + 0.2f;
@@ -136,7 +218,7 @@ DMZ_INTERNAL NHorizontalSegmentation best_n_hseg(IplImage *y_strip, NVerticalSeg
   offset_slice.min = best.pattern_offset < 3 ? 0 : best.pattern_offset - 3;
   offset_slice.max = best.pattern_offset + 3;
   offset_slice.step = 1;
-  best = best_n_hseg_constrained(grad_sum_data, vseg, best, width_slice, offset_slice);
+  best = best_n_hseg_constrained(grad_sum_data, &score_table, vseg, best, width_slice, offset_slice);
   
   width_slice.min = best.number_width - 0.1f;
   width_slice.max = best.number_width + 0.1f;
@@ -144,13 +226,15 @@ DMZ_INTERNAL NHorizontalSegmentation best_n_hseg(IplImage *y_strip, NVerticalSeg
   offset_slice.min = best.pattern_offset < 3 ? 0 : best.pattern_offset - 3;
   offset_slice.max = best.pattern_offset + 3;
   offset_slice.step = 1;
-  best = best_n_hseg_constrained(grad_sum_data, vseg, best, width_slice, offset_slice);
+  best = best_n_hseg_constrained(grad_sum_data, &score_table, vseg, best, width_slice, offset_slice);
 
-  cvReleaseImage(&grad_sum);
+  scan_scratch_release(scratch, scratch_mark);
 
   return best;
 }
 
-
+#undef kHSegTabulatedEdges
+#undef kHSegMinTabulatedLength
+#undef kHSegScoreEstimateError
 
 #endif // COMPILE_DMZ
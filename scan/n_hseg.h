@@ -18,7 +18,7 @@ typedef struct {
   uint16_t pattern_offset;
 } NHorizontalSegmentation;
 
-DMZ_INTERNAL NHorizontalSegmentation best_n_hseg(IplImage *y_strip, NVerticalSegmentation vseg);
+DMZ_INTERNAL NHorizontalSegmentation best_n_hseg(IplImage *y_strip, NVerticalSegmentation vseg, ScanScratch *scratch);
 
 
 #endif
@@ -31,19 +31,21 @@ static uint8_t const NumberPatternAmexlikePattern[19] = {1, 1, 1, 1, 0, 1, 1, 1,
 static uint8_t const * NumberPatternForPatternType[3] = {NumberPatternUnknownPattern, NumberPatternVisalikePattern, NumberPatternAmexlikePattern};
 
 
-typedef Eigen::Matrix<float, 1, 204, Eigen::RowMajor> VSegModelInput;
-typedef Eigen::Matrix<float, 1, 3, Eigen::RowMajor> VSegProbabilities;
-
 #define kVertSegSumWindowSize 27
+#define kVertSegModelInputSize 204
+#define kVertSegCoarseStep 4
+#define kVertSegCoarseStripCount ((270 + kVertSegCoarseStep - 1) / kVertSegCoarseStep)
+#define kVertSegTrackingBuffer 6
 
-DMZ_INTERNAL inline VSegProbabilities vseg_probabilities_for_hstrip(IplImage *y, IplImage *cropped_gradient, IplImage *downsampled_normed, IplImage *as_float) {
-  llcv_morph_grad3_1d_u8(y, cropped_gradient);
-  llcv_lineardown2_1d_u8(cropped_gradient, downsampled_normed);
-  llcv_norm_convert_1d_u8_to_f32(downsampled_normed, as_float);
-  
-  Eigen::Map<VSegModelInput> vseg_model_input((float *)as_float->imageData);
-  VSegProbabilities probabilities = applym_befe75da(vseg_model_input);
-  return probabilities;
+typedef struct {
+  float visalike_scores[270];
+  float amexlike_scores[270];
+} VSegScores;
+
+// Writes the model input for the strip at y_offset to model_input.
+DMZ_INTERNAL inline void vseg_model_input_for_hstrip(IplImage *y, uint16_t y_offset, float *model_input) {
+  const uint8_t *strip = (const uint8_t *)y->imageData + y_offset * y->widthStep + 10;
+  llcv_grad3_down2_norm_u8_to_f32(strip, model_input, kVertSegModelInputSize);
 }
 
 DMZ_INTERNAL inline void best_segmentation_for_vseg_scores(float *visalike_scores, float *amexlike_scores, NVerticalSegmentation *best) {
@@ -91,41 +93,82 @@ DMZ_INTERNAL inline void best_segmentation_for_vseg_scores(float *visalike_score
   }
 }
 
-DMZ_INTERNAL NVerticalSegmentation best_n_vseg(IplImage *y) {
-  assert(y->roi == NULL);
-  CvSize y_size = cvGetSize(y);
-#pragma unused(y_size) // work around broken compiler warnings
-  assert(y_size.width == kCreditCardTargetWidth);
-  assert(y_size.height == kCreditCardTargetHeight);
-  assert(y->depth == IPL_DEPTH_8U);
-  assert(y->nChannels == 1);
-
-  // Set up reusable memory for image calculations
-  IplImage *cropped_gradient = cvCreateImage(cvSize(408, 1), IPL_DEPTH_8U, 1);
-  IplImage *downsampled_normed = cvCreateImage(cvSize(204, 1), IPL_DEPTH_8U, 1);
-  IplImage *as_float = cvCreateImage(cvSize(204, 1), IPL_DEPTH_32F, 1);
+// Scores the strips at y_offsets[i] of y[frame_indexes[i]], all in one batch through the model.
+DMZ_INTERNAL void vseg_score_strips(IplImage **y, uint16_t *frame_indexes, uint16_t *y_offsets, uint32_t n_strips, VSegScores *scores, ScanScratch *scratch) {
+  if(n_strips == 0) {
+    return;
+  }
 
-  // Score buffers, to be filled in as needed
-  float visalike_scores[270];
-  memset(visalike_scores, 0, sizeof(visalike_scores));
+  ScanScratchMark scratch_mark = scan_scratch_mark(scratch);
+  float *model_inputs = (float *)scan_scratch_alloc(scratch, n_strips * kVertSegModelInputSize * sizeof(float));
+  ModelMOutput_befe75da *probabilities = (ModelMOutput_befe75da *)scan_scratch_alloc(scratch, n_strips * sizeof(ModelMOutput_befe75da));
 
-  float amexlike_scores[270];
-  memset(amexlike_scores, 0, sizeof(amexlike_scores));
+  for(uint32_t strip = 0; strip < n_strips; strip++) {
+    vseg_model_input_for_hstrip(y[frame_indexes[strip]], y_offsets[strip], model_inputs + strip * kVertSegModelInputSize);
+  }
+
+  // applym_batch_befe75da takes at most UINT16_MAX inputs at a time
+  for(uint32_t first_strip = 0; first_strip < n_strips; first_strip += UINT16_MAX) {
+    uint16_t n_batch = (uint16_t)MIN((uint32_t)UINT16_MAX, n_strips - first_strip);
+    applym_batch_befe75da(model_inputs + first_strip * kVertSegModelInputSize, n_batch, probabilities + first_strip);
+  }
 
-  uint16_t min_y_offset = 0;
-  uint16_t max_y_offset = 270;
-  uint8_t y_offset_step = 4;
+  for(uint32_t strip = 0; strip < n_strips; strip++) {
+    VSegScores *frame_scores = &scores[frame_indexes[strip]];
+    frame_scores->visalike_scores[y_offsets[strip]] = probabilities[strip](1);
+    frame_scores->amexlike_scores[y_offsets[strip]] = probabilities[strip](2);
+  }
 
-  // Initially, calculate every fourth score, to narrow down the area in which we have to work
-  for(uint16_t y_offset = min_y_offset; y_offset < max_y_offset; y_offset += y_offset_step) {
-    cvSetImageROI(y, cvRect(10, y_offset, 408, 1));
-    VSegProbabilities probabilities = vseg_probabilities_for_hstrip(y, cropped_gradient, downsampled_normed, as_float);
-    visalike_scores[y_offset] = probabilities(0, 1);
-    amexlike_scores[y_offset] = probabilities(0, 2);
+  scan_scratch_release(scratch, scratch_mark);
+}
+
+DMZ_INTERNAL inline void vseg_set_number_pattern(NVerticalSegmentation *vseg) {
+  vseg->number_pattern_length = NumberPatternLengthForPatternType[vseg->pattern_type];
+  memcpy(&vseg->number_pattern, NumberPatternForPatternType[vseg->pattern_type], sizeof(vseg->number_pattern));
+  vseg->number_length = NumberLengthForNumberPatternType[vseg->pattern_type];
+}
+
+DMZ_INTERNAL size_t best_n_vseg_frames_scratch_size(uint16_t n_frames) {
+  size_t max_strips = n_frames * 270;
+  size_t n_coarse_strips = n_frames * kVertSegCoarseStripCount; // the fine pass needs fewer than the coarse pass
+  return n_frames * sizeof(VSegScores)
+       + 2 * max_strips * sizeof(uint16_t)
+       + n_coarse_strips * (kVertSegModelInputSize * sizeof(float) + sizeof(ModelMOutput_befe75da))
+       + 5 * 32; // alignment of each of the above allocations
+}
+
+DMZ_INTERNAL void best_n_vseg_frames(IplImage **y, uint16_t n_frames, NVerticalSegmentation *best, ScanScratch *scratch) {
+  for(uint16_t frame = 0; frame < n_frames; frame++) {
+    assert(y[frame]->roi == NULL);
+    CvSize y_size = cvGetSize(y[frame]);
+    (void)y_size; // only used in asserts
+    assert(y_size.width == kCreditCardTargetWidth);
+    assert(y_size.height == kCreditCardTargetHeight);
+    assert(y[frame]->depth == IPL_DEPTH_8U);
+    assert(y[frame]->nChannels == 1);
   }
 
-  NVerticalSegmentation best;
-  best_segmentation_for_vseg_scores(visalike_scores, amexlike_scores, &best);
+  ScanScratchMark scratch_mark = scan_scratch_mark(scratch);
+
+  // Score buffers, to be filled in as needed
+  VSegScores *scores = (VSegScores *)scan_scratch_alloc(scratch, n_frames * sizeof(VSegScores));
+  memset(scores, 0, n_frames * sizeof(VSegScores));
+
+  // Strip lists, big enough for either pass
+  uint32_t max_strips = n_frames * 270;
+  uint16_t *frame_indexes = (uint16_t *)scan_scratch_alloc(scratch, max_strips * sizeof(uint16_t));
+  uint16_t *y_offsets = (uint16_t *)scan_scratch_alloc(scratch, max_strips * sizeof(uint16_t));
+  uint32_t n_strips = 0;
+
+  // Initially, calculate every fourth score, to narrow down the area in which we have to work
+  for(uint16_t frame = 0; frame < n_frames; frame++) {
+    for(uint16_t y_offset = 0; y_offset < 270; y_offset += kVertSegCoarseStep) {
+      frame_indexes[n_strips] = frame;
+      y_offsets[n_strips] = y_offset;
+      n_strips++;
+    }
+  }
+  vseg_score_strips(y, frame_indexes, y_offsets, n_strips, scores, scratch);
 
   // Now that we know roughly where we're interested in, fill in a few more scores
   // (the ones that could make a difference), and recalculate
@@ -136,36 +179,80 @@ DMZ_INTERNAL NVerticalSegmentation best_n_vseg(IplImage *y) {
   // for all possible y_offsets), but go ahead and calculate them anyway, since the provide useful signal about
   // whether it is actually a credit card present or not
 
-  // All values must be bounds checked against 270 and (when needed) safely against 0 (using uints!)
-  min_y_offset = MIN(270, best.y_offset < kFineTuningBuffer ? 0 : best.y_offset - kFineTuningBuffer);
-  max_y_offset = MIN(270, best.y_offset + kVertSegSumWindowSize + kFineTuningBuffer);
-  y_offset_step = 1;
-
-  for(uint16_t y_offset = min_y_offset; y_offset < max_y_offset; y_offset += y_offset_step) {
-    // Don't recalculate anything -- we already calculated 1/4th of them!
-    if(visalike_scores[y_offset] == 0 && amexlike_scores[y_offset] == 0) {
-      cvSetImageROI(y, cvRect(10, y_offset, 408, 1));
-      VSegProbabilities probabilities = vseg_probabilities_for_hstrip(y, cropped_gradient, downsampled_normed, as_float);
-      visalike_scores[y_offset] = probabilities(0, 1);
-      amexlike_scores[y_offset] = probabilities(0, 2);
+  n_strips = 0;
+  for(uint16_t frame = 0; frame < n_frames; frame++) {
+    best_segmentation_for_vseg_scores(scores[frame].visalike_scores, scores[frame].amexlike_scores, &best[frame]);
+
+    // All values must be bounds checked against 270 and (when needed) safely against 0 (using uints!)
+    uint16_t min_y_offset = MIN(270, best[frame].y_offset < kFineTuningBuffer ? 0 : best[frame].y_offset - kFineTuningBuffer);
+    uint16_t max_y_offset = MIN(270, best[frame].y_offset + kVertSegSumWindowSize + kFineTuningBuffer);
+
+    for(uint16_t y_offset = min_y_offset; y_offset < max_y_offset; y_offset++) {
+      // Don't recalculate anything -- we already calculated 1/4th of them!
+      if(scores[frame].visalike_scores[y_offset] == 0 && scores[frame].amexlike_scores[y_offset] == 0) {
+        frame_indexes[n_strips] = frame;
+        y_offsets[n_strips] = y_offset;
+        n_strips++;
+      }
     }
   }
+  vseg_score_strips(y, frame_indexes, y_offsets, n_strips, scores, scratch);
 
-  // TODO: Hint that resumming across all the possible values isn't really necessary...
-  best_segmentation_for_vseg_scores(visalike_scores, amexlike_scores, &best);
+  for(uint16_t frame = 0; frame < n_frames; frame++) {
+    // TODO: Hint that resumming across all the possible values isn't really necessary...
+    best_segmentation_for_vseg_scores(scores[frame].visalike_scores, scores[frame].amexlike_scores, &best[frame]);
+    vseg_set_number_pattern(&best[frame]);
+  }
 
-  cvReleaseImage(&cropped_gradient);
-  cvReleaseImage(&downsampled_normed);
-  cvReleaseImage(&as_float);
+  scan_scratch_release(scratch, scratch_mark);
+}
 
-  cvResetImageROI(y);
+DMZ_INTERNAL NVerticalSegmentation best_n_vseg(IplImage *y, ScanScratch *scratch) {
+  NVerticalSegmentation best;
+  best_n_vseg_frames(&y, 1, &best, scratch);
+  return best;
+}
 
-  best.number_pattern_length = NumberPatternLengthForPatternType[best.pattern_type];
-  memcpy(&best.number_pattern, NumberPatternForPatternType[best.pattern_type], sizeof(best.number_pattern));
-  best.number_length = NumberLengthForNumberPatternType[best.pattern_type];
-  
+DMZ_INTERNAL NVerticalSegmentation best_n_vseg_tracking(IplImage *y, NVerticalSegmentation previous, float min_score, ScanScratch *scratch) {
+  assert(y->roi == NULL);
+
+  ScanScratchMark scratch_mark = scan_scratch_mark(scratch);
+  VSegScores *scores = (VSegScores *)scan_scratch_alloc(scratch, sizeof(VSegScores));
+  memset(scores, 0, sizeof(VSegScores));
+
+  // Every score that the segmentations near previous.y_offset depend on, as in best_n_vseg_frames' fine pass
+  uint16_t min_y_offset = MIN(270, previous.y_offset < kVertSegTrackingBuffer ? 0 : previous.y_offset - kVertSegTrackingBuffer);
+  uint16_t max_y_offset = MIN(270, previous.y_offset + kVertSegSumWindowSize + kVertSegTrackingBuffer);
+  uint32_t n_strips = max_y_offset - min_y_offset;
+  uint16_t *frame_indexes = (uint16_t *)scan_scratch_alloc(scratch, n_strips * sizeof(uint16_t));
+  uint16_t *y_offsets = (uint16_t *)scan_scratch_alloc(scratch, n_strips * sizeof(uint16_t));
+  for(uint32_t strip = 0; strip < n_strips; strip++) {
+    frame_indexes[strip] = 0;
+    y_offsets[strip] = (uint16_t)(min_y_offset + strip);
+  }
+  vseg_score_strips(&y, frame_indexes, y_offsets, n_strips, scores, scratch);
+
+  NVerticalSegmentation best;
+  best_segmentation_for_vseg_scores(scores->visalike_scores, scores->amexlike_scores, &best);
+  scan_scratch_release(scratch, scratch_mark);
+
+  // Sums that reach past the scored rows are missing some of their scores. If the best one is such a sum,
+  // or is right at the edge of the window, a better one may well lie outside it.
+  bool at_window_edge = (min_y_offset > 0 && best.y_offset <= min_y_offset) ||
+                        (max_y_offset < 270 && best.y_offset + kVertSegSumWindowSize >= max_y_offset);
+  if(at_window_edge || best.pattern_type != previous.pattern_type || best.score <= min_score) {
+    return best_n_vseg(y, scratch);
+  }
+
+  vseg_set_number_pattern(&best);
   return best;
 }
 
+#undef kVertSegSumWindowSize
+#undef kVertSegModelInputSize
+#undef kVertSegCoarseStep
+#undef kVertSegCoarseStripCount
+#undef kVertSegTrackingBuffer
+#undef kFineTuningBuffer
 
 #endif // COMPILE_DMZ
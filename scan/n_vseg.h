@@ -8,6 +8,7 @@
 
 #include "opencv2/core/core_c.h" // needed for IplImage
 #include "dmz_macros.h"
+#include "scan_scratch.h"
 
 typedef uint8_t NumberPatternType;
 
@@ -22,7 +23,21 @@ typedef struct {
 
 // Calculate the best number vertical segmentation for the card image y.
 // y must be 428x270, single channel, uint8_t, with no ROI set.
-DMZ_INTERNAL NVerticalSegmentation best_n_vseg(IplImage *y);
+DMZ_INTERNAL NVerticalSegmentation best_n_vseg(IplImage *y, ScanScratch *scratch);
+
+// As best_n_vseg, for n_frames card images at once, with best[i] the segmentation for y[i].
+// The strips from all frames are run through the model together; best[i] is exactly what
+// best_n_vseg(y[i]) would give.
+DMZ_INTERNAL void best_n_vseg_frames(IplImage **y, uint16_t n_frames, NVerticalSegmentation *best, ScanScratch *scratch);
+
+// As best_n_vseg, but first scores only the strips within a few rows of previous, the segmentation of an
+// earlier frame of the same card. The full search is done only if the best segmentation among those is of
+// a different pattern type, scores no more than min_score, or is at the edge of the window.
+// Much cheaper while the card is held steady, but the result is not necessarily what best_n_vseg would give.
+DMZ_INTERNAL NVerticalSegmentation best_n_vseg_tracking(IplImage *y, NVerticalSegmentation previous, float min_score, ScanScratch *scratch);
+
+// Upper bound on the scratch memory that best_n_vseg_frames uses for n_frames frames.
+DMZ_INTERNAL size_t best_n_vseg_frames_scratch_size(uint16_t n_frames);
 
 
 #endif
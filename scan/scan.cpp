@@ -16,10 +16,78 @@
 #define kDecayFactor 0.8f
 #define kMinStability 0.7f
 
+#define TEST_SCAN_SCRATCH 0
+
+#if TEST_SCAN_SCRATCH
+#ifndef __GLIBC__
+  #error "TEST_SCAN_SCRATCH counts heap allocations by standing in for glibc's malloc"
+#endif
+#include <errno.h>
+
+// cvSetMemoryManager would be the obvious hook, but OpenCV 2.4 and later refuse custom allocators
+// (and Eigen and the STL don't go through cvAlloc anyway). glibc does let a program replace malloc
+// and friends outright, with its own still reachable as __libc_malloc etc., so count them there.
+// Counts allocations from every thread, so run this with nothing else going on.
+extern "C" {
+  void *__libc_malloc(size_t size);
+  void *__libc_calloc(size_t n, size_t size);
+  void *__libc_realloc(void *ptr, size_t size);
+  void *__libc_memalign(size_t alignment, size_t size);
+  void __libc_free(void *ptr);
+}
+
+static uint32_t scan_test_heap_allocations = 0;
+
+static inline void scan_test_count_heap_allocation(void) {
+  __atomic_add_fetch(&scan_test_heap_allocations, 1, __ATOMIC_RELAXED);
+}
+
+extern "C" void *malloc(size_t size) __THROW {
+  scan_test_count_heap_allocation();
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size) __THROW {
+  scan_test_count_heap_allocation();
+  return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) __THROW {
+  scan_test_count_heap_allocation();
+  return __libc_realloc(ptr, size);
+}
+
+extern "C" void *memalign(size_t alignment, size_t size) __THROW {
+  scan_test_count_heap_allocation();
+  return __libc_memalign(alignment, size);
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size) __THROW {
+  scan_test_count_heap_allocation();
+  return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void **ptr, size_t alignment, size_t size) __THROW {
+  scan_test_count_heap_allocation();
+  *ptr = __libc_memalign(alignment, size);
+  return *ptr != NULL ? 0 : ENOMEM;
+}
+
+extern "C" void free(void *ptr) __THROW {
+  __libc_free(ptr);
+}
+#endif
+
 void scanner_initialize(ScannerState *state) {
+  scan_scratch_initialize(&state->scratch);
+  state->vseg_tracking = false;
   scanner_reset(state);
 }
 
+void scanner_set_vseg_tracking(ScannerState *state, bool tracking) {
+  state->vseg_tracking = tracking;
+}
+
 void scanner_reset(ScannerState *state) {
   state->count15 = 0;
   state->count16 = 0;
@@ -38,14 +106,15 @@ void scanner_add_frame(ScannerState *state, IplImage *y, FrameScanResult *result
   scanner_add_frame_with_expiry(state, y, false, result);
 }
 
-void scanner_add_frame_with_expiry(ScannerState *state, IplImage *y, bool scan_expiry, FrameScanResult *result) {
+// Everything scanner_add_frame_with_expiry does after finding the vertical segmentation.
+DMZ_INTERNAL void scanner_add_frame_with_vseg(ScannerState *state, IplImage *y, NVerticalSegmentation vseg, bool scan_expiry, FrameScanResult *result) {
 
   bool still_need_to_collect_card_number = (state->timeOfCardNumberCompletionInMilliseconds == 0);
   bool still_need_to_scan_expiry = scan_expiry && (state->expiry_month == 0 || state->expiry_year == 0);
 
   // Don't bother with a bunch of assertions about y here,
   // since the frame reader will make them anyway.
-  scan_card_image(y, still_need_to_collect_card_number, still_need_to_scan_expiry, result);
+  scan_card_image_with_vseg(y, vseg, still_need_to_collect_card_number, still_need_to_scan_expiry, result, &state->scratch);
   if (result->upside_down) {
     return;
   }
@@ -61,11 +130,11 @@ void scanner_add_frame_with_expiry(ScannerState *state, IplImage *y, bool scan_e
 #if SCAN_EXPIRY
   if (still_need_to_scan_expiry) {
     state->scan_expiry = true;
-    expiry_extract(y, state->expiry_groups, result->expiry_groups, &state->expiry_month, &state->expiry_year);
+    expiry_extract(y, state->expiry_groups, result->expiry_groups, &state->expiry_month, &state->expiry_year, &state->scratch);
     state->name_groups = result->name_groups;  // for now, for the debugging display
   }
 #endif
-  
+
   if (still_need_to_collect_card_number) {
     
     state->mostRecentUsableHSeg = result->hseg;
@@ -85,6 +154,54 @@ void scanner_add_frame_with_expiry(ScannerState *state, IplImage *y, bool scan_e
   }
 }
 
+void scanner_add_frame_with_expiry(ScannerState *state, IplImage *y, bool scan_expiry, FrameScanResult *result) {
+  scan_scratch_reset(&state->scratch);
+#if TEST_SCAN_SCRATCH
+  // Once initialized, scanning a frame's number should never touch the heap. (Expiry scanning still
+  // collects its character groups in std::vectors, so frames that scan it aren't checked.)
+  uint32_t heap_allocations = scan_test_heap_allocations;
+#endif
+
+  NVerticalSegmentation vseg;
+  // mostRecentUsableVSeg is set along with the first count
+  if (state->vseg_tracking && state->count15 + state->count16 > 0) {
+    vseg = best_n_vseg_tracking(y, state->mostRecentUsableVSeg, kMinVSegScore, &state->scratch);
+  } else {
+    vseg = best_n_vseg(y, &state->scratch);
+  }
+  scanner_add_frame_with_vseg(state, y, vseg, scan_expiry, result);
+
+#if TEST_SCAN_SCRATCH
+  if (!scan_expiry && scan_test_heap_allocations != heap_allocations) {
+    dmz_debug_print("TEST_SCAN_SCRATCH: %u heap allocations while scanning a frame (scratch has %d chunks)\n",
+                    scan_test_heap_allocations - heap_allocations, state->scratch.n_chunks);
+    assert(false);
+  }
+#endif
+}
+
+void scanner_add_frames(ScannerState *state, IplImage **frames, uint16_t n_frames, bool scan_expiry, FrameScanResult *results) {
+  if (state->vseg_tracking) {
+    for(uint16_t frame = 0; frame < n_frames; frame++) {
+      scanner_add_frame_with_expiry(state, frames[frame], scan_expiry, &results[frame]);
+    }
+    return;
+  }
+
+  size_t vsegs_size = n_frames * sizeof(NVerticalSegmentation);
+  scan_scratch_reset(&state->scratch);
+  scan_scratch_reserve(&state->scratch, vsegs_size + 32 + best_n_vseg_frames_scratch_size(n_frames));
+
+  // The vertical segmentation doesn't depend on the scanner state, so do it for all frames at once.
+  NVerticalSegmentation *vsegs = (NVerticalSegmentation *)scan_scratch_alloc(&state->scratch, vsegs_size);
+  best_n_vseg_frames(frames, n_frames, vsegs, &state->scratch);
+
+  // Everything else does (e.g. whether to keep scanning for the expiry), so go frame by frame, in order.
+  for(uint16_t frame = 0; frame < n_frames; frame++) {
+    scanner_add_frame_with_vseg(state, frames[frame], vsegs[frame], scan_expiry, &results[frame]);
+  }
+}
+
 void scanner_result(ScannerState *state, ScannerResult *result) {
   result->complete = false; // until we change our minds otherwise...avoids having to set this at all the possible early exits
 
@@ -194,7 +311,7 @@ void scanner_result(ScannerState *state, ScannerResult *result) {
 }
 
 void scanner_destroy(ScannerState *state) {
-  // currently a no-op
+  scan_scratch_destroy(&state->scratch);
 }
 
 
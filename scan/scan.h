@@ -9,6 +9,7 @@
 #include "frame.h"
 #include "dmz_macros.h"
 #include "scan_analytics.h"
+#include "scan_scratch.h"
 #include "expiry_seg.h"
 #include <sys/time.h>
 
@@ -45,14 +46,22 @@ typedef struct {
   int expiry_year;
   GroupedRectsList expiry_groups;
   GroupedRectsList name_groups;
+  ScanScratch scratch; // temporary images for scanning a frame; reused from frame to frame
+  bool vseg_tracking; // See scanner_set_vseg_tracking
 } ScannerState;
 
 // Initialize a scanner.
 void scanner_initialize(ScannerState *state);
 
-// Reset a scanner. Called by initialize.
+// Reset a scanner. Called by initialize. Keeps the scratch memory allocated by initialize.
 void scanner_reset(ScannerState *state);
 
+// With vseg tracking, the number's vertical position is first looked for within a few rows of where it
+// was in the most recent usable frame, and the whole card is searched only if it isn't found there.
+// Cheaper while the card is held steady, but not necessarily the position the full search would have
+// found. Off by default; kept across scanner_reset.
+void scanner_set_vseg_tracking(ScannerState *state, bool tracking);
+
 // Provide the scanner with a single card image.
 //
 // Notes:
@@ -64,6 +73,13 @@ void scanner_reset(ScannerState *state);
 void scanner_add_frame(ScannerState *state, IplImage *y, FrameScanResult *result); // pre-expiry backward-compatible version
 void scanner_add_frame_with_expiry(ScannerState *state, IplImage *y, bool scan_expiry, FrameScanResult *result);
 
+// Provide the scanner with n_frames card images at once, e.g. to re-score a recorded session.
+// Leaves the scanner (and results[i]) exactly as calling scanner_add_frame_with_expiry
+// on each of frames[0..n_frames-1] in turn would, but runs the vertical segmentation
+// model over all frames together (unless vseg tracking is on, since then each frame's
+// search depends on the frames before it). Same requirements on each frame and result as above.
+void scanner_add_frames(ScannerState *state, IplImage **frames, uint16_t n_frames, bool scan_expiry, FrameScanResult *results);
+
 // Ask the scanner for its number predictions.
 // If result.complete is false, the rest of the result must be ignored.
 void scanner_result(ScannerState *state, ScannerResult *result);
@@ -0,0 +1,159 @@
+//
+//  scan_scratch.cpp
+//  See the file "LICENSE.md" for the full license governing this code.
+//
+
+#include "compile.h"
+#if COMPILE_DMZ
+
+#include "scan_scratch.h"
+#include "dmz_constants.h"
+#include "opencv2/imgproc/imgproc_c.h"
+
+#define kScanScratchAlignment 32
+#define kScanScratchInitialMaxChunks 4
+#define kScanScratchImageRowAlignment 4 // matches cvCreateImage (CV_DEFAULT_IMAGE_ROW_ALIGN)
+
+// Enough for every temporary in best_n_vseg, scan_card_image_with_vseg and expiry_extract at once. The largest by far is
+// best_expiry_seg's full-card 16S sobel image, followed by best_n_vseg's batch of model inputs
+// (one 204-float row per coarse strip); everything else fits comfortably in the slack.
+#define kScanScratchVSegSize (64 * 1024)
+#if SCAN_EXPIRY
+  #define kScanScratchInitialSize (kCreditCardTargetWidth * kCreditCardTargetHeight * sizeof(int16_t) + kScanScratchVSegSize + 64 * 1024)
+#else
+  #define kScanScratchInitialSize (kScanScratchVSegSize + 64 * 1024)
+#endif
+
+DMZ_INTERNAL void scan_scratch_add_chunk(ScanScratch *scratch, size_t size) {
+  if(scratch->n_chunks == scratch->max_chunks) {
+    // Images handed out earlier still point into the existing chunks, so they can't be coalesced
+    // until the next reset; make room for more of them instead.
+    assert(scratch->max_chunks <= UINT16_MAX / 2);
+    uint16_t max_chunks = scratch->max_chunks > 0 ? 2 * scratch->max_chunks : kScanScratchInitialMaxChunks;
+    ScanScratchChunk *chunks = (ScanScratchChunk *)cvAlloc(max_chunks * sizeof(ScanScratchChunk));
+    if(scratch->chunks != NULL) {
+      memcpy(chunks, scratch->chunks, scratch->n_chunks * sizeof(ScanScratchChunk));
+      cvFree(&scratch->chunks);
+    }
+    scratch->chunks = chunks;
+    scratch->max_chunks = max_chunks;
+  }
+  scratch->chunks[scratch->n_chunks].data = (uint8_t *)cvAlloc(size);
+  scratch->chunks[scratch->n_chunks].size = size;
+  scratch->n_chunks++;
+}
+
+DMZ_INTERNAL void scan_scratch_free_chunks(ScanScratch *scratch) {
+  for(uint16_t chunk = 0; chunk < scratch->n_chunks; chunk++) {
+    cvFree(&scratch->chunks[chunk].data);
+    scratch->chunks[chunk].size = 0;
+  }
+  scratch->n_chunks = 0;
+}
+
+DMZ_INTERNAL void scan_scratch_initialize(ScanScratch *scratch) {
+  memset(scratch, 0, sizeof(ScanScratch));
+  scan_scratch_add_chunk(scratch, kScanScratchInitialSize);
+  scratch->cross_kernel = cvCreateStructuringElementEx(3, 3, 1, 1, CV_SHAPE_CROSS, NULL);
+}
+
+DMZ_INTERNAL void scan_scratch_destroy(ScanScratch *scratch) {
+  scan_scratch_free_chunks(scratch);
+  if(scratch->chunks != NULL) {
+    cvFree(&scratch->chunks);
+  }
+  scratch->max_chunks = 0;
+  if(scratch->cross_kernel != NULL) {
+    cvReleaseStructuringElement(&scratch->cross_kernel);
+  }
+  scratch->n_images = 0;
+}
+
+DMZ_INTERNAL void scan_scratch_reset(ScanScratch *scratch) {
+  if(scratch->n_chunks > 1) {
+    // We outgrew the initial chunk at some point; replace all chunks with a single one that
+    // is at least as large as all of them together, so that next time everything fits.
+    size_t total_size = 0;
+    for(uint16_t chunk = 0; chunk < scratch->n_chunks; chunk++) {
+      total_size += scratch->chunks[chunk].size;
+    }
+    scan_scratch_free_chunks(scratch);
+    scan_scratch_add_chunk(scratch, total_size);
+  }
+  scratch->current_chunk = 0;
+  scratch->current_offset = 0;
+  scratch->n_images = 0;
+}
+
+DMZ_INTERNAL void scan_scratch_reserve(ScanScratch *scratch, size_t extra_size) {
+  assert(scratch->current_chunk == 0 && scratch->current_offset == 0);
+  size_t size = kScanScratchInitialSize + extra_size;
+  if(scratch->n_chunks != 1 || scratch->chunks[0].size < size) {
+    scan_scratch_free_chunks(scratch);
+    scan_scratch_add_chunk(scratch, size);
+  }
+}
+
+DMZ_INTERNAL ScanScratchMark scan_scratch_mark(ScanScratch *scratch) {
+  ScanScratchMark mark;
+  mark.chunk = scratch->current_chunk;
+  mark.offset = scratch->current_offset;
+  mark.n_images = scratch->n_images;
+  return mark;
+}
+
+DMZ_INTERNAL void scan_scratch_release(ScanScratch *scratch, ScanScratchMark mark) {
+#if DMZ_DEBUG
+  for(uint8_t image_index = mark.n_images; image_index < scratch->n_images; image_index++) {
+    assert(scratch->images[image_index].roi == NULL);
+  }
+#endif
+  scratch->current_chunk = mark.chunk;
+  scratch->current_offset = mark.offset;
+  scratch->n_images = mark.n_images;
+}
+
+DMZ_INTERNAL void *scan_scratch_alloc(ScanScratch *scratch, size_t size) {
+  // Pad the request so that we can always align within it.
+  size_t padded_size = size + kScanScratchAlignment;
+
+  while(scratch->current_chunk < scratch->n_chunks) {
+    if(scratch->current_offset + padded_size <= scratch->chunks[scratch->current_chunk].size) {
+      break;
+    }
+    if(scratch->current_chunk + 1 == scratch->n_chunks) {
+      break;
+    }
+    scratch->current_chunk++;
+    scratch->current_offset = 0;
+  }
+
+  if(scratch->current_offset + padded_size > scratch->chunks[scratch->current_chunk].size) {
+    scan_scratch_add_chunk(scratch, MAX(padded_size, kScanScratchInitialSize));
+    scratch->current_chunk = scratch->n_chunks - 1;
+    scratch->current_offset = 0;
+  }
+
+  uint8_t *base = scratch->chunks[scratch->current_chunk].data + scratch->current_offset;
+  uint8_t *aligned = (uint8_t *)(((uintptr_t)base + kScanScratchAlignment - 1) & ~(uintptr_t)(kScanScratchAlignment - 1));
+  scratch->current_offset += (aligned - base) + size;
+  return aligned;
+}
+
+DMZ_INTERNAL IplImage *scan_scratch_image(ScanScratch *scratch, CvSize size, int depth, int channels) {
+  assert(scratch->n_images < kScanScratchMaxImages);
+  IplImage *image = &scratch->images[scratch->n_images];
+  scratch->n_images++;
+
+  cvInitImageHeader(image, size, depth, channels, IPL_ORIGIN_TL, kScanScratchImageRowAlignment);
+  image->imageData = image->imageDataOrigin = (char *)scan_scratch_alloc(scratch, image->imageSize);
+  return image;
+}
+
+#undef kScanScratchAlignment
+#undef kScanScratchInitialMaxChunks
+#undef kScanScratchImageRowAlignment
+#undef kScanScratchInitialSize
+#undef kScanScratchVSegSize
+
+#endif // COMPILE_DMZ
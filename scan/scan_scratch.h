@@ -0,0 +1,78 @@
+//
+//  scan_scratch.h
+//  See the file "LICENSE.md" for the full license governing this code.
+//
+
+#ifndef DMZ_SCAN_SCAN_SCRATCH_H
+#define DMZ_SCAN_SCAN_SCRATCH_H
+
+#include "opencv2/core/core_c.h" // needed for IplImage
+#include "dmz_macros.h"
+
+// Scratch memory for the temporary images used while scanning a frame.
+//
+// The scanner used to cvCreateImage/cvReleaseImage every temporary, every frame.
+// Instead, each ScannerState owns a ScanScratch, and hands out IplImage headers
+// over one reused, aligned buffer. Images are handed out stack-style: take a mark,
+// get as many images as you need, and release back to the mark when done with them.
+//
+// The buffer is sized up front for the whole scan pipeline (including expiry), so
+// steady-state scanning does no heap allocation for these images. If it ever does
+// run out, it grows by adding another chunk (and, if need be, room for more chunks);
+// chunks are coalesced at the next scan_scratch_reset, so growth happens at most once
+// per new high-water mark.
+//
+// Images from the scratch must not outlive their mark, must not be released with
+// cvReleaseImage, and must have any ROI reset before being released.
+
+#define kScanScratchMaxImages 16
+
+typedef struct {
+  uint8_t *data;
+  size_t size;
+} ScanScratchChunk;
+
+typedef struct {
+  ScanScratchChunk *chunks; // n_chunks of them, with room for max_chunks
+  uint16_t n_chunks;
+  uint16_t max_chunks;
+  uint16_t current_chunk;
+  size_t current_offset;
+  IplImage images[kScanScratchMaxImages];
+  uint8_t n_images;
+  IplConvKernel *cross_kernel; // 3x3 cross structuring element, for cvMorphologyEx
+} ScanScratch;
+
+typedef struct {
+  uint16_t chunk;
+  size_t offset;
+  uint8_t n_images;
+} ScanScratchMark;
+
+// Allocates the initial buffer. Call once per scratch, paired with scan_scratch_destroy.
+DMZ_INTERNAL void scan_scratch_initialize(ScanScratch *scratch);
+
+// Frees everything owned by the scratch.
+DMZ_INTERNAL void scan_scratch_destroy(ScanScratch *scratch);
+
+// Releases all images and, if the scratch had to grow, coalesces its chunks.
+// Call at the start of each frame.
+DMZ_INTERNAL void scan_scratch_reset(ScanScratch *scratch);
+
+// Makes room for extra_size bytes of allocations (including their alignment) on top of the
+// usual amount for one frame, so that scanning several frames at once needn't grow the scratch.
+// Call right after scan_scratch_reset.
+DMZ_INTERNAL void scan_scratch_reserve(ScanScratch *scratch, size_t extra_size);
+
+DMZ_INTERNAL ScanScratchMark scan_scratch_mark(ScanScratch *scratch);
+
+// Releases all images handed out since mark was taken.
+DMZ_INTERNAL void scan_scratch_release(ScanScratch *scratch, ScanScratchMark mark);
+
+// Returns size bytes of 32-byte aligned scratch memory, released along with images.
+DMZ_INTERNAL void *scan_scratch_alloc(ScanScratch *scratch, size_t size);
+
+// Equivalent to cvCreateImage, but over scratch memory. The image has no ROI.
+DMZ_INTERNAL IplImage *scan_scratch_image(ScanScratch *scratch, CvSize size, int depth, int channels);
+
+#endif